@@ -0,0 +1,133 @@
+/*
+ * Benchmark of formatting the trace for ThreadSanitizer offline.
+ *
+ * Usage: bench_converter_tsan_output [<n-lines>]
+ *
+ * For every formatting method(ostringstream per line, ostream with
+ * std::hex, TsanLineBuffer) number of lines formatted per second
+ * is reported. Formatted lines are passed to /dev/null.
+ */
+
+#include <kedr/utils/tsan_output.h>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include <cstdlib>
+#include <ctime>
+
+struct Line
+{
+    const char* name;
+    uint64_t tid;
+    uint64_t pc;
+    uint64_t addr;
+    uint64_t size;
+};
+
+enum BenchMode
+{
+    modeStringstream = 0,
+    modeStream,
+    modeLineBuffer
+};
+
+static const char* modeNames[] =
+{
+    "ostringstream per line",
+    "ostream",
+    "TsanLineBuffer"
+};
+
+static double getTime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void runBench(const std::vector<Line>& lines, enum BenchMode mode)
+{
+    std::ofstream os("/dev/null");
+    /* Flush every 64K, as TsanLineBuffer does */
+    std::vector<char> streamBuffer(64 * 1024);
+    os.rdbuf()->pubsetbuf(&streamBuffer[0], streamBuffer.size());
+
+    TsanLineBuffer buf;
+
+    double start = getTime();
+
+    for(int i = 0; i < (int)lines.size(); i++)
+    {
+        const Line& line = lines[i];
+        switch(mode)
+        {
+        case modeStringstream:
+        {
+            std::ostringstream out;
+            out << line.name << std::hex << " " << line.tid << " "
+                << line.pc << " " << line.addr << " " << line.size;
+            os << out.str() << "\n";
+        }
+        break;
+        case modeStream:
+            os << line.name << " " << std::hex << line.tid << " "
+                << line.pc << " " << line.addr << " " << line.size
+                << std::dec << "\n";
+        break;
+        case modeLineBuffer:
+            buf.event(line.name, line.tid, line.pc, line.addr, line.size);
+            if(buf.isFull())
+            {
+                os.write(buf.data(), buf.size());
+                buf.clear();
+            }
+        break;
+        }
+    }
+    os.write(buf.data(), buf.size());
+    os.flush();
+
+    double elapsed = getTime() - start;
+
+    std::cout << modeNames[mode] << ": " << lines.size() << " lines in "
+        << elapsed << " s, " << (long)(lines.size() / elapsed)
+        << " lines/s.\n";
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc > 2)
+    {
+        std::cerr << "Usage: bench_converter_tsan_output [<n-lines>]"
+            << std::endl;
+        return 1;
+    }
+
+    int nLines = (argc == 2) ? atoi(argv[1]) : 5000000;
+
+    static const char* names[] = {"READ", "WRITE", "SBLOCK_ENTER",
+        "LOCK", "UNLOCK", "RTN_CALL", "RTN_EXIT"};
+
+    /* Mostly memory accesses, as in real traces. */
+    std::vector<Line> lines(nLines);
+    srand(1);
+    for(int i = 0; i < nLines; i++)
+    {
+        Line& line = lines[i];
+        int r = rand() % 16;
+        line.name = names[r < 12 ? r % 2 : r - 10];
+        line.tid = 1 + rand() % 16;
+        line.pc = 0xffffffffa0000000ULL + rand() % 0x10000;
+        line.addr = (r < 12) ? 0xffff880000000000ULL + rand() : 0;
+        line.size = (r < 12) ? 1 << (rand() % 4) : 0;
+    }
+
+    runBench(lines, modeStringstream);
+    runBench(lines, modeStream);
+    runBench(lines, modeLineBuffer);
+
+    return 0;
+}
@@ -0,0 +1,143 @@
+/*
+ * Generate synthetic KEDR trace with events of all types.
+ *
+ * Usage:
+ *
+ *   test_converter_tsan_generate_trace <meta-template> <trace-dir>
+ *       <n-events> [lost]
+ *
+ * If 'lost' is given, some events are lost in the middle of the trace.
+ */
+
+#include "trace_generator.h"
+
+#include <iostream>
+#include <stdexcept>
+
+#include <cstdlib>
+#include <cstring>
+
+/* Number of threads(different tids) in the trace */
+static const int nThreads = 8;
+/* Number of CPUs(streams) in the trace */
+static const int nCPUs = 4;
+
+static uint64_t randomAddr(void)
+{
+    return 0xffffffffa0000000ULL + (rand() % 0x10000);
+}
+
+static void fillEvent(KEDREvent& event, int counter)
+{
+    memset(&event, 0, sizeof(event));
+
+    event.type = (enum KEDREvent::Type)(rand() % KEDREvent::typeUnknown);
+    event.timestamp = 1000 + counter * 10;
+    event.tid = 0xffff880000001000ULL + (rand() % nThreads) * 0x100;
+    event.counter = counter;
+
+    switch(event.type)
+    {
+    case KEDREvent::typeMA:
+        event.nSubevents = 1 + rand() % 8;
+        for(int i = 0; i < event.nSubevents; i++)
+        {
+            event.subevents[i].pc = randomAddr();
+            event.subevents[i].addr = randomAddr();
+            event.subevents[i].size = 1 << (rand() % 4);
+            event.subevents[i].accessType = 1 + rand() % 3;
+        }
+    break;
+    case KEDREvent::typeLMAUpdate:
+    case KEDREvent::typeLMARead:
+    case KEDREvent::typeLMAWrite:
+        event.pc = randomAddr();
+        event.addr = randomAddr();
+        event.size = 1 << (rand() % 4);
+    break;
+    case KEDREvent::typeIOMA:
+        event.pc = randomAddr();
+        event.addr = randomAddr();
+        event.size = 1 << (rand() % 4);
+        event.accessType = 1 + rand() % 3;
+    break;
+    case KEDREvent::typeMRB:
+    case KEDREvent::typeMWB:
+    case KEDREvent::typeMFB:
+    case KEDREvent::typeTCBefore:
+        event.pc = randomAddr();
+    break;
+    case KEDREvent::typeAlloc:
+        event.pc = randomAddr();
+        event.size = rand() % 0x1000;
+        event.pointer = randomAddr();
+    break;
+    case KEDREvent::typeFree:
+        event.pc = randomAddr();
+        event.pointer = randomAddr();
+    break;
+    case KEDREvent::typeLock:
+    case KEDREvent::typeUnlock:
+    case KEDREvent::typeRLock:
+    case KEDREvent::typeRUnlock:
+    case KEDREvent::typeSignal:
+    case KEDREvent::typeWait:
+        event.pc = randomAddr();
+        event.object = randomAddr();
+        event.objectType = rand() % 3;
+    break;
+    case KEDREvent::typeTCAfter:
+    case KEDREvent::typeTJoin:
+        event.pc = randomAddr();
+        event.childTid = 0xffff880000001000ULL + (rand() % nThreads) * 0x100;
+    break;
+    case KEDREvent::typeFEntry:
+    case KEDREvent::typeFExit:
+        event.func = randomAddr();
+    break;
+    case KEDREvent::typeFCPre:
+    case KEDREvent::typeFCPost:
+        event.pc = randomAddr();
+        event.func = randomAddr();
+    break;
+    default:
+    break;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if((argc != 4) && !((argc == 5) && !strcmp(argv[4], "lost")))
+    {
+        std::cerr << "Usage: test_converter_tsan_generate_trace "
+            "<meta-template> <trace-dir> <n-events> [lost]" << std::endl;
+        return 1;
+    }
+
+    int nEvents = atoi(argv[3]);
+    bool lost = (argc == 5);
+
+    try
+    {
+        KEDRTraceGenerator generator(argv[1], argv[2], nCPUs);
+        KEDREvent* event = new KEDREvent;
+
+        srand(1);
+        for(int i = 0; i < nEvents; i++)
+        {
+            fillEvent(*event, i);
+            generator.addEvent(rand() % nCPUs, *event);
+
+            if(lost && (i == nEvents / 2)) generator.loseEvents(1, 3);
+        }
+
+        delete event;
+    }
+    catch(std::exception& e)
+    {
+        std::cerr << "Failed to generate trace: " << e.what() << "." << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,86 @@
+/*
+ * Test that TsanLineBuffer formats lines in the same way as iostreams
+ * did before.
+ *
+ * Usage: test_converter_tsan_output
+ */
+
+#include <kedr/utils/tsan_output.h>
+
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include <cstdlib>
+
+/* Random value with random number of significant bits */
+static uint64_t randomValue(void)
+{
+    uint64_t val = ((uint64_t)rand() << 32) ^ ((uint64_t)rand() << 16) ^ rand();
+    int bits = rand() % 65;
+
+    return bits == 64 ? val : val & (((uint64_t)1 << bits) - 1);
+}
+
+static int compareOutput(const TsanLineBuffer& buf,
+    const std::string& expected, int iter)
+{
+    std::string result(buf.data(), buf.size());
+    if(result != expected)
+    {
+        std::cerr << "Iteration " << iter << ": expected output\n"
+            << expected << "but got\n" << result;
+        return 1;
+    }
+    return 0;
+}
+
+int main(void)
+{
+    static const int nIter = 100000;
+
+    /* Small capacity for check growing of the buffer */
+    TsanLineBuffer buf(16);
+
+    srand(1);
+    for(int i = 0; i < nIter; i++)
+    {
+        uint64_t tid = randomValue(), pc = randomValue(),
+            addr = randomValue(), size = randomValue(),
+            dec = randomValue();
+
+        std::ostringstream os;
+        os << std::hex << "READ " << tid << " " << pc << " " << addr
+            << " " << size << "\n";
+        os << std::dec << "# " << dec << " " << "comment\n";
+
+        buf.event("READ", tid, pc, addr, size);
+        buf.put("# ");
+        buf.putDec(dec);
+        buf.putChar(' ');
+        buf.put("comment");
+        buf.endLine();
+
+        if(!buf.isFull())
+        {
+            std::cerr << "Buffer with " << buf.size()
+                << " bytes is not reported as full." << std::endl;
+            return 1;
+        }
+
+        if(compareOutput(buf, os.str(), i)) return 1;
+
+        buf.clear();
+    }
+
+    /* Accumulation of many lines */
+    std::ostringstream os;
+    for(int i = 0; i < nIter; i++)
+    {
+        os << std::hex << "WRITE " << i << " 0 " << i * 16 << " 4\n";
+        buf.event("WRITE", i, 0, i * 16, 4);
+    }
+    if(compareOutput(buf, os.str(), nIter)) return 1;
+
+    return 0;
+}
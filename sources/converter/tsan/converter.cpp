@@ -4,8 +4,10 @@
  */
 
 #include <kedr/kedr_trace_reader/kedr_trace_reader.h>
+#include <kedr/kedr_trace_reader/kedr_prefetch_iterator.h>
 
 #include <kedr/object_types.h> /* Enumerations describing events */
+#include <kedr/utils/tsan_output.h>
 
 #include <iostream>
 #include <stdexcept>
@@ -25,6 +27,9 @@
 
 #include <fcntl.h>
 
+#include <pthread.h>
+#include <sched.h>
+
 #include <getopt.h>
 
 #include <cassert>
@@ -97,6 +102,8 @@ struct Size<uint32_t>
 {
     uint32_t size;
 
+    Size(uint32_t size) : size(size) {}
+
 #ifndef KEDR_DEBUG
     Size(const CTFVarInt& var, CTFContext& context):
         size(var.getUInt32(context)) {}
@@ -111,6 +118,8 @@ struct Size<uint64_t>
 {
     uint64_t size;
 
+    Size(uint64_t size) : size(size) {}
+
 #ifndef KEDR_DEBUG
     Size(const CTFVarInt& var, CTFContext& context):
         size(var.getUInt64(context)) {}
@@ -677,52 +686,101 @@ void KEDRTraceProcessor::process(KEDREventProcessor& eventProcessor,
 }
 
 /************************* Printer of tsan events**********************/
-/* Print events in tsan sence into stream */
+/* Append parts of the comment line to the buffer with tsan trace */
+TsanLineBuffer& operator<<(TsanLineBuffer& buf, const char* str)
+{
+    buf.put(str);
+    return buf;
+}
+
+TsanLineBuffer& operator<<(TsanLineBuffer& buf, const string& str)
+{
+    buf.put(str.c_str(), str.size());
+    return buf;
+}
+
+template<class T>
+TsanLineBuffer& operator<<(TsanLineBuffer& buf, const struct Addr<T>& addr)
+{
+    buf.putHex(addr.addr);
+    return buf;
+}
+
+TsanLineBuffer& operator<<(TsanLineBuffer& buf, const struct Tid& tid)
+{
+    buf.putHex((unsigned int)tid.tid);
+    return buf;
+}
+
+/* 
+ * Print events in tsan sence into stream.
+ * 
+ * Lines are formatted into the buffer, which is written into the stream
+ * when it becomes full and at destruction.
+ */
 template<class T>
 class TsanEventPrinter
 {
 public:
     TsanEventPrinter(ostream& os): os(os) {}
+    ~TsanEventPrinter() {flush();}
 
     void printThreadStart(Tid tid, Tid parentTid = 0) const
-        {os << "THR_START " << tid << " 0 0 " << parentTid << "\n";}
+        {print("THR_START", tid, 0, 0, parentTid);}
     void printThreadEnd(Tid tid) const
-        {os << "THR_END " << tid << " 0 0 0\n";}
+        {print("THR_END", tid, 0, 0, 0);}
     void printRead(Tid tid, Addr<T> pc, Addr<T> addr, Size<T> size) const
-        {os << "READ " << tid << " " << pc << " " << addr << " " << size << "\n";}
+        {print("READ", tid, pc, addr, size.size);}
     void printWrite(Tid tid, Addr<T> pc, Addr<T> addr, Size<T> size) const
-        {os << "WRITE " << tid << " " << pc << " " << addr << " " << size << "\n";}
+        {print("WRITE", tid, pc, addr, size.size);}
     void printSignal(Tid tid, Addr<T> pc, Addr<T> obj) const
-        {os << "SIGNAL " << tid << " " << pc << " " << obj << " 0\n";}
+        {print("SIGNAL", tid, pc, obj, 0);}
     void printWait(Tid tid, Addr<T> pc, Addr<T> obj) const
-        {os << "WAIT " << tid << " " << pc << " " << obj << " 0\n";}
+        {print("WAIT", tid, pc, obj, 0);}
     void printFunctionCall(Tid tid, Addr<T> pc) const
-        {os << "RTN_CALL " << tid << " " << pc << " 0 0\n";}
+        {print("RTN_CALL", tid, pc, 0, 0);}
     void printFunctionExit(Tid tid) const
-        {os << "RTN_EXIT " << tid << " 0 0 0\n";}
+        {print("RTN_EXIT", tid, 0, 0, 0);}
     void printLock(Tid tid, Addr<T> pc, Addr<T> obj) const
-        {os << "WRITER_LOCK " << tid << " " << pc << " " << obj << " 0\n";}
+        {print("WRITER_LOCK", tid, pc, obj, 0);}
     void printRLock(Tid tid, Addr<T> pc, Addr<T> obj) const
-        {os << "READER_LOCK " << tid << " " << pc << " " << obj << " 0\n";}
+        {print("READER_LOCK", tid, pc, obj, 0);}
     void printUnlock(Tid tid, Addr<T> pc, Addr<T> obj) const
-        {os << "UNLOCK " << tid << " " << pc << " " << obj << " 0\n";}
+        {print("UNLOCK", tid, pc, obj, 0);}
     void printAlloc(Tid tid, Addr<T> pc, Size<T> size, Addr<T> pointer) const
-        {os << "MALLOC " << tid << " " << pc << " " << pointer << " " << size << "\n";}
+        {print("MALLOC", tid, pc, pointer, size.size);}
     void printFree(Tid tid, Addr<T> pc, Addr<T> pointer) const
-        {os << "FREE " << tid << " " << pc << " " << pointer << " 0\n";}
+        {print("FREE", tid, pc, pointer, 0);}
     void printThreadCreateBefore(Tid tid, Addr<T> pc) const
-        {os << "THR_CREATE_BEFORE " << tid << " " << pc << " 0 0\n";}
+        {print("THR_CREATE_BEFORE", tid, pc, 0, 0);}
     void printThreadCreateAfter(Tid tid, Tid childTid) const
-        {os << "THR_CREATE_AFTER " << tid << " 0 " << childTid << " 0\n";}
+        {print("THR_CREATE_AFTER", tid, 0, (unsigned int)childTid.tid, 0);}
     void printThreadJoin(Tid tid, Addr<T> pc, Tid childTid) const
-        {os << "THR_JOIN_AFTER " << tid << " " << pc << " " << childTid << " 0\n";}
+        {print("THR_JOIN_AFTER", tid, pc, (unsigned int)childTid.tid, 0);}
     void printBlock(Tid tid, Addr<T> pc) const
-        {os << "SBLOCK_ENTER " << tid << " " << pc << " 0 0\n";}
+        {print("SBLOCK_ENTER", tid, pc, 0, 0);}
+    
+    TsanLineBuffer& commentBegin(void) const {return buf << "# ";}
+    void commentEnd(void) const {buf.endLine(); flushIfFull();}
     
-    ostream& commentBegin(void) const {return os << "# ";}
-    void commentEnd(void) const {os << "\n";}
+    /* Write formatted lines into the stream. */
+    void flush(void) const
+    {
+        os.write(buf.data(), buf.size());
+        buf.clear();
+    }
 private:
     ostream& os;
+    /* Formatting does not change the printer from the user's view. */
+    mutable TsanLineBuffer buf;
+    
+    void print(const char* name, Tid tid, T pc, T addr, T size) const
+    {
+        buf.event(name, (unsigned int)tid.tid, pc, addr, size);
+        flushIfFull();
+    }
+    
+    void flushIfFull(void) const {if(buf.isFull()) flush();}
 };
 
 /****************** Process event in some intermediate format *********/
@@ -2268,6 +2326,912 @@ EventProcessorFixLock<T>::~EventProcessorFixLock(void)
     close(fd);
 }
 
+/************************ Pipelined conversion ************************/
+/* 
+ * Conversion may be performed by three stages, each in its own thread:
+ * 
+ * 1. Decode: events are read and decoded by
+ *    KEDRTraceReader::PrefetchEventIterator.
+ * 2. Transform: thread addresses are resolved into ThreadInfo and
+ *    events are passed through transformers(like EventProcessorFixLock).
+ * 3. Format: events are converted into tsan format and written into
+ *    the output. This stage is executed by the main thread.
+ * 
+ * Stages are connected via single-producer single-consumer queues of
+ * plain event structures. Every stage preserves order of events, so
+ * output is the same as for sequential conversion.
+ */
+
+/* Wait for other stage of the pipeline, 'nTries' is per-wait counter. */
+static void pipelineWait(int& nTries)
+{
+    if(++nTries < 100) sched_yield();
+    else usleep(50);
+}
+
+/* 
+ * Lock-free bounded queue with one producer and one consumer.
+ * 
+ * Every side publishes its position only once per several elements
+ * or when it needs to wait. So producer should call flush() after
+ * the last element.
+ */
+template<class E>
+class SPSCQueue
+{
+public:
+    /* Capacity should be power of 2 */
+    SPSCQueue(size_t capacity = 4096) : elems(new E[capacity]),
+        capacity(capacity), headShared(0), tailShared(0),
+        tail(0), tailPublished(0), headCached(0),
+        head(0), headPublished(0), tailCached(0) {}
+    ~SPSCQueue() {delete[] elems;}
+    
+    /* Producer: element to be filled. Wait while queue is full. */
+    E& back(void)
+    {
+        if(tail - headCached == capacity)
+        {
+            flush();
+            for(int nTries = 0; ; pipelineWait(nTries))
+            {
+                headCached = __atomic_load_n(&headShared, __ATOMIC_ACQUIRE);
+                if(tail - headCached != capacity) break;
+            }
+        }
+        return elems[tail & (capacity - 1)];
+    }
+    /* Producer: commit element returned by back(). */
+    void push(void)
+    {
+        tail++;
+        if(tail - tailPublished >= publishBatch) flush();
+    }
+    /* Producer: make all committed elements visible for the consumer. */
+    void flush(void)
+    {
+        __atomic_store_n(&tailShared, tail, __ATOMIC_RELEASE);
+        tailPublished = tail;
+    }
+    
+    /* Consumer: first element in the queue. Wait while queue is empty. */
+    const E& front(void)
+    {
+        if(head == tailCached)
+        {
+            release();
+            for(int nTries = 0; ; pipelineWait(nTries))
+            {
+                tailCached = __atomic_load_n(&tailShared, __ATOMIC_ACQUIRE);
+                if(head != tailCached) break;
+            }
+        }
+        return elems[head & (capacity - 1)];
+    }
+    /* Consumer: remove element returned by front(). */
+    void pop(void)
+    {
+        head++;
+        if(head - headPublished >= publishBatch) release();
+    }
+private:
+    SPSCQueue(const SPSCQueue&); /* not implemented */
+    
+    static const size_t publishBatch = 64;
+    
+    void release(void)
+    {
+        __atomic_store_n(&headShared, head, __ATOMIC_RELEASE);
+        headPublished = head;
+    }
+    
+    E* elems;
+    size_t capacity;
+    
+    /* Positions visible to other side, each in its own cache line. */
+    char pad0[64];
+    size_t headShared;
+    char pad1[64];
+    size_t tailShared;
+    char pad2[64];
+    
+    /* Used only by producer */
+    size_t tail;
+    size_t tailPublished;
+    size_t headCached;
+    char pad3[64];
+    
+    /* Used only by consumer */
+    size_t head;
+    size_t headPublished;
+    size_t tailCached;
+};
+
+/* 
+ * Kinds of the pipeline events, which mark end of the trace.
+ * 
+ * Values do not intersect with KEDREvent::Type.
+ */
+enum PipelineEndKind
+{
+    /* Trace is processed */
+    pipelineEnd = KEDREvent::typeUnknown + 1,
+    /* Events lost in the trace */
+    pipelineLost,
+    /* Error occures in the decode stage */
+    pipelineError
+};
+
+/* Decoded KEDR event, passed from decode to transform stage */
+struct PipelineEventDecoded
+{
+    /* 
+     * KEDREvent::Type, PipelineEndKind or pipelineMAElem.
+     * 
+     * Event with type KEDREvent::typeMA is followed by 'aux' events
+     * of kind pipelineMAElem, one per memory access.
+     */
+    int kind;
+    /* Access type, object type or number of memory accesses */
+    uint32_t aux;
+    uint64_t tid;
+    uint64_t pc;
+    /* Address, pointer, object, function or child tid */
+    uint64_t addr;
+    uint64_t size;
+};
+
+static const int pipelineMAElem = pipelineError + 1;
+
+/* 
+ * Intermediate event(call of EventProcessor method), passed from
+ * transform to format stage.
+ */
+template<class T>
+struct PipelineEventIntermediate
+{
+    enum Kind
+    {
+        kindFunctionEntry = 0,
+        kindFunctionExit,
+        kindCallPre,
+        kindCallPost,
+        kindMAStart,
+        kindMA,
+        kindLMAUpdate,
+        kindLMARead,
+        kindLMAWrite,
+        kindIOMA,
+        kindMRB,
+        kindMWB,
+        kindMFB,
+        kindAlloc,
+        kindFree,
+        kindLock,
+        kindUnlock,
+        kindRLock,
+        kindRUnlock,
+        kindSignal,
+        kindWait,
+        kindThreadCreateBefore,
+        kindThreadCreateAfter,
+        kindThreadJoin,
+        kindThreadStart,
+        kindThreadStop,
+        /* Same meaning as PipelineEndKind */
+        kindEnd,
+        kindLost,
+        kindError
+    };
+    
+    enum Kind kind;
+    /* Number of memory accesses or type of the access or object */
+    int aux;
+    ThreadInfo<T>* thread;
+    /* Child or parent thread */
+    ThreadInfo<T>* otherThread;
+    /* Method parameters in order of their declaration */
+    T arg1;
+    T arg2;
+    T arg3;
+};
+
+/* 
+ * Event processor which passes events to the next pipeline stage.
+ */
+template<class T>
+class EventProcessorQueue: public EventProcessor<T>
+{
+public:
+    typedef PipelineEventIntermediate<T> Event;
+    
+    EventProcessorQueue(SPSCQueue<Event>& queue): queue(queue) {}
+    
+    void processFunctionEntry(ThreadInfo<T>* thread, Addr<T> func)
+        {put(Event::kindFunctionEntry, thread, func);}
+    void processFunctionExit(ThreadInfo<T>* thread, Addr<T> func)
+        {put(Event::kindFunctionExit, thread, func);}
+    void processCallPre(ThreadInfo<T>* thread, Addr<T> pc, Addr<T> func)
+        {put(Event::kindCallPre, thread, pc, func);}
+    void processCallPost(ThreadInfo<T>* thread, Addr<T> pc, Addr<T> func)
+        {put(Event::kindCallPost, thread, pc, func);}
+    void processMAStart(ThreadInfo<T>* thread, int nEvents)
+        {put(Event::kindMAStart, thread, 0, 0, 0, nEvents);}
+    void processMA(ThreadInfo<T>* thread, Addr<T> pc, Addr<T> addr,
+        Size<T> size, enum kedr_memory_event_type type)
+        {put(Event::kindMA, thread, pc, addr, size.size, type);}
+    void processLMAUpdate(ThreadInfo<T>* thread,
+        Addr<T> pc, Addr<T> addr, Size<T> size)
+        {put(Event::kindLMAUpdate, thread, pc, addr, size.size);}
+    void processLMARead(ThreadInfo<T>* thread,
+        Addr<T> pc, Addr<T> addr, Size<T> size)
+        {put(Event::kindLMARead, thread, pc, addr, size.size);}
+    void processLMAWrite(ThreadInfo<T>* thread,
+        Addr<T> pc, Addr<T> addr, Size<T> size)
+        {put(Event::kindLMAWrite, thread, pc, addr, size.size);}
+    void processIOMA(ThreadInfo<T>* thread, Addr<T> pc, Addr<T> addr,
+        Size<T> size, enum kedr_memory_event_type type)
+        {put(Event::kindIOMA, thread, pc, addr, size.size, type);}
+    void processMRB(ThreadInfo<T>* thread, Addr<T> pc)
+        {put(Event::kindMRB, thread, pc);}
+    void processMWB(ThreadInfo<T>* thread, Addr<T> pc)
+        {put(Event::kindMWB, thread, pc);}
+    void processMFB(ThreadInfo<T>* thread, Addr<T> pc)
+        {put(Event::kindMFB, thread, pc);}
+    void processAlloc(ThreadInfo<T>* thread,
+        Addr<T> pc, Size<T> size, Addr<T> pointer)
+        {put(Event::kindAlloc, thread, pc, size.size, pointer);}
+    void processFree(ThreadInfo<T>* thread, Addr<T> pc, Addr<T> pointer)
+        {put(Event::kindFree, thread, pc, pointer);}
+    void processLock(ThreadInfo<T>* thread, Addr<T> pc, Addr<T> obj,
+        enum kedr_lock_type type)
+        {put(Event::kindLock, thread, pc, obj, 0, type);}
+    void processUnlock(ThreadInfo<T>* thread, Addr<T> pc, Addr<T> obj,
+        enum kedr_lock_type type)
+        {put(Event::kindUnlock, thread, pc, obj, 0, type);}
+    void processRLock(ThreadInfo<T>* thread, Addr<T> pc, Addr<T> obj,
+        enum kedr_lock_type type)
+        {put(Event::kindRLock, thread, pc, obj, 0, type);}
+    void processRUnlock(ThreadInfo<T>* thread, Addr<T> pc, Addr<T> obj,
+        enum kedr_lock_type type)
+        {put(Event::kindRUnlock, thread, pc, obj, 0, type);}
+    void processSignal(ThreadInfo<T>* thread, Addr<T> pc,
+        Addr<T> obj, enum kedr_sw_object_type type)
+        {put(Event::kindSignal, thread, pc, obj, 0, type);}
+    void processWait(ThreadInfo<T>* thread, Addr<T> pc,
+        Addr<T> obj, enum kedr_sw_object_type type)
+        {put(Event::kindWait, thread, pc, obj, 0, type);}
+    void processThreadCreateBefore(ThreadInfo<T>* thread, Addr<T> pc)
+        {put(Event::kindThreadCreateBefore, thread, pc);}
+    void processThreadCreateAfter(ThreadInfo<T>* thread,
+        Addr<T> pc, ThreadInfo<T>* childThread)
+        {put(Event::kindThreadCreateAfter, thread, pc, 0, 0, 0, childThread);}
+    void processThreadJoin(ThreadInfo<T>* thread,
+        Addr<T> pc, ThreadInfo<T>* childThread)
+        {put(Event::kindThreadJoin, thread, pc, 0, 0, 0, childThread);}
+    void processThreadStart(ThreadInfo<T>* thread,
+        ThreadInfo<T>* parentThread)
+        {put(Event::kindThreadStart, thread, 0, 0, 0, 0, parentThread);}
+    void processThreadStop(ThreadInfo<T>* thread)
+        {put(Event::kindThreadStop, thread);}
+    
+    /* Pass event to the given processor. */
+    static void replay(const Event& event, EventProcessor<T>& eventProcessor);
+private:
+    SPSCQueue<Event>& queue;
+    
+    void put(typename Event::Kind kind, ThreadInfo<T>* thread,
+        T arg1 = 0, T arg2 = 0, T arg3 = 0, int aux = 0,
+        ThreadInfo<T>* otherThread = NULL)
+    {
+        Event& event = queue.back();
+        event.kind = kind;
+        event.aux = aux;
+        event.thread = thread;
+        event.otherThread = otherThread;
+        event.arg1 = arg1;
+        event.arg2 = arg2;
+        event.arg3 = arg3;
+        queue.push();
+    }
+};
+
+template<class T>
+void EventProcessorQueue<T>::replay(const Event& event,
+    EventProcessor<T>& eventProcessor)
+{
+    ThreadInfo<T>* thread = event.thread;
+    switch(event.kind)
+    {
+    case Event::kindFunctionEntry:
+        eventProcessor.processFunctionEntry(thread, event.arg1);
+    break;
+    case Event::kindFunctionExit:
+        eventProcessor.processFunctionExit(thread, event.arg1);
+    break;
+    case Event::kindCallPre:
+        eventProcessor.processCallPre(thread, event.arg1, event.arg2);
+    break;
+    case Event::kindCallPost:
+        eventProcessor.processCallPost(thread, event.arg1, event.arg2);
+    break;
+    case Event::kindMAStart:
+        eventProcessor.processMAStart(thread, event.aux);
+    break;
+    case Event::kindMA:
+        eventProcessor.processMA(thread, event.arg1, event.arg2,
+            Size<T>(event.arg3), (enum kedr_memory_event_type)event.aux);
+    break;
+    case Event::kindLMAUpdate:
+        eventProcessor.processLMAUpdate(thread, event.arg1, event.arg2,
+            Size<T>(event.arg3));
+    break;
+    case Event::kindLMARead:
+        eventProcessor.processLMARead(thread, event.arg1, event.arg2,
+            Size<T>(event.arg3));
+    break;
+    case Event::kindLMAWrite:
+        eventProcessor.processLMAWrite(thread, event.arg1, event.arg2,
+            Size<T>(event.arg3));
+    break;
+    case Event::kindIOMA:
+        eventProcessor.processIOMA(thread, event.arg1, event.arg2,
+            Size<T>(event.arg3), (enum kedr_memory_event_type)event.aux);
+    break;
+    case Event::kindMRB:
+        eventProcessor.processMRB(thread, event.arg1);
+    break;
+    case Event::kindMWB:
+        eventProcessor.processMWB(thread, event.arg1);
+    break;
+    case Event::kindMFB:
+        eventProcessor.processMFB(thread, event.arg1);
+    break;
+    case Event::kindAlloc:
+        eventProcessor.processAlloc(thread, event.arg1,
+            Size<T>(event.arg2), event.arg3);
+    break;
+    case Event::kindFree:
+        eventProcessor.processFree(thread, event.arg1, event.arg2);
+    break;
+    case Event::kindLock:
+        eventProcessor.processLock(thread, event.arg1, event.arg2,
+            (enum kedr_lock_type)event.aux);
+    break;
+    case Event::kindUnlock:
+        eventProcessor.processUnlock(thread, event.arg1, event.arg2,
+            (enum kedr_lock_type)event.aux);
+    break;
+    case Event::kindRLock:
+        eventProcessor.processRLock(thread, event.arg1, event.arg2,
+            (enum kedr_lock_type)event.aux);
+    break;
+    case Event::kindRUnlock:
+        eventProcessor.processRUnlock(thread, event.arg1, event.arg2,
+            (enum kedr_lock_type)event.aux);
+    break;
+    case Event::kindSignal:
+        eventProcessor.processSignal(thread, event.arg1, event.arg2,
+            (enum kedr_sw_object_type)event.aux);
+    break;
+    case Event::kindWait:
+        eventProcessor.processWait(thread, event.arg1, event.arg2,
+            (enum kedr_sw_object_type)event.aux);
+    break;
+    case Event::kindThreadCreateBefore:
+        eventProcessor.processThreadCreateBefore(thread, event.arg1);
+    break;
+    case Event::kindThreadCreateAfter:
+        eventProcessor.processThreadCreateAfter(thread, event.arg1,
+            event.otherThread);
+    break;
+    case Event::kindThreadJoin:
+        eventProcessor.processThreadJoin(thread, event.arg1,
+            event.otherThread);
+    break;
+    case Event::kindThreadStart:
+        eventProcessor.processThreadStart(thread, event.otherThread);
+    break;
+    case Event::kindThreadStop:
+        eventProcessor.processThreadStop(thread);
+    break;
+    default:
+    break;
+    }
+}
+
+/* Stream buffer which writes into file descriptor by large blocks. */
+class FdOutBuf: public streambuf
+{
+public:
+    FdOutBuf(int fd, size_t bufSize = 1024 * 1024)
+        : fd(fd), buf(new char[bufSize])
+    {
+        /* Last byte is reserved for character passed to overflow() */
+        setp(buf, buf + bufSize - 1);
+    }
+    ~FdOutBuf() {sync(); delete[] buf;}
+protected:
+    int overflow(int c)
+    {
+        if(c != EOF)
+        {
+            *pptr() = c;
+            pbump(1);
+        }
+        return writeBuffer() ? traits_type::not_eof(c) : EOF;
+    }
+    int sync(void) {return writeBuffer() ? 0 : -1;}
+private:
+    FdOutBuf(const FdOutBuf&); /* not implemented */
+    
+    int fd;
+    char* buf;
+    
+    /* Write content of the buffer and empty it. */
+    bool writeBuffer(void);
+};
+
+bool FdOutBuf::writeBuffer(void)
+{
+    const char* data = pbase();
+    size_t size = pptr() - pbase();
+    
+    pbump(-(int)size);
+    
+    while(size > 0)
+    {
+        ssize_t result = write(fd, data, size);
+        if(result == -1)
+        {
+            if(errno == EINTR) continue;
+            cerr << "Failed to write converted trace: "
+                << strerror(errno) << "." << endl;
+            return false;
+        }
+        data += result;
+        size -= result;
+    }
+    
+    return true;
+}
+
+/* 
+ * Convert KEDR trace using pipeline.
+ * 
+ * 'transformer' is a chain of EventProcessor transformations, which
+ * should end with EventProcessorQueue created for 'intermediateQueue'.
+ * It is used by the transform stage.
+ * 
+ * 'printer' is used by the format stage.
+ * 
+ * Both processors are owned by the pipeline.
+ */
+template<class T>
+class ConverterPipeline
+{
+public:
+    typedef PipelineEventIntermediate<T> EventIntermediate;
+    
+    ConverterPipeline(KEDRTraceReader& traceReader)
+        : traceReader(traceReader), transformer(NULL), printer(NULL),
+        threads(1), /* thread id 0 is reserved for tsan */
+        threadMA(NULL) {}
+    ~ConverterPipeline() {delete transformer; delete printer;}
+    
+    /* Set processors for the stages. */
+    void setProcessors(EventProcessor<T>* transformer,
+        EventProcessor<T>* printer)
+    {
+        this->transformer = transformer;
+        this->printer = printer;
+    }
+    
+    /* Queue which should be used for create EventProcessorQueue */
+    SPSCQueue<EventIntermediate>& getIntermediateQueue(void)
+        {return intermediateQueue;}
+    
+    /* 
+     * Convert the trace.
+     * 
+     * Throw LostEventsException if events are lost in the trace.
+     * In that case events before lost ones are converted.
+     */
+    void run(void);
+private:
+    ConverterPipeline(const ConverterPipeline&); /* not implemented */
+    
+    KEDRTraceReader& traceReader;
+    EventProcessor<T>* transformer;
+    EventProcessor<T>* printer;
+    
+    SPSCQueue<PipelineEventDecoded> decodedQueue;
+    SPSCQueue<EventIntermediate> intermediateQueue;
+    
+    /* Used by transform stage only */
+    ThreadMap<T> threads;
+    /* Thread of the last 'ma' event */
+    ThreadInfo<T>* threadMA;
+    
+    /* Description of the error in the decode and transform stages */
+    string decodeError;
+    string transformError;
+    
+    void decode(void);
+    void transform(void);
+    /* Return kind of the last event */
+    int format(void);
+    
+    void putDecoded(const KEDREvent& event);
+    void putDecodedEnd(int kind);
+    
+    /* Skip decoded events until the last one. */
+    void drainDecoded(void);
+    
+    /* Process decoded event. Return false for the last event. */
+    bool transformEvent(const PipelineEventDecoded& event);
+    
+    ThreadInfo<T>* getThreadInfo(uint64_t tid);
+    
+    static void* decodeThread(void* arg);
+    static void* transformThread(void* arg);
+};
+
+template<class T>
+void* ConverterPipeline<T>::decodeThread(void* arg)
+{
+    ((ConverterPipeline<T>*)arg)->decode();
+    return NULL;
+}
+
+template<class T>
+void* ConverterPipeline<T>::transformThread(void* arg)
+{
+    ((ConverterPipeline<T>*)arg)->transform();
+    return NULL;
+}
+
+template<class T>
+void ConverterPipeline<T>::putDecoded(const KEDREvent& event)
+{
+    PipelineEventDecoded& decoded = decodedQueue.back();
+    decoded.kind = event.type;
+    decoded.tid = event.tid;
+    decoded.pc = event.pc;
+    decoded.aux = 0;
+    decoded.addr = 0;
+    decoded.size = event.size;
+    
+    switch(event.type)
+    {
+    case KEDREvent::typeMA:
+        decoded.aux = event.nSubevents;
+        decodedQueue.push();
+        for(int i = 0; i < event.nSubevents; i++)
+        {
+            const KEDREvent::MemoryAccess& ma = event.subevents[i];
+            PipelineEventDecoded& decodedMA = decodedQueue.back();
+            decodedMA.kind = pipelineMAElem;
+            decodedMA.aux = ma.accessType;
+            decodedMA.pc = ma.pc;
+            decodedMA.addr = ma.addr;
+            decodedMA.size = ma.size;
+            decodedQueue.push();
+        }
+        return;
+    case KEDREvent::typeLMAUpdate:
+    case KEDREvent::typeLMARead:
+    case KEDREvent::typeLMAWrite:
+        decoded.addr = event.addr;
+    break;
+    case KEDREvent::typeIOMA:
+        decoded.addr = event.addr;
+        decoded.aux = event.accessType;
+    break;
+    case KEDREvent::typeAlloc:
+    case KEDREvent::typeFree:
+        decoded.addr = event.pointer;
+    break;
+    case KEDREvent::typeLock:
+    case KEDREvent::typeUnlock:
+    case KEDREvent::typeRLock:
+    case KEDREvent::typeRUnlock:
+    case KEDREvent::typeSignal:
+    case KEDREvent::typeWait:
+        decoded.addr = event.object;
+        decoded.aux = event.objectType;
+    break;
+    case KEDREvent::typeTCAfter:
+    case KEDREvent::typeTJoin:
+        decoded.addr = event.childTid;
+    break;
+    case KEDREvent::typeFEntry:
+    case KEDREvent::typeFExit:
+    case KEDREvent::typeFCPre:
+    case KEDREvent::typeFCPost:
+        decoded.addr = event.func;
+    break;
+    default:
+    break;
+    }
+    
+    decodedQueue.push();
+}
+
+template<class T>
+void ConverterPipeline<T>::putDecodedEnd(int kind)
+{
+    PipelineEventDecoded& decoded = decodedQueue.back();
+    decoded.kind = kind;
+    decodedQueue.push();
+    decodedQueue.flush();
+}
+
+template<class T>
+void ConverterPipeline<T>::decode(void)
+{
+    try
+    {
+        for(KEDRTraceReader::PrefetchEventIterator iter(traceReader);
+            iter;
+            ++iter)
+        {
+            putDecoded(*iter);
+        }
+    }
+    catch(KEDRTraceReader::LostEventsException&)
+    {
+        putDecodedEnd(pipelineLost);
+        return;
+    }
+    catch(exception& e)
+    {
+        decodeError = e.what();
+        putDecodedEnd(pipelineError);
+        return;
+    }
+    
+    putDecodedEnd(pipelineEnd);
+}
+
+template<class T>
+ThreadInfo<T>* ConverterPipeline<T>::getThreadInfo(uint64_t tid)
+{
+    Addr<T> threadAddr((T)tid);
+    ThreadInfo<T>* threadInfo = threads.find(threadAddr);
+    if(threadInfo == NULL)
+    {
+        threadInfo = threads.add(threadAddr);
+        transformer->processThreadStart(threadInfo, NULL);
+        threadInfo->isStarted = true;
+    }
+    return threadInfo;
+}
+
+template<class T>
+bool ConverterPipeline<T>::transformEvent(const PipelineEventDecoded& event)
+{
+    EventProcessor<T>& p = *transformer;
+    
+    T pc = (T)event.pc;
+    T addr = (T)event.addr;
+    
+    switch(event.kind)
+    {
+    case KEDREvent::typeFEntry:
+        p.processFunctionEntry(getThreadInfo(event.tid), addr);
+    break;
+    case KEDREvent::typeFExit:
+        p.processFunctionExit(getThreadInfo(event.tid), addr);
+    break;
+    case KEDREvent::typeFCPre:
+        p.processCallPre(getThreadInfo(event.tid), pc, addr);
+    break;
+    case KEDREvent::typeFCPost:
+        p.processCallPost(getThreadInfo(event.tid), pc, addr);
+    break;
+    case KEDREvent::typeMA:
+        threadMA = getThreadInfo(event.tid);
+        p.processMAStart(threadMA, event.aux);
+    break;
+    case pipelineMAElem:
+        p.processMA(threadMA, pc, addr, Size<T>((T)event.size),
+            (enum kedr_memory_event_type)event.aux);
+    break;
+    case KEDREvent::typeLMAUpdate:
+        p.processLMAUpdate(getThreadInfo(event.tid), pc, addr,
+            Size<T>((T)event.size));
+    break;
+    case KEDREvent::typeLMARead:
+        p.processLMARead(getThreadInfo(event.tid), pc, addr,
+            Size<T>((T)event.size));
+    break;
+    case KEDREvent::typeLMAWrite:
+        p.processLMAWrite(getThreadInfo(event.tid), pc, addr,
+            Size<T>((T)event.size));
+    break;
+    case KEDREvent::typeIOMA:
+        p.processIOMA(getThreadInfo(event.tid), pc, addr,
+            Size<T>((T)event.size), (enum kedr_memory_event_type)event.aux);
+    break;
+    case KEDREvent::typeMRB:
+        p.processMRB(getThreadInfo(event.tid), pc);
+    break;
+    case KEDREvent::typeMWB:
+        p.processMWB(getThreadInfo(event.tid), pc);
+    break;
+    case KEDREvent::typeMFB:
+        p.processMFB(getThreadInfo(event.tid), pc);
+    break;
+    case KEDREvent::typeAlloc:
+        p.processAlloc(getThreadInfo(event.tid), pc,
+            Size<T>((T)event.size), addr);
+    break;
+    case KEDREvent::typeFree:
+        p.processFree(getThreadInfo(event.tid), pc, addr);
+    break;
+    case KEDREvent::typeLock:
+        p.processLock(getThreadInfo(event.tid), pc, addr,
+            (enum kedr_lock_type)event.aux);
+    break;
+    case KEDREvent::typeUnlock:
+        p.processUnlock(getThreadInfo(event.tid), pc, addr,
+            (enum kedr_lock_type)event.aux);
+    break;
+    case KEDREvent::typeRLock:
+        p.processRLock(getThreadInfo(event.tid), pc, addr,
+            (enum kedr_lock_type)event.aux);
+    break;
+    case KEDREvent::typeRUnlock:
+        p.processRUnlock(getThreadInfo(event.tid), pc, addr,
+            (enum kedr_lock_type)event.aux);
+    break;
+    case KEDREvent::typeSignal:
+        p.processSignal(getThreadInfo(event.tid), pc, addr,
+            (enum kedr_sw_object_type)event.aux);
+    break;
+    case KEDREvent::typeWait:
+        p.processWait(getThreadInfo(event.tid), pc, addr,
+            (enum kedr_sw_object_type)event.aux);
+    break;
+    case KEDREvent::typeTCBefore:
+    case KEDREvent::typeTCAfter:
+    case KEDREvent::typeTJoin:
+        /* Same as for KEDREventProcessorStandard: temporary disabled */
+    break;
+    case pipelineEnd:
+    case pipelineLost:
+    case pipelineError:
+        return false;
+    default:
+        cerr << "Event of unknown type.\n";
+    break;
+    }
+    
+    return true;
+}
+
+template<class T>
+void ConverterPipeline<T>::drainDecoded(void)
+{
+    while(true)
+    {
+        int kind = decodedQueue.front().kind;
+        if((kind == pipelineEnd) || (kind == pipelineLost)
+            || (kind == pipelineError)) break;
+        decodedQueue.pop();
+    }
+}
+
+template<class T>
+void ConverterPipeline<T>::transform(void)
+{
+    int kind;
+    try
+    {
+        while(true)
+        {
+            const PipelineEventDecoded& event = decodedQueue.front();
+            kind = event.kind;
+            if(!transformEvent(event)) break;
+            decodedQueue.pop();
+        }
+    }
+    catch(exception& e)
+    {
+        transformError = e.what();
+        kind = pipelineError;
+        /* Decode stage may wait for the free space in the queue. */
+        drainDecoded();
+    }
+    
+    EventIntermediate& event = intermediateQueue.back();
+    switch(kind)
+    {
+    case pipelineEnd:
+        event.kind = EventIntermediate::kindEnd;
+    break;
+    case pipelineLost:
+        event.kind = EventIntermediate::kindLost;
+    break;
+    default:
+        event.kind = EventIntermediate::kindError;
+    break;
+    }
+    intermediateQueue.push();
+    intermediateQueue.flush();
+}
+
+template<class T>
+int ConverterPipeline<T>::format(void)
+{
+    while(true)
+    {
+        const EventIntermediate& event = intermediateQueue.front();
+        switch(event.kind)
+        {
+        case EventIntermediate::kindEnd:
+        case EventIntermediate::kindLost:
+        case EventIntermediate::kindError:
+            return event.kind;
+        default:
+            EventProcessorQueue<T>::replay(event, *printer);
+        break;
+        }
+        intermediateQueue.pop();
+    }
+}
+
+template<class T>
+void ConverterPipeline<T>::run(void)
+{
+    pthread_t decodeThreadID, transformThreadID;
+    
+    int result = pthread_create(&decodeThreadID, NULL, decodeThread, this);
+    if(result)
+    {
+        cerr << "Failed to create thread for decode events: "
+            << strerror(result) << ".\n";
+        throw runtime_error("Failed to create thread");
+    }
+    result = pthread_create(&transformThreadID, NULL, transformThread, this);
+    if(result)
+    {
+        cerr << "Failed to create thread for transform events: "
+            << strerror(result) << ".\n";
+        drainDecoded();
+        pthread_join(decodeThreadID, NULL);
+        throw runtime_error("Failed to create thread");
+    }
+    
+    int kind = format();
+    /* Printer may buffer output, it will be flushed by the destructor. */
+    delete printer;
+    printer = NULL;
+    
+    pthread_join(transformThreadID, NULL);
+    pthread_join(decodeThreadID, NULL);
+    
+    switch(kind)
+    {
+    case EventIntermediate::kindLost:
+        throw KEDRTraceReader::LostEventsException();
+    case EventIntermediate::kindError:
+        if(!decodeError.empty())
+        {
+            cerr << "Failed to decode events: " << decodeError << ".\n";
+            throw runtime_error(decodeError);
+        }
+        else
+        {
+            cerr << "Failed to transform events: " << transformError << ".\n";
+            throw runtime_error(transformError);
+        }
+    default:
+    break;
+    }
+}
+
 /****************************** Options *******************************/
 /* Representation of program's options */
 struct Options
@@ -2280,8 +3244,10 @@ struct Options
     
     bool fixLock; /* Whether need to restore 'lock' operation prefix.*/
     
+    bool pipeline; /* Whether need to convert trace using several threads */
+    
     Options(void) : traceDir(""), sectionsFile(""), moduleFile(""),
-        resolvePC(false), fixLock(false) {}
+        resolvePC(false), fixLock(false), pipeline(false) {}
     
     int parseParameters(int argc, char** argv);
     
@@ -2304,6 +3270,7 @@ int Options::parseParameters(int argc, char** argv)
         optFixLock = 256,
         optResolvePC,
         optFixAll,
+        optPipeline,
     };
 
     // Available program's options
@@ -2314,6 +3281,7 @@ int Options::parseParameters(int argc, char** argv)
         {"fix-lock", 0, 0, optFixLock},
         {"fix-all", 0, 0, optFixAll},
         {"resolve-pc", 0, 0, optResolvePC},
+        {"pipeline", 0, 0, optPipeline},
         {"help", 0, 0, optHelp},
         {0, 0, 0, 0}
     };
@@ -2367,6 +3335,9 @@ int Options::parseParameters(int argc, char** argv)
         case optResolvePC:
             resolvePC = true;
         break;
+        case optPipeline:
+            pipeline = true;
+        break;
         case optHelp:
             usage();
             return 1;
@@ -2428,16 +3399,10 @@ void Options::usage(void)
 }
 
 /****************************** MAIN **********************************/
-/* 
- * Create event processor corresponded to trace reader, created
- * for traceDir, and options.
- */
+/* Create processor which converts intermediate events into tsan ones. */
 template<class T>
-KEDREventProcessor* createEventProcessor(const KEDRTraceReader& traceReader,
-    const Options& options)
+EventProcessor<T>* createTsanProcessor(ostream& os, const Options& options)
 {
-    EventProcessor<T>* eventProcessorIntermediate;
-    
     if(options.resolvePC)
     {
         /* Open module file as ELF */
@@ -2495,15 +3460,20 @@ KEDREventProcessor* createEventProcessor(const KEDRTraceReader& traceReader,
         elf_end(e);
         close(fd);
         /* Create tsan processor which resolve PC */
-        eventProcessorIntermediate = new EventProcessorTsanPC<T>(cout,
-            sectionsMappingNames);
+        return new EventProcessorTsanPC<T>(os, sectionsMappingNames);
     }
     else
     {
         /* Create tsan standard processor */
-        eventProcessorIntermediate = new EventProcessorTsan<T>(cout);
+        return new EventProcessorTsan<T>(os);
     }
-    
+}
+
+/* Wraps processor of intermediate events into transformators. */
+template<class T>
+EventProcessor<T>* createTransformers(
+    EventProcessor<T>* eventProcessorIntermediate, const Options& options)
+{
     /* Wraps tsan processor into PC-restoring processor */
     //Temporary disable
     //eventProcessorIntermediate = new EventProcessorRestorePC<T>(
@@ -2518,9 +3488,64 @@ KEDREventProcessor* createEventProcessor(const KEDRTraceReader& traceReader,
             loadSectionRecords(options.sectionsFile.c_str()));
     }
     
+    return eventProcessorIntermediate;
+}
+
+/* 
+ * Create event processor corresponded to trace reader, created
+ * for traceDir, and options.
+ */
+template<class T>
+KEDREventProcessor* createEventProcessor(const KEDRTraceReader& traceReader,
+    const Options& options)
+{
+    EventProcessor<T>* eventProcessorIntermediate =
+        createTransformers<T>(createTsanProcessor<T>(cout, options), options);
+    
     return new KEDREventProcessorStandard<T>(traceReader, eventProcessorIntermediate);
 }
 
+/* Convert trace using pipeline. Return value is exit code of the program. */
+template<class T>
+int convertPipeline(KEDRTraceReader& traceReader, const Options& options)
+{
+    FdOutBuf outBuf(STDOUT_FILENO);
+    ostream os(&outBuf);
+    
+    ConverterPipeline<T> pipeline(traceReader);
+    
+    EventProcessor<T>* printer = createTsanProcessor<T>(os, options);
+    EventProcessor<T>* transformer;
+    try
+    {
+        transformer = createTransformers<T>(
+            new EventProcessorQueue<T>(pipeline.getIntermediateQueue()),
+            options);
+    }
+    catch(...)
+    {
+        delete printer;
+        throw;
+    }
+    pipeline.setProcessors(transformer, printer);
+    
+    try
+    {
+        traceReader.exceptions(KEDRTraceReader::eventsLostBit);
+        pipeline.run();
+    }
+    catch(KEDRTraceReader::LostEventsException&)
+    {
+        os.flush();
+        cerr << "Events lost in the trace" << endl;
+        return 1;
+    }
+    
+    os.flush();
+    
+    return os ? 0 : 1;
+}
+
 
 
 int main(int argc, char** argv)
@@ -2545,10 +3570,14 @@ int main(int argc, char** argv)
     }
     else if(*pointer_bits == "32")
     {
+        if(options.pipeline)
+            return convertPipeline<uint32_t>(traceReader, options);
         eventProcessor = createEventProcessor<uint32_t>(traceReader, options);
     }
     else if(*pointer_bits == "64")
     {
+        if(options.pipeline)
+            return convertPipeline<uint64_t>(traceReader, options);
         eventProcessor = createEventProcessor<uint64_t>(traceReader, options);
     }
     else
@@ -306,6 +306,11 @@ unsigned int insn_reg_mask(struct insn *insn);
  * expression (ModRM.RM, SIB) are considered. */
 unsigned int insn_reg_mask_for_expr(struct insn *insn);
 
+/* Similar to the above but only the register encoded in ModRM.reg is 
+ * considered. X86_REG_MASK_NONE is returned if that field does not encode
+ * a general-purpose register. */
+unsigned int insn_reg_mask_reg(struct insn *insn);
+
 /* Query memory access type */
 /* Nonzero if the instruction reads data from memory, 0 otherwise. 
  * The function decodes the relevant parts of the instruction if needed. */
@@ -721,7 +721,7 @@ int insn_is_noop(struct insn *insn)
  *
  * If the field does not encode a GPR, the function returns 
  * X86_REG_MASK_NONE. */
-static unsigned int 
+unsigned int 
 insn_reg_mask_reg(struct insn *insn)
 {
 	unsigned int reg;
@@ -0,0 +1,165 @@
+/* dup_filter.c - filtering of the repeated memory accesses a thread makes
+ * between two synchronization points. */
+
+/* ========================================================================
+ * Copyright (C) 2014, ROSA Laboratory
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ ======================================================================== */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/smp.h>
+#include <linux/percpu.h>
+#include <linux/hash.h>
+#include <linux/irqflags.h>
+#include <linux/errno.h>
+
+#include <kedr/kedr_mem/core_api.h>
+
+#include "config.h"
+#include "core_impl.h"
+
+#include "dup_filter.h"
+/* ====================================================================== */
+
+#ifndef __percpu
+/* See tid.c. */
+#define __percpu
+#endif
+/* ====================================================================== */
+
+/* Instead of clearing the remembered accesses at the synchronization
+ * points, the generation counters are incremented. A remembered access is
+ * only valid if the generations stored with it are equal to the current
+ * ones: the generation for its thread and the global generation.
+ *
+ * The generation for a thread is selected from 'thread_gen[]' by the hash
+ * of the thread ID, so it may be shared with other threads. A collision
+ * only makes the accesses of these threads forgotten more often.
+ *
+ * The global generation is incremented when the memory may be reused
+ * (allocations and deallocations) and when a session starts. The accesses
+ * of all threads are forgotten then. */
+#define KEDR_DUP_GEN_HASH_BITS 10
+#define KEDR_DUP_GEN_TABLE_SIZE (1 << KEDR_DUP_GEN_HASH_BITS)
+
+static atomic_t thread_gen[KEDR_DUP_GEN_TABLE_SIZE];
+static atomic_t global_gen = ATOMIC_INIT(0);
+
+/* A remembered memory access. */
+struct kedr_dup_entry
+{
+	unsigned long tid;
+	unsigned long addr;
+	unsigned long size;
+	unsigned int type;
+	unsigned int gen;
+	unsigned int global_gen;
+};
+
+/* The table of the remembered accesses for a CPU. An access is stored at
+ * the position determined by the hash of its address and thread ID,
+ * evicting the access stored there before, if any.
+ * The table is only accessed with the interrupts disabled on the given
+ * CPU, so there is no need for other kinds of synchronization. */
+#define KEDR_DUP_CACHE_HASH_BITS 7
+#define KEDR_DUP_CACHE_SIZE (1 << KEDR_DUP_CACHE_HASH_BITS)
+
+struct kedr_dup_cache
+{
+	struct kedr_dup_entry entries[KEDR_DUP_CACHE_SIZE];
+};
+
+static struct kedr_dup_cache __percpu *dup_caches = NULL;
+/* ====================================================================== */
+
+int
+kedr_dup_filter_init(void)
+{
+	if (!filter_repeated_accesses)
+		return 0;
+
+	dup_caches = alloc_percpu(struct kedr_dup_cache);
+	if (dup_caches == NULL)
+		return -ENOMEM;
+	return 0;
+}
+
+void
+kedr_dup_filter_cleanup(void)
+{
+	if (dup_caches != NULL)
+		free_percpu(dup_caches);
+	dup_caches = NULL;
+}
+
+void
+kedr_dup_filter_start(void)
+{
+	atomic_inc(&global_gen);
+}
+
+void
+kedr_mark_sync_point(unsigned long tid)
+{
+	if (!filter_repeated_accesses)
+		return;
+
+	atomic_inc(&thread_gen[hash_long(tid, KEDR_DUP_GEN_HASH_BITS)]);
+}
+EXPORT_SYMBOL(kedr_mark_sync_point);
+
+void
+kedr_mark_memory_reuse(void)
+{
+	if (!filter_repeated_accesses)
+		return;
+
+	atomic_inc(&global_gen);
+}
+EXPORT_SYMBOL(kedr_mark_memory_reuse);
+
+int
+kedr_is_repeated_access(unsigned long tid, unsigned long addr,
+	unsigned long size, enum kedr_memory_event_type type)
+{
+	struct kedr_dup_cache *cache;
+	struct kedr_dup_entry *entry;
+	unsigned int gen;
+	unsigned int ggen;
+	unsigned long irq_flags;
+	int repeated;
+
+	gen = (unsigned int)atomic_read(
+		&thread_gen[hash_long(tid, KEDR_DUP_GEN_HASH_BITS)]);
+	ggen = (unsigned int)atomic_read(&global_gen);
+
+	local_irq_save(irq_flags);
+	cache = per_cpu_ptr(dup_caches, smp_processor_id());
+	entry = &cache->entries[
+		hash_long(addr ^ tid, KEDR_DUP_CACHE_HASH_BITS)];
+
+	repeated = (entry->addr == addr && entry->tid == tid &&
+		entry->size == size && entry->type == (unsigned int)type &&
+		entry->gen == gen && entry->global_gen == ggen);
+	if (!repeated) {
+		entry->tid = tid;
+		entry->addr = addr;
+		entry->size = size;
+		entry->type = (unsigned int)type;
+		entry->gen = gen;
+		entry->global_gen = ggen;
+	}
+	local_irq_restore(irq_flags);
+
+	/* The counters are updated without synchronization, like the
+	 * counters of the blocks (see module.c). */
+	++dup_accesses_total;
+	if (repeated)
+		++dup_accesses_filtered;
+	return repeated;
+}
+/* ====================================================================== */
@@ -0,0 +1,48 @@
+#ifndef DUP_FILTER_H_1517_INCLUDED
+#define DUP_FILTER_H_1517_INCLUDED
+
+/* dup_filter.h - filtering of the repeated memory accesses a thread makes
+ * between two synchronization points (see 'filter_repeated_accesses'
+ * parameter in module.c).
+ *
+ * For each thread, the core remembers the memory accesses (address, size
+ * and type) reported since the last synchronization point of that thread.
+ * If the thread makes the same access again, it is not reported: a
+ * happens-before race detector gains nothing from it. The accesses are
+ * remembered in small hash tables, one per CPU, so some accesses may be
+ * forgotten earlier, in which case they are reported again. This is OK.
+ *
+ * The synchronization points are marked with kedr_mark_sync_point() and
+ * kedr_mark_memory_reuse() (see core_api.h). The kedr_eh_*() functions
+ * for the relevant events call these automatically. */
+
+#include <kedr/kedr_mem/core_api.h>
+/* ====================================================================== */
+
+/* Initialize the subsystem. Call this from the init function of the
+ * core. Returns 0 on success, a negative error code on failure.
+ * Nothing is allocated if the filter is disabled. */
+int
+kedr_dup_filter_init(void);
+
+/* Cleanup of the subsystem. Call this from the cleanup function of the
+ * core. */
+void
+kedr_dup_filter_cleanup(void);
+
+/* Forget all the accesses seen so far. Call this before a session
+ * starts. */
+void
+kedr_dup_filter_start(void);
+
+/* Returns non-zero if the thread has already made the same access since
+ * its last synchronization point, that is, if the access need not be
+ * reported. Otherwise, remembers the access and returns 0.
+ * Updates 'dup_accesses_total' and 'dup_accesses_filtered' counters.
+ * May be called in atomic context.
+ * Must not be called if the filter is disabled. */
+int
+kedr_is_repeated_access(unsigned long tid, unsigned long addr,
+	unsigned long size, enum kedr_memory_event_type type);
+/* ====================================================================== */
+#endif /* DUP_FILTER_H_1517_INCLUDED */
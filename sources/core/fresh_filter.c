@@ -0,0 +1,330 @@
+/* fresh_filter.c - filtering of the accesses to the freshly allocated
+ * objects that have not been published to other threads yet. */
+
+/* ========================================================================
+ * Copyright (C) 2014, ROSA Laboratory
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ ======================================================================== */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/bug.h>
+#include <linux/hash.h>
+#include <linux/seqlock.h>
+#include <linux/string.h>
+
+#include <kedr/kedr_mem/core_api.h>
+
+#include "config.h"
+#include "core_impl.h"
+
+#include "fresh_filter.h"
+/* ====================================================================== */
+
+/* When a thread performs a release-type operation, its generation counter
+ * is incremented rather than its objects are looked for and forgotten.
+ * An object is private to its thread only while the generation stored
+ * with it is equal to the current generation of that thread.
+ *
+ * As in dup_filter.c, the generation for a thread is selected by the hash
+ * of the thread ID, so it may be shared with other threads. A collision
+ * only makes the objects of these threads published earlier. */
+#define KEDR_FRESH_GEN_HASH_BITS 10
+#define KEDR_FRESH_GEN_TABLE_SIZE (1 << KEDR_FRESH_GEN_HASH_BITS)
+
+static atomic_t release_gen[KEDR_FRESH_GEN_TABLE_SIZE];
+
+/* A freshly allocated object, [start, end). The slot is free if 'end' is
+ * 0. */
+struct kedr_fresh_object
+{
+	unsigned long start;
+	unsigned long end;
+	unsigned long tid;
+	unsigned int gen;
+};
+
+/* The most recently allocated objects. The table is shared by all threads
+ * because the accesses of other threads to the objects must be detected
+ * too. When the table is full, a new object replaces the oldest one, the
+ * latter just stops being filtered. The objects in the table do not
+ * overlap: if a new object overlaps the old ones, the memory has been
+ * reused, so the old objects are forgotten.
+ *
+ * The table is read on each memory access, so a seqlock is used to
+ * protect it: the readers do not write to the shared memory and therefore
+ * do not interfere with each other. The writers disable interrupts on the
+ * local CPU because the readers may run in the interrupt handlers. */
+#define KEDR_FRESH_TABLE_SIZE 64
+
+static struct kedr_fresh_object fresh_objects[KEDR_FRESH_TABLE_SIZE];
+
+/* The slot to store the next object to. */
+static unsigned int next_slot = 0;
+
+/* The indexes of the occupied slots sorted by the start addresses of the
+ * objects, so that the object containing a given address can be found
+ * with binary search. 'num_fresh' is the number of the occupied slots. */
+static unsigned int sorted_slots[KEDR_FRESH_TABLE_SIZE];
+static unsigned int num_fresh = 0;
+
+/* The lowest start address and the highest end address of the objects,
+ * ULONG_MAX and 0 if there are no objects. They are checked without
+ * locking before looking for the object in the table, so that the
+ * accesses outside of the fresh objects do not touch the seqlock at
+ * all. */
+static unsigned long fresh_min_start = ULONG_MAX;
+static unsigned long fresh_max_end = 0;
+
+static DEFINE_SEQLOCK(fresh_lock);
+/* ====================================================================== */
+
+static unsigned int
+current_gen(unsigned long tid)
+{
+	return (unsigned int)atomic_read(
+		&release_gen[hash_long(tid, KEDR_FRESH_GEN_HASH_BITS)]);
+}
+
+/* Returns the position in the first 'num' elements of 'sorted_slots' of
+ * the first object starting at 'addr' or above, 'num' if there is no such
+ * object. */
+static unsigned int
+lower_bound(unsigned long addr, unsigned int num)
+{
+	unsigned int lo = 0;
+	unsigned int hi = num;
+	unsigned int mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (fresh_objects[sorted_slots[mid]].start < addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* The functions below should be called with 'fresh_lock' locked for
+ * writing. */
+static void
+update_range(void)
+{
+	if (num_fresh == 0) {
+		ACCESS_ONCE(fresh_min_start) = ULONG_MAX;
+		ACCESS_ONCE(fresh_max_end) = 0;
+		return;
+	}
+
+	ACCESS_ONCE(fresh_min_start) = fresh_objects[sorted_slots[0]].start;
+	ACCESS_ONCE(fresh_max_end) =
+		fresh_objects[sorted_slots[num_fresh - 1]].end;
+}
+
+/* Removes the object at the given position in 'sorted_slots'. */
+static void
+forget_object_at(unsigned int pos)
+{
+	memset(&fresh_objects[sorted_slots[pos]], 0,
+		sizeof(fresh_objects[0]));
+
+	--num_fresh;
+	memmove(&sorted_slots[pos], &sorted_slots[pos + 1],
+		(num_fresh - pos) * sizeof(sorted_slots[0]));
+}
+
+static void
+forget_object(struct kedr_fresh_object *obj)
+{
+	unsigned int pos;
+
+	if (obj->end == 0)
+		return;
+
+	pos = lower_bound(obj->start, num_fresh);
+	BUG_ON(pos >= num_fresh ||
+	       &fresh_objects[sorted_slots[pos]] != obj);
+	forget_object_at(pos);
+}
+
+void
+kedr_fresh_filter_start(void)
+{
+	unsigned long irq_flags;
+
+	write_seqlock_irqsave(&fresh_lock, irq_flags);
+	memset(&fresh_objects[0], 0, sizeof(fresh_objects));
+	next_slot = 0;
+	num_fresh = 0;
+	update_range();
+	write_sequnlock_irqrestore(&fresh_lock, irq_flags);
+}
+
+void
+kedr_mark_release_point(unsigned long tid)
+{
+	kedr_mark_sync_point(tid);
+
+	if (!filter_fresh_objects)
+		return;
+
+	atomic_inc(&release_gen[hash_long(tid, KEDR_FRESH_GEN_HASH_BITS)]);
+}
+EXPORT_SYMBOL(kedr_mark_release_point);
+
+void
+kedr_fresh_filter_alloc(unsigned long tid, unsigned long addr,
+	unsigned long size)
+{
+	struct kedr_fresh_object *obj;
+	unsigned long irq_flags;
+	unsigned long end = addr + size;
+	unsigned int pos;
+
+	if (!filter_fresh_objects || addr == 0 || size == 0)
+		return;
+
+	write_seqlock_irqsave(&fresh_lock, irq_flags);
+
+	/* The objects overlapping the new one, if any, are stale. At most
+	 * one of them starts below 'addr' because they do not overlap each
+	 * other. */
+	pos = lower_bound(addr, num_fresh);
+	if (pos > 0 && fresh_objects[sorted_slots[pos - 1]].end > addr)
+		--pos;
+	while (pos < num_fresh &&
+	       fresh_objects[sorted_slots[pos]].start < end)
+		forget_object_at(pos);
+
+	obj = &fresh_objects[next_slot];
+	forget_object(obj);
+
+	obj->start = addr;
+	obj->end = end;
+	obj->tid = tid;
+	obj->gen = current_gen(tid);
+
+	pos = lower_bound(addr, num_fresh);
+	memmove(&sorted_slots[pos + 1], &sorted_slots[pos],
+		(num_fresh - pos) * sizeof(sorted_slots[0]));
+	sorted_slots[pos] = next_slot;
+	++num_fresh;
+	update_range();
+
+	next_slot = (next_slot + 1) % KEDR_FRESH_TABLE_SIZE;
+	write_sequnlock_irqrestore(&fresh_lock, irq_flags);
+}
+
+void
+kedr_fresh_filter_free(unsigned long addr)
+{
+	unsigned long irq_flags;
+	unsigned int pos;
+
+	if (!filter_fresh_objects || addr == 0 ||
+	    addr < ACCESS_ONCE(fresh_min_start) ||
+	    addr >= ACCESS_ONCE(fresh_max_end))
+		return;
+
+	write_seqlock_irqsave(&fresh_lock, irq_flags);
+	pos = lower_bound(addr, num_fresh);
+	if (pos < num_fresh &&
+	    fresh_objects[sorted_slots[pos]].start == addr) {
+		forget_object_at(pos);
+		update_range();
+	}
+	write_sequnlock_irqrestore(&fresh_lock, irq_flags);
+}
+
+/* Forgets the object if it is still in the table. 'obj' is a copy of the
+ * object made earlier. */
+static void
+forget_object_copy(const struct kedr_fresh_object *obj)
+{
+	struct kedr_fresh_object *p;
+	unsigned long irq_flags;
+	unsigned int pos;
+
+	write_seqlock_irqsave(&fresh_lock, irq_flags);
+	pos = lower_bound(obj->start, num_fresh);
+	if (pos < num_fresh) {
+		p = &fresh_objects[sorted_slots[pos]];
+		if (p->start == obj->start && p->end == obj->end &&
+		    p->tid == obj->tid && p->gen == obj->gen) {
+			forget_object_at(pos);
+			update_range();
+		}
+	}
+	write_sequnlock_irqrestore(&fresh_lock, irq_flags);
+}
+
+int
+kedr_is_fresh_object_access(unsigned long tid, unsigned long pc,
+	unsigned long addr, unsigned long size)
+{
+	struct kedr_fresh_object obj;
+	unsigned long end = addr + size;
+	unsigned int seq;
+	unsigned int num;
+	unsigned int pos;
+	int found;
+
+	/* Fast path: the access is outside of all the fresh objects. This
+	 * also covers the case when there are no fresh objects. */
+	if (addr >= ACCESS_ONCE(fresh_max_end) ||
+	    end <= ACCESS_ONCE(fresh_min_start))
+		return 0;
+
+	do {
+		seq = read_seqbegin(&fresh_lock);
+		found = 0;
+
+		/* The objects do not overlap, so only the last one starting
+		 * below 'end' may overlap the accessed area. The data may be
+		 * inconsistent until read_seqretry() is checked, the number
+		 * of the objects is limited just in case. */
+		num = min_t(unsigned int, ACCESS_ONCE(num_fresh),
+			    KEDR_FRESH_TABLE_SIZE);
+		pos = lower_bound(end, num);
+		if (pos > 0) {
+			obj = fresh_objects[sorted_slots[pos - 1]];
+			found = (addr < obj.end);
+		}
+	} while (read_seqretry(&fresh_lock, seq));
+
+	if (!found)
+		return 0;
+	if (obj.tid == tid && obj.gen == current_gen(tid)) {
+		/* The object is still private to this thread. If the access
+		 * goes beyond it, report it, just in case. */
+		if (addr < obj.start || end > obj.end)
+			return 0;
+
+		/* The counters are updated without synchronization, like the
+		 * counters of the blocks (see module.c). */
+		++fresh_accesses_filtered;
+		if (filter_fresh_objects != 2)
+			return 1;
+
+		if (printk_ratelimit()) {
+			pr_info(KEDR_MSG_PREFIX
+			"Would filter out the access at %pS (thread: %lx) "
+			"to [%lx, %lx), the object [%lx, %lx).\n",
+				(void *)pc, tid, addr, end,
+				obj.start, obj.end);
+		}
+		return 0;
+	}
+
+	/* Either another thread has accessed the object or the owner has
+	 * published it. The object is not private any longer. */
+	if (obj.tid != tid)
+		++fresh_objects_escaped;
+	forget_object_copy(&obj);
+	return 0;
+}
+/* ====================================================================== */
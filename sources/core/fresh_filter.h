@@ -0,0 +1,57 @@
+#ifndef FRESH_FILTER_H_1704_INCLUDED
+#define FRESH_FILTER_H_1704_INCLUDED
+
+/* fresh_filter.h - filtering of the accesses to the freshly allocated
+ * objects that have not been published to other threads yet (see
+ * 'filter_fresh_objects' parameter in module.c).
+ *
+ * The core remembers a limited number of the most recently allocated
+ * objects along with the threads that allocated them. An object is
+ * considered private to its thread until that thread performs a
+ * synchronization operation of "release" type (unlock, signal, a locked
+ * operation, a memory barrier, thread creation, etc.), until the object is
+ * freed or until another thread accesses it, whichever happens first.
+ * The accesses of the owning thread to a private object cannot race with
+ * anything, so they need not be reported.
+ *
+ * The allocations, deallocations and the release-type operations are
+ * marked with kedr_mark_alloc(), kedr_mark_free() and
+ * kedr_mark_release_point() (see core_api.h). The kedr_eh_*() functions
+ * for the relevant events call these automatically. */
+
+#include <kedr/kedr_mem/core_api.h>
+/* ====================================================================== */
+
+/* Forget all the objects seen so far. Call this before a session
+ * starts. */
+void
+kedr_fresh_filter_start(void);
+
+/* Remember the object [addr, addr + size) allocated by the given thread
+ * and forget the object starting at 'addr', respectively. Called from
+ * kedr_mark_alloc() and kedr_mark_free() (see handlers.c). */
+void
+kedr_fresh_filter_alloc(unsigned long tid, unsigned long addr,
+	unsigned long size);
+
+void
+kedr_fresh_filter_free(unsigned long addr);
+
+/* Returns non-zero if the access of the given thread to [addr, addr+size)
+ * is an access to an object this thread has allocated and has not
+ * published yet, that is, if the access need not be reported. Returns 0
+ * otherwise. If the object has been accessed by another thread or has
+ * been published by its owner, it is forgotten.
+ *
+ * In the validation mode ('filter_fresh_objects' is 2), the accesses that
+ * would be filtered out are reported to the system log instead and 0 is
+ * returned.
+ *
+ * Updates 'fresh_accesses_filtered' and 'fresh_objects_escaped' counters.
+ * May be called in atomic context.
+ * Must not be called if the filter is disabled. */
+int
+kedr_is_fresh_object_access(unsigned long tid, unsigned long pc,
+	unsigned long addr, unsigned long size);
+/* ====================================================================== */
+#endif /* FRESH_FILTER_H_1704_INCLUDED */
@@ -23,6 +23,10 @@
 #include <linux/sched.h>
 #include <linux/smp.h>
 #include <linux/rcupdate.h>
+#include <linux/percpu.h>
+#include <linux/cpumask.h>
+#include <linux/kallsyms.h>
+#include <linux/sort.h>
 
 #include <kedr/kedr_mem/core_api.h>
 #include <kedr/kedr_mem/local_storage.h>
@@ -35,6 +39,10 @@
 #include "handlers.h"
 #include "tid.h"
 #include "fh_impl.h"
+#include "dup_filter.h"
+#include "fresh_filter.h"
+#include "watch_filter.h"
+#include "shadow_stack.h"
 /* ====================================================================== */
 
 /* KEDR_SAVE_SCRATCH_REGS_BUT_AX
@@ -246,6 +254,7 @@ kedr_on_function_entry(struct kedr_prologue_data *pd)
 	if (sampling_rate != 0)
 		ls->tindex = kedr_get_tindex();
 	
+	kedr_shadow_stack_push(ls);
 	kedr_eh_on_function_entry(ls->tid, ls->fi->addr);
 	
 	/* Call the pre handler if it is set. */
@@ -283,6 +292,7 @@ kedr_on_function_exit(unsigned long storage)
 	rcu_read_unlock();
 	
 	kedr_eh_on_function_exit(ls->tid, ls->fi->addr);
+	kedr_shadow_stack_pop(ls);
 	ls_allocator->free_ls(ls_allocator, ls);
 }
 KEDR_DEFINE_WRAPPER(kedr_on_function_exit);
@@ -392,6 +402,101 @@ is_stack_address(unsigned long addr)
 		KEDR_PTR_ALIGN(sp, THREAD_SIZE));
 }
 
+/* The static per-CPU areas, one for each possible CPU, sorted by their 
+ * start addresses. Each area contains the static per-CPU data of the
+ * kernel proper followed by the area reserved for the static per-CPU data
+ * of the modules (PERCPU_MODULE_RESERVE bytes). The areas are only 
+ * prepared if the addresses are to be checked at runtime (see 
+ * 'check_percpu_addresses' parameter), 'num_percpu_areas' is 0 otherwise.
+ */
+struct kedr_percpu_area
+{
+	unsigned long start;
+	unsigned long end;
+};
+static struct kedr_percpu_area *percpu_areas = NULL;
+static unsigned int num_percpu_areas = 0;
+
+static int
+percpu_area_compare(const void *lhs, const void *rhs)
+{
+	const struct kedr_percpu_area *left = lhs;
+	const struct kedr_percpu_area *right = rhs;
+	
+	if (left->start < right->start)
+		return -1;
+	return (left->start > right->start) ? 1 : 0;
+}
+
+int
+kedr_init_percpu_areas(void)
+{
+#ifdef CONFIG_SMP
+	unsigned long start;
+	unsigned long end;
+	unsigned int cpu;
+	unsigned int n = 0;
+	
+	if (process_percpu_accesses || !check_percpu_addresses)
+		return 0;
+	
+	/* These symbols are not exported, so we need the same hack as for
+	 * set_memory_rX() in module.c. __per_cpu_start may be 0 on x86-64,
+	 * that is OK. */
+	start = kallsyms_lookup_name("__per_cpu_start");
+	end = kallsyms_lookup_name("__per_cpu_end");
+	if (end == 0 || end <= start) {
+		pr_warning(KEDR_MSG_PREFIX 
+		"Failed to find the bounds of the static per-CPU area.\n");
+		return -EINVAL;
+	}
+	
+	percpu_areas = kzalloc(num_possible_cpus() * sizeof(*percpu_areas),
+			       GFP_KERNEL);
+	if (percpu_areas == NULL)
+		return -ENOMEM;
+	
+	for_each_possible_cpu(cpu) {
+		percpu_areas[n].start = start + per_cpu_offset(cpu);
+		percpu_areas[n].end = end + per_cpu_offset(cpu) + 
+			PERCPU_MODULE_RESERVE;
+		++n;
+	}
+	sort(percpu_areas, n, sizeof(*percpu_areas), percpu_area_compare,
+	     NULL);
+	num_percpu_areas = n;
+#endif
+	return 0;
+}
+
+void
+kedr_cleanup_percpu_areas(void)
+{
+	num_percpu_areas = 0;
+	kfree(percpu_areas);
+	percpu_areas = NULL;
+}
+
+/* Non-zero if the address belongs to one of the static per-CPU areas, 
+ * 0 otherwise. */
+static int
+is_percpu_address(unsigned long addr)
+{
+	unsigned int first = 0;
+	unsigned int last = num_percpu_areas;
+	unsigned int mid;
+	
+	/* Find the last area starting at or before 'addr'. */
+	while (first < last) {
+		mid = first + (last - first) / 2;
+		if (percpu_areas[mid].start <= addr)
+			first = mid + 1;
+		else
+			last = mid;
+	}
+	return (first != 0 && addr < percpu_areas[first - 1].end);
+}
+
 static void
 eh_on_memory_event_impl(struct kedr_event_handlers *eh, 
 	unsigned long tid, unsigned long pc, 
@@ -399,11 +504,30 @@ eh_on_memory_event_impl(struct kedr_event_handlers *eh,
 	enum kedr_memory_event_type type,
 	void *data)
 {
-	/* Filter out the accesses to the stack and to the user 
-	 * space memory if required. That is, call on_memory_event()
-	 * with 0 as 'addr' as if the event did not happen. */
+	/* Filter out the accesses to the stack, to the user space memory
+	 * and to the static per-CPU areas if required. That is, call 
+	 * on_memory_event() with 0 as 'addr' as if the event did not 
+	 * happen. */
 	if ((!process_stack_accesses && is_stack_address(addr)) || 
-	    (!process_um_accesses && is_user_space_address(addr)))
+	    (!process_um_accesses && is_user_space_address(addr)) ||
+	    (num_percpu_areas != 0 && is_percpu_address(addr)))
+		addr = 0;
+	
+	/* The same for the accesses outside of the watched address ranges
+	 * or inside of the excluded ones, if these are specified. */
+	if (addr != 0 && kedr_is_watch_filtered(addr, size))
+		addr = 0;
+	
+	/* The same for the accesses of the thread to the objects it has 
+	 * just allocated and not yet published, if required. */
+	if (addr != 0 && filter_fresh_objects && 
+	    kedr_is_fresh_object_access(tid, pc, addr, size))
+		addr = 0;
+	
+	/* The same for the repeated accesses of the thread since its last 
+	 * synchronization point, if required. */
+	if (addr != 0 && filter_repeated_accesses && 
+	    kedr_is_repeated_access(tid, addr, size, type))
 		addr = 0;
 	eh->on_memory_event(eh, tid, pc, addr, size, type, data);
 }
@@ -419,6 +543,23 @@ kedr_eh_on_memory_event(unsigned long tid, unsigned long pc,
 		eh_on_memory_event_impl(eh, tid, pc, addr, size, type, data);
 }
 EXPORT_SYMBOL(kedr_eh_on_memory_event);
+
+void
+kedr_mark_alloc(unsigned long tid, unsigned long pc, unsigned long addr,
+	unsigned long size)
+{
+	kedr_fresh_filter_alloc(tid, addr, size);
+	kedr_watch_filter_alloc(pc, addr, size);
+}
+EXPORT_SYMBOL(kedr_mark_alloc);
+
+void
+kedr_mark_free(unsigned long addr)
+{
+	kedr_fresh_filter_free(addr);
+	kedr_watch_filter_free(addr);
+}
+EXPORT_SYMBOL(kedr_mark_free);
 /* ====================================================================== */
 
 /* For each memory access event that could happen in the block, executes 
@@ -469,8 +610,7 @@ report_events(struct kedr_local_storage *ls, void *data)
  * Sampling is taken into account here, sampling counters are updated as 
  * needed. */
 static int
-should_report_events(struct kedr_local_storage *ls, 
-	struct kedr_block_info *info)
+should_report_events(unsigned long tindex, struct kedr_block_info *info)
 {
 	s32 num_to_skip;
 	u32 counter;
@@ -480,7 +620,7 @@ should_report_events(struct kedr_local_storage *ls,
 	if (sampling_rate == 0)
 		return 1; /* Sampling is disabled, report all events. */
 	
-	sc = &info->scounters[ls->tindex];
+	sc = &info->scounters[tindex];
 	
 	/* Find out how many times the events collected for the block should
 	 * still be discarded. Racy but OK as some inaccuracy of the 
@@ -509,8 +649,8 @@ kedr_on_common_block_end(unsigned long storage)
 	
 	void *data = NULL;
 	
-	if (should_report_events(ls, info)) {
-		kedr_eh_begin_memory_events(ls->tid, info->max_events, 
+	if (should_report_events(ls->tindex, info)) {
+		kedr_eh_begin_block_events(ls->tid, info, info->max_events,
 			&data);
 		report_events(ls, data);
 		kedr_eh_end_memory_events(ls->tid, data);
@@ -523,6 +663,45 @@ kedr_on_common_block_end(unsigned long storage)
 	ls->dest_addr = 0;
 }
 KEDR_DEFINE_WRAPPER(kedr_on_common_block_end);
+
+static __used void
+kedr_on_leaf_access(unsigned long pdata)
+{
+	struct kedr_leaf_access *la = (struct kedr_leaf_access *)pdata;
+	struct kedr_block_info *info = (struct kedr_block_info *)la->info;
+	unsigned long tid;
+	unsigned long tindex = 0;
+	enum kedr_memory_event_type type = KEDR_ET_MREAD;
+	void *data = NULL;
+	
+	/* There is no local storage to keep the thread ID and index, so 
+	 * obtain them here, the same way kedr_on_function_entry() does. */
+	if (kedr_thread_handle_changes() != 0)
+		return;
+	
+	tid = kedr_get_thread_id();
+	if (sampling_rate != 0)
+		tindex = kedr_get_tindex();
+	
+	if (!should_report_events(tindex, info))
+		return;
+	
+	kedr_eh_begin_block_events(tid, info, 1, &data);
+	
+	if (eh_current->on_memory_event != NULL) {
+		/* The access is unconditional, so the write mask of the
+		 * block is all we need. */
+		if (info->write_mask & 1) {
+			type = ((info->read_mask & 1) != 0) ? 
+				KEDR_ET_MUPDATE :
+				KEDR_ET_MWRITE;
+		}
+		eh_on_memory_event_impl(eh_current, tid, info->events[0].pc,
+			la->addr, info->events[0].size, type, data);
+	}
+	kedr_eh_end_memory_events(tid, data);
+}
+KEDR_DEFINE_WRAPPER(kedr_on_leaf_access);
 /* ====================================================================== */
 
 static __used void
@@ -532,6 +711,7 @@ kedr_on_locked_op_pre(unsigned long storage)
 		(struct kedr_local_storage *)storage;
 	struct kedr_block_info *info = (struct kedr_block_info *)ls->info;
 	
+	kedr_mark_release_point(ls->tid);
 	if (eh_current->on_locked_op_pre != NULL) {
 		ls->temp = 0;
 		eh_current->on_locked_op_pre(eh_current, ls->tid,
@@ -553,6 +733,7 @@ kedr_on_locked_op_post(unsigned long storage)
 	 *
 	 * [NB] A locked operation is not necessarily an update. For 
 	 * example, it can be a "read" in case of CMPXCHG*. */
+	kedr_mark_release_point(ls->tid);
 	if (eh_current->on_locked_op_post != NULL) {
 		u32 write_mask = info->write_mask | ls->write_mask;
 		enum kedr_memory_event_type type = KEDR_ET_MREAD;
@@ -582,6 +763,7 @@ kedr_on_io_mem_op_pre(unsigned long storage)
 		(struct kedr_local_storage *)storage;
 	struct kedr_block_info *info = (struct kedr_block_info *)ls->info;
 	
+	kedr_mark_release_point(ls->tid);
 	if (eh_current->on_io_mem_op_pre != NULL) {
 		ls->temp = 0;
 		eh_current->on_io_mem_op_pre(eh_current, ls->tid,
@@ -601,6 +783,7 @@ kedr_on_io_mem_op_post(unsigned long storage)
 	 * block is INS or OUTS, that is, a string operation of type X or Y
 	 * but not XY. It is either read or write but not update. */
 	
+	kedr_mark_release_point(ls->tid);
 	if (eh_current->on_io_mem_op_post != NULL) {
 		enum kedr_memory_event_type type = KEDR_ET_MREAD;
 		if (info->write_mask & 1)
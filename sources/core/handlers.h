@@ -106,6 +106,35 @@ kedr_fill_call_info(unsigned long ci);
  *   none. */
 KEDR_DECLARE_WRAPPER(kedr_on_common_block_end);
 
+/* The data for kedr_on_leaf_access(), prepared on the stack by the 
+ * instrumented code. */
+struct kedr_leaf_access
+{
+	/* The address of the block_info instance for the block containing
+	 * the memory access. */
+	unsigned long info;
+	
+	/* The address of the memory area to be accessed. */
+	unsigned long addr;
+};
+
+/* kedr_on_leaf_access
+ * Called before the only tracked memory operation of a function that has
+ * no local storage (see 'fast_leaf_functions' parameter in module.c). 
+ * Reports that memory operation the same way kedr_on_common_block_end()
+ * would report it: sampling is taken into account, begin_memory_events(),
+ * on_memory_event() and end_memory_events() handlers are called if set.
+ * 
+ * The memory operation must be the only one described by the block_info
+ * instance, it must not be a string operation and it must happen 
+ * unconditionally.
+ *
+ * Parameter:
+ *   unsigned long pdata - address of struct kedr_leaf_access instance.
+ * Return value:
+ *   none. */
+KEDR_DECLARE_WRAPPER(kedr_on_leaf_access);
+
 /* kedr_on_locked_op_pre
  * Called before the locked update operation. The operation is expected to 
  * be the only one in the block.
@@ -228,4 +257,17 @@ KEDR_DECLARE_WRAPPER(kedr_on_barrier_pre);
 KEDR_DECLARE_WRAPPER(kedr_on_barrier_post);
 /* ====================================================================== */
 
+/* Prepare and release the information about the static per-CPU areas 
+ * needed to filter out the accesses to these areas at runtime (see
+ * 'check_percpu_addresses' parameter in module.c). Nothing is prepared if
+ * these addresses need not be checked. 
+ * kedr_init_percpu_areas() returns 0 on success, a negative error code 
+ * on failure. */
+int
+kedr_init_percpu_areas(void);
+
+void
+kedr_cleanup_percpu_areas(void);
+/* ====================================================================== */
+
 #endif /* HANDLERS_H_1810_INCLUDED */
@@ -16,6 +16,7 @@
 #include <linux/errno.h>
 #include <linux/err.h>
 #include <linux/slab.h>
+#include <linux/string.h>
 #include <linux/vmalloc.h>
 #include <linux/hash.h>
 #include <linux/spinlock.h>
@@ -609,9 +610,11 @@ kedr_i13n_process_module(struct module *target)
 {
 	struct kedr_i13n *i13n;
 	struct kedr_ifunc *func;
+	unsigned int num_kind[KEDR_FUNC_I13N_NUM_KINDS];
 	int ret = 0;
 	
 	BUG_ON(target == NULL);
+	memset(&num_kind[0], 0, sizeof(num_kind));
 	
 	i13n = kzalloc(sizeof(*i13n), GFP_KERNEL);
 	if (i13n == NULL) 
@@ -665,10 +668,28 @@ kedr_i13n_process_module(struct module *target)
 	list_for_each_entry(func, &i13n->ifuncs, list) {
 		i13n->total_size += func->size;
 		i13n->total_i_size += func->i_size;
+		++num_kind[func->i13n_kind];
 	}
 	pr_info(KEDR_MSG_PREFIX "Total size of the functions before "
-		"instrumentation (bytes): %lu, after: %lu\n",
-		i13n->total_size, i13n->total_i_size);
+		"instrumentation (bytes): %lu, after: %lu%s\n",
+		i13n->total_size, i13n->total_i_size,
+		(shared_thunks ? " (shared thunks are used)" : ""));
+	
+	pr_info(KEDR_MSG_PREFIX "Memory accesses filtered out during "
+		"instrumentation: stack: %lu, frame: %lu, read-only data: "
+		"%lu, per-CPU data: %lu\n",
+		i13n->num_filtered[KEDR_FILTERED_STACK],
+		i13n->num_filtered[KEDR_FILTERED_FRAME],
+		i13n->num_filtered[KEDR_FILTERED_RODATA],
+		i13n->num_filtered[KEDR_FILTERED_PERCPU]);
+	
+	if (fast_leaf_functions) {
+		pr_info(KEDR_MSG_PREFIX "Functions instrumented fully: %u, "
+			"not instrumented: %u, leaf functions: %u\n",
+			num_kind[KEDR_FUNC_I13N_FULL], 
+			num_kind[KEDR_FUNC_I13N_NONE],
+			num_kind[KEDR_FUNC_I13N_LEAF]);
+	}
 	
 	ret = create_detour_buffer(i13n);
 	if (ret != 0)
@@ -10,6 +10,29 @@
 struct module;
 struct kedr_func_info;
 
+/* Kinds of the memory accesses that are filtered out at the instrumentation
+ * time, i.e. the corresponding instructions are not instrumented at all.
+ * See ir_filter_accesses() in ir.c. */
+enum kedr_filtered_kind
+{
+	/* The addressing expression uses %rsp/%esp. */
+	KEDR_FILTERED_STACK = 0,
+	
+	/* The addressing expression uses %rbp/%ebp only and the function 
+	 * uses it as a frame pointer. */
+	KEDR_FILTERED_FRAME,
+	
+	/* Reading from a fixed address in the read-only area of the target 
+	 * module (IP-relative or absolute addressing). */
+	KEDR_FILTERED_RODATA,
+	
+	/* Access to the per-CPU data of the current CPU via the segment 
+	 * register (%gs on x86-64, %fs or %gs on x86-32). */
+	KEDR_FILTERED_PERCPU,
+	
+	KEDR_FILTERED_NUM_KINDS
+};
+
 /* An instance of struct kedr_i13n contains everything related to the 
  * instrumentation of a particular kernel module ("instrumentation object"). 
  */
@@ -47,6 +70,11 @@ struct kedr_i13n
 	/* ...and of their instrumented instances. */
 	unsigned long total_i_size;
 	
+	/* Number of the memory accessing instructions filtered out at the
+	 * instrumentation time, for each kind (see enum kedr_filtered_kind).
+	 */
+	unsigned long num_filtered[KEDR_FILTERED_NUM_KINDS];
+	
 	/* A hash table that allows lookup of func_info objects by the 
 	 * addresses of the corresponding original functions. The table 
 	 * is created and maintained only if lookup is enabled. */
@@ -39,6 +39,27 @@ struct kedr_i13n;
  * passed there instead, and the fallback instance should operate as the 
  * original instance would. */
 
+/* How a function has been instrumented. */
+enum kedr_func_i13n_kind
+{
+	/* The usual instrumentation: the local storage is allocated on
+	 * entry to the function, the memory accesses are collected there
+	 * and reported at the ends of the blocks, etc. */
+	KEDR_FUNC_I13N_FULL = 0,
+	
+	/* The function neither calls other functions nor accesses memory
+	 * in a way to be tracked. It is not instrumented at all. */
+	KEDR_FUNC_I13N_NONE,
+	
+	/* The function does not call other functions and has only one
+	 * tracked memory access. That access is reported directly, the 
+	 * function is not given the local storage. */
+	KEDR_FUNC_I13N_LEAF,
+	
+	/* The number of the kinds, must go last. */
+	KEDR_FUNC_I13N_NUM_KINDS
+};
+
 /* This structure represents a function in the code of the loaded target
  * module. */
 struct kedr_ifunc
@@ -103,6 +124,10 @@ struct kedr_ifunc
 	 * These structures must live until this kedr_ifunc instance is
 	 * destroyed (they are used when the target module is working). */
 	struct list_head call_infos;
+	
+	/* How the function has been instrumented. The "leaf" kinds are 
+	 * used only if 'fast_leaf_functions' parameter is non-zero. */
+	enum kedr_func_i13n_kind i13n_kind;
 };
 
 struct kedr_ir_node;
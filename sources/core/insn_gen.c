@@ -702,6 +702,35 @@ kedr_mk_mov_value32_to_slot(u32 value32, u8 base, u32 offset,
 	return &node->list;
 }
 
+/* movl value32, <offset>(%base) */
+struct list_head *
+kedr_mk_mov_value32_to_mem32(u32 value32, u8 base, u32 offset, 
+	struct list_head *item, int in_place, int *err)
+{
+	struct kedr_ir_node *node;
+	u8 *pos;
+	
+	if (*err != 0)
+		return item;
+	
+	node = prepare_node(item, in_place, err);
+	if (node == NULL)
+		return item;
+	
+	pos = node->insn_buffer;
+	pos = write_rex_prefix(pos, 1, KEDR_REG_UNUSED, KEDR_REG_UNUSED, 
+		base);
+	*pos++ = 0xc7; /* opcode: C7/0 */
+	pos = write_modrm_expr(pos, base, 0, 0, (unsigned long)offset);
+	*(u32 *)pos = value32;
+	pos += 4;
+	
+	decode_insn_in_node(node);
+	BUG_ON(node->insn.length != 
+		(unsigned char)(pos - node->insn_buffer));
+	return &node->list;
+}
+
 /* mov value8, <offset>(%base) */
 struct list_head *
 kedr_mk_mov_value8_to_slot(u8 value8, u8 base, u32 offset, 
@@ -210,6 +210,15 @@ struct list_head *
 kedr_mk_mov_value32_to_slot(u32 value32, u8 base, u32 offset, 
 	struct list_head *item, int in_place, int *err);
 
+/* movl value32, <offset>(%base) 
+ * see c7 (Move imm32 to r/m32). 
+ * 
+ * Unlike kedr_mk_mov_value32_to_slot(), only 32 bits are written on 
+ * x86-64 too. */
+struct list_head *
+kedr_mk_mov_value32_to_mem32(u32 value32, u8 base, u32 offset, 
+	struct list_head *item, int in_place, int *err);
+
 /* mov value8, <offset>(%base) 
  * see c6 (Move imm8 to r/m8). */
 struct list_head *
@@ -835,10 +835,11 @@ is_tracked_memory_op(struct insn *insn)
 	if (insn_is_locked_op(insn))
 		return 1;
 	
+	/* The accesses to the stack and to the read-only data are filtered
+	 * out later, see ir_filter_accesses(). */
 	if (is_insn_type_e(insn) || is_insn_movbe(insn) || 
-	    is_insn_cmpxchg8b_16b(insn)) {
-	    	return (process_stack_accesses || !expr_uses_sp(insn));
-	}
+	    is_insn_cmpxchg8b_16b(insn))
+		return 1;
 	
 	if (is_insn_type_x(insn) || is_insn_type_y(insn))
 		return 1;
@@ -930,6 +931,303 @@ do_process_insn(struct kedr_ifunc *func, struct insn *insn, void *data)
 	return 0; 
 }
 
+/* Filtering of the memory accesses at the instrumentation time. 
+ * 
+ * Some of the memory accesses can be shown to be uninteresting without
+ * executing the code, so the corresponding instructions need not be 
+ * instrumented at all. This reduces both the overhead in runtime and the 
+ * number of events each block needs to report. Only the instructions of 
+ * type E and M (except the locked ones, which also act as barriers) are 
+ * considered here, as well as MOV with direct offset and XLAT for the 
+ * per-CPU accesses. The following accesses are filtered out:
+ * 
+ * - the accesses with %rsp/%esp in the addressing expression, unless 
+ *   process_stack_accesses is non-zero (KEDR_FILTERED_STACK);
+ * 
+ * - the accesses with %rbp/%ebp as the only register in the addressing 
+ *   expression if the function uses %rbp as a frame pointer, also unless
+ *   process_stack_accesses is non-zero (KEDR_FILTERED_FRAME, see 
+ *   ir_uses_frame_pointer());
+ *
+ * - reading from a fixed address (IP-relative or plain disp32 addressing)
+ *   in the read-only part of the "core" or "init" area of the target,
+ *   unless process_ro_accesses is non-zero (KEDR_FILTERED_RODATA). 
+ *   Nothing writes there, so such accesses cannot race with anything;
+ *
+ * - the accesses with the segment override prefix of the per-CPU segment,
+ *   unless process_percpu_accesses is non-zero (KEDR_FILTERED_PERCPU, see
+ *   insn_is_percpu_access()). These are this_cpu_*() operations and the
+ *   like, the data they access belong to the current CPU. */
+
+#ifdef CONFIG_X86_64
+/* The only prefix "mov %rsp, %rbp" has in the function prologues. */
+# define KEDR_FRAME_MOV_REX 0x48
+#else
+# define KEDR_FRAME_MOV_REX 0x0
+#endif
+
+/* "push %rbp", "pop %rbp" and "leave" (opcodes 55, 5D and C9), without 
+ * prefixes. */
+static int
+is_insn_push_bp(struct insn *insn)
+{
+	return (insn->opcode.bytes[0] == 0x55 && 
+		insn->prefixes.nbytes == 0 && 
+		insn->rex_prefix.nbytes == 0);
+}
+
+static int
+is_insn_pop_bp_or_leave(struct insn *insn)
+{
+	u8 opcode = insn->opcode.bytes[0];
+	return ((opcode == 0x5d || opcode == 0xc9) && 
+		insn->prefixes.nbytes == 0 && 
+		insn->rex_prefix.nbytes == 0);
+}
+
+/* "mov %rsp, %rbp" (89 E5 or 8B EC, with REX.W on x86-64) */
+static int
+is_insn_mov_sp_to_bp(struct insn *insn)
+{
+	u8 opcode = insn->opcode.bytes[0];
+	u8 modrm = insn->modrm.bytes[0];
+	
+	if (insn->prefixes.nbytes != 0 || 
+	    insn->rex_prefix.value != KEDR_FRAME_MOV_REX)
+		return 0;
+	return ((opcode == 0x89 && modrm == 0xe5) || 
+		(opcode == 0x8b && modrm == 0xec));
+}
+
+/* Near return (C3, C2) */
+static int
+is_insn_ret_near(struct insn *insn)
+{
+	u8 opcode = insn->opcode.bytes[0];
+	return (opcode == 0xc3 || opcode == 0xc2);
+}
+
+/* Nonzero if the node may follow "pop %rbp" or "leave" in a function using
+ * %rbp as a frame pointer: a near return, a direct jump out of the function
+ * (a tail call) or a direct jump to a near return. */
+static int
+is_node_frame_exit(struct kedr_ir_node *node)
+{
+	u8 opcode = node->insn.opcode.bytes[0];
+	
+	if (is_insn_ret_near(&node->insn))
+		return 1;
+	
+	if (opcode != 0xe9 && opcode != 0xeb)
+		return 0;
+	
+	return (node->dest_inner == NULL || 
+		is_insn_ret_near(&node->dest_inner->insn));
+}
+
+/* Nonzero if the instruction may use %rbp in some way other than in the 
+ * addressing expression of its memory operand, 0 otherwise. */
+static int
+insn_uses_bp_not_in_expr(struct insn *insn)
+{
+	unsigned int bp_mask = X86_REG_MASK(INAT_REG_CODE_BP);
+	insn_attr_t *attr = &insn->attr;
+	
+	if (!(insn_reg_mask(insn) & bp_mask))
+		return 0;
+	
+	/* Register operand or no Mod R/M at all: %rbp is used directly. */
+	if (!inat_has_modrm(attr) || 
+	    X86_MODRM_MOD(insn->modrm.value) == 3)
+		return 1;
+	
+	return ((inat_reg_usage_attribute(attr) | 
+		insn_reg_mask_reg(insn)) & bp_mask);
+}
+
+/* Nonzero if the function provably uses %rbp as a frame pointer, that is, 
+ * %rbp points to the stack frame of the function whenever it is used in 
+ * an addressing expression. 0 is returned if it is not known.
+ *
+ * The following is checked:
+ * - only direct calls (e.g. to __fentry__) and no-ops may precede the 
+ *   prologue, "push %rbp; mov %rsp, %rbp", and these do not use %rbp;
+ * - after the prologue, %rbp is not changed except by "pop %rbp" and 
+ *   "leave", and each of these is immediately followed by a return, a 
+ *   jump to a return or a jump out of the function; 
+ * - %rbp is not used other than in the addressing expressions, so its 
+ *   value does not escape to other registers. */
+static int
+ir_uses_frame_pointer(struct list_head *ir)
+{
+	struct kedr_ir_node *node;
+	struct kedr_ir_node *prev = NULL;
+	int in_prologue = 1;
+	
+	list_for_each_entry(node, ir, list) {
+		struct insn *insn = &node->insn;
+		
+		if (prev != NULL && is_insn_pop_bp_or_leave(&prev->insn) &&
+		    !is_node_frame_exit(node))
+			return 0;
+		
+		if (in_prologue) {
+			if (is_insn_mov_sp_to_bp(insn)) {
+				if (prev == NULL || 
+				    !is_insn_push_bp(&prev->insn))
+					return 0;
+				in_prologue = 0;
+			}
+			else if (is_insn_push_bp(insn)) {
+				if (prev != NULL && 
+				    is_insn_push_bp(&prev->insn))
+					return 0;
+			}
+			else if (!is_insn_call_rel32(insn) && 
+				 !insn_is_noop(insn)) {
+				return 0;
+			}
+			else if (prev != NULL && 
+				 is_insn_push_bp(&prev->insn)) {
+				return 0;
+			}
+		}
+		else if (is_insn_push_bp(insn) || 
+			 (!is_insn_pop_bp_or_leave(insn) && 
+			  insn_uses_bp_not_in_expr(insn))) {
+			return 0;
+		}
+		prev = node;
+	}
+	
+	/* The last instruction must not be "pop %rbp" or "leave" either. */
+	if (prev != NULL && is_insn_pop_bp_or_leave(&prev->insn))
+		return 0;
+	
+	return !in_prologue;
+}
+
+/* Nonzero if the instruction has a segment override prefix %fs or %gs. 
+ * The addresses are not what they seem for such instructions. */
+static int
+insn_has_fs_gs_prefix(struct insn *insn)
+{
+	return (insn_has_prefix(insn, 0x64) || insn_has_prefix(insn, 0x65));
+}
+
+/* Nonzero if the instruction accesses the per-CPU data of the current CPU
+ * via the segment register, i.e. it has the segment override prefix %gs on
+ * x86-64 or %fs on x86-32. On x86-32, %gs is also used for the per-CPU 
+ * data: the stack canary (if the stack protector is enabled) is accessed 
+ * via %gs there.
+ *
+ * [NB] The address of such access computed by the instrumented code is the
+ * offset in the per-CPU area rather than the real address, because the 
+ * base of the segment is not taken into account. */
+static int
+insn_is_percpu_access(struct insn *insn)
+{
+#ifdef CONFIG_X86_64
+	return insn_has_prefix(insn, 0x65);
+#else
+	return insn_has_fs_gs_prefix(insn);
+#endif
+}
+
+/* If the instruction refers to memory at a fixed address, that is, uses 
+ * IP-relative addressing or plain disp32 without registers, returns that 
+ * address. Returns 0 otherwise. */
+static unsigned long
+insn_fixed_mem_addr(struct kedr_ir_node *node)
+{
+	struct insn *insn = &node->insn;
+	
+	if (insn_has_prefix(insn, 0x67) || insn_has_fs_gs_prefix(insn))
+		return 0;
+	
+#ifdef CONFIG_X86_64
+	if (insn_rip_relative(insn))
+		return node->iprel_addr;
+#endif
+	if (X86_MODRM_MOD(insn->modrm.value) == 3 ||
+	    insn_reg_mask_for_expr(insn) != X86_REG_MASK_NONE)
+		return 0;
+	
+	return X86_SIGN_EXTEND_V32(insn->displacement.value);
+}
+
+/* Returns the kind of filtering applicable to the access made by the 
+ * instruction in the node (enum kedr_filtered_kind), 
+ * KEDR_FILTERED_NUM_KINDS if the access must be tracked. */
+static int
+get_filtered_kind(struct kedr_ir_node *node, struct module *mod, 
+	int uses_fp)
+{
+	struct insn *insn = &node->insn;
+	unsigned int expr_reg_mask;
+	unsigned long addr;
+	
+	if (!node->is_tracked_mem_op || insn_is_locked_op(insn))
+		return KEDR_FILTERED_NUM_KINDS;
+	
+	/* "mov %fs:<offset>, %eax" and the like are common on x86-32, so
+	 * the direct offset MOVs are checked here too. The string 
+	 * operations are not: the segment override prefix applies to only
+	 * one of their operands. */
+	if (!process_percpu_accesses && !node->is_string_op && 
+	    insn_is_percpu_access(insn))
+		return KEDR_FILTERED_PERCPU;
+	
+	if (!is_insn_type_e(insn) && !is_insn_movbe(insn) && 
+	    !is_insn_cmpxchg8b_16b(insn))
+		return KEDR_FILTERED_NUM_KINDS;
+	
+	if (!process_stack_accesses) {
+		if (expr_uses_sp(insn))
+			return KEDR_FILTERED_STACK;
+		
+		expr_reg_mask = insn_reg_mask_for_expr(insn);
+		if (uses_fp && 
+		    expr_reg_mask == X86_REG_MASK(INAT_REG_CODE_BP) &&
+		    X86_MODRM_MOD(insn->modrm.value) != 3 &&
+		    !insn_has_prefix(insn, 0x67) && 
+		    !insn_has_fs_gs_prefix(insn))
+			return KEDR_FILTERED_FRAME;
+	}
+	
+	if (!process_ro_accesses && !insn_is_mem_write(insn)) {
+		addr = insn_fixed_mem_addr(node);
+		if (addr != 0 && kedr_is_ro_address(addr, mod))
+			return KEDR_FILTERED_RODATA;
+	}
+	return KEDR_FILTERED_NUM_KINDS;
+}
+
+/* Marks the memory accesses that can be filtered out as not tracked and 
+ * updates the statistics in 'i13n'. Must be called after the jumps within
+ * the function have been linked to their destinations but before the short
+ * jumps are processed and the blocks are created. */
+static void
+ir_filter_accesses(struct list_head *ir, struct kedr_i13n *i13n)
+{
+	struct kedr_ir_node *node;
+	int uses_fp = 0;
+	int kind;
+	
+	if (!process_stack_accesses)
+		uses_fp = ir_uses_frame_pointer(ir);
+	
+	list_for_each_entry(node, ir, list) {
+		kind = get_filtered_kind(node, i13n->target, uses_fp);
+		if (kind == KEDR_FILTERED_NUM_KINDS)
+			continue;
+		
+		node->is_tracked_mem_op = 0;
+		++i13n->num_filtered[kind];
+	}
+}
+/* ====================================================================== */
+
 /* For each direct jump within the function, link its node in the IR to the 
  * node corresponding to the destination. */
 static int
@@ -2092,6 +2390,8 @@ kedr_ir_create(struct kedr_ifunc *func, struct kedr_i13n *i13n,
 	if (ret != 0)
 		goto out;
 	
+	ir_filter_accesses(ir, i13n);
+	
 	/* [NB] list_for_each_entry_safe() should also be safe w.r.t. the 
 	 * addition of the nodes, not only against removal. 
 	 * ir_node_process_short_jumps() may add new nodes before and after
@@ -2326,6 +2626,154 @@ is_simple_function_exit(struct insn *insn)
 	return 0;
 }
 
+/* Returns the mask of the registers the instruction overwrites completely
+ * without reading their values first. Only the most common instructions
+ * are recognized here (MOV, LEA, MOVZX/MOVSX, POP, zeroing with XOR/SUB),
+ * for the remaining ones the function returns 0. That is, the result may
+ * miss some such registers but it never contains the registers the 
+ * instruction reads.
+ * 
+ * [NB] Only 32- and 64-bit destinations are considered: writing to an 8- 
+ * or 16-bit part of a register leaves the rest of it unchanged. On 
+ * x86-64, writing to a 32-bit register zeroes the higher 32 bits. */
+static unsigned int
+insn_kill_mask(struct insn *insn)
+{
+	u8 *opcode = insn->opcode.bytes;
+	u8 modrm = insn->modrm.bytes[0];
+	u8 rex = insn->rex_prefix.bytes[0]; /* always 0 on x86-32 */
+	unsigned int reg = X86_MODRM_REG(modrm);
+	unsigned int rm = X86_MODRM_RM(modrm);
+	unsigned int src_mask;
+	unsigned int dest;
+	
+	if (X86_REX_R(rex))
+		reg += 8;
+	if (X86_REX_B(rex))
+		rm += 8;
+	
+	if (insn->opnd_bytes < 4)
+		return 0;
+	
+	/* POP %reg */
+	if (opcode[0] >= 0x58 && opcode[0] <= 0x5f) {
+		dest = opcode[0] - 0x58;
+		if (X86_REX_B(rex))
+			dest += 8;
+		return X86_REG_MASK(dest) & ~X86_REG_MASK(INAT_REG_CODE_SP);
+	}
+	
+	/* MOV imm32/imm64, %reg */
+	if (opcode[0] >= 0xb8 && opcode[0] <= 0xbf) {
+		dest = opcode[0] - 0xb8;
+		if (X86_REX_B(rex))
+			dest += 8;
+		return X86_REG_MASK(dest) & ~X86_REG_MASK(INAT_REG_CODE_SP);
+	}
+	
+	/* The remaining instructions have Mod R/M. */
+	if (!inat_has_modrm(&insn->attr))
+		return 0;
+	
+	switch (opcode[0]) {
+	case 0x8b: /* MOV Ev, Gv */
+	case 0x8d: /* LEA M, Gv */
+#ifdef CONFIG_X86_64
+	/* On x86-32, 0x63 is ARPL Ew, Gw, it writes to its r/m operand. */
+	case 0x63: /* MOVSXD Ed, Gv */
+#endif
+		dest = reg;
+		src_mask = insn_reg_mask_for_expr(insn);
+		break;
+	case 0x0f:
+		/* MOVZX, MOVSX */
+		if (opcode[1] != 0xb6 && opcode[1] != 0xb7 && 
+		    opcode[1] != 0xbe && opcode[1] != 0xbf)
+			return 0;
+		dest = reg;
+		src_mask = insn_reg_mask_for_expr(insn);
+		break;
+	case 0x89: /* MOV Gv, Ev */
+		if (X86_MODRM_MOD(modrm) != 3)
+			return 0;
+		dest = rm;
+		src_mask = X86_REG_MASK(reg);
+		break;
+	case 0xc7: /* MOV imm32, Ev */
+		if (X86_MODRM_MOD(modrm) != 3 || X86_MODRM_REG(modrm) != 0)
+			return 0;
+		dest = rm;
+		src_mask = 0;
+		break;
+	case 0x29: /* SUB %reg, %reg */
+	case 0x2b:
+	case 0x31: /* XOR %reg, %reg */
+	case 0x33:
+		if (X86_MODRM_MOD(modrm) != 3 || reg != rm)
+			return 0;
+		dest = reg;
+		src_mask = 0;
+		break;
+	default:
+		return 0;
+	}
+	
+	if (src_mask & X86_REG_MASK(dest))
+		return 0;
+	return X86_REG_MASK(dest) & ~X86_REG_MASK(INAT_REG_CODE_SP);
+}
+
+/* Finds the registers that are dead before each reference node (see 
+ * 'dead_mask' in struct kedr_ir_node) and marks the nodes control can be
+ * transferred to by jumps. 
+ * 
+ * The analysis is done backwards, within the straight-line parts of the
+ * code only: a control transfer instruction or a node added during the 
+ * instrumentation makes all registers live. This is conservative but 
+ * covers the common case: a register loaded from memory after being used
+ * in the address expressions of the preceding instructions, etc.
+ * 
+ * Must be called after 'reg_mask' has been set for each node (see 
+ * ir_choose_base_register()) but before the instrumentation adds new 
+ * nodes. */
+static void
+ir_find_dead_registers(struct list_head *ir)
+{
+	struct kedr_ir_node *node;
+	unsigned int dead = 0;
+	
+	list_for_each_entry_reverse(node, ir, list) {
+		unsigned int kill_mask;
+		
+		if (!is_reference_node(node) || node->dest_addr != 0 ||
+		    is_simple_function_exit(&node->insn)) {
+			/* Control transfer or something unknown. */
+			dead = 0;
+			continue;
+		}
+		
+		kill_mask = insn_kill_mask(&node->insn);
+		dead = (dead | kill_mask) & ~(node->reg_mask & ~kill_mask);
+		node->dead_mask = dead & X86_REG_MASK_ALL;
+	}
+	
+	list_for_each_entry(node, ir, list) {
+		if (node->block_starts)
+			node->is_jump_dest = 1;
+		
+		if (node->dest_inner == NULL)
+			continue;
+		
+		node->dest_inner->is_jump_dest = 1;
+		
+		/* Such jumps lead to the node following the destination. */
+		if (node->jump_past_last && 
+		    !list_is_last(&node->dest_inner->list, ir))
+			list_entry(node->dest_inner->list.next, 
+				struct kedr_ir_node, list)->is_jump_dest = 1;
+	}
+}
+
 /* Instrument the instruction in the given node. The instruction is assumed 
  * to perform a tracked memory operation. 
  * '*num' is the number of the instruction in the block (can be needed to set
@@ -2523,6 +2971,101 @@ instrument_io_mem_op_block(struct kedr_ir_node *start, u8 base)
 	return kedr_handle_io_mem_op(start, base);
 }
 
+/* Returns non-zero if the block starting with 'start' may appear in a
+ * function that is not given the local storage, 0 otherwise. */
+static int
+is_block_allowed_in_leaf(struct kedr_ir_node *start)
+{
+	switch (start->cb_type) {
+	case KEDR_CB_JUMP_BACKWARDS:
+	case KEDR_CB_COMMON_NO_MEM_OPS:
+	case KEDR_CB_COMMON:
+	case KEDR_CB_JUMP_INDIRECT_INNER:
+		return 1;
+	case KEDR_CB_CONTROL_OUT_OTHER:
+		/* Only RET and the like are OK here, the function must not
+		 * pass control elsewhere. */
+		return is_simple_function_exit(&start->insn);
+	default:
+		/* Calls and jumps out of the function, locked operations,
+		 * I/O operations and memory barriers need the local 
+		 * storage. */
+		return 0;
+	}
+}
+
+/* Determines how the function should be instrumented, see enum 
+ * kedr_func_i13n_kind. If 'fast_leaf_functions' is 0, the result is always
+ * KEDR_FUNC_I13N_FULL.
+ * 
+ * For KEDR_FUNC_I13N_LEAF, '*leaf_node' will be the node containing the 
+ * tracked memory operation and '*leaf_info' - the block_info instance for
+ * the block containing it. */
+static enum kedr_func_i13n_kind
+ir_choose_i13n_kind(struct kedr_ifunc *func, struct list_head *ir,
+	struct kedr_ir_node **leaf_node, struct kedr_block_info **leaf_info)
+{
+	struct kedr_ir_node *node;
+	struct kedr_ir_node *start = NULL;
+	struct kedr_ir_node *tracked = NULL;
+	struct kedr_ir_node *tracked_start = NULL;
+	struct module *mod = func->info.owner;
+	
+	if (!fast_leaf_functions)
+		return KEDR_FUNC_I13N_FULL;
+	
+	/* The init and exit functions of the target always need the entry
+	 * and exit handling: the handlers for these are set by the core 
+	 * itself (see i13n.c). */
+	if (mod != NULL && 
+	    (func->info.addr == (unsigned long)mod->init || 
+	     func->info.addr == (unsigned long)mod->exit))
+		return KEDR_FUNC_I13N_FULL;
+	
+	list_for_each_entry(node, ir, list) {
+		if (node->block_starts) {
+			if (!is_block_allowed_in_leaf(node))
+				return KEDR_FUNC_I13N_FULL;
+			start = node;
+		}
+		
+		if (node->call_info != NULL)
+			return KEDR_FUNC_I13N_FULL;
+		
+		if (!node->is_tracked_mem_op)
+			continue;
+		
+		if (tracked != NULL)
+			return KEDR_FUNC_I13N_FULL;
+		tracked = node;
+		tracked_start = start;
+	}
+	
+	if (tracked == NULL)
+		return KEDR_FUNC_I13N_NONE;
+	
+	/* Only the simple cases are handled: the access happens 
+	 * unconditionally and its address can be obtained with LEA before 
+	 * the instruction. */
+	BUG_ON(tracked_start == NULL);
+	if (tracked_start->cb_type != KEDR_CB_COMMON || 
+	    tracked_start->block_info == NULL ||
+	    tracked_start->block_info->max_events != 1 ||
+	    !is_insn_type_e(&tracked->insn) ||
+	    is_insn_cmpxchg(&tracked->insn) || 
+	    is_insn_cmpxchg8b_16b(&tracked->insn) ||
+	    is_insn_setcc(&tracked->insn) ||
+	    is_insn_cmovcc(&tracked->insn) ||
+	    is_insn_push_ev(&tracked->insn) ||
+	    is_insn_pop_ev(&tracked->insn) ||
+	    expr_uses_sp(&tracked->insn))
+		return KEDR_FUNC_I13N_FULL;
+	
+	*leaf_node = tracked;
+	*leaf_info = tracked_start->block_info;
+	return KEDR_FUNC_I13N_LEAF;
+}
+
 int 
 kedr_ir_instrument(struct kedr_ifunc *func, struct list_head *ir)
 {
@@ -2530,17 +3073,28 @@ kedr_ir_instrument(struct kedr_ifunc *func, struct list_head *ir)
 	u8 base;
 	struct kedr_ir_node *node;
 	struct kedr_ir_node *tmp;
+	struct kedr_ir_node *leaf_node = NULL;
+	struct kedr_block_info *leaf_info = NULL;
 	
 	/* Consistency check */
 	BUILD_BUG_ON(KEDR_X86_REG_COUNT != X86_REG_COUNT);
 	
 	BUG_ON(ir == NULL);
 	
+	func->i13n_kind = ir_choose_i13n_kind(func, ir, &leaf_node, 
+		&leaf_info);
+	if (func->i13n_kind == KEDR_FUNC_I13N_NONE)
+		return 0;
+	if (func->i13n_kind == KEDR_FUNC_I13N_LEAF)
+		return kedr_handle_leaf_access(leaf_node, leaf_info);
+	
 	ret = ir_choose_base_register(func, ir);
 	if (ret < 0)
 		return ret;
 	base = (u8)ret;
 	
+	ir_find_dead_registers(ir);
+	
 	/* Phase 1:
 	 * - handle the instructions that use the base register and 
 	 *   "release" it;
@@ -208,6 +208,24 @@ struct kedr_ir_node
 	 * general-purpose registers. */
 	unsigned int reg_mask;
 	
+	/* The registers that are "dead" right before the instruction: the
+	 * instruction does not use them and, on each path from here, they
+	 * are overwritten before they are read. The code inserted before 
+	 * the instruction may use such registers without saving and 
+	 * restoring their values. Meaningful only for the reference nodes.
+	 * Default value: 0 (no registers are known to be dead). */
+	unsigned int dead_mask;
+	
+	/* Meaningful only for the reference nodes of the tracked memory 
+	 * operations. If the work register used to record the address of 
+	 * the accessed memory is restored from its spill slot right before
+	 * the instruction, 'wreg_reload' is the node restoring it and 
+	 * 'wreg' is the code of that register. 'wreg_reload' is NULL 
+	 * otherwise. The instrumentation of the next instruction may use 
+	 * this to avoid saving and restoring the same register again. */
+	struct kedr_ir_node *wreg_reload;
+	u8 wreg;
+	
 	/* Meaningful only if the instruction is a memory barrier. */
 	enum kedr_barrier_type barrier_type;
 		
@@ -244,6 +262,12 @@ struct kedr_ir_node
 	 * should be reported). */
 	unsigned int is_tracked_mem_op : 1;
 	
+	/* Nonzero if control may be transferred to the node by a jump 
+	 * other than the fallthrough from the previous instruction. 
+	 * The starting nodes of the blocks are considered as such too. 
+	 * Default value: 0. */
+	unsigned int is_jump_dest : 1;
+	
 	/* Nonzero if the node corresponds to a string operation. */
 	unsigned int is_string_op : 1;
 	
@@ -41,18 +41,25 @@
 #include <kedr/kedr_mem/core_api.h>
 #include <kedr/kedr_mem/local_storage.h>
 #include <kedr/kedr_mem/functions.h>
+#include <kedr/kedr_mem/block_info.h>
 
 #include "config.h"
 #include "core_impl.h"
 
 #include "module_ms_alloc.h"
 #include "i13n.h"
+#include "ifunc.h"
 #include "hooks.h"
 #include "tid.h"
 #include "util.h"
 #include "resolve_ip.h"
 #include "fh_impl.h"
 #include "target.h"
+#include "handlers.h"
+#include "dup_filter.h"
+#include "fresh_filter.h"
+#include "watch_filter.h"
+#include "shadow_stack.h"
 /* ====================================================================== */
 
 MODULE_AUTHOR("Eugene A. Shatokhin");
@@ -87,7 +94,8 @@ module_param(umh_dir, charp, S_IRUGO);*/
 /* This parameter controls whether to track memory accesses that actually
  * read and/or modify data on stack. Namely, if this parameter is zero,
  * - the instructions of type E and M that refer to memory relative to %rsp
- * are not tracked;
+ * are not tracked, as well as those that refer to memory relative to %rbp
+ * in the functions using %rbp as a frame pointer;
  * - the memory events may also be filtered out in runtime if the
  * corresponding instructions access the stack only (even if not using %rsp-
  * based addressing).
@@ -104,6 +112,37 @@ module_param(process_stack_accesses, int, S_IRUGO);
 int process_um_accesses = 0;
 module_param(process_um_accesses, int, S_IRUGO);
 
+/* This parameter controls whether to report reading from the read-only 
+ * areas of the target module (code and read-only data). If it is 0, the 
+ * instructions of type E and M reading from a fixed address (IP-relative or
+ * absolute addressing) in these areas are not tracked. Nothing writes 
+ * there, so such accesses cannot be involved in races. */
+int process_ro_accesses = 0;
+module_param(process_ro_accesses, int, S_IRUGO);
+
+/* This parameter controls whether to report the accesses to the per-CPU 
+ * data of the current CPU made via the segment register, like this_cpu_*()
+ * operations do (%gs on x86-64, %fs on x86-32). If it is 0, the 
+ * instructions of type E and M and the direct offset MOVs with the 
+ * corresponding segment override prefix are not tracked. The data they 
+ * access are local to the CPU, so the threads executing on different CPUs
+ * cannot race there. Note that if such accesses are reported, the offsets
+ * of the data in the per-CPU area are reported instead of the real 
+ * addresses. */
+int process_percpu_accesses = 0;
+module_param(process_percpu_accesses, int, S_IRUGO);
+
+/* If this parameter is non-zero and process_percpu_accesses is 0, the 
+ * addresses of the memory accesses are also checked at runtime and the 
+ * accesses to the static per-CPU areas of the kernel and of the modules 
+ * are not reported, no matter which instructions perform them 
+ * (per_cpu_ptr(), this_cpu_ptr(), etc.). The per-CPU memory allocated 
+ * with alloc_percpu() is not checked this way. The check costs a binary
+ * search among the per-CPU areas for each memory access, so it is 
+ * disabled by default. */
+int check_percpu_addresses = 0;
+module_param(check_percpu_addresses, int, S_IRUGO);
+
 /* This parameter controls sampling technique used when reporting memory
  * accesses made in the common blocks.
  *
@@ -146,6 +185,92 @@ module_param(sampling_rate, uint, S_IRUGO);
  * handling subsystem (see tid.c), in milliseconds. */
 unsigned int gc_msec = 2000;
 module_param(gc_msec, uint, S_IRUGO);
+
+/* If this parameter is non-zero, the functions that cannot call other
+ * functions and contain at most one memory access to be tracked are not
+ * given the local storage. Such a function gets no function entry and exit
+ * code at all, the only memory access it may perform is reported directly
+ * before it is executed (see kedr_handle_leaf_access()). This reduces the
+ * overhead for small "leaf" functions like getters and setters
+ * significantly.
+ *
+ * The price is that "function entry" and "function exit" events are not
+ * reported for these functions, and the pre- and post- handlers set for
+ * them with kedr_set_func_handlers() are never called. The latter may be
+ * important for the callbacks the function handling plugins rely upon, so
+ * this parameter is 0 by default. */
+int fast_leaf_functions = 0;
+module_param(fast_leaf_functions, int, S_IRUGO);
+
+/* If nonzero, the code sequences for the ends of the blocks and for the
+ * calls and jumps out of the functions are not inserted into the 
+ * instrumented code each time. Instead, the instrumented code stores the
+ * pointer to the needed data in the local storage and calls one of the 
+ * shared thunks (see thunks_*.S). This makes the instrumented code 
+ * considerably smaller, which is good for the instruction cache if the 
+ * target has a lot of code, at the cost of a call and a return for each 
+ * of these sequences. The sizes of the code are reported when the target
+ * is loaded, so the two modes can be compared. */
+int shared_thunks = 0;
+module_param(shared_thunks, int, S_IRUGO);
+
+/* If nonzero, a memory access is not reported if the same thread has 
+ * already made the same access (the same address, size and type) since 
+ * its last synchronization point: locking and unlocking, signal and wait, 
+ * a locked operation, a memory barrier, thread creation and join, etc. 
+ * Allocation and deallocation of memory are the synchronization points 
+ * for all threads. A happens-before race detector gains nothing from such
+ * repeated accesses but they are common in the loops. 
+ *
+ * The accesses are remembered in small per-CPU hash tables (see 
+ * dup_filter.h), so some of the repeated accesses may still be reported.
+ * The number of the accesses checked and filtered out is available in 
+ * "dup_accesses_total" and "dup_accesses_filtered" files in debugfs.
+ *
+ * [NB] The plugins that report synchronization events calling the event
+ * handlers directly rather than via kedr_eh_*() functions must call 
+ * kedr_mark_sync_point() for them, see core_api.h. */
+int filter_repeated_accesses = 0;
+module_param(filter_repeated_accesses, int, S_IRUGO);
+
+/* If 1, the accesses of a thread to the objects it has just allocated are
+ * not reported until the object is published: until the thread performs 
+ * a "release" operation (unlock, signal, a locked operation, a memory 
+ * barrier, thread creation, etc.), until the object is freed or until 
+ * another thread accesses it. Such accesses cannot race with anything.
+ * Only a limited number of the most recently allocated objects is tracked
+ * (see fresh_filter.h).
+ *
+ * If 2, the accesses are reported as usual but the ones that would be 
+ * filtered out are also logged (rate-limited), to validate the filter.
+ *
+ * The number of such accesses and the number of the objects accessed by
+ * other threads before they have been published by their owners are 
+ * available in "fresh_accesses_filtered" and "fresh_objects_escaped" 
+ * files in debugfs.
+ *
+ * [NB] The plugins that report allocations, deallocations and the 
+ * synchronization events calling the event handlers directly rather than
+ * via kedr_eh_*() functions must call kedr_mark_alloc(), kedr_mark_free()
+ * and kedr_mark_release_point() for them, see core_api.h. */
+int filter_fresh_objects = 0;
+module_param(filter_fresh_objects, int, S_IRUGO);
+
+/* If nonzero, the core maintains the shadow call stack for each thread 
+ * executing the code of the targets and assigns a unique ID to each call
+ * stack (see shadow_stack.h). The providers of the event handlers may use
+ * kedr_get_stack_id() and kedr_get_stack_frame() to obtain the call stacks
+ * for the events without recording function entry/exit and call events 
+ * (see core_api.h). The number of the call stacks seen in the current 
+ * session and the number of the stacks truncated because there was no 
+ * room for them are available in "stacks_total" and "stacks_truncated"
+ * files in debugfs. 
+ *
+ * [NB] The small leaf functions do not get the frames in the shadow 
+ * stacks if 'fast_leaf_functions' is nonzero, the events from these
+ * functions are attributed to their callers. */
+int shadow_call_stacks = 0;
+module_param(shadow_call_stacks, int, S_IRUGO);
 /* ====================================================================== */
 
 /* An structure that identifies an analysis session for the target module. 
@@ -185,6 +310,10 @@ struct kedr_session
 	 * modules will not be processed until the core of our system is 
 	 * reloaded. */
 	int is_broken;
+	
+	/* The ID to be assigned to the next block of code, see 'id' in 
+	 * struct kedr_block_info. */
+	unsigned long next_block_id;
 };
 
 /* The session object. */
@@ -211,6 +340,44 @@ size_t blocks_skipped = 0;
 /* Files for these counters in debugfs. */
 static struct dentry *blocks_total_file = NULL;
 static struct dentry *blocks_skipped_file = NULL;
+
+/* Total number of memory accesses checked by the filter of the repeated
+ * accesses and the number of the accesses filtered out (see 
+ * 'filter_repeated_accesses' parameter). The same rules apply to these
+ * counters as to the ones above. */
+size_t dup_accesses_total = 0;
+size_t dup_accesses_filtered = 0;
+
+static struct dentry *dup_accesses_total_file = NULL;
+static struct dentry *dup_accesses_filtered_file = NULL;
+
+/* The number of the accesses to the unpublished fresh objects filtered out
+ * (or that would be filtered out in the validation mode) and the number of
+ * the fresh objects accessed by other threads before they have been 
+ * published (see 'filter_fresh_objects' parameter). The same rules apply 
+ * to these counters as to the ones above. */
+size_t fresh_accesses_filtered = 0;
+size_t fresh_objects_escaped = 0;
+
+static struct dentry *fresh_accesses_filtered_file = NULL;
+static struct dentry *fresh_objects_escaped_file = NULL;
+
+/* The number of the accesses filtered out because of the address ranges
+ * specified in "watch" file in debugfs (see watch_filter.h). The same 
+ * rules apply to this counter as to the ones above. */
+size_t watch_accesses_filtered = 0;
+
+static struct dentry *watch_accesses_filtered_file = NULL;
+
+/* The number of the call stacks in the depot and the number of the stacks
+ * truncated because the depot was full (see 'shadow_call_stacks' 
+ * parameter). The same rules apply to these counters as to the ones 
+ * above. */
+size_t stacks_total = 0;
+size_t stacks_truncated = 0;
+
+static struct dentry *stacks_total_file = NULL;
+static struct dentry *stacks_truncated_file = NULL;
 /* ====================================================================== */
 
 static struct kedr_event_handlers *eh_default = NULL;
@@ -784,9 +951,21 @@ session_start(void)
 	kedr_eh_on_session_start();
 	kedr_fh_on_session_start();
 	kedr_thread_handling_start();
+	kedr_dup_filter_start();
+	kedr_fresh_filter_start();
+	kedr_watch_filter_start();
+	kedr_shadow_stack_start();
 	
 	blocks_total = 0;
 	blocks_skipped = 0;
+	dup_accesses_total = 0;
+	dup_accesses_filtered = 0;
+	fresh_accesses_filtered = 0;
+	fresh_objects_escaped = 0;
+	watch_accesses_filtered = 0;
+	stacks_total = 0;
+	stacks_truncated = 0;
+	session.next_block_id = 1;
 	return 0;
 }
 
@@ -888,6 +1067,24 @@ static inline void set_module_pages_ro(struct module* mod) { }
 static inline int prepare_set_memory_rx_funcs(void) { return 0; }
 #endif
 
+/* Assigns the IDs to the blocks of code in the target module and reports 
+ * the information about the blocks to the output system.
+ *
+ * Note that this function must be called with 'session_mutex' locked. */
+static void
+report_blocks(struct kedr_target *t)
+{
+	struct kedr_ifunc *func;
+	struct kedr_block_info *bi;
+	
+	list_for_each_entry(func, &t->i13n->ifuncs, list) {
+		list_for_each_entry(bi, &func->block_infos, list) {
+			bi->id = session.next_block_id++;
+			kedr_eh_on_block_info(t->mod, bi);
+		}
+	}
+}
+
 /* on_module_load() handles loading of the target module. This function is
  * called after the target module has been loaded into memory but before it
  * begins its initialization.
@@ -937,9 +1134,11 @@ on_module_load(struct kedr_target *t)
 		return;
 	}
 
-	/* First, report "target load" event, then allow the plugins to
-	 * generate more events for this target if they need to. */
+	/* First, report "target load" event and the blocks of code, then 
+	 * allow the plugins to generate more events for this target if 
+	 * they need to. */
 	kedr_eh_on_target_loaded(t->mod);
+	report_blocks(t);
 	kedr_fh_on_target_load(t->mod);
 	return;
 }
@@ -1440,6 +1639,20 @@ remove_debugfs_files(void)
 		debugfs_remove(blocks_total_file);
 	if (blocks_skipped_file != NULL)
 		debugfs_remove(blocks_skipped_file);
+	if (dup_accesses_total_file != NULL)
+		debugfs_remove(dup_accesses_total_file);
+	if (dup_accesses_filtered_file != NULL)
+		debugfs_remove(dup_accesses_filtered_file);
+	if (fresh_accesses_filtered_file != NULL)
+		debugfs_remove(fresh_accesses_filtered_file);
+	if (fresh_objects_escaped_file != NULL)
+		debugfs_remove(fresh_objects_escaped_file);
+	if (watch_accesses_filtered_file != NULL)
+		debugfs_remove(watch_accesses_filtered_file);
+	if (stacks_total_file != NULL)
+		debugfs_remove(stacks_total_file);
+	if (stacks_truncated_file != NULL)
+		debugfs_remove(stacks_truncated_file);
 	if (loaded_targets_file != NULL)
 		debugfs_remove(loaded_targets_file);
 }
@@ -1467,6 +1680,68 @@ create_debugfs_files(void)
 		ret = -ENOMEM;
 		goto out;
 	}
+
+	dup_accesses_total_file = debugfs_create_size_t(
+		"dup_accesses_total", S_IRUGO, debugfs_dir_dentry, 
+		&dup_accesses_total);
+	if (dup_accesses_total_file == NULL) {
+		name = "dup_accesses_total";
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	dup_accesses_filtered_file = debugfs_create_size_t(
+		"dup_accesses_filtered", S_IRUGO, debugfs_dir_dentry, 
+		&dup_accesses_filtered);
+	if (dup_accesses_filtered_file == NULL) {
+		name = "dup_accesses_filtered";
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	fresh_accesses_filtered_file = debugfs_create_size_t(
+		"fresh_accesses_filtered", S_IRUGO, debugfs_dir_dentry, 
+		&fresh_accesses_filtered);
+	if (fresh_accesses_filtered_file == NULL) {
+		name = "fresh_accesses_filtered";
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	fresh_objects_escaped_file = debugfs_create_size_t(
+		"fresh_objects_escaped", S_IRUGO, debugfs_dir_dentry, 
+		&fresh_objects_escaped);
+	if (fresh_objects_escaped_file == NULL) {
+		name = "fresh_objects_escaped";
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	watch_accesses_filtered_file = debugfs_create_size_t(
+		"watch_accesses_filtered", S_IRUGO, debugfs_dir_dentry, 
+		&watch_accesses_filtered);
+	if (watch_accesses_filtered_file == NULL) {
+		name = "watch_accesses_filtered";
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	stacks_total_file = debugfs_create_size_t(
+		"stacks_total", S_IRUGO, debugfs_dir_dentry, &stacks_total);
+	if (stacks_total_file == NULL) {
+		name = "stacks_total";
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	stacks_truncated_file = debugfs_create_size_t(
+		"stacks_truncated", S_IRUGO, debugfs_dir_dentry, 
+		&stacks_truncated);
+	if (stacks_truncated_file == NULL) {
+		name = "stacks_truncated";
+		ret = -ENOMEM;
+		goto out;
+	}
 	
 	loaded_targets_file = debugfs_create_file("loaded_targets", S_IRUGO, 
 		debugfs_dir_dentry, NULL, &loaded_targets_ops);
@@ -1557,14 +1832,30 @@ core_init_module(void)
 	if (ret != 0)
 		goto out_cleanup_resolve_ip;
 
-	ret = kedr_init_module_ms_alloc();
+	ret = kedr_init_watch_filter(debugfs_dir_dentry);
 	if (ret != 0)
 		goto out_remove_files;
 
-	ret = kedr_thread_handling_init(gc_msec);
+	ret = kedr_init_module_ms_alloc();
+	if (ret != 0)
+		goto out_cleanup_watch;
+
+	ret = kedr_init_percpu_areas();
 	if (ret != 0)
 		goto out_cleanup_alloc;
 
+	ret = kedr_dup_filter_init();
+	if (ret != 0)
+		goto out_cleanup_percpu;
+
+	ret = kedr_shadow_stack_init();
+	if (ret != 0)
+		goto out_cleanup_dup_filter;
+
+	ret = kedr_thread_handling_init(gc_msec);
+	if (ret != 0)
+		goto out_cleanup_shadow_stack;
+
 	/* [NB] If something else needs to be initialized, do it before
 	 * registering our callbacks with the notification system.
 	 * Do not forget to re-check labels in the error path after that. */
@@ -1619,9 +1910,21 @@ out_unreg_notifier:
 out_cleanup_tid:
 	kedr_thread_handling_cleanup();
 
+out_cleanup_shadow_stack:
+	kedr_shadow_stack_cleanup();
+
+out_cleanup_dup_filter:
+	kedr_dup_filter_cleanup();
+
+out_cleanup_percpu:
+	kedr_cleanup_percpu_areas();
+
 out_cleanup_alloc:
 	kedr_cleanup_module_ms_alloc();
 
+out_cleanup_watch:
+	kedr_cleanup_watch_filter();
+
 out_remove_files:
 	remove_debugfs_files();
 
@@ -1647,7 +1950,11 @@ core_exit_module(void)
 	unregister_module_notifier(&detector_nb);
 
 	kedr_thread_handling_cleanup();
+	kedr_shadow_stack_cleanup();
+	kedr_dup_filter_cleanup();
+	kedr_cleanup_percpu_areas();
 	kedr_cleanup_module_ms_alloc();
+	kedr_cleanup_watch_filter();
 
 	remove_debugfs_files();
 	kedr_cleanup_resolve_ip();
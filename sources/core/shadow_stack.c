@@ -0,0 +1,375 @@
+/* shadow_stack.c - shadow call stacks of the threads and the depot of the
+ * call stacks. */
+
+/* ========================================================================
+ * Copyright (C) 2014, ROSA Laboratory
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ ======================================================================== */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/hash.h>
+#include <linux/hardirq.h>
+#include <linux/threads.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+#include <linux/errno.h>
+
+#include <kedr/kedr_mem/core_api.h>
+#include <kedr/kedr_mem/local_storage.h>
+#include <kedr/kedr_mem/functions.h>
+
+#include "config.h"
+#include "core_impl.h"
+
+#include "shadow_stack.h"
+/* ====================================================================== */
+
+/* A node of the stack depot: the call stack with the ID 'parent' extended
+ * with the call instruction at 'pc'. 'next' is the ID of the next node in
+ * the same hash chain, 0 if there is none. */
+struct kedr_stack_node
+{
+	unsigned long pc;
+	unsigned int parent;
+	unsigned int next;
+};
+
+/* The depot. The nodes are only added there (with 'depot_lock' locked),
+ * never removed or changed while the targets are executing. So the nodes
+ * may be looked for without locking: a node is fully initialized before
+ * it is published by adding it to its hash chain. */
+#define KEDR_STACK_DEPOT_SIZE (1 << 16)
+#define KEDR_STACK_HASH_BITS 14
+#define KEDR_STACK_HASH_SIZE (1 << KEDR_STACK_HASH_BITS)
+
+static struct kedr_stack_node *depot_nodes = NULL;
+static unsigned int *depot_heads = NULL;
+static unsigned int depot_nr_nodes = 0;
+
+static DEFINE_SPINLOCK(depot_lock);
+
+/* The threads currently executing the functions of the target, the hash
+ * table with open addressing. The key of an element is TID + 1, so that
+ * the IDs of the interrupt "threads" (the numbers of the CPUs) are never
+ * 0. A hardirq handler may interrupt a softirq on the same CPU and both
+ * have the number of the CPU as the TID, so NR_CPUS is added to the key
+ * for the hardirq handlers (see thread_key()). The TIDs of other threads
+ * are the addresses of their task structs, so the keys never collide.
+ * 'top' is the local storage of the innermost function of the target
+ * the thread is executing.
+ *
+ * An element is only added, changed and removed by the thread it belongs
+ * to (or by the code in tid.c when the thread has ended) and only this
+ * thread looks for it. An element may be reused by another thread after
+ * it has been removed, so the elements are claimed with cmpxchg(). The
+ * removed elements are marked with KEDR_STACK_THREAD_REMOVED rather than
+ * with 0 to keep the probe sequences of other elements intact. */
+#define KEDR_STACK_THREAD_HASH_BITS 10
+#define KEDR_STACK_THREAD_TABLE_SIZE (1 << KEDR_STACK_THREAD_HASH_BITS)
+#define KEDR_STACK_MAX_PROBES 32
+#define KEDR_STACK_THREAD_REMOVED (~0UL)
+
+struct kedr_stack_thread
+{
+	unsigned long key;
+	struct kedr_local_storage *top;
+};
+
+static struct kedr_stack_thread stack_threads[KEDR_STACK_THREAD_TABLE_SIZE];
+/* ====================================================================== */
+
+int
+kedr_shadow_stack_init(void)
+{
+	if (!shadow_call_stacks)
+		return 0;
+
+	depot_nodes = vmalloc(
+		KEDR_STACK_DEPOT_SIZE * sizeof(struct kedr_stack_node));
+	if (depot_nodes == NULL)
+		return -ENOMEM;
+
+	depot_heads = vmalloc(KEDR_STACK_HASH_SIZE * sizeof(unsigned int));
+	if (depot_heads == NULL) {
+		vfree(depot_nodes);
+		depot_nodes = NULL;
+		return -ENOMEM;
+	}
+
+	kedr_shadow_stack_start();
+	return 0;
+}
+
+void
+kedr_shadow_stack_cleanup(void)
+{
+	vfree(depot_heads);
+	depot_heads = NULL;
+	vfree(depot_nodes);
+	depot_nodes = NULL;
+}
+
+void
+kedr_shadow_stack_start(void)
+{
+	unsigned long irq_flags;
+
+	if (!shadow_call_stacks)
+		return;
+
+	/* No target is executing at this point, so the threads cannot use
+	 * the depot. */
+	spin_lock_irqsave(&depot_lock, irq_flags);
+	memset(depot_heads, 0, KEDR_STACK_HASH_SIZE * sizeof(unsigned int));
+	depot_nr_nodes = 0;
+	spin_unlock_irqrestore(&depot_lock, irq_flags);
+
+	memset(&stack_threads[0], 0, sizeof(stack_threads));
+}
+/* ====================================================================== */
+
+static unsigned int
+stack_hash(unsigned int parent, unsigned long pc)
+{
+	return (unsigned int)hash_long(pc ^ hash_32(parent, 32),
+		KEDR_STACK_HASH_BITS);
+}
+
+static unsigned int
+depot_find(unsigned int head, unsigned int parent, unsigned long pc)
+{
+	unsigned int id = head;
+
+	while (id != 0) {
+		struct kedr_stack_node *node = &depot_nodes[id - 1];
+
+		/* Make sure the node is read after its ID, the node has
+		 * been initialized before the ID was published. */
+		smp_read_barrier_depends();
+		if (node->pc == pc && node->parent == parent)
+			return id;
+		id = node->next;
+	}
+	return 0;
+}
+
+/* Returns the ID of the stack 'parent' extended with the call at 'pc',
+ * adds the stack to the depot if it is not there yet. If the depot is
+ * full, returns 'parent', i.e. the stack is truncated. */
+static unsigned int
+depot_intern(unsigned int parent, unsigned long pc)
+{
+	unsigned int hash = stack_hash(parent, pc);
+	struct kedr_stack_node *node;
+	unsigned long irq_flags;
+	unsigned int id;
+
+	id = depot_find(ACCESS_ONCE(depot_heads[hash]), parent, pc);
+	if (id != 0)
+		return id;
+
+	spin_lock_irqsave(&depot_lock, irq_flags);
+
+	/* Another thread might have added the stack in the meantime. */
+	id = depot_find(depot_heads[hash], parent, pc);
+	if (id != 0)
+		goto out;
+
+	if (depot_nr_nodes == KEDR_STACK_DEPOT_SIZE) {
+		/* The counters are updated without synchronization, like
+		 * the counters of the blocks (see module.c). */
+		++stacks_truncated;
+		id = parent;
+		goto out;
+	}
+
+	node = &depot_nodes[depot_nr_nodes];
+	node->pc = pc;
+	node->parent = parent;
+	node->next = depot_heads[hash];
+	id = ++depot_nr_nodes;
+
+	/* Publish the node only after it is initialized. */
+	smp_wmb();
+	depot_heads[hash] = id;
+	++stacks_total;
+out:
+	spin_unlock_irqrestore(&depot_lock, irq_flags);
+	return id;
+}
+
+int
+kedr_get_stack_frame(unsigned int stack_id, unsigned long *pc,
+	unsigned int *parent_id)
+{
+	struct kedr_stack_node *node;
+
+	/* The caller must have obtained 'stack_id' from the core, so the
+	 * node has been published before. */
+	if (!shadow_call_stacks || stack_id == 0 ||
+	    stack_id > ACCESS_ONCE(depot_nr_nodes))
+		return -EINVAL;
+
+	node = &depot_nodes[stack_id - 1];
+	smp_rmb();
+	*pc = node->pc;
+	*parent_id = node->parent;
+	return 0;
+}
+EXPORT_SYMBOL(kedr_get_stack_frame);
+/* ====================================================================== */
+
+/* The key of the element for the thread with the given ID, if the code
+ * of this thread is currently executing. */
+static unsigned long
+thread_key(unsigned long tid)
+{
+	return (in_irq() ? tid + 1 + NR_CPUS : tid + 1);
+}
+
+static struct kedr_stack_thread *
+find_thread(unsigned long key)
+{
+	unsigned int pos = (unsigned int)hash_long(key,
+		KEDR_STACK_THREAD_HASH_BITS);
+	unsigned int i;
+
+	for (i = 0; i < KEDR_STACK_MAX_PROBES; ++i) {
+		unsigned long k = ACCESS_ONCE(stack_threads[pos].key);
+		if (k == key)
+			return &stack_threads[pos];
+		if (k == 0)
+			break;
+		pos = (pos + 1) & (KEDR_STACK_THREAD_TABLE_SIZE - 1);
+	}
+	return NULL;
+}
+
+/* Adds an element for the thread that has no element in the table yet.
+ * Returns NULL if there is no room for it. */
+static struct kedr_stack_thread *
+claim_thread(unsigned long key)
+{
+	unsigned int pos = (unsigned int)hash_long(key,
+		KEDR_STACK_THREAD_HASH_BITS);
+	unsigned int i;
+
+	for (i = 0; i < KEDR_STACK_MAX_PROBES; ++i) {
+		unsigned long k = ACCESS_ONCE(stack_threads[pos].key);
+		if ((k == 0 || k == KEDR_STACK_THREAD_REMOVED) &&
+		    cmpxchg(&stack_threads[pos].key, k, key) == k)
+			return &stack_threads[pos];
+		pos = (pos + 1) & (KEDR_STACK_THREAD_TABLE_SIZE - 1);
+	}
+	return NULL;
+}
+
+void
+kedr_shadow_stack_push(struct kedr_local_storage *ls)
+{
+	struct kedr_stack_thread *st;
+	struct kedr_local_storage *caller;
+	unsigned long key;
+
+	ls->caller_ls = NULL;
+	ls->stack_id = 0;
+	ls->call_pc = 0;
+
+	if (!shadow_call_stacks)
+		return;
+
+	key = thread_key(ls->tid);
+	st = find_thread(key);
+	if (st == NULL) {
+		/* The outermost function of the target for this thread.
+		 * The stack is empty. If the table is full, the thread
+		 * will not have the shadow stack until it leaves the
+		 * target. */
+		st = claim_thread(key);
+		if (st != NULL)
+			st->top = ls;
+		return;
+	}
+
+	/* Normally, the caller is executing a call (perhaps, this function
+	 * is a callback called from the kernel proper) and 'call_pc' is
+	 * the address of that call. Otherwise, the caller has been
+	 * interrupted (e.g. by an NMI) and this function starts a new
+	 * stack. It is still linked to the caller to restore the top when
+	 * this function exits. */
+	caller = st->top;
+	if (caller != NULL && caller->call_pc != 0) {
+		ls->stack_id = depot_intern(caller->stack_id,
+			caller->call_pc);
+	}
+	ls->caller_ls = caller;
+	st->top = ls;
+}
+
+void
+kedr_shadow_stack_pop(struct kedr_local_storage *ls)
+{
+	struct kedr_stack_thread *st;
+
+	if (!shadow_call_stacks)
+		return;
+
+	st = find_thread(thread_key(ls->tid));
+	if (st == NULL || st->top != ls)
+		return;
+
+	if (ls->caller_ls != NULL) {
+		st->top = ls->caller_ls;
+	}
+	else {
+		st->top = NULL;
+		ACCESS_ONCE(st->key) = KEDR_STACK_THREAD_REMOVED;
+	}
+}
+
+void
+kedr_shadow_stack_thread_end(unsigned long tid)
+{
+	struct kedr_stack_thread *st;
+
+	if (!shadow_call_stacks)
+		return;
+
+	/* Only the threads with task structs end this way. */
+	st = find_thread(tid + 1);
+	if (st == NULL)
+		return;
+
+	st->top = NULL;
+	ACCESS_ONCE(st->key) = KEDR_STACK_THREAD_REMOVED;
+}
+
+int
+kedr_shadow_stacks_enabled(void)
+{
+	return shadow_call_stacks;
+}
+EXPORT_SYMBOL(kedr_shadow_stacks_enabled);
+
+unsigned int
+kedr_get_stack_id(unsigned long tid)
+{
+	struct kedr_stack_thread *st;
+
+	/* The local storage of another thread may be freed at any 
+	 * moment. */
+	if (!shadow_call_stacks || tid != kedr_get_thread_id())
+		return 0;
+
+	st = find_thread(thread_key(tid));
+	if (st == NULL || st->top == NULL)
+		return 0;
+	return st->top->stack_id;
+}
+EXPORT_SYMBOL(kedr_get_stack_id);
+/* ====================================================================== */
@@ -0,0 +1,57 @@
+#ifndef SHADOW_STACK_H_1452_INCLUDED
+#define SHADOW_STACK_H_1452_INCLUDED
+
+/* shadow_stack.h - shadow call stacks of the threads (see
+ * 'shadow_call_stacks' parameter in module.c).
+ *
+ * When a function of the target is called, its local storage is linked to
+ * the local storage of the caller in the same thread, if the caller is a
+ * function of the target too. The addresses of the call instructions in
+ * the callers form the call stack of the thread.
+ *
+ * The call stacks are stored in a "stack depot": each node of the depot
+ * is a pair {ID of the stack of the caller, address of the call
+ * instruction}. The same pair is always stored only once, so each call
+ * stack seen so far has a unique ID which is the index of the node + 1.
+ * ID 0 denotes the empty stack, i.e. the function called from the code not
+ * under analysis. The providers of the event handlers may obtain the ID of
+ * the current call stack of a thread and output each stack only once,
+ * instead of recording all function entry/exit and call events. See
+ * kedr_get_stack_id() and kedr_get_stack_frame() in core_api.h.
+ *
+ * The depot has a limited size. When it is full, the new stacks are
+ * truncated, i.e. the innermost frames are not recorded.
+ * The depot is cleared when a new session starts. */
+
+#include <kedr/kedr_mem/core_api.h>
+#include <kedr/kedr_mem/local_storage.h>
+/* ====================================================================== */
+
+/* Allocate the depot and the table of the threads. Does nothing if the
+ * shadow stacks are disabled. */
+int
+kedr_shadow_stack_init(void);
+
+void
+kedr_shadow_stack_cleanup(void);
+
+/* Forget all the stacks and threads seen so far. Call this before a
+ * session starts. */
+void
+kedr_shadow_stack_start(void);
+
+/* Push the frame for the function 'ls' belongs to and pop it,
+ * respectively. Called from kedr_on_function_entry() and
+ * kedr_on_function_exit(), 'ls->tid' must be set. */
+void
+kedr_shadow_stack_push(struct kedr_local_storage *ls);
+
+void
+kedr_shadow_stack_pop(struct kedr_local_storage *ls);
+
+/* The thread has ended, possibly without leaving the functions of the
+ * target. Forget its call stack. */
+void
+kedr_shadow_stack_thread_end(unsigned long tid);
+/* ====================================================================== */
+#endif /* SHADOW_STACK_H_1452_INCLUDED */
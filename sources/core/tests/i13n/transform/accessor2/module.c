@@ -109,7 +109,36 @@ print_ir_node(struct kedr_ifunc *func, struct kedr_ir_node *node,
 	is_mov_imm_to_reg = 
 		((opcode == 0xc7 && X86_MODRM_REG(modrm) == 0) ||
 		(opcode >= 0xb8 && opcode <= 0xbf));
-	
+
+#ifdef CONFIG_X86_64
+	if (start != NULL && node->orig_addr == 0 && opcode == 0xc7 &&
+	    X86_MODRM_REG(modrm) == 0 &&
+	    !X86_REX_W(insn->rex_prefix.value)) {
+		/* "movl imm32, <offset>(%base)": the shared thunks are used
+		 * and this is a half of the pointer to a call_info or a
+		 * block_info instance stored in local_storage::info. Check
+		 * the lower half against these pointers.
+		 * This is done before the checks below because the insn
+		 * may also use SIB and disp32 (if %base is %r12). */
+		u32 imm32 = (u32)insn->immediate.value;
+
+		if (start->block_info != NULL &&
+		    imm32 == (u32)(unsigned long)start->block_info) {
+			debug_util_print_ulong(offset_for_node(func, start),
+			"Ref. to block_info for the block at 0x%lx\n");
+		}
+		if (start->call_info != NULL &&
+		    imm32 == (u32)(unsigned long)start->call_info) {
+			debug_util_print_ulong(offset_for_node(func, start),
+			"Ref. to call_info for the node at 0x%lx\n");
+		}
+
+		/* Zero the immediate value anyway */
+		pos = buf + insn_offset_immediate(insn);
+		*(u32 *)pos = 0;
+	}
+#endif
+
 	/* For the indirect near jumps using a jump table, as well as 
 	 * for other instructions using similar addressing expressions
 	 * we cannot determine the address of the table in advance to  
@@ -2,6 +2,7 @@
 #include <linux/moduleparam.h>
 #include <linux/init.h>
 #include <linux/kernel.h>
+#include <linux/percpu.h>
 
 /* ====================================================================== */
 MODULE_AUTHOR("Eugene A. Shatokhin");
@@ -15,6 +16,13 @@ int must_be_zero = 0;
 module_param(must_be_zero, int, S_IRUGO);
 /* ====================================================================== */
 
+/* A per-CPU variable for kedr_test_percpu_var() to access. The address of
+ * its instance for CPU 0 is passed to that function via 
+ * kedr_test_percpu_ptr. */
+static DEFINE_PER_CPU(unsigned long, kedr_test_percpu_data);
+extern unsigned long *kedr_test_percpu_ptr;
+/* ====================================================================== */
+
 /* The test functions to be called */
 void kedr_test_base_reg(void);
 void kedr_test_calls_jumps2_rel32(void);
@@ -29,6 +37,22 @@ void kedr_test_strings(void);
 void kedr_test_locked_updates2(void);
 void kedr_test_barriers_mem(void);
 void kedr_test_stack_access(void);
+void kedr_test_leaf_funcs(void);
+void kedr_test_shared_thunks_bx(void);
+void kedr_test_shared_thunks_bp(void);
+void kedr_test_percpu_var(void);
+
+#ifdef CONFIG_X86_64
+/* Additional functions to be called on x86-64. */
+void kedr_test_shared_thunks_r12(void);
+void kedr_test_shared_thunks_r13(void);
+void kedr_test_shared_thunks_r14(void);
+void kedr_test_shared_thunks_r15(void);
+#else
+/* Additional functions to be called on x86-32. */
+void kedr_test_shared_thunks_si(void);
+void kedr_test_shared_thunks_di(void);
+#endif
 
 #ifndef CONFIG_X86_64
 /* Additional functions to be called on x86-32. */
@@ -52,9 +76,10 @@ kedr_test_base_reg_no_esi_edi2(void)
 { }	
 #endif
 
-/* The following function is not intended to be called but we need to
- * make the compiler and linker think it is. */
+/* The following functions are not intended to be called but we need to
+ * make the compiler and linker think they are. */
 void kedr_test_io_mem(void);
+void kedr_test_percpu_prefixes(void);
 /* ====================================================================== */
 
 /* [NB] It is safer to call the test functions from the cleanup function
@@ -106,6 +131,26 @@ test_cleanup_module(void)
 	/* Group "stack_access" */
 	kedr_test_stack_access();
 	
+	/* Group "leaf_funcs" */
+	kedr_test_leaf_funcs();
+	
+	/* Group "shared_thunks" */
+	kedr_test_shared_thunks_bx();
+	kedr_test_shared_thunks_bp();
+#ifdef CONFIG_X86_64
+	kedr_test_shared_thunks_r12();
+	kedr_test_shared_thunks_r13();
+	kedr_test_shared_thunks_r14();
+	kedr_test_shared_thunks_r15();
+#else
+	kedr_test_shared_thunks_si();
+	kedr_test_shared_thunks_di();
+#endif
+	
+	/* Group "percpu" */
+	kedr_test_percpu_ptr = per_cpu_ptr(&kedr_test_percpu_data, 0);
+	kedr_test_percpu_var();
+	
 	/* [NB] When adding more tests with the functions that are actually
 	 * executable rather than testing-only, consider calling these 
 	 * functions here to make sure they do not crash the system. */
@@ -115,6 +160,7 @@ test_cleanup_module(void)
 		 * called but the calls to which must be present in the code
 		 * somewhere. */
 		kedr_test_io_mem();
+		kedr_test_percpu_prefixes();
 	}
 	return;
 }
@@ -41,4 +41,44 @@ kedr_thunk_call(void);
  * in the original code at this point) on entry to the thunk. */
 void
 kedr_thunk_jmp(void);
+
+/* The thunks used instead of some of the inline code sequences if 
+ * 'shared_thunks' parameter is nonzero (see module.c). Each of these 
+ * thunks exists in several variants, one for each register that may be 
+ * used as %base in the instrumented code. 'info' field of the local 
+ * storage must be set before calling any of these. See thunks_*.S and 
+ * transform.c for details. */
+struct kedr_base_thunks
+{
+	/* The end of a common block, without jumps out of it and with 
+	 * such jumps, respectively. Should be called with CALL 
+	 * instruction. */
+	unsigned long block_end;
+	unsigned long block_end_jumps;
+	
+	/* Same as kedr_thunk_call() and kedr_thunk_jmp() but expect %rax
+	 * to have its original value rather than the address of the local
+	 * storage. */
+	unsigned long call;
+	unsigned long jmp;
+};
+
+#define KEDR_DECLARE_BASE_THUNKS(_name) \
+	void kedr_thunk_block_end_ ## _name(void); \
+	void kedr_thunk_block_end_jumps_ ## _name(void); \
+	void kedr_thunk_call_ ## _name(void); \
+	void kedr_thunk_jmp_ ## _name(void)
+
+KEDR_DECLARE_BASE_THUNKS(bx);
+KEDR_DECLARE_BASE_THUNKS(bp);
+#ifdef CONFIG_X86_64
+KEDR_DECLARE_BASE_THUNKS(r12);
+KEDR_DECLARE_BASE_THUNKS(r13);
+KEDR_DECLARE_BASE_THUNKS(r14);
+KEDR_DECLARE_BASE_THUNKS(r15);
+#else /* x86-32 */
+KEDR_DECLARE_BASE_THUNKS(si);
+KEDR_DECLARE_BASE_THUNKS(di);
+#endif
+
 #endif /* THUNKS_H_1137_INCLUDED */
@@ -34,6 +34,7 @@
 #include "core_impl.h"
 
 #include "tid.h"
+#include "shadow_stack.h"
 /* ====================================================================== */
 
 #ifndef __percpu
@@ -322,6 +323,7 @@ create_new_bucket(const struct kedr_thread_info *old_bucket,
 		 * we find an entry with the corresponding TID, it is for a
 		 * thread that has already finished. Report that it has. */
 		if (old_item->tid == (unsigned long)task) {
+			kedr_shadow_stack_thread_end((unsigned long)task);
 			kedr_eh_on_thread_end((unsigned long)task);
 			continue;
 		}
@@ -475,6 +477,8 @@ remove_dead_items(unsigned long index)
 		}
 		else {
 			*pnext = item->next;
+			kedr_shadow_stack_thread_end(
+				item->tid | KEDR_LIVE_THREAD_MASK);
 			kedr_eh_on_thread_end(
 				item->tid | KEDR_LIVE_THREAD_MASK);
 			kfree(item);
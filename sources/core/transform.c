@@ -122,6 +122,72 @@ mk_eval_addr_to_reg(struct kedr_ir_node *ref_node, u8 base, u8 wreg,
 }
 /* ====================================================================== */
 
+/* The shared thunks for each register that can be %base (see thunks.h). */
+#define KEDR_BASE_THUNKS(_name) { \
+	.block_end = (unsigned long)&kedr_thunk_block_end_ ## _name, \
+	.block_end_jumps = \
+		(unsigned long)&kedr_thunk_block_end_jumps_ ## _name, \
+	.call = (unsigned long)&kedr_thunk_call_ ## _name, \
+	.jmp = (unsigned long)&kedr_thunk_jmp_ ## _name, \
+}
+
+static const struct kedr_base_thunks base_thunks[X86_REG_COUNT] = {
+	[INAT_REG_CODE_BX] = KEDR_BASE_THUNKS(bx),
+	[INAT_REG_CODE_BP] = KEDR_BASE_THUNKS(bp),
+#ifdef CONFIG_X86_64
+	[INAT_REG_CODE_12] = KEDR_BASE_THUNKS(r12),
+	[INAT_REG_CODE_13] = KEDR_BASE_THUNKS(r13),
+	[INAT_REG_CODE_14] = KEDR_BASE_THUNKS(r14),
+	[INAT_REG_CODE_15] = KEDR_BASE_THUNKS(r15),
+#else /* x86-32 */
+	[INAT_REG_CODE_SI] = KEDR_BASE_THUNKS(si),
+	[INAT_REG_CODE_DI] = KEDR_BASE_THUNKS(di),
+#endif
+};
+
+static const struct kedr_base_thunks *
+get_base_thunks(u8 base)
+{
+	/* %base is always a non-scratch register, there are thunks for 
+	 * each of these. */
+	BUG_ON(base >= X86_REG_COUNT || base_thunks[base].block_end == 0);
+	return &base_thunks[base];
+}
+
+/* A helper function that generates the instructions to store the given 
+ * pointer in local_storage::info without using any registers except 
+ * %base. This is what the shared thunks expect.
+ * The rules concerning 'item' and 'err' are the same as for kedr_mk_*().
+ *
+ * On x86-32 this is done as follows:
+ *	mov <ptr>, <offset_info>(%base)
+ * 
+ * On x86-64 this is done as follows:
+ *	movl <lower 32 bits of ptr>, <offset_info>(%base)
+ *	movl <higher 32 bits of ptr>, <offset_info + 4>(%base)
+ */
+static struct list_head *
+mk_store_info_ptr_no_reg(unsigned long ptr, u8 base, 
+	struct list_head *item, int *err)
+{
+	u32 offset = (u32)offsetof(struct kedr_local_storage, info);
+	
+	if (*err != 0)
+		return item;
+	
+#ifdef CONFIG_X86_64
+	item = kedr_mk_mov_value32_to_mem32((u32)ptr, base, offset, item, 0, 
+		err);
+	item = kedr_mk_mov_value32_to_mem32((u32)(ptr >> 32), base, 
+		offset + 4, item, 0, err);
+#else /* x86-32 */
+	item = kedr_mk_mov_value32_to_slot((u32)ptr, base, offset, item, 0,
+		err);
+#endif
+	return item;
+}
+/* ====================================================================== */
+
 /* ====================================================================== */
 /* Transformation of the IR, phase 1 */
 /* ====================================================================== */
@@ -555,6 +621,11 @@ kedr_handle_jmp_indirect_out(struct kedr_ir_node *ref_node, u8 base)
  *      (x86-64 only) mov %rax, <offset_info>(%base)
  *      mov %base, %rax
  *      call kedr_thunk_call # this will replace the original instruction
+ * 
+ * Code if 'shared_thunks' is nonzero:
+ *	<store call_info to <offset_info>(%base)> # see 
+ *						  # mk_store_info_ptr_no_reg()
+ *	call kedr_thunk_call_<base> # this will replace the original insn
  */
 int
 kedr_handle_call_rel32_out(struct kedr_ir_node *ref_node, u8 base)
@@ -566,6 +637,20 @@ kedr_handle_call_rel32_out(struct kedr_ir_node *ref_node, u8 base)
 	BUG_ON(ref_node->call_info == NULL);
 	
 	item = ref_node->list.prev;
+	if (shared_thunks) {
+		mk_store_info_ptr_no_reg((unsigned long)ref_node->call_info,
+			base, item, &err);
+		kedr_mk_call_rel32(get_base_thunks(base)->call, 
+			&ref_node->list, 1, &err);
+		
+		if (err == 0)
+			ref_node->first = list_entry(item->next, 
+				struct kedr_ir_node, list);
+		else
+			warn_fail(ref_node);
+		return err;
+	}
+	
 	item = kedr_mk_store_reg_to_spill_slot(INAT_REG_CODE_AX, base, item,
 		0, &err);
 	first_item = item;
@@ -614,6 +699,12 @@ kedr_handle_call_rel32_out(struct kedr_ir_node *ref_node, u8 base)
  *      # to the address of the thunk. The immediate value in the 
  *	# instruction itself does not matter here.
  *      jxx kedr_thunk_jmp 
+ * 
+ * Code if 'shared_thunks' is nonzero:
+ *	<store call_info to <offset_info>(%base)> # see 
+ *						  # mk_store_info_ptr_no_reg()
+ *	jxx kedr_thunk_jmp_<base> # the original instruction, 'iprel_addr'
+ *				  # is changed as above
  */
 int
 kedr_handle_jxx_rel32_out(struct kedr_ir_node *ref_node, u8 base)
@@ -625,6 +716,19 @@ kedr_handle_jxx_rel32_out(struct kedr_ir_node *ref_node, u8 base)
 	BUG_ON(ref_node->call_info == NULL);
 	
 	item = ref_node->list.prev;
+	if (shared_thunks) {
+		mk_store_info_ptr_no_reg((unsigned long)ref_node->call_info,
+			base, item, &err);
+		ref_node->iprel_addr = get_base_thunks(base)->jmp;
+		
+		if (err == 0)
+			ref_node->first = list_entry(item->next, 
+				struct kedr_ir_node, list);
+		else
+			warn_fail(ref_node);
+		return err;
+	}
+	
 	item = kedr_mk_store_reg_to_spill_slot(INAT_REG_CODE_AX, base, item,
 		0, &err);
 	first_item = item;
@@ -771,39 +875,48 @@ kedr_handle_popad(struct kedr_ir_node *ref_node, u8 base)
  * consistent.
  * 
  * It is expected that there is at least one register that <insn> does not 
- * use. %wreg should be chosen among such registers.
+ * use. %wreg should be chosen among such registers. If some of them are 
+ * dead before <insn> (see 'dead_mask' in struct kedr_ir_node), %wreg is 
+ * chosen among these and the instructions marked with [*] are omitted.
  * 
  * Code:
- *	mov %wreg, <offset_wreg>(%base)
+ *	mov %wreg, <offset_wreg>(%base)		[*]
  *	mov %base, %wreg
  *	mov <offset_base>(%wreg), %base
  *	<insn>
  *	mov %base, <offset_base>(%wreg)
  *	mov %wreg, %base
- *	mov <offset_wreg>(%base), %wreg
+ *	mov <offset_wreg>(%base), %wreg		[*]
  */
 int
 kedr_handle_general_case(struct kedr_ir_node *ref_node, u8 base)
 {
 	int err = 0;
-	struct list_head *item = ref_node->list.prev;
-	struct list_head *first_item;
+	struct list_head *insert_after = ref_node->list.prev;
+	struct list_head *item = insert_after;
+	int is_dead = 1;
 	u8 wreg;
 
 	/* No-ops are handled automatically as they do not use registers. */
 	if (!(ref_node->reg_mask & X86_REG_MASK(base)))
 		return 0;
 	
-	wreg = kedr_choose_work_register(X86_REG_MASK_ALL, 
+	wreg = kedr_choose_work_register(ref_node->dead_mask, 
 		ref_node->reg_mask, base);
+	if (wreg == KEDR_REG_NONE) {
+		is_dead = 0;
+		wreg = kedr_choose_work_register(X86_REG_MASK_ALL, 
+			ref_node->reg_mask, base);
+	}
 	if (wreg == KEDR_REG_NONE) {
 		warn_no_wreg(ref_node, base);
 		return -EILSEQ;
 	}
 	
 	/* adding code before the instruction */
-	item = kedr_mk_store_reg_to_spill_slot(wreg, base, item, 0, &err);
-	first_item = item;
+	if (!is_dead)
+		item = kedr_mk_store_reg_to_spill_slot(wreg, base, item, 0, 
+			&err);
 	item = kedr_mk_mov_reg_to_reg(base, wreg, item, 0, &err);
 	item = kedr_mk_load_reg_from_spill_slot(base, wreg, item, 0, &err);
 	
@@ -811,11 +924,13 @@ kedr_handle_general_case(struct kedr_ir_node *ref_node, u8 base)
 	item = &ref_node->list;
 	item = kedr_mk_store_reg_to_spill_slot(base, wreg, item, 0, &err);
 	item = kedr_mk_mov_reg_to_reg(wreg, base, item, 0, &err);
-	item = kedr_mk_load_reg_from_spill_slot(wreg, base, item, 0, &err);
+	if (!is_dead)
+		item = kedr_mk_load_reg_from_spill_slot(wreg, base, item, 0,
+			&err);
 	
 	if (err == 0) {
-		ref_node->first = 
-			list_entry(first_item, struct kedr_ir_node, list);
+		ref_node->first = list_entry(insert_after->next, 
+			struct kedr_ir_node, list);
 		ref_node->last = 
 			list_entry(item, struct kedr_ir_node, list);
 	}
@@ -920,17 +1035,33 @@ mk_call_wrapper_with_info(struct kedr_block_info *info,
 
 /* Process the end of a common block that has no jumps out. It is enough to
  * save the pointer to the block_info instance in local_storage::info and
- * call kedr_on_common_block_end_wrapper(). */
+ * call kedr_on_common_block_end_wrapper(). 
+ * 
+ * If 'shared_thunks' is nonzero, the latter is done by the thunk:
+ *	<store block_info to <offset_info>(%base)> # see 
+ *						   # mk_store_info_ptr_no_reg()
+ *	call kedr_thunk_block_end_<base>
+ */
 int 
 kedr_handle_block_end_no_jumps(struct kedr_ir_node *start_node, 
 	struct kedr_ir_node *end_node, u8 base)
 {
 	int err = 0;
+	struct list_head *item;
 	
 	BUG_ON(start_node->block_info == NULL);
-	mk_call_wrapper_with_info(start_node->block_info,
-		(unsigned long)&kedr_on_common_block_end_wrapper, base,
-		&end_node->last->list, &err);
+	if (shared_thunks) {
+		item = mk_store_info_ptr_no_reg(
+			(unsigned long)start_node->block_info, base,
+			&end_node->last->list, &err);
+		kedr_mk_call_rel32(get_base_thunks(base)->block_end, item, 0,
+			&err);
+	}
+	else {
+		mk_call_wrapper_with_info(start_node->block_info,
+			(unsigned long)&kedr_on_common_block_end_wrapper, 
+			base, &end_node->last->list, &err);
+	}
 	
 	if (err != 0) {
 		pr_warning(KEDR_MSG_PREFIX 
@@ -978,6 +1109,14 @@ kedr_handle_block_end_no_jumps(struct kedr_ir_node *start_node,
  * go_on:
  *	popf
  * next_block:
+ * 
+ * If 'shared_thunks' is nonzero, all this except setting 'info' is done
+ * by the thunk:
+ * block_end:
+ *	<store block_info to <offset_info>(%base)> # see 
+ *						   # mk_store_info_ptr_no_reg()
+ *	call kedr_thunk_block_end_jumps_<base>
+ * next_block:
  */
 int 
 kedr_handle_block_end(struct kedr_ir_node *start_node, 
@@ -988,6 +1127,20 @@ kedr_handle_block_end(struct kedr_ir_node *start_node,
 	struct list_head *item = NULL;
 	int err = 0;
 	
+	if (shared_thunks) {
+		item = mk_store_info_ptr_no_reg(
+			(unsigned long)start_node->block_info, base,
+			&end_node->last->list, &err);
+		kedr_mk_call_rel32(get_base_thunks(base)->block_end_jumps, 
+			item, 0, &err);
+		if (err != 0) {
+			pr_warning(KEDR_MSG_PREFIX 
+		"Failed to add code at %pS, after the end of the block.\n",
+				(void *)end_node->orig_addr);
+		}
+		return err;
+	}
+	
 	/* Create the first node of the sequence and place it after
 	 * 'end_node->last', then create the node for 'jz'. 
 	 * [NB] If the second allocation fails, the memory will be reclaimed
@@ -1286,58 +1439,55 @@ kedr_handle_jump_out_of_block(struct kedr_ir_node *ref_node,
  * There are 2 cases: 
  * - %base is not used in the memory addressing expression <expr>; 
  * - %base is used there. 
- * %wreg is selected among the registers not used in <expr>, it should be
- * different from %base too.
+ * %wreg must not be used in <expr>, it should be different from %base 
+ * too.
+ * 
+ * The instructions marked with [save] and [restore] are generated only if
+ * 'save_wreg' and 'restore_wreg' are nonzero, respectively. They are not 
+ * needed if %wreg is dead at this point or if its value has already been
+ * saved.
  *
  * <offset_values[nval]> - offset of values[nval] in the local storage.
  *
  * Code: 
  * 
  * Case 1: %base is not used in <expr>
- *	mov  %wreg, <offset_wreg>(%base)
+ *	mov  %wreg, <offset_wreg>(%base)	[save]
  *	lea  <expr>, %wreg
  * The following part is the same in both cases:
  *	mov  %wreg, <offset_values[nval]>(%base)
- * 	mov  <offset_wreg>(%base), %wreg
+ * 	mov  <offset_wreg>(%base), %wreg	[restore]
  *
  * ---------------------------------------------------
  * Case 2: %base is used in <expr>. 
- *	mov  %wreg, <offset_wreg>(%base)
+ *	mov  %wreg, <offset_wreg>(%base)	[save]
  * 	mov  %base, %wreg
  * 	mov  <offset_base>(%wreg), %base
  *	lea  <expr>, %base
  *	xchg %base, %wreg
  * The following part is the same in both cases:
  *	mov  %wreg, <offset_values[nval]>(%base)
- * 	mov  <offset_wreg>(%base), %wreg 
+ * 	mov  <offset_wreg>(%base), %wreg	[restore]
  * 
  * The rules concerning 'item' and 'err' are the same as for kedr_mk_*(). */
 static struct list_head *
-mk_record_access_common(struct kedr_ir_node *node, u8 base, 
-	unsigned int nval, struct list_head *item, int *err)
+mk_record_access_wreg(struct kedr_ir_node *node, u8 base, u8 wreg,
+	int save_wreg, int restore_wreg, unsigned int nval, 
+	struct list_head *item, int *err)
 {
-	u8 wreg;
 	unsigned int expr_reg_mask;
-	int base_is_used;
 	
 	if (*err != 0)
 		return item;
 	
 	expr_reg_mask = insn_reg_mask_for_expr(&node->insn);
-	base_is_used = (expr_reg_mask & X86_REG_MASK(base));
-	
-	wreg = kedr_choose_work_register(X86_REG_MASK_ALL,
-		(expr_reg_mask | X86_REG_MASK(INAT_REG_CODE_SP)), 
-		base);
-	if (wreg == KEDR_REG_NONE) {
-		warn_no_wreg(node, base);
-		*err = -EILSEQ;
-		return item;
-	}
+	BUG_ON(wreg == base || (expr_reg_mask & X86_REG_MASK(wreg)));
 	
-	item = kedr_mk_store_reg_to_spill_slot(wreg, base, item, 0, err);
+	if (save_wreg)
+		item = kedr_mk_store_reg_to_spill_slot(wreg, base, item, 0, 
+			err);
 	
-	if (base_is_used) {
+	if (expr_reg_mask & X86_REG_MASK(base)) {
 		item = kedr_mk_mov_reg_to_reg(base, wreg, item, 0, err);
 		item = kedr_mk_load_reg_from_spill_slot(base, wreg, item, 0,
 			err);
@@ -1351,10 +1501,58 @@ mk_record_access_common(struct kedr_ir_node *node, u8 base,
 	item = kedr_mk_store_reg_to_mem(wreg, base, 
 		KEDR_OFFSET_VALUES_N(nval), item, 0, err);
 	
-	item = kedr_mk_load_reg_from_spill_slot(wreg, base, item, 0, err);
+	if (restore_wreg)
+		item = kedr_mk_load_reg_from_spill_slot(wreg, base, item, 0, 
+			err);
 	return item;
 }
 
+/* Chooses the work register to record the address accessed by the 
+ * instruction in the given node. The registers dead before the 
+ * instruction are preferred, '*is_dead' is set to 1 if such register is 
+ * chosen, to 0 otherwise. 
+ * Returns KEDR_REG_NONE if no suitable register is found. */
+static u8
+choose_wreg_for_access(struct kedr_ir_node *node, u8 base, int *is_dead)
+{
+	unsigned int used_mask = insn_reg_mask_for_expr(&node->insn) | 
+		X86_REG_MASK(INAT_REG_CODE_SP);
+	u8 wreg;
+	
+	wreg = kedr_choose_work_register(node->dead_mask, used_mask, base);
+	*is_dead = (wreg != KEDR_REG_NONE);
+	if (wreg == KEDR_REG_NONE)
+		wreg = kedr_choose_work_register(X86_REG_MASK_ALL, used_mask,
+			base);
+	return wreg;
+}
+
+/* Generates the code to record the memory access from the instruction of
+ * type E or M in the given node, see mk_record_access_wreg(). %wreg is 
+ * saved and restored there only if it is not dead before the instruction.
+ * 
+ * The rules concerning 'item' and 'err' are the same as for kedr_mk_*(). */
+static struct list_head *
+mk_record_access_common(struct kedr_ir_node *node, u8 base, 
+	unsigned int nval, struct list_head *item, int *err)
+{
+	u8 wreg;
+	int is_dead;
+	
+	if (*err != 0)
+		return item;
+	
+	wreg = choose_wreg_for_access(node, base, &is_dead);
+	if (wreg == KEDR_REG_NONE) {
+		warn_no_wreg(node, base);
+		*err = -EILSEQ;
+		return item;
+	}
+	
+	return mk_record_access_wreg(node, base, wreg, !is_dead, !is_dead,
+		nval, item, err);
+}
+
 /* Process memory accesses for the following instructions:
  * 	SETcc and CMOVcc
  *
@@ -1491,18 +1689,110 @@ kedr_handle_cmpxchg8b_16b(struct kedr_ir_node *ref_node, u8 base,
 	return handle_cmpxchg_impl(ref_node, base, num, nval);
 }
 
+/* Checks if the instrumentation of the given instruction may reuse the 
+ * work register of the previous instruction without saving it again: 
+ * the previous instruction must be a tracked memory operation right 
+ * before this one, with its work register restored right before it (see
+ * 'wreg_reload' in struct kedr_ir_node), and it must not use that 
+ * register. If so, its value is still in the spill slot and the reload 
+ * can be moved past the current instruction (or removed if the register 
+ * is dead there).
+ * 
+ * Returns the node for the previous instruction if the register can be 
+ * reused, NULL otherwise. */
+static struct kedr_ir_node *
+find_wreg_to_reuse(struct kedr_ir_node *ref_node, u8 base)
+{
+	struct kedr_ir_node *prev;
+	unsigned int used_mask;
+	
+	/* The first node of the function always starts a block, so there 
+	 * is always a node before ref_node->first here. */
+	if (ref_node->block_starts)
+		return NULL;
+	
+	prev = list_entry(ref_node->first->list.prev, struct kedr_ir_node,
+		list);
+	if (prev->orig_addr == 0 || prev->wreg_reload == NULL || 
+	    prev->last != prev ||
+	    prev->wreg_reload->list.next != &prev->list)
+		return NULL;
+	
+	used_mask = insn_reg_mask_for_expr(&ref_node->insn) | 
+		X86_REG_MASK(INAT_REG_CODE_SP) | X86_REG_MASK(base);
+	if ((prev->reg_mask | used_mask) & X86_REG_MASK(prev->wreg))
+		return NULL;
+	
+	/* If the register is not dead here, it must be restored after the
+	 * code added below. This is wrong if control may be transferred
+	 * to that code by a jump: the spill slot may contain something 
+	 * else then. */
+	if (!(ref_node->dead_mask & X86_REG_MASK(prev->wreg)) &&
+	    ref_node->is_jump_dest)
+		return NULL;
+	
+	return prev;
+}
+
+/* Processing memory accesses for the instructions of type E and M.
+ * Apply this before the instruction sequence.
+ * 
+ * Code:
+ *	... # see mk_record_access_wreg()
+ * 
+ * If %wreg of the previous instruction can be reused (see 
+ * find_wreg_to_reuse()), it is used without saving it again. The code to
+ * restore it that precedes the current instruction is removed then. */
 int
 kedr_handle_type_e_and_m(struct kedr_ir_node *ref_node, u8 base, 
 	unsigned int num, unsigned int nval)
 {
 	int err = 0;
-	struct list_head *insert_after = ref_node->first->list.prev;
+	struct list_head *insert_after;
+	struct list_head *item;
+	struct kedr_ir_node *prev;
+	int no_code_before = (ref_node->first == ref_node);
+	int save_wreg;
+	int restore_wreg;
+	int is_dead;
+	u8 wreg;
 	
-	mk_record_access_common(ref_node, base, nval, insert_after, &err);
+	prev = find_wreg_to_reuse(ref_node, base);
+	wreg = choose_wreg_for_access(ref_node, base, &is_dead);
+	
+	if (prev != NULL && 
+	    ((ref_node->dead_mask & X86_REG_MASK(prev->wreg)) || !is_dead)) {
+		list_del(&prev->wreg_reload->list);
+		kedr_ir_node_destroy(prev->wreg_reload);
+		prev->wreg_reload = NULL;
+		
+		wreg = prev->wreg;
+		save_wreg = 0;
+		restore_wreg = 
+			!(ref_node->dead_mask & X86_REG_MASK(wreg));
+	}
+	else if (wreg != KEDR_REG_NONE) {
+		save_wreg = !is_dead;
+		restore_wreg = !is_dead;
+	}
+	else {
+		warn_no_wreg(ref_node, base);
+		warn_fail(ref_node);
+		return -EILSEQ;
+	}
+	
+	insert_after = ref_node->first->list.prev;
+	item = mk_record_access_wreg(ref_node, base, wreg, save_wreg, 
+		restore_wreg, nval, insert_after, &err);
 	
 	if (err == 0) {
 		ref_node->first = list_entry(insert_after->next, 
 			struct kedr_ir_node, list);
+		if (restore_wreg && no_code_before) {
+			ref_node->wreg_reload = list_entry(item, 
+				struct kedr_ir_node, list);
+			ref_node->wreg = wreg;
+		}
 	}
 	else {
 		warn_fail(ref_node);
@@ -1933,3 +2223,56 @@ kedr_handle_type_xy(struct kedr_ir_node *ref_node,
 	return err;
 }
 /* ====================================================================== */
+
+/* Processing of the only tracked memory access in a function that has no
+ * local storage (see 'fast_leaf_functions' in module.c). The access is 
+ * reported right before the instruction is executed. The instruction must
+ * be of type E and its addressing expression must not use %rsp: the 
+ * expression is evaluated after %rax has been pushed.
+ *
+ * The instructions below do not change the flags.
+ *
+ * Code:
+ *	push %rax
+ *	lea <expr>, %rax
+ *	push %rax                 # kedr_leaf_access::addr
+ *	mov <address_of_block_info>, %rax
+ *	push %rax                 # kedr_leaf_access::info
+ *	mov %rsp, %rax
+ *	call kedr_on_leaf_access_wrapper
+ *	pop %rax
+ *	pop %rax
+ *	pop %rax
+ *	<the original instruction>
+ */
+int
+kedr_handle_leaf_access(struct kedr_ir_node *ref_node, 
+	struct kedr_block_info *info)
+{
+	int err = 0;
+	struct list_head *insert_after = ref_node->first->list.prev;
+	struct list_head *item = insert_after;
+	
+	item = kedr_mk_push_reg(INAT_REG_CODE_AX, item, 0, &err);
+	item = kedr_mk_lea_expr_reg(ref_node, INAT_REG_CODE_AX, item, 0, 
+		&err);
+	item = kedr_mk_push_reg(INAT_REG_CODE_AX, item, 0, &err);
+	item = kedr_mk_mov_ulong_to_ax((unsigned long)info, item, 0, &err);
+	item = kedr_mk_push_reg(INAT_REG_CODE_AX, item, 0, &err);
+	item = kedr_mk_mov_reg_to_reg(INAT_REG_CODE_SP, INAT_REG_CODE_AX,
+		item, 0, &err);
+	item = kedr_mk_call_rel32(
+		(unsigned long)&kedr_on_leaf_access_wrapper, item, 0, &err);
+	item = kedr_mk_pop_reg(INAT_REG_CODE_AX, item, 0, &err);
+	item = kedr_mk_pop_reg(INAT_REG_CODE_AX, item, 0, &err);
+	item = kedr_mk_pop_reg(INAT_REG_CODE_AX, item, 0, &err);
+	
+	if (err == 0)
+		ref_node->first = list_entry(insert_after->next, 
+			struct kedr_ir_node, list);
+	else
+		warn_fail(ref_node);
+	
+	return err;
+}
+/* ====================================================================== */
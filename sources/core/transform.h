@@ -126,6 +126,13 @@ int
 kedr_handle_type_xy(struct kedr_ir_node *ref_node, 
 	struct kedr_block_info *info, u8 base, 
 	unsigned int num, unsigned int nval);
+
+/* ====================================================================== */
+/* Transformation of the functions without local storage */
+/* ====================================================================== */
+int
+kedr_handle_leaf_access(struct kedr_ir_node *ref_node, 
+	struct kedr_block_info *info);
 /* ====================================================================== */
 
 #endif /* TRANSFORM_H_1609_INCLUDED */
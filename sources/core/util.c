@@ -152,4 +152,22 @@ kedr_is_core_address(unsigned long addr, struct module *mod)
 	
 	return 0;
 }
+
+int
+kedr_is_ro_address(unsigned long addr, struct module *mod)
+{
+	BUG_ON(mod == NULL);
+
+	if ((module_core_addr(mod)) &&
+	    (addr >= (unsigned long)(module_core_addr(mod))) &&
+	    (addr < (unsigned long)(module_core_addr(mod)) + core_ro_size(mod)))
+		return 1;
+	
+	if ((module_init_addr(mod)) &&
+	    (addr >= (unsigned long)(module_init_addr(mod))) &&
+	    (addr < (unsigned long)(module_init_addr(mod)) + init_ro_size(mod)))
+		return 1;
+	
+	return 0;
+}
 /* ====================================================================== */
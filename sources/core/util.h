@@ -158,5 +158,11 @@ kedr_is_init_address(unsigned long addr, struct module *mod);
  * the module (may be code or data), 0 otherwise. */
 int
 kedr_is_core_address(unsigned long addr, struct module *mod);
+
+/* Nonzero if 'addr' is the address of some location in the read-only part 
+ * of the "core" or "init" area of the module (code and read-only data), 
+ * 0 otherwise. */
+int
+kedr_is_ro_address(unsigned long addr, struct module *mod);
 /* ====================================================================== */
 #endif /* UTIL_H_1633_INCLUDED */
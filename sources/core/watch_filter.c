@@ -0,0 +1,636 @@
+/* watch_filter.c - filtering of the memory accesses by the address ranges
+ * they refer to. */
+
+/* ========================================================================
+ * Copyright (C) 2014, ROSA Laboratory
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ ======================================================================== */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/string.h>
+#include <linux/errno.h>
+#include <linux/debugfs.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/rcupdate.h>
+#include <linux/seqlock.h>
+#include <asm/uaccess.h>
+
+#include "config.h"
+#include "core_impl.h"
+
+#include "watch_filter.h"
+/* ====================================================================== */
+
+/* The maximum number of the included and excluded ranges (each) and of
+ * the allocation sites. */
+#define KEDR_WATCH_MAX_RANGES 64
+#define KEDR_WATCH_MAX_SITES 16
+
+/* The maximum number of the memory blocks allocated at the specified
+ * sites to be watched at the same time. If more blocks are allocated,
+ * the accesses to the extra ones are not reported. */
+#define KEDR_WATCH_MAX_BLOCKS 256
+
+/* The maximum size of the commands written to the file at once. */
+#define KEDR_WATCH_BUF_SIZE 4096
+
+/* The maximum length of a line when the commands are output. */
+#define KEDR_WATCH_LINE_LEN 64
+
+/* [start, end) */
+struct kedr_watch_range
+{
+	unsigned long start;
+	unsigned long end;
+};
+
+/* The ranges are sorted by their start addresses and do not overlap, so
+ * the binary search can be used to find them. */
+struct kedr_watch_set
+{
+	struct kedr_watch_range include[KEDR_WATCH_MAX_RANGES];
+	struct kedr_watch_range exclude[KEDR_WATCH_MAX_RANGES];
+	unsigned long sites[KEDR_WATCH_MAX_SITES];
+	unsigned int num_include;
+	unsigned int num_exclude;
+	unsigned int num_sites;
+};
+
+/* The current set of ranges and sites, NULL if nothing is specified.
+ * The set is never changed once published. A new set replaces it instead
+ * and the old one is freed after an RCU grace period. So the readers
+ * only need rcu_read_lock() and rcu_dereference().
+ *
+ * 'watch_mutex' serializes the updates of the set. */
+static struct kedr_watch_set *watch_set = NULL;
+static DEFINE_MUTEX(watch_mutex);
+
+/* The memory blocks allocated at the specified sites, sorted, do not
+ * overlap. The array is changed on each allocation and deallocation of
+ * such blocks, so a seqlock is used to protect it rather than RCU, as in
+ * fresh_filter.c. */
+static struct kedr_watch_range watched_blocks[KEDR_WATCH_MAX_BLOCKS];
+static unsigned int num_watched_blocks = 0;
+static DEFINE_SEQLOCK(blocks_lock);
+
+static struct dentry *watch_file = NULL;
+/* ====================================================================== */
+
+/* Returns the index of the first of the 'n' sorted non-overlapping ranges
+ * that ends after 'addr', 'n' if there is no such range. */
+static unsigned int
+find_range(const struct kedr_watch_range *ranges, unsigned int n,
+	unsigned long addr)
+{
+	unsigned int first = 0;
+	unsigned int last = n;
+	unsigned int mid;
+
+	while (first < last) {
+		mid = first + (last - first) / 2;
+		if (ranges[mid].end <= addr)
+			first = mid + 1;
+		else
+			last = mid;
+	}
+	return first;
+}
+
+/* Non-zero if [start, end) overlaps with one of the ranges, 0 otherwise.*/
+static int
+ranges_overlap(const struct kedr_watch_range *ranges, unsigned int n,
+	unsigned long start, unsigned long end)
+{
+	unsigned int i = find_range(ranges, n, start);
+	return (i < n && ranges[i].start < end);
+}
+
+static int
+range_compare(const void *lhs, const void *rhs)
+{
+	const struct kedr_watch_range *left = lhs;
+	const struct kedr_watch_range *right = rhs;
+
+	if (left->start < right->start)
+		return -1;
+	return (left->start > right->start) ? 1 : 0;
+}
+
+/* Sorts the ranges and merges the overlapping and adjacent ones. Returns
+ * the resulting number of the ranges. */
+static unsigned int
+normalize_ranges(struct kedr_watch_range *ranges, unsigned int n)
+{
+	unsigned int i;
+	unsigned int k = 0;
+
+	if (n == 0)
+		return 0;
+
+	sort(ranges, n, sizeof(*ranges), range_compare, NULL);
+	for (i = 1; i < n; ++i) {
+		if (ranges[i].start <= ranges[k].end) {
+			if (ranges[i].end > ranges[k].end)
+				ranges[k].end = ranges[i].end;
+		}
+		else {
+			++k;
+			ranges[k] = ranges[i];
+		}
+	}
+	return k + 1;
+}
+/* ====================================================================== */
+
+void
+kedr_watch_filter_start(void)
+{
+	unsigned long irq_flags;
+
+	write_seqlock_irqsave(&blocks_lock, irq_flags);
+	num_watched_blocks = 0;
+	write_sequnlock_irqrestore(&blocks_lock, irq_flags);
+}
+
+static int
+is_watched_site(unsigned long pc)
+{
+	struct kedr_watch_set *set;
+	unsigned int i;
+	int found = 0;
+
+	rcu_read_lock();
+	set = rcu_dereference(watch_set);
+	if (set != NULL) {
+		for (i = 0; i < set->num_sites; ++i) {
+			if (set->sites[i] == pc) {
+				found = 1;
+				break;
+			}
+		}
+	}
+	rcu_read_unlock();
+	return found;
+}
+
+void
+kedr_watch_filter_alloc(unsigned long pc, unsigned long addr,
+	unsigned long size)
+{
+	unsigned long end = addr + size;
+	unsigned long irq_flags;
+	unsigned int n;
+	unsigned int i;
+	unsigned int k;
+	int added = 0;
+
+	if (addr == 0 || size == 0 || !is_watched_site(pc))
+		return;
+
+	write_seqlock_irqsave(&blocks_lock, irq_flags);
+	n = num_watched_blocks;
+	i = find_range(watched_blocks, n, addr);
+
+	/* If the new block overlaps with some of the blocks we know, the
+	 * deallocation of the latter must have been missed. Forget them. */
+	k = i;
+	while (k < n && watched_blocks[k].start < end)
+		++k;
+	if (k != i) {
+		memmove(&watched_blocks[i], &watched_blocks[k],
+			(n - k) * sizeof(watched_blocks[0]));
+		n -= k - i;
+	}
+
+	if (n < KEDR_WATCH_MAX_BLOCKS) {
+		memmove(&watched_blocks[i + 1], &watched_blocks[i],
+			(n - i) * sizeof(watched_blocks[0]));
+		watched_blocks[i].start = addr;
+		watched_blocks[i].end = end;
+		++n;
+		added = 1;
+	}
+	num_watched_blocks = n;
+	write_sequnlock_irqrestore(&blocks_lock, irq_flags);
+
+	if (!added && printk_ratelimit()) {
+		pr_warning(KEDR_MSG_PREFIX
+		"Too many memory blocks to watch, the accesses to "
+		"[%lx, %lx) will not be reported.\n", addr, end);
+	}
+}
+
+void
+kedr_watch_filter_free(unsigned long addr)
+{
+	unsigned long irq_flags;
+	unsigned int n;
+	unsigned int i;
+
+	if (addr == 0 || ACCESS_ONCE(num_watched_blocks) == 0)
+		return;
+
+	write_seqlock_irqsave(&blocks_lock, irq_flags);
+	n = num_watched_blocks;
+	i = find_range(watched_blocks, n, addr);
+	if (i < n && watched_blocks[i].start == addr) {
+		memmove(&watched_blocks[i], &watched_blocks[i + 1],
+			(n - i - 1) * sizeof(watched_blocks[0]));
+		num_watched_blocks = n - 1;
+	}
+	write_sequnlock_irqrestore(&blocks_lock, irq_flags);
+}
+
+static int
+is_watched_block(unsigned long start, unsigned long end)
+{
+	unsigned int seq;
+	int ret;
+
+	if (ACCESS_ONCE(num_watched_blocks) == 0)
+		return 0;
+
+	do {
+		seq = read_seqbegin(&blocks_lock);
+		ret = ranges_overlap(watched_blocks, num_watched_blocks,
+				     start, end);
+	} while (read_seqretry(&blocks_lock, seq));
+	return ret;
+}
+
+int
+kedr_is_watch_filtered(unsigned long addr, unsigned long size)
+{
+	struct kedr_watch_set *set;
+	unsigned long end = addr + size;
+	int filtered = 0;
+
+	rcu_read_lock();
+	set = rcu_dereference(watch_set);
+	if (set == NULL)
+		goto out;
+
+	if (set->num_include != 0 || set->num_sites != 0) {
+		filtered = !ranges_overlap(set->include, set->num_include,
+					   addr, end) &&
+			   !is_watched_block(addr, end);
+	}
+
+	if (!filtered && set->num_exclude != 0)
+		filtered = ranges_overlap(set->exclude, set->num_exclude,
+					  addr, end);
+out:
+	rcu_read_unlock();
+
+	/* The counter is updated without synchronization, like the
+	 * counters of the blocks (see module.c). */
+	if (filtered)
+		++watch_accesses_filtered;
+	return filtered;
+}
+/* ====================================================================== */
+
+static int
+add_range(struct kedr_watch_range *ranges, unsigned int *num,
+	unsigned long start, unsigned long end)
+{
+	if (*num == KEDR_WATCH_MAX_RANGES)
+		*num = normalize_ranges(ranges, *num);
+	if (*num == KEDR_WATCH_MAX_RANGES)
+		return -ENOSPC;
+
+	ranges[*num].start = start;
+	ranges[*num].end = end;
+	++(*num);
+	return 0;
+}
+
+static int
+add_site(struct kedr_watch_set *set, unsigned long pc)
+{
+	unsigned int i;
+
+	for (i = 0; i < set->num_sites; ++i) {
+		if (set->sites[i] == pc)
+			return 0;
+	}
+
+	if (set->num_sites == KEDR_WATCH_MAX_SITES)
+		return -ENOSPC;
+
+	set->sites[set->num_sites] = pc;
+	++set->num_sites;
+	return 0;
+}
+
+static int
+parse_number(const char *str, unsigned long *val)
+{
+	char *end;
+
+	*val = simple_strtoul(str, &end, 16);
+	return (*end == 0) ? 0 : -EINVAL;
+}
+
+/* Splits the line into at most 'max' whitespace-separated tokens. Returns
+ * the number of the tokens, 'max + 1' if there are more. */
+static unsigned int
+split_line(char *line, char **tokens, unsigned int max)
+{
+	unsigned int n = 0;
+	char *tok;
+
+	while ((tok = strsep(&line, " \t\r")) != NULL) {
+		if (*tok == 0)
+			continue;
+		if (n == max)
+			return max + 1;
+		tokens[n] = tok;
+		++n;
+	}
+	return n;
+}
+
+/* Executes the command in 'line' for the set. If the command is "clear",
+ * '*cleared' is set to 1. */
+static int
+apply_command(struct kedr_watch_set *set, char *line, int *cleared)
+{
+	char *tokens[3];
+	unsigned int n;
+	unsigned long start;
+	unsigned long end;
+	int ret;
+
+	n = split_line(line, tokens, 3);
+	if (n == 0 || tokens[0][0] == '#')
+		return 0;
+
+	if (strcmp(tokens[0], "clear") == 0 && n == 1) {
+		memset(set, 0, sizeof(*set));
+		*cleared = 1;
+		return 0;
+	}
+
+	if (strcmp(tokens[0], "site") == 0 && n == 2) {
+		ret = parse_number(tokens[1], &start);
+		if (ret != 0)
+			return ret;
+		return add_site(set, start);
+	}
+
+	if (n != 3)
+		return -EINVAL;
+
+	ret = parse_number(tokens[1], &start);
+	if (ret != 0)
+		return ret;
+	ret = parse_number(tokens[2], &end);
+	if (ret != 0)
+		return ret;
+	if (start >= end)
+		return -EINVAL;
+
+	if (strcmp(tokens[0], "include") == 0)
+		return add_range(set->include, &set->num_include, start, end);
+	if (strcmp(tokens[0], "exclude") == 0)
+		return add_range(set->exclude, &set->num_exclude, start, end);
+	return -EINVAL;
+}
+
+/* Executes the commands from 'buf' and publishes the resulting set. If a
+ * command is invalid, nothing is changed. */
+static int
+apply_commands(char *buf)
+{
+	struct kedr_watch_set *set;
+	struct kedr_watch_set *old_set;
+	unsigned int lineno = 0;
+	int cleared = 0;
+	char *line;
+	int ret = 0;
+
+	set = kzalloc(sizeof(*set), GFP_KERNEL);
+	if (set == NULL)
+		return -ENOMEM;
+
+	if (mutex_lock_killable(&watch_mutex) != 0) {
+		pr_warning(KEDR_MSG_PREFIX "apply_commands(): "
+			"got a signal while trying to acquire a mutex.\n");
+		kfree(set);
+		return -EINTR;
+	}
+
+	old_set = watch_set;
+	if (old_set != NULL)
+		memcpy(set, old_set, sizeof(*set));
+
+	while ((line = strsep(&buf, "\n")) != NULL) {
+		++lineno;
+		ret = apply_command(set, line, &cleared);
+		if (ret != 0) {
+			pr_warning(KEDR_MSG_PREFIX
+			"\"watch\": failed to execute the command at line "
+			"%u, error: %d.\n", lineno, ret);
+			mutex_unlock(&watch_mutex);
+			kfree(set);
+			return ret;
+		}
+	}
+
+	set->num_include = normalize_ranges(set->include, set->num_include);
+	set->num_exclude = normalize_ranges(set->exclude, set->num_exclude);
+	if (set->num_include == 0 && set->num_exclude == 0 &&
+	    set->num_sites == 0) {
+		kfree(set);
+		set = NULL;
+	}
+
+	rcu_assign_pointer(watch_set, set);
+	if (cleared)
+		kedr_watch_filter_start();
+	mutex_unlock(&watch_mutex);
+
+	if (old_set != NULL) {
+		synchronize_rcu();
+		kfree(old_set);
+	}
+	return 0;
+}
+
+/* Outputs the current set as the commands that would create it. */
+static char *
+format_watch_set(void)
+{
+	struct kedr_watch_set *set = watch_set;
+	size_t size = KEDR_WATCH_LINE_LEN + 1;
+	size_t len = 0;
+	unsigned int i;
+	char *buf;
+
+	if (set != NULL)
+		size += KEDR_WATCH_LINE_LEN * (set->num_include +
+			set->num_exclude + set->num_sites);
+
+	buf = kzalloc(size, GFP_KERNEL);
+	if (buf == NULL || set == NULL)
+		return buf;
+
+	for (i = 0; i < set->num_include; ++i) {
+		len += snprintf(&buf[len], size - len,
+			"include 0x%lx 0x%lx\n",
+			set->include[i].start, set->include[i].end);
+	}
+	for (i = 0; i < set->num_exclude; ++i) {
+		len += snprintf(&buf[len], size - len,
+			"exclude 0x%lx 0x%lx\n",
+			set->exclude[i].start, set->exclude[i].end);
+	}
+	for (i = 0; i < set->num_sites; ++i) {
+		len += snprintf(&buf[len], size - len,
+			"site 0x%lx\n", set->sites[i]);
+	}
+	snprintf(&buf[len], size - len, "# memory blocks watched: %u\n",
+		 ACCESS_ONCE(num_watched_blocks));
+	return buf;
+}
+/* ====================================================================== */
+
+/* File: "watch", read-write. If the file is opened for writing, the
+ * commands are accumulated in the buffer and executed when the file is
+ * closed. If it is opened for reading, the buffer contains the current
+ * set of ranges. */
+static int
+watch_open(struct inode *inode, struct file *filp)
+{
+	char *buf;
+
+	if ((filp->f_mode & FMODE_READ) && (filp->f_mode & FMODE_WRITE))
+		return -EINVAL;
+
+	if (filp->f_mode & FMODE_WRITE) {
+		buf = kzalloc(KEDR_WATCH_BUF_SIZE, GFP_KERNEL);
+	}
+	else {
+		if (mutex_lock_killable(&watch_mutex) != 0) {
+			pr_warning(KEDR_MSG_PREFIX "watch_open(): "
+			"got a signal while trying to acquire a mutex.\n");
+			return -EINTR;
+		}
+		buf = format_watch_set();
+		mutex_unlock(&watch_mutex);
+	}
+
+	if (buf == NULL)
+		return -ENOMEM;
+	filp->private_data = buf;
+	return nonseekable_open(inode, filp);
+}
+
+static int
+watch_release(struct inode *inode, struct file *filp)
+{
+	char *buf = filp->private_data;
+	int ret = 0;
+
+	if (filp->f_mode & FMODE_WRITE)
+		ret = apply_commands(buf);
+
+	kfree(buf);
+	filp->private_data = NULL;
+	return ret;
+}
+
+static ssize_t
+watch_read(struct file *filp, char __user *buf, size_t count,
+	loff_t *f_pos)
+{
+	loff_t pos = *f_pos;
+	const char *data = filp->private_data;
+	size_t data_len = strlen(data);
+
+	/* Reading outside of the data buffer is not allowed */
+	if ((pos < 0) || (pos > data_len))
+		return -EINVAL;
+
+	/* EOF reached or 0 bytes requested */
+	if ((count == 0) || (pos == data_len))
+		return 0;
+
+	if (pos + count > data_len)
+		count = data_len - pos;
+	if (copy_to_user(buf, &data[pos], count) != 0)
+		return -EFAULT;
+
+	*f_pos += count;
+	return count;
+}
+
+static ssize_t
+watch_write(struct file *filp, const char __user *buf, size_t count,
+	loff_t *f_pos)
+{
+	loff_t pos = *f_pos;
+	char *data = filp->private_data;
+
+	if (pos < 0)
+		return -EINVAL;
+
+	/* 0 bytes to be written, nothing to do */
+	if (count == 0)
+		return 0;
+
+	/* Check if the buffer has enough space for the data, including the
+	 * terminating 0. */
+	if ((size_t)pos + count + 1 > KEDR_WATCH_BUF_SIZE)
+		return -ENOSPC;
+
+	if (copy_from_user(&data[pos], buf, count) != 0)
+		return -EFAULT;
+
+	*f_pos += count;
+	return count;
+}
+
+static const struct file_operations watch_ops = {
+	.owner = THIS_MODULE,
+	.open = watch_open,
+	.release = watch_release,
+	.read = watch_read,
+	.write = watch_write,
+};
+/* ====================================================================== */
+
+int
+kedr_init_watch_filter(struct dentry *debugfs_dir)
+{
+	BUG_ON(debugfs_dir == NULL);
+
+	watch_file = debugfs_create_file("watch", S_IRUSR | S_IWUSR,
+		debugfs_dir, NULL, &watch_ops);
+	if (watch_file == NULL) {
+		pr_warning(KEDR_MSG_PREFIX
+			"Failed to create a file in debugfs (\"watch\").\n");
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+void
+kedr_cleanup_watch_filter(void)
+{
+	if (watch_file != NULL)
+		debugfs_remove(watch_file);
+	watch_file = NULL;
+
+	/* No target is loaded at this point, so there are no readers. */
+	kfree(watch_set);
+	watch_set = NULL;
+}
+/* ====================================================================== */
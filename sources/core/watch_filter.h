@@ -0,0 +1,73 @@
+/* watch_filter.h - filtering of the memory accesses by the address ranges
+ * they refer to. This allows to focus the analysis on particular objects,
+ * e.g. when looking for the cause of a memory corruption.
+ *
+ * The ranges are specified by writing commands to "kedr_mem_core/watch"
+ * file in debugfs, one command per line, the numbers are hex values
+ * possibly prefixed with "0x":
+ *
+ * - "include <start> <end>" - report the accesses to [start, end);
+ *
+ * - "exclude <start> <end>" - do not report the accesses to [start, end);
+ *
+ * - "site <pc>" - report the accesses to the memory blocks allocated at
+ *   the given location in the code (the same 'pc' as in the "alloc" events
+ *   of the trace), from the allocation until the block is freed;
+ *
+ * - "clear" - remove all the ranges and the allocation sites.
+ *
+ * If no "include" ranges and no allocation sites are specified, all
+ * accesses are reported except the excluded ones. Otherwise, only the
+ * accesses overlapping with the included ranges or with the memory blocks
+ * allocated at the specified sites are reported, again, except the
+ * excluded ones.
+ *
+ * Reading the file outputs the current ranges and sites as the commands
+ * listed above.
+ *
+ * Only the memory access events are filtered this way, the events for
+ * locked operations, I/O memory operations, allocations, deallocations and
+ * synchronization are reported as usual.
+ *
+ * The ranges can be changed at any time, even when the target is running.
+ * The blocks allocated at the specified sites are forgotten when a new
+ * session starts or when "clear" command is executed. */
+
+#ifndef WATCH_FILTER_H_1209_INCLUDED
+#define WATCH_FILTER_H_1209_INCLUDED
+
+#include <linux/fs.h>
+/* ====================================================================== */
+
+/* Initialize the subsystem, create the file in the given directory in
+ * debugfs. */
+int
+kedr_init_watch_filter(struct dentry *debugfs_dir);
+
+/* Clean up the subsystem (delete its file in debugfs, etc.). */
+void
+kedr_cleanup_watch_filter(void);
+
+/* Forget the memory blocks allocated at the specified sites. Call this
+ * before a session starts. */
+void
+kedr_watch_filter_start(void);
+
+/* Remember the memory block [addr, addr + size) if it has been allocated
+ * at one of the specified sites. */
+void
+kedr_watch_filter_alloc(unsigned long pc, unsigned long addr,
+	unsigned long size);
+
+/* Forget the memory block starting at 'addr' if it is remembered. */
+void
+kedr_watch_filter_free(unsigned long addr);
+
+/* Returns non-zero if the access to [addr, addr + size) must not be
+ * reported according to the specified ranges, 0 otherwise.
+ * Updates 'watch_accesses_filtered' counter.
+ * May be called in atomic context. */
+int
+kedr_is_watch_filtered(unsigned long addr, unsigned long size);
+/* ====================================================================== */
+#endif /* WATCH_FILTER_H_1209_INCLUDED */
@@ -84,6 +84,8 @@ public:
     class PacketEventIterator;
     /* Iterator through events in the stream(can cross packet boundaries)*/
     class EventIterator;
+    /* Stream file mapped into memory. */
+    class StreamMap;
 
     /* One packet with CTF metadata */
     class MetaPacket;
@@ -122,6 +124,13 @@ public:
      * First packet in the stream.
      */
     Packet(const CTFReader& reader, std::istream& s);
+    /*
+     * First packet in the mapped stream.
+     * 
+     * Packet and all events in it are views into the mapping,
+     * no data is copied.
+     */
+    Packet(const CTFReader& reader, StreamMap& streamMap);
     /* Copy packet */
     Packet(const Packet& packet);
     ~Packet();
@@ -144,10 +153,14 @@ protected:
         int* mapStartShift_p);
 private:
 	void setupPacket(void);
+	/* Common initialization for all non-copy constructors. */
+	void initPacket(void);
 
 	int refs;
 
-   	std::istream& s;
+	/* Exactly one of 's' and 'streamMap' is not NULL. */
+	std::istream* s;
+	StreamMap* streamMap;
 	off_t streamMapStart;
 
 	char* mapStart;
@@ -173,6 +186,13 @@ public:
     ~Event();
 
     Packet& getPacket(void) const {return *packet;}
+    /*
+     * Return offset(in bits) of the event start relative to
+     * the start of the mapping(see CTFContext::mapStart()).
+     * 
+     * May be used for user-defined interpretation of the event.
+     */
+    int getStartOffset(void) const;
     /* 
      * Move to the next event in the stream. 
      * 
@@ -223,6 +243,9 @@ public:
     /* Create iterator pointed to the first packet in the stream */
     PacketIterator(const CTFReader& reader, std::istream& s)
         : packet(new Packet(reader, s)) {}
+    /* Same but for mapped stream */
+    PacketIterator(const CTFReader& reader, StreamMap& streamMap)
+        : packet(new Packet(reader, streamMap)) {}
     /* Copy iterator */
     PacketIterator(const PacketIterator& packetIterator)
         : packet(packetIterator.packet) {if(packet) packet->ref();}
@@ -332,6 +355,13 @@ public:
         event = new Event(*packet);
         packet->unref();
     }
+    /* Same but for mapped stream */
+    EventIterator(const CTFReader& reader, StreamMap& streamMap)
+    {
+        Packet* packet = new Packet(reader, streamMap);
+        event = new Event(*packet);
+        packet->unref();
+    }
     
     EventIterator(const EventIterator& eventIterator)
         : event(eventIterator.event) {if(event) event->ref();}
@@ -377,6 +407,51 @@ private:
 };
 
 
+/*
+ * Stream file mapped into memory.
+ * 
+ * Packets and events created for such stream refer to the mapping
+ * directly instead of reading and copying stream data. Each packet
+ * holds a reference to the mapping, so cloned iterators remain valid
+ * after the original ones are destroyed.
+ * 
+ * Mapping is advised for sequential access, and read-ahead is
+ * requested as packets are advanced.
+ */
+class CTFReader::StreamMap
+{
+public:
+    /* Map file with given name. */
+    StreamMap(const std::string& filename);
+
+    /* Return pointer to the start of the mapping. */
+    const char* getData(void) const {return data;}
+    /* Return size of the mapped file, in bytes. */
+    off_t getSize(void) const {return size;}
+
+    /* 
+     * Notify that data at given offset are going to be read.
+     * 
+     * Request read-ahead for data after that offset, if needed.
+     */
+    void willRead(off_t offset);
+
+    void ref(void) {refs++;}
+    void unref(void) {if(--refs == 0) delete this;}
+private:
+    StreamMap(const StreamMap& streamMap); /* not implemented */
+    /* Object must be created in the heap */
+    ~StreamMap(void);
+
+    int refs;
+
+    char* data;
+    off_t size;
+
+    /* End of the region for which read-ahead has been requested. */
+    off_t readaheadEnd;
+};
+
 class CTFReader::MetaPacket
 {
 public:
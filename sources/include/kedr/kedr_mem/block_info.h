@@ -77,6 +77,16 @@ struct kedr_block_info
 	/* The list of such structures for a particular function. */
 	struct list_head list;
 	
+	/* ID of the block. The IDs are assigned when the target module has
+	 * been instrumented, in the order the blocks are listed for the 
+	 * functions, starting from 1 for the first target loaded in the 
+	 * session. So, the IDs are unique within the session and the same
+	 * for the same targets loaded in the same order. The output system
+	 * gets the information about each block (see on_block_info() 
+	 * handler in core_api.h) and may use the IDs instead of that 
+	 * information in the trace. */
+	unsigned long id;
+	
 	/* The number of the elements in events[] array (see below). The 
 	 * block of code may contain no more than 'max_events' operations 
 	 * with memory. For most of the instructions accessing memory, each
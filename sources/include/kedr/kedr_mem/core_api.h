@@ -7,6 +7,7 @@
 #include <kedr/object_types.h>
 
 struct module;
+struct kedr_block_info;
 
 /* The meaning of the arguments:
  *	eh - the pointer passed during registration
@@ -111,6 +112,31 @@ struct kedr_event_handlers
 		enum kedr_memory_event_type type,
 		void *data);
 	
+	/* (optional) Information about the blocks of code with memory 
+	 * accesses, see struct kedr_block_info in block_info.h.
+	 * 
+	 * on_block_info() is called for each such block of the target 
+	 * module after on_target_loaded(), before the code of the target 
+	 * is executed. The handler is executed in a non-atomic context. 
+	 * The structure remains valid until the target is unloaded.
+	 * 
+	 * If begin_block_events() is set, it is called instead of 
+	 * begin_memory_events() for the memory events from a block. 
+	 * on_memory_event() is then called for the events in the order
+	 * they are listed in info->events[] and end_memory_events() is 
+	 * called after that, as described above. This allows the output 
+	 * system to store only the ID of the block and the addresses of 
+	 * the accessed memory areas for the events rather than everything
+	 * known about them at the instrumentation phase.
+	 * [NB] begin_memory_events() is still used for the memory events
+	 * the plugins report with kedr_eh_on_single_memory_event(), etc. */
+	void (*on_block_info)(struct kedr_event_handlers *eh, 
+		struct module *target_module, 
+		const struct kedr_block_info *info);
+	void (*begin_block_events)(struct kedr_event_handlers *eh, 
+		unsigned long tid, const struct kedr_block_info *info,
+		void **pdata /* out param*/);
+	
 	/* Memory barriers (pre & post handlers) */
 	/* MB1: locked operations */
 	void (*on_locked_op_pre)(struct kedr_event_handlers *eh, 
@@ -267,6 +293,84 @@ struct kedr_event_handlers *
 kedr_get_event_handlers(void);
 /* ====================================================================== */
 
+/* The thread has performed an operation that may establish a 
+ * happens-before relation with other threads (locking, signal/wait, a 
+ * locked operation, thread creation, etc.). 
+ * The core uses this information if it is configured to filter out the
+ * repeated memory accesses of a thread between such points (see 
+ * 'filter_repeated_accesses' parameter of the core). The kedr_eh_*() 
+ * functions for these events call kedr_mark_sync_point() automatically, 
+ * so it is only needed if the handlers are called directly. */
+void
+kedr_mark_sync_point(unsigned long tid);
+
+/* Similar to kedr_mark_sync_point() but for the operations that may 
+ * reuse memory (allocation and deallocation). The core forgets the memory
+ * accesses seen so far for all threads in this case. */
+void
+kedr_mark_memory_reuse(void);
+
+/* Similar to kedr_mark_sync_point() but for the operations of "release" 
+ * type, i.e. the ones that may publish the data of the thread to other 
+ * threads: unlocking, signal, a locked operation, a memory barrier, 
+ * thread creation, etc. Calls kedr_mark_sync_point() too. 
+ * The objects the thread has allocated before are no longer considered
+ * private to it after that (see 'filter_fresh_objects' parameter of the 
+ * core). */
+void
+kedr_mark_release_point(unsigned long tid);
+
+/* The thread has allocated the memory area [addr, addr + size) at the 
+ * location 'pc' in the code or the area at 'addr' is about to be freed, 
+ * respectively. The core uses this to filter out the accesses to the 
+ * freshly allocated objects and to watch the objects allocated at the 
+ * given locations if it is configured to do so. kedr_eh_on_alloc_post() 
+ * and kedr_eh_on_free_pre() call these functions automatically. */
+void
+kedr_mark_alloc(unsigned long tid, unsigned long pc, unsigned long addr,
+	unsigned long size);
+
+void
+kedr_mark_free(unsigned long addr);
+/* ====================================================================== */
+
+/* If the core maintains the shadow call stacks of the threads (see 
+ * 'shadow_call_stacks' parameter of the core), each call stack seen in 
+ * the current session has a unique non-zero ID. A call stack consists of 
+ * the addresses of the call instructions in the functions of the targets
+ * that have been called but have not returned yet, the innermost call
+ * first. The calls made by the code not under analysis are not included.
+ * The ID of a stack remains valid until the session ends.
+ * 
+ * kedr_shadow_stacks_enabled() returns non-zero if the core maintains the
+ * shadow call stacks, 0 otherwise. If it returns 0, the functions listed
+ * below are still available but provide no stacks.
+ *
+ * kedr_get_stack_id() returns the ID of the current call stack of the 
+ * thread, 0 if the stack is empty or the shadow stacks are disabled. 
+ * The function must be called by that thread itself, e.g. from the 
+ * handlers of its memory and synchronization events, it returns 0 
+ * otherwise. 
+ *
+ * kedr_get_stack_frame() retrieves the address of the innermost call in
+ * the stack with the given ID and the ID of the stack without that call
+ * (0 if the latter stack is empty). Returns 0 on success, -EINVAL if the
+ * ID is not valid. May be called in atomic context.
+ *
+ * This way, the providers of the event handlers may record each call 
+ * stack only once and refer to it by its ID instead of recording all 
+ * function entry/exit and call events. */
+int
+kedr_shadow_stacks_enabled(void);
+
+unsigned int
+kedr_get_stack_id(unsigned long tid);
+
+int
+kedr_get_stack_frame(unsigned int stack_id, unsigned long *pc, 
+	unsigned int *parent_id);
+/* ====================================================================== */
+
 /* These functions should be used if it is needed to obtain the current set 
  * of handlers and call some of these handlers. The functions have no effect
  * if the corresponding handlers are not set. 
@@ -314,6 +418,7 @@ kedr_eh_on_alloc_pre(unsigned long tid, unsigned long pc,
 	unsigned long size)
 {
 	struct kedr_event_handlers *eh = kedr_get_event_handlers();
+	kedr_mark_memory_reuse();
 	if (eh->on_alloc_pre != NULL)
 		eh->on_alloc_pre(eh, tid, pc, size);
 }
@@ -323,6 +428,8 @@ kedr_eh_on_alloc_post(unsigned long tid, unsigned long pc,
 	unsigned long size, unsigned long addr)
 {
 	struct kedr_event_handlers *eh = kedr_get_event_handlers();
+	kedr_mark_memory_reuse();
+	kedr_mark_alloc(tid, pc, addr, size);
 	if (eh->on_alloc_post != NULL)
 		eh->on_alloc_post(eh, tid, pc, size, addr);
 }
@@ -341,6 +448,8 @@ kedr_eh_on_free_pre(unsigned long tid, unsigned long pc,
 	unsigned long addr)
 {
 	struct kedr_event_handlers *eh = kedr_get_event_handlers();
+	kedr_mark_memory_reuse();
+	kedr_mark_free(addr);
 	if (eh->on_free_pre != NULL)
 		eh->on_free_pre(eh, tid, pc, addr);
 }
@@ -350,6 +459,7 @@ kedr_eh_on_free_post(unsigned long tid, unsigned long pc,
 	unsigned long addr)
 {
 	struct kedr_event_handlers *eh = kedr_get_event_handlers();
+	kedr_mark_memory_reuse();
 	if (eh->on_free_post != NULL)
 		eh->on_free_post(eh, tid, pc, addr);
 }
@@ -366,6 +476,7 @@ static inline void
 kedr_eh_on_locked_op_pre(unsigned long tid, unsigned long pc, void **pdata)
 {
 	struct kedr_event_handlers *eh = kedr_get_event_handlers();
+	kedr_mark_release_point(tid);
 	if (eh->on_locked_op_pre != NULL)
 		eh->on_locked_op_pre(eh, tid, pc, pdata);
 }
@@ -376,6 +487,7 @@ kedr_eh_on_locked_op_post(unsigned long tid, unsigned long pc,
 	enum kedr_memory_event_type type, void *data)
 {
 	struct kedr_event_handlers *eh = kedr_get_event_handlers();
+	kedr_mark_release_point(tid);
 	if (eh->on_locked_op_post != NULL)
 		eh->on_locked_op_post(eh, tid, pc, addr, size, type, data);
 }
@@ -385,6 +497,7 @@ kedr_eh_on_lock_pre(unsigned long tid, unsigned long pc,
 	unsigned long lock_id, enum kedr_lock_type type)
 {
 	struct kedr_event_handlers *eh = kedr_get_event_handlers();
+	kedr_mark_sync_point(tid);
 	if (eh->on_lock_pre != NULL)
 		eh->on_lock_pre(eh, tid, pc, lock_id, type);
 }
@@ -394,6 +507,7 @@ kedr_eh_on_lock_post(unsigned long tid, unsigned long pc,
 	unsigned long lock_id, enum kedr_lock_type type)
 {
 	struct kedr_event_handlers *eh = kedr_get_event_handlers();
+	kedr_mark_sync_point(tid);
 	if (eh->on_lock_post != NULL)
 		eh->on_lock_post(eh, tid, pc, lock_id, type);
 }
@@ -412,6 +526,7 @@ kedr_eh_on_unlock_pre(unsigned long tid, unsigned long pc,
 	unsigned long lock_id, enum kedr_lock_type type)
 {
 	struct kedr_event_handlers *eh = kedr_get_event_handlers();
+	kedr_mark_release_point(tid);
 	if (eh->on_unlock_pre != NULL)
 		eh->on_unlock_pre(eh, tid, pc, lock_id, type);
 }
@@ -421,6 +536,7 @@ kedr_eh_on_unlock_post(unsigned long tid, unsigned long pc,
 	unsigned long lock_id, enum kedr_lock_type type)
 {
 	struct kedr_event_handlers *eh = kedr_get_event_handlers();
+	kedr_mark_release_point(tid);
 	if (eh->on_unlock_post != NULL)
 		eh->on_unlock_post(eh, tid, pc, lock_id, type);
 }
@@ -439,6 +555,7 @@ kedr_eh_on_signal_pre(unsigned long tid, unsigned long pc,
 	unsigned long obj_id, enum kedr_sw_object_type type)
 {
 	struct kedr_event_handlers *eh = kedr_get_event_handlers();
+	kedr_mark_release_point(tid);
 	if (eh->on_signal_pre != NULL)
 		eh->on_signal_pre(eh, tid, pc, obj_id, type);
 }
@@ -448,6 +565,7 @@ kedr_eh_on_signal_post(unsigned long tid, unsigned long pc,
 	unsigned long obj_id, enum kedr_sw_object_type type)
 {
 	struct kedr_event_handlers *eh = kedr_get_event_handlers();
+	kedr_mark_release_point(tid);
 	if (eh->on_signal_post != NULL)
 		eh->on_signal_post(eh, tid, pc, obj_id, type);
 }
@@ -466,6 +584,7 @@ kedr_eh_on_wait_pre(unsigned long tid, unsigned long pc,
 	unsigned long obj_id, enum kedr_sw_object_type type)
 {
 	struct kedr_event_handlers *eh = kedr_get_event_handlers();
+	kedr_mark_sync_point(tid);
 	if (eh->on_wait_pre != NULL)
 		eh->on_wait_pre(eh, tid, pc, obj_id, type);
 }
@@ -475,6 +594,7 @@ kedr_eh_on_wait_post(unsigned long tid, unsigned long pc,
 	unsigned long obj_id, enum kedr_sw_object_type type)
 {
 	struct kedr_event_handlers *eh = kedr_get_event_handlers();
+	kedr_mark_sync_point(tid);
 	if (eh->on_wait_post != NULL)
 		eh->on_wait_post(eh, tid, pc, obj_id, type);
 }
@@ -492,6 +612,7 @@ static inline void
 kedr_eh_on_thread_create_pre(unsigned long tid, unsigned long pc)
 {
 	struct kedr_event_handlers *eh = kedr_get_event_handlers();
+	kedr_mark_release_point(tid);
 	if (eh->on_thread_create_pre != NULL)
 		eh->on_thread_create_pre(eh, tid, pc);
 }
@@ -501,6 +622,7 @@ kedr_eh_on_thread_create_post(unsigned long tid, unsigned long pc,
 	unsigned long child_tid)
 {
 	struct kedr_event_handlers *eh = kedr_get_event_handlers();
+	kedr_mark_release_point(tid);
 	if (eh->on_thread_create_post != NULL)
 		eh->on_thread_create_post(eh, tid, pc, child_tid);
 }
@@ -510,6 +632,7 @@ kedr_eh_on_thread_join_pre(unsigned long tid, unsigned long pc,
 	unsigned long child_tid)
 {
 	struct kedr_event_handlers *eh = kedr_get_event_handlers();
+	kedr_mark_sync_point(tid);
 	if (eh->on_thread_join_pre != NULL)
 		eh->on_thread_join_pre(eh, tid, pc, child_tid);
 }
@@ -519,6 +642,7 @@ kedr_eh_on_thread_join_post(unsigned long tid, unsigned long pc,
 	unsigned long child_tid)
 {
 	struct kedr_event_handlers *eh = kedr_get_event_handlers();
+	kedr_mark_sync_point(tid);
 	if (eh->on_thread_join_post != NULL)
 		eh->on_thread_join_post(eh, tid, pc, child_tid);
 }
@@ -536,6 +660,7 @@ static inline void
 kedr_eh_on_thread_start(unsigned long tid, const char *comm)
 {
 	struct kedr_event_handlers *eh = kedr_get_event_handlers();
+	kedr_mark_sync_point(tid);
 	if (eh->on_thread_start != NULL)
 		eh->on_thread_start(eh, tid, comm);
 }
@@ -544,6 +669,7 @@ static inline void
 kedr_eh_on_thread_end(unsigned long tid)
 {
 	struct kedr_event_handlers *eh = kedr_get_event_handlers();
+	kedr_mark_release_point(tid);
 	if (eh->on_thread_end != NULL)
 		eh->on_thread_end(eh, tid);
 }
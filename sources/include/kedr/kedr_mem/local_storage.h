@@ -224,6 +224,22 @@ struct kedr_local_storage
 	/* Similar to 'temp_bx' and 'temp_bp', an additional temporary slot
 	 * used in kedr_thunk_*(). */
 	unsigned long temp_aux;
+
+	/* The shadow call stack of the thread (see 'shadow_call_stacks'
+	 * parameter of the core). 'caller_ls' is the local storage of the
+	 * function of the target that has called this function in the same
+	 * thread, NULL if this function has been called from elsewhere.
+	 * 'stack_id' is the ID of the call stack at the entry of this 
+	 * function, 0 if the stack is empty or unknown. 
+	 * 'call_pc' is the address of the call instruction (in the original
+	 * code) this function is currently executing, 0 if it is not
+	 * executing a call. Set and cleared by kedr_thunk_call() and
+	 * kedr_thunk_jmp().
+	 * For internal use in kedr_mem_core only. Use kedr_get_stack_id()
+	 * to obtain the ID of the current call stack of a thread. */
+	struct kedr_local_storage *caller_ls;
+	unsigned int stack_id;
+	unsigned long call_pc;
 };
 
 /* The allocator of kedr_local_storage instances. 
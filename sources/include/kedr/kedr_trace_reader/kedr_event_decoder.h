@@ -0,0 +1,237 @@
+/*
+ * Fast decoding of events in the trace generated by KEDR.
+ */
+
+#ifndef KEDR_EVENT_DECODER_H
+#define KEDR_EVENT_DECODER_H
+
+#include <kedr/ctf_reader/ctf_reader.h>
+
+#include <vector>
+
+/*
+ * Plain representation of one event in the KEDR trace.
+ *
+ * Fields which have no sence for the event type are 0.
+ */
+struct KEDREvent
+{
+    /* Types of the events, same as in 'output/kernel/trace_definition.h' */
+    enum Type
+    {
+        typeMA = 0,
+        typeLMAUpdate,
+        typeLMARead,
+        typeLMAWrite,
+        typeIOMA,
+        typeMRB,
+        typeMWB,
+        typeMFB,
+        typeAlloc,
+        typeFree,
+        typeLock,
+        typeUnlock,
+        typeRLock,
+        typeRUnlock,
+        typeSignal,
+        typeWait,
+        typeTCBefore,
+        typeTCAfter,
+        typeTJoin,
+        typeFEntry,
+        typeFExit,
+        typeFCPre,
+        typeFCPost,
+
+        /* Event of the type not described above. */
+        typeUnknown
+    };
+
+    enum Type type;
+
+    /* Stream event context */
+    uint64_t timestamp;
+    uint64_t tid;
+    int32_t counter;
+
+    /* Per-type fields */
+    uint64_t pc;
+    uint64_t addr;
+    uint64_t size;
+    /* For 'ioma' events, see enum kedr_memory_event_type */
+    uint32_t accessType;
+    /* For 'alloc' and 'free' events */
+    uint64_t pointer;
+    /* For lock and signal/wait events */
+    uint64_t object;
+    /* See enum kedr_lock_type and enum kedr_sw_object_type */
+    uint32_t objectType;
+    /* For function entry/exit and call pre/post events */
+    uint64_t func;
+    /* For thread create/join events */
+    uint64_t childTid;
+
+    /* One memory access in 'ma' event */
+    struct MemoryAccess
+    {
+        uint64_t pc;
+        uint64_t addr;
+        uint64_t size;
+        /* See enum kedr_memory_event_type */
+        uint32_t accessType;
+    };
+
+    /* Number of memory accesses in 'ma' event */
+    int nSubevents;
+    /* Number of subevents is stored in 8-bit integer. */
+    struct MemoryAccess subevents[256];
+};
+
+/*
+ * Decoder of the KEDR events into plain structures.
+ *
+ * The layout of KEDR events is fixed by the metadata template.
+ * When decoder recognizes that layout(all fields are byte-aligned
+ * integers of standard sizes), it uses fast path: offsets of the fields
+ * are computed once for each event type and alignment of the event
+ * start, after that fields are read directly from the event mapping.
+ *
+ * Offsets are computed using CTF interpretation of the first event with
+ * given type and alignment, so fast path is guaranteed to produce same
+ * values as the interpretation.
+ *
+ * For other layouts(or when requested) generic CTF interpretation
+ * is used for every event.
+ */
+class KEDREventDecoder
+{
+public:
+    /*
+     * Create decoder for the events in the trace.
+     *
+     * Throw exception if some of the KEDR event fields are absent
+     * in the trace metadata.
+     */
+    KEDREventDecoder(const CTFReader& reader);
+
+    /* Whether fast path is used for decode events. */
+    bool isFast(void) const {return fast;}
+    /*
+     * Disable(or re-enable, if the layout allows) fast path.
+     *
+     * Mainly for testing and benchmarking.
+     */
+    void setFast(bool fast);
+
+    /* Decode given event. */
+    void decode(CTFReader::Event& event, KEDREvent& result)
+    {
+        if(fast) decodeFast(event, result);
+        else decodeGeneric(event, result);
+    }
+
+    void decodeFast(CTFReader::Event& event, KEDREvent& result);
+    void decodeGeneric(CTFReader::Event& event, KEDREvent& result);
+
+    /* Identificators of fields in KEDREvent structure */
+    enum FieldID
+    {
+        fieldTimestamp = 0,
+        fieldTid,
+        fieldCounter,
+        fieldPC,
+        fieldAddr,
+        fieldSize,
+        fieldAccessType,
+        fieldPointer,
+        fieldObject,
+        fieldObjectType,
+        fieldFunc,
+        fieldChildTid,
+        /* Field in subevent of 'ma' event */
+        fieldMAPC,
+        fieldMAAddr,
+        fieldMASize,
+        fieldMAAccessType,
+        /* Number of subevents in 'ma' event */
+        fieldNSubevents
+    };
+
+    /* Integer field in the event */
+    struct Field
+    {
+        enum FieldID id;
+        const CTFVarInt* var;
+
+        /* Parameters for fast path. */
+        int sizeBytes;
+        bool isSigned;
+        bool needSwap;
+        /* Offset in bytes from the event(subevent) start. */
+        int offset;
+    };
+
+private:
+    KEDREventDecoder(const KEDREventDecoder&); /* not implemented */
+
+    const CTFVarEnum& typeVar;
+    /* Fields of the stream event context, common for all events. */
+    std::vector<Field> contextFields;
+    /* Per-type fields, indexed by KEDREvent::Type */
+    std::vector<std::vector<Field> > typeFields;
+    /* Fields of subevent of 'ma' event */
+    std::vector<Field> maFields;
+    Field maNSubevents;
+    const CTFVarArray& maArrayVar;
+    const CTFVar& maElemVar;
+
+    /* Index of enumeration value -> event type */
+    std::vector<enum KEDREvent::Type> enumIndexToType;
+
+    /* Whether layout allows fast path */
+    bool layoutFast;
+    /* Whether fast path is used */
+    bool fast;
+
+    /* Maximum alignment of the fields, in bytes. */
+    int maxAlign;
+
+    /*
+     * Offsets of the fields for one type of events for one
+     * alignment of the event start.
+     */
+    struct Layout
+    {
+        bool isLearned;
+        enum KEDREvent::Type type;
+        /*
+         * Offsets of fields, in the same order as in 'contextFields',
+         * then as in typeFields[type].
+         */
+        std::vector<int> offsets;
+        /*
+         * For 'ma' event - offset of the number of subevents and
+         * of the first subevent.
+         */
+        int nSubeventsOffset;
+        int maStartOffset;
+
+        Layout(void): isLearned(false) {}
+    };
+    /*
+     * Layouts, indexed by raw value of the event type
+     * and event start(in bytes) modulo 'maxAlign'.
+     */
+    std::vector<Layout> layouts;
+
+    /* Whether offsets inside 'ma' subevent has been learned. */
+    bool maLearned;
+    /* Distance between subevents in 'ma' event. */
+    int maStride;
+
+    void learnLayout(CTFReader::Event& event, int eventStart,
+        Layout& layout);
+    void learnMA(CTFReader::Event& event);
+};
+
+#endif /* KEDR_EVENT_DECODER_H */
@@ -0,0 +1,158 @@
+/*
+ * Iterator through the KEDR trace, which decodes events in background.
+ */
+
+#ifndef KEDR_PREFETCH_ITERATOR_H
+#define KEDR_PREFETCH_ITERATOR_H
+
+#include <kedr/kedr_trace_reader/kedr_trace_reader.h>
+#include <kedr/kedr_trace_reader/kedr_event_decoder.h>
+
+#include <vector>
+#include <deque>
+#include <string>
+
+#include <pthread.h>
+
+/*
+ * Iterator through all events in the trace, from the older one
+ * to the newest one, which returns decoded events.
+ *
+ * Every stream is read and decoded by its own background thread,
+ * which fills bounded queue of decoded events. Streams are merged
+ * using binary heap, which compares only timestamps and counters of
+ * already decoded events.
+ *
+ * Order of events is the same as for KEDRTraceReader::EventIterator.
+ * Lost events are checked at the same points: exception is thrown from
+ * the constructor or from operator++ when the first event of the packet
+ * indicating lost events becomes current one. Iterator remains usable
+ * after that exception.
+ *
+ * Unlike EventIterator, this iterator cannot be copied or cloned.
+ */
+class KEDRTraceReader::PrefetchEventIterator
+{
+public:
+	/* Create iterator points to the first event in the trace */
+	PrefetchEventIterator(KEDRTraceReader& traceReader);
+	~PrefetchEventIterator(void);
+
+	/* Iterators are compared via their bool representation */
+	operator bool(void) const {return !heap.empty();}
+
+	/* Returned reference is valid until iterator is advanced. */
+	const KEDREvent& operator*(void) const
+		{return streams[heap[0]]->current->event;}
+	const KEDREvent* operator->(void) const
+		{return &streams[heap[0]]->current->event;}
+
+	PrefetchEventIterator& operator++(void);
+
+	/* Decoded event in the queue with additional information */
+	struct Record
+	{
+		/* Size of the record in bytes, including padding */
+		uint32_t size;
+		/* Non-zero if the event is the first one in the packet */
+		uint32_t packetStart;
+		/* Packet parameters, set only for the first event in the packet */
+		uint32_t packetCount;
+		uint32_t lostEventsTotal;
+		/* Only used subevents are stored */
+		KEDREvent event;
+	};
+
+	/* Block of records, transferred between threads at once */
+	struct Chunk
+	{
+		char* data;
+		/* Number of bytes used for records */
+		size_t used;
+		/* Whether no chunks follow this one in the stream */
+		bool last;
+		/* If not empty, reading of the stream has been failed */
+		std::string error;
+	};
+
+	/* Stream with its background thread */
+	struct Stream
+	{
+		KEDRTraceReader* traceReader;
+		/* Owned by the background thread after it is started */
+		CTFReader::Event* event;
+		KEDREventDecoder decoder;
+
+		pthread_t thread;
+		bool threadStarted;
+
+		pthread_mutex_t mutex;
+		pthread_cond_t cond;
+		/* Chunks filled by the thread */
+		std::deque<Chunk*> chunksFull;
+		/* Chunks which may be filled by the thread */
+		std::deque<Chunk*> chunksFree;
+		/* Set when iterator is destroyed */
+		bool stop;
+
+		/* All chunks, for free them at the end */
+		std::vector<Chunk*> chunks;
+
+		/* Chunk currently read by the iterator */
+		Chunk* chunk;
+		/* Current record in that chunk */
+		Record* current;
+
+		/* Sequence number of insertion into the heap */
+		uint64_t seq;
+		/* Packet counter for the stream */
+		uint32_t packetCounter;
+
+		Stream(KEDRTraceReader& traceReader, CTFReader::Event* event);
+		~Stream(void);
+	};
+private:
+	PrefetchEventIterator(const PrefetchEventIterator&); /* not implemented */
+
+	KEDRTraceReader* traceReader;
+
+	std::vector<Stream*> streams;
+	/*
+	 * Indices of the non-exhausted streams, organized into heap
+	 * with the oldest event on the top.
+	 */
+	std::vector<int> heap;
+	/* Counter for Stream::seq */
+	uint64_t seq;
+
+	/* Whether current event of stream1 should be returned before stream2's */
+	bool isStreamBefore(int stream1, int stream2) const;
+	void siftDown(int pos);
+	void siftUp(int pos);
+
+	/*
+	 * Advance stream to the next record.
+	 *
+	 * Return false if stream is exhausted.
+	 */
+	bool nextRecord(Stream& stream);
+	/* Take next chunk filled by the thread. Return false if no chunks. */
+	bool nextChunk(Stream& stream);
+
+	/* Process new packet in the stream in the manner of EventIterator */
+	void checkFirstPacket(Stream& stream);
+	void checkNextPacket(Stream& stream);
+
+	void destroy(void);
+
+	static void* streamThread(void* arg);
+	/*
+	 * Decode current event of the stream into the chunk.
+	 *
+	 * Chunk should have enough space for the record with
+	 * all subevents.
+	 */
+	static void writeRecord(Stream& stream, Chunk& chunk, bool packetStart);
+};
+
+#endif /* KEDR_PREFETCH_ITERATOR_H */
@@ -8,6 +8,8 @@
 #include <kedr/ctf_reader/ctf_reader.h>
 
 #include <stdexcept>
+#include <vector>
+#include <string>
 
 class KEDRTraceReader : public CTFReader
 {
@@ -19,6 +21,12 @@ public:
 	
 	/* Iterator through events */
 	class EventIterator;
+	/*
+	 * Iterator through decoded events, which uses background threads.
+	 *
+	 * Declared in <kedr/kedr_trace_reader/kedr_prefetch_iterator.h>.
+	 */
+	class PrefetchEventIterator;
 	
 	/* State of the trace*/
 	typedef int TraceState;
@@ -58,6 +66,14 @@ private:
 	 * than event2 from stream2.
 	 */
 	bool isEventOlder(Event& event1, Event& event2) const;
+	/* Same but for already extracted timestamps and counters. */
+	bool isEventOlder(uint64_t timestamp1, int32_t counter1,
+		uint64_t timestamp2, int32_t counter2) const;
+
+	/* Fill 'filenames' with names of all stream files in the trace. */
+	void findStreamFiles(std::vector<std::string>& filenames) const;
+	/* Create event pointed to the first event in the stream file. */
+	Event* openStream(const std::string& streamFilename);
 	/* Set 'eventsLostBit' in state. Should be called with bit cleared.*/
 	void setEventsLost(void);
 };
@@ -113,10 +129,12 @@ private:
 	/* All information about stream which is needed. */
 	struct StreamInfo
 	{
-		/* Standard filestream with refcount support */
-		class RefStream;
-
-		RefStream* refStream;
+		/* 
+		 * Event in the stream.
+		 * 
+		 * Stream is mapped into memory and the mapping is held by
+		 * the packet of the event.
+		 */
 		CTFReader::Event* event;
 		
 		/* Packet counter for the stream */
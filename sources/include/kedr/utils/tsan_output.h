@@ -0,0 +1,144 @@
+/* Formatting of the trace accepted by ThreadSanitizer offline */
+
+#ifndef KEDR_TSAN_OUTPUT_H
+#define KEDR_TSAN_OUTPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <new> /* std::bad_alloc */
+
+/*
+ * Buffer with lines of the trace for ThreadSanitizer offline.
+ *
+ * Every event is represented by the line
+ *
+ *	<NAME> <tid> <pc> <addr> <size>
+ *
+ * where all numbers are hexadecimal without '0x' prefix, e.g.
+ *
+ *	READ 1 ffffffffa0001234 ffff88003c5e1000 4
+ *
+ * Lines started with '#' are comments.
+ *
+ * Numbers are formatted without iostreams and without memory
+ * allocations: buffer grows only when its content exceeds the capacity.
+ * Owner of the buffer is expected to pass content somewhere
+ * (e.g., write() it) and clear() the buffer after it becomes large
+ * enough, see isFull().
+ */
+class TsanLineBuffer
+{
+public:
+	/* 'capacity' is a size at which buffer is reported as full. */
+	TsanLineBuffer(size_t capacity = 64 * 1024)
+		: capacity(capacity), allocated(capacity + lineMax), used(0)
+	{
+		buf = (char *)malloc(allocated);
+		if (buf == NULL)
+			throw std::bad_alloc();
+	}
+	~TsanLineBuffer() {free(buf);}
+
+	/* Append line for the event. */
+	void event(const char *name, uint64_t tid, uint64_t pc,
+		uint64_t addr, uint64_t size)
+	{
+		put(name);
+		putChar(' ');
+		putHex(tid);
+		putChar(' ');
+		putHex(pc);
+		putChar(' ');
+		putHex(addr);
+		putChar(' ');
+		putHex(size);
+		endLine();
+	}
+
+	/*
+	 * Parts of the line. Used for comments and non-standard lines.
+	 *
+	 * Line should be terminated with endLine().
+	 */
+	void put(const char *str) {put(str, strlen(str));}
+	void put(const char *str, size_t len)
+	{
+		reserve(len);
+		memcpy(buf + used, str, len);
+		used += len;
+	}
+	void putChar(char c)
+	{
+		reserve(1);
+		buf[used++] = c;
+	}
+	/* Hexadecimal representation of the number, lowercase. */
+	void putHex(uint64_t val)
+	{
+		static const char digits[] = "0123456789abcdef";
+
+		/* Number of hexadecimal digits, at least one */
+		int n = val ? (64 - __builtin_clzll(val) + 3) / 4 : 1;
+
+		reserve(n);
+		char *p = buf + used + n;
+		do {
+			*--p = digits[val & 0xf];
+			val >>= 4;
+		} while (val);
+		used += n;
+	}
+	/* Decimal representation of the number. */
+	void putDec(uint64_t val)
+	{
+		char tmp[20];
+		char *p = tmp + sizeof(tmp);
+		do {
+			*--p = '0' + val % 10;
+			val /= 10;
+		} while (val);
+		put(p, tmp + sizeof(tmp) - p);
+	}
+	void endLine(void) {putChar('\n');}
+
+	const char *data(void) const {return buf;}
+	size_t size(void) const {return used;}
+	void clear(void) {used = 0;}
+
+	/* Whether content of the buffer should be flushed. */
+	bool isFull(void) const {return used >= capacity;}
+
+private:
+	TsanLineBuffer(const TsanLineBuffer &); /* not implemented */
+	TsanLineBuffer &operator=(const TsanLineBuffer &); /* not implemented */
+
+	/* Space which is reserved after the capacity for one line. */
+	static const size_t lineMax = 256;
+
+	char *buf;
+	size_t capacity;
+	size_t allocated;
+	size_t used;
+
+	/* Make sure that 'len' bytes may be added to the buffer. */
+	void reserve(size_t len)
+	{
+		if (used + len <= allocated)
+			return;
+
+		size_t allocatedNew = allocated * 2;
+		while (used + len > allocatedNew)
+			allocatedNew *= 2;
+
+		char *bufNew = (char *)realloc(buf, allocatedNew);
+		if (bufNew == NULL)
+			throw std::bad_alloc();
+		buf = bufNew;
+		allocated = allocatedNew;
+	}
+};
+
+#endif /* KEDR_TSAN_OUTPUT_H */
@@ -22,6 +22,8 @@
 
 #include <endian.h> /* process endianess in packets with metadata*/
 
+#include <climits> /* INT_MAX */
+
 /*
  * Read given number of bytes from stream started at given offset.
  * 
@@ -112,6 +114,24 @@ CTFReader::Event::Event(const Event& event) :
     refs(1), eventsEndOffset(event.eventsEndOffset),
     rootVar(event.rootVar), packet(new CTFReader::Packet(*event.packet))
 {
+    int eventStartOffset = rootVar->eventStartVar->
+        getEventStart(event);
+
+    if(packet->streamMap)
+    {
+        /* 
+         * Mapping of the event is a view into the stream map, which
+         * is shared with copied packet. Simply refer to it.
+         */
+        map = NULL;
+        mapSize = 0;
+        
+        moveMap(event.CTFContext::mapSize(), event.mapStart(), 0);
+        
+        rootVar->eventStartVar->setEventStart(eventStartOffset, *this);
+        
+        return;
+    }
     /* 
      * Copied context is fully mapped.
      * 
@@ -119,8 +139,6 @@ CTFReader::Event::Event(const Event& event) :
      * 
      * NOTE: Use fact, that mapping shift is 0.
      */
-    int eventStartOffset = rootVar->eventStartVar->
-        getEventStart(event);
     /* Effective start of the mapping(int bytes). All bytes before it are unused.*/
     int effectiveStartOffsetBytes = eventStartOffset / 8;
     /* Effective end of the mapping. Because cannot copy part of byte.*/
@@ -145,6 +163,11 @@ CTFReader::Event::~Event(void)
     free(map);
 }
 
+int CTFReader::Event::getStartOffset(void) const
+{
+    return rootVar->eventStartVar->getEventStart(*this);
+}
+
 bool CTFReader::Event::nextInPacket(void)
 {
     int nextEventStartOffset = rootVar->eventLastVar->getEndOffset(*this);
@@ -207,6 +230,24 @@ void CTFReader::Event::beginPacket(void)
     if(eventsEndOffset <= eventsStartOffset)
         std::logic_error("Non-positive size of packet content.");
     
+    if(packet->streamMap)
+    {
+        /* Events are read directly from the mapping. */
+        off_t streamMapEnd = packet->streamMapStart + (eventsEndOffset + 7) / 8;
+        if(streamMapEnd > packet->streamMap->getSize())
+        {
+            std::cerr << "Packet content ends at " << streamMapEnd
+                << " offset, but the stream has size "
+                << packet->streamMap->getSize() << ".\n";
+            throw std::runtime_error("Failed to read from stream");
+        }
+        
+        moveMap(eventsEndOffset,
+            packet->streamMap->getData() + packet->streamMapStart, 0);
+        rootVar->eventStartVar->setEventStart(eventsStartOffset, *this);
+        return;
+    }
+    
     int mapStartOffset = eventsStartOffset / 8;
     
     int mapSizeNew = (eventsEndOffset + 7) / 8 - mapStartOffset;
@@ -222,7 +263,7 @@ void CTFReader::Event::beginPacket(void)
         }
         mapSize = mapSizeNew;
     }
-    readFromStreamAt(packet->s, map, mapSizeNew,
+    readFromStreamAt(*packet->s, map, mapSizeNew,
         packet->streamMapStart + mapStartOffset);
     
     moveMap(eventsEndOffset, map - mapStartOffset, 0);
@@ -267,8 +308,31 @@ int EventStartVar::getEventStart(const CTFContext& context) const
 /* Packet */
 CTFReader::Packet::Packet(const CTFReader& reader, std::istream& s)
 	: CTFContext(reader.varRoot->packetContextVar), refs(1),
-    s(s), streamMapStart(0), mapStart(NULL), mapSize(0),
+    s(&s), streamMap(NULL), streamMapStart(0), mapStart(NULL), mapSize(0),
+    rootVar(reader.varRoot), reader(reader)
+{
+	initPacket();
+}
+
+CTFReader::Packet::Packet(const CTFReader& reader, StreamMap& streamMap)
+	: CTFContext(reader.varRoot->packetContextVar), refs(1),
+    s(NULL), streamMap(&streamMap), streamMapStart(0),
+    mapStart(NULL), mapSize(0),
     rootVar(reader.varRoot), reader(reader)
+{
+	streamMap.ref();
+	try
+	{
+		initPacket();
+	}
+	catch(...)
+	{
+		streamMap.unref();
+		throw;
+	}
+}
+
+void CTFReader::Packet::initPacket(void)
 {
 	setupPacket();
 
@@ -300,14 +364,22 @@ CTFReader::Packet::Packet(const CTFReader& reader, std::istream& s)
 
 CTFReader::Packet::Packet(const Packet& packet) :
     CTFContext(packet.getContextVar()), refs(1),
-    s(packet.s), streamMapStart(packet.streamMapStart),
+    s(packet.s), streamMap(packet.streamMap),
+    streamMapStart(packet.streamMapStart),
     mapSize(packet.mapSize),
     rootVar(packet.rootVar),
     reader(packet.reader),
     packetSizeVar(packet.packetSizeVar),
     contentSizeVar(packet.contentSizeVar)
 {
-    if(mapSize)
+    if(streamMap)
+    {
+        /* Share mapping with the original packet. */
+        streamMap->ref();
+        mapStart = NULL;
+        setMap(packet.CTFContext::mapSize(), packet.CTFContext::mapStart(), 0);
+    }
+    else if(mapSize)
     {
         mapStart = (char*)malloc(mapSize);
         if(mapStart == NULL) throw std::bad_alloc();
@@ -325,6 +397,7 @@ CTFReader::Packet::Packet(const Packet& packet) :
 CTFReader::Packet::~Packet(void)
 {
     free(mapStart);
+    if(streamMap) streamMap->unref();
 }
 
 bool CTFReader::Packet::next(void)
@@ -335,7 +408,8 @@ bool CTFReader::Packet::next(void)
     
     off_t nextStreamMapStart = streamMapStart + packetSize / 8;
     
-    if(isStreamEnds(s, nextStreamMapStart))
+    if(streamMap ? (nextStreamMapStart >= streamMap->getSize())
+        : isStreamEnds(*s, nextStreamMapStart))
     {
         /* current packet is last*/
         return false;
@@ -347,6 +421,8 @@ bool CTFReader::Packet::next(void)
     /* Flush map */
     setMap(0, NULL, 0);
     
+    if(streamMap) streamMap->willRead(streamMapStart);
+    
     setupPacket();
    
     return true;
@@ -357,13 +433,30 @@ int CTFReader::Packet::extendMapImpl(int newSize, const char** mapStart_p,
 {
 	int mapSizeNew = (newSize +  7) / 8;
     
+    if(streamMap)
+    {
+        /* 
+         * Map all the rest of the stream at once(but no more than
+         * context size may describe). Returning less than requested
+         * means EOF.
+         */
+        off_t rest = streamMap->getSize() - streamMapStart;
+        
+        mapSize = (rest > INT_MAX / 8) ? INT_MAX / 8 : (int)rest;
+        
+        *mapStart_p = streamMap->getData() + streamMapStart;
+        *mapStartShift_p = 0;
+        
+        return mapSize * 8;
+    }
+    
     char* mapStartNew = (char*)realloc(mapStart, mapSizeNew);
 	if(mapStartNew == NULL)
 		throw std::bad_alloc();
     
     mapStart = mapStartNew;
 
-	readFromStreamAt(s, mapStart + mapSize,
+	readFromStreamAt(*s, mapStart + mapSize,
         mapSizeNew - mapSize, streamMapStart + mapSize);
     
     mapSize = mapSizeNew;
@@ -0,0 +1,103 @@
+/* Implementation of the memory-mapped CTF stream */
+
+#include <kedr/ctf_reader/ctf_reader.h>
+
+#include <cerrno> /* errno */
+#include <cstring> /* strerror */
+
+#include <fcntl.h> /* open */
+#include <unistd.h> /* close, sysconf */
+#include <sys/mman.h> /* mmap, madvise */
+#include <sys/stat.h> /* fstat */
+
+#include <stdexcept> /* standard exceptions */
+
+#include <iostream> /* stream for output errors */
+
+/*
+ * Size of the region, for which read-ahead is requested at once.
+ *
+ * New request is issued when reading comes to the second half of
+ * the previous region.
+ */
+static const off_t readaheadWindow = 4 * 1024 * 1024;
+
+CTFReader::StreamMap::StreamMap(const std::string& filename)
+	: refs(1), data(NULL), size(0), readaheadEnd(0)
+{
+	int fd = open(filename.c_str(), O_RDONLY);
+	if(fd == -1)
+	{
+		std::cerr << "Failed to open stream file '" << filename
+			<< "': " << strerror(errno) << ".\n";
+		throw std::runtime_error("Failed to open stream file");
+	}
+
+	struct stat st;
+	if(fstat(fd, &st) == -1)
+	{
+		std::cerr << "Failed to obtain size of stream file '" << filename
+			<< "': " << strerror(errno) << ".\n";
+		close(fd);
+		throw std::runtime_error("Failed to stat stream file");
+	}
+
+	if((off_t)(size_t)st.st_size != st.st_size)
+	{
+		std::cerr << "Stream file '" << filename
+			<< "' is too large for being mapped.\n";
+		close(fd);
+		throw std::runtime_error("Failed to map stream file");
+	}
+
+	size = st.st_size;
+
+	if(size == 0)
+	{
+		/* Cannot map empty file, but needn't it. */
+		close(fd);
+		return;
+	}
+
+	void* addr = mmap(NULL, (size_t)size, PROT_READ, MAP_PRIVATE, fd, 0);
+	/* Mapping remains valid after file is closed. */
+	close(fd);
+
+	if(addr == MAP_FAILED)
+	{
+		std::cerr << "Failed to map stream file '" << filename
+			<< "': " << strerror(errno) << ".\n";
+		throw std::runtime_error("Failed to map stream file");
+	}
+
+	data = (char*)addr;
+
+	/* Advices are only hints, so ignore errors. */
+	(void)madvise(data, (size_t)size, MADV_SEQUENTIAL);
+
+	willRead(0);
+}
+
+CTFReader::StreamMap::~StreamMap(void)
+{
+	if(data) munmap(data, (size_t)size);
+}
+
+void CTFReader::StreamMap::willRead(off_t offset)
+{
+	if(offset + readaheadWindow / 2 < readaheadEnd) return;
+	if(readaheadEnd >= size) return;
+
+	static const off_t pageSize = sysconf(_SC_PAGESIZE);
+
+	/* Request read-ahead from the start of the page with given offset. */
+	off_t start = offset > readaheadEnd ? offset : readaheadEnd;
+	start -= start % pageSize;
+
+	off_t end = start + readaheadWindow;
+	if(end > size) end = size;
+
+	(void)madvise(data + start, (size_t)(end - start), MADV_WILLNEED);
+
+	readaheadEnd = end;
+}
@@ -22,6 +22,7 @@ static int test1(void);
 static int test2(void);
 static int test3(void);
 static int test4(void);
+static int test5(void);
 
 /* Helpers for search typed variables */
 static const CTFVarInt& findInt(const CTFReader& reader, const std::string& name)
@@ -103,6 +104,7 @@ int main(int argc, char *argv[])
 	RUN_TEST(test2, "complex");
     RUN_TEST(test3, "cross-packet");
     RUN_TEST(test4, "iterator-cloning");
+    RUN_TEST(test5, "mapped-stream");
 
 	return 0;
 }
@@ -473,4 +475,90 @@ int test4(void)
     }
 
     return 0;
-}
\ No newline at end of file
+}
+
+/* 
+ * Similar to test4, but for the mapped stream.
+ * 
+ * Also check that cloned iterator remains valid after the initial one
+ * and the mapping are released.
+ */
+int test5(void)
+{
+	/* Number of events skipped before cloning */
+	static const int eventSkipped = 3;
+	
+	std::string metaFilename = sourceDir + "metadata3";
+	std::string streamFilename = sourceDir + "data3";
+	
+	std::ifstream fs;
+	fs.open(metaFilename.c_str());
+	if(!fs)
+	{
+		std::cerr << "Failed to open file '" << metaFilename
+		<< "' with metadata." <<std::endl;
+		return 1;
+	}
+	
+	CTFReader reader(fs);
+	
+	const CTFVarInt& varEventField = findInt(reader, "event.fields");
+	
+	CTFReader::StreamMap* streamMap =
+		new CTFReader::StreamMap(streamFilename);
+	
+	CTFReader::EventIterator* event =
+		new CTFReader::EventIterator(reader, *streamMap);
+	/* Mapping is held by the iterator now */
+	streamMap->unref();
+
+	int eventNumber = 0;
+	for(;
+		*event != CTFReader::EventIterator();
+		++*event, ++eventNumber)
+	{
+		if(eventNumber == eventSkipped) break;
+		
+		int32_t eventFieldVal = varEventField.getInt32(**event);
+		int32_t eventFieldVal_expected = eventNumber + 1;
+		if(eventFieldVal != eventFieldVal_expected)
+		{
+			std::cerr << "Expected, that value of event "
+				<< eventNumber << " in mapped stream will be "
+				<< eventFieldVal_expected << "." << std::endl;
+			std::cerr << "But it is " << eventFieldVal << "." << std::endl;
+			
+			delete event;
+			return 1;
+		}
+	}
+
+	CTFReader::EventIterator eventClone = event->clone();
+	/* Release initial iterator, cloned one should hold the mapping. */
+	delete event;
+
+	for(;
+		eventClone != CTFReader::EventIterator();
+		++eventClone, ++eventNumber)
+	{
+		int32_t eventFieldVal = varEventField.getInt32(*eventClone);
+		int32_t eventFieldVal_expected = eventNumber + 1;
+		if(eventFieldVal != eventFieldVal_expected)
+		{
+			std::cerr << "Expected, that value of event "
+				<< eventNumber << " in cloned iterator will be "
+				<< eventFieldVal_expected << "." << std::endl;
+			std::cerr << "But it is " << eventFieldVal << "." << std::endl;
+			
+			return 1;
+		}
+	}
+    if(eventNumber != 13)
+    {
+        std::cerr << "Expected, that mapped stream will contain 13 events. "
+            << "But it contains " << eventNumber << "." << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -53,6 +53,12 @@ static bool sections_only = false;
 /* The argument to '--hybrid' option. An empty string means the option is
  * not set at all. */
 static string hybrid_arg = "";
+
+/* The index of the trace (see '--index' option) and the number of threads
+ * to decode the trace with (see '--jobs' option). */
+static TraceIndex trace_index;
+static bool use_index = false;
+static unsigned int nr_jobs = 1;
 /* ====================================================================== */
 
 /* Debug mode can be used to debug the software that has collected the trace
@@ -134,6 +140,8 @@ process_args(int argc, char *argv[])
 		{"sections-only", no_argument, NULL, 's'},
 		{"hybrid", required_argument, NULL, 'y'},
 		{"debug", no_argument, NULL, 'b'},
+		{"index", required_argument, NULL, 'i'},
+		{"jobs", required_argument, NULL, 'j'},
 		{NULL, 0, NULL, 0}
 	};
 	
@@ -183,6 +191,25 @@ process_args(int argc, char *argv[])
 		case 'b':
 			debug_mode = true;
 			break;
+		case 'i':
+			try {
+				trace_index.load(optarg);
+			}
+			catch (TraceIndex::Error &e) {
+				cerr << e.what() << endl;
+				return false;
+			}
+			use_index = true;
+			break;
+		case 'j':
+			nr_jobs = (unsigned int)atoi(optarg);
+			if (nr_jobs == 0) {
+				cerr << 
+		"'--jobs' requires a positive number as an argument.";
+				cerr << endl;
+				return false;
+			}
+			break;
 		case '?':
 			/* Unknown option, getopt_long() should have already 
 			printed an error message. */
@@ -269,7 +296,8 @@ main(int argc, char *argv[])
 	}
 		
 	try {
-		TraceProcessor tp(args);
+		TraceProcessor tp(args, (use_index ? &trace_index : NULL),
+				  nr_jobs);
 		tp.process_trace();
 	}
 	catch (runtime_error &e) {
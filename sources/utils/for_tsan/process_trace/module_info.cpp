@@ -65,6 +65,26 @@ static TAddrMap real_addr_map;
 
 /* {effective address of a code area => module info}. */
 static TAddrMap eff_addr_map;
+
+/* A loaded code area, as used for translation of the real addresses into
+ * the effective ones. */
+struct RealArea
+{
+	unsigned int addr_real;
+	unsigned int addr_eff;
+	unsigned int size;
+	rc_ptr<ModuleInfo> mi;
+};
+
+/* The loaded code areas sorted by their real addresses. This is a flat
+ * copy of the information from 'real_addr_map', it is rebuilt each time a
+ * code area is loaded or unloaded. The lookup is performed for each event
+ * in the trace, so it must be fast. */
+static std::vector<RealArea> real_areas;
+
+/* Index of the area in 'real_areas' found by the last lookup. The 
+ * addresses in the events often belong to the same area. */
+static size_t last_area = 0;
 /* ====================================================================== */
 
 /* NULL means DWARF debug info should not be used. */
@@ -494,6 +514,62 @@ remove_real_address(rc_ptr<ModuleInfo> &mi, const ModuleInfo::CodeArea &ca)
 	real_addr_map.erase(it);
 }
 
+/* Rebuild 'real_areas' according to the current contents of 
+ * 'real_addr_map'. Should be called when the loading or unloading of the 
+ * code areas has been processed completely. */
+static void
+update_real_areas()
+{
+	real_areas.clear();
+	last_area = 0;
+	
+	TAddrMap::const_iterator it;
+	for (it = real_addr_map.begin(); it != real_addr_map.end(); ++it) {
+		const rc_ptr<ModuleInfo> &mi = it->second;
+		const ModuleInfo::CodeArea &ca = 
+			(mi->init_ca.addr_real == it->first ? 
+				mi->init_ca : mi->core_ca);
+		
+		RealArea ra;
+		ra.addr_real = ca.addr_real;
+		ra.addr_eff = ca.addr_eff;
+		ra.size = ca.size;
+		ra.mi = mi;
+		real_areas.push_back(ra);
+	}
+}
+
+/* Returns the loaded code area with the greatest real address not 
+ * exceeding 'addr', NULL if there is no such area. 
+ * [NB] The caller should check if 'addr' actually belongs to that area. */
+static const RealArea *
+real_area_for_address(unsigned int addr)
+{
+	if (real_areas.empty())
+		return NULL;
+	
+	const RealArea *ra = &real_areas[last_area];
+	if (addr - ra->addr_real < ra->size)
+		return ra;
+	
+	/* Binary search for the first area starting after 'addr'. */
+	size_t left = 0;
+	size_t right = real_areas.size();
+	while (left < right) {
+		size_t mid = left + (right - left) / 2;
+		if (real_areas[mid].addr_real <= addr)
+			left = mid + 1;
+		else
+			right = mid;
+	}
+	
+	if (left == 0)
+		return NULL;
+	
+	last_area = left - 1;
+	return &real_areas[last_area];
+}
+
 static void 
 print_section(const rc_ptr<SectionInfo> &si)
 {
@@ -579,6 +655,9 @@ ModuleInfo::on_module_load(
 		}
 	}
 	
+	/* The effective addresses are known at this point. */
+	update_real_areas();
+	
 	mi->loaded = true;
 }
 	
@@ -608,6 +687,8 @@ ModuleInfo::on_module_unload(const std::string &name)
 	mi->core_ca.addr_real = 0;
 	mi->init_ca.addr_real = 0;
 	
+	update_real_areas();
+	
 	mi->init_func = 0;
 	
 	if (debug_mode) {
@@ -637,12 +718,14 @@ on_module_init_complete(rc_ptr<ModuleInfo> &mi)
 
 	remove_real_address(mi, mi->init_ca);
 	mi->init_ca.addr_real = 0;
+	
+	update_real_areas();
 }
 
 void
 ModuleInfo::on_function_entry(unsigned int addr)
 {
-	rc_ptr<ModuleInfo> mi = module_for_real_address(addr);
+	const rc_ptr<ModuleInfo> &mi = module_for_real_address(addr);
 	
 	if (mi->init_func != 0)
 		/* Already found the init function. */
@@ -664,66 +747,59 @@ ModuleInfo::on_function_entry(unsigned int addr)
 void
 ModuleInfo::on_function_exit(unsigned int addr)
 {
-	rc_ptr<ModuleInfo> mi = module_for_real_address(addr);
+	const rc_ptr<ModuleInfo> &mi_found = module_for_real_address(addr);
 	
-	if (mi->init_func == 0 || mi->init_func != addr)
+	if (mi_found->init_func == 0 || mi_found->init_func != addr)
 		return;
 	
-	/* Got an exit from the init function of the module. */
+	/* Got an exit from the init function of the module. 
+	 * [NB] The reference returned by module_for_real_address() becomes
+	 * invalid when the init area is removed, so make a copy. */
+	rc_ptr<ModuleInfo> mi = mi_found;
 	on_module_init_complete(mi);
 }
 
-rc_ptr<ModuleInfo>
-ModuleInfo::module_for_real_address(unsigned int addr)
+/* Throws ModuleInfo::Error for the code address that does not belong to
+ * any of the loaded modules. */
+static void
+no_module_for_real_address(unsigned int addr)
 {
-	if (real_addr_map.empty()) {
-		ostringstream err;
+	ostringstream err;
+	
+	if (real_areas.empty()) {
 		err << "According to the trace, no module was loaded "
 			<< "when the event at the address "
 			<< (void *)(unsigned long)addr
 			<< " occurred ("
 			<< "the map {real address => module} is empty"
 			<< "). Corrupted or incomplete trace?";
-		throw ModuleInfo::Error(err.str());
 	}
-	
-	TAddrMap::const_iterator it = real_addr_map.upper_bound(addr);
-	if (it == real_addr_map.begin()) {
-		ostringstream err;
+	else {
 		err << "Failed to find the module the code address "
 			<< (void *)(unsigned long)addr
 			<< " belongs to.";
-		throw ModuleInfo::Error(err.str());
 	}
-	
-	--it;
-	rc_ptr<ModuleInfo> mi = it->second;
-	
-	return mi;
+	throw ModuleInfo::Error(err.str());
 }
 
+const rc_ptr<ModuleInfo> &
+ModuleInfo::module_for_real_address(unsigned int addr)
+{
+	const RealArea *ra = real_area_for_address(addr);
+	if (ra == NULL)
+		no_module_for_real_address(addr);
+	
+	return ra->mi;
+}
 
 unsigned int 
 ModuleInfo::effective_address(unsigned int addr)
 {
-	rc_ptr<ModuleInfo> mi = module_for_real_address(addr);
-	
-	if (mi->core_ca.contains(addr)) {
-		return mi->core_ca.effective_address(addr);
-	}
-	else if (mi->init_ca.contains(addr)) {
-		return mi->init_ca.effective_address(addr);
-	}
-	else {
-		ostringstream err;
-		err << "Failed to find the module the code address "
-			<< (void *)(unsigned long)addr
-			<< " belongs to.";
-		throw ModuleInfo::Error(err.str());
-	}
+	const RealArea *ra = real_area_for_address(addr);
+	if (ra == NULL || addr - ra->addr_real >= ra->size)
+		no_module_for_real_address(addr);
 	
-	assert(false);
-	return 0;
+	return addr - ra->addr_real + ra->addr_eff;
 }
 
 /* Find the module and the section within the module the specified 
@@ -224,7 +224,9 @@ public:
 					  unsigned int addr_eff);
 
 private:
-	static rc_ptr<ModuleInfo> module_for_real_address(
+	/* Find the module this code address belongs to. The returned 
+	 * reference remains valid until a code area is loaded or unloaded. */
+	static const rc_ptr<ModuleInfo> &module_for_real_address(
 		unsigned int addr);
 };
 
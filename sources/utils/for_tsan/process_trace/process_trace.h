@@ -56,6 +56,16 @@
  "mode (default) of in the hybrid mode. See the description of the\n\t" \
  "corresponding option of ThreadSanitizer.\n\n"  \
  "" \
+ "--index=<index_file>\n\t" \
+ "Use the index of the trace created by kedr_st_rec_index. The trace\n\t" \
+ "must then be a regular file rather than a pipe. With the index, the\n\t" \
+ "series of events are decompressed and decoded in several threads\n\t" \
+ "while the trace is being processed.\n\n" \
+ "" \
+ "--jobs=<N>\n\t" \
+ "The number of threads to decode the trace with if the index is\n\t" \
+ "given, 1 by default.\n\n" \
+ "" \
  "--debug\n\t" \
  "Enable the debug mode. In this mode, the tool does not invoke\n\t" \
  "ThreadSanitizer but outputs the trace that would have been passed to\n\t" \
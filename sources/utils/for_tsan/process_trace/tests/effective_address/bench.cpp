@@ -0,0 +1,162 @@
+/* bench.cpp - benchmark of the translation of the code addresses from the
+ * trace into the effective addresses (ModuleInfo::effective_address()).
+ *
+ * Usage:
+ *	bench_process_trace_addr <n-lookups> <module_file> [<module_file> ...]
+ *
+ * The given modules are "loaded" at synthetic addresses, each one with 
+ * "init" and "core" areas. Then the addresses from several synthetic 
+ * streams are translated:
+ * - "local": the addresses from a small window in one code area, the 
+ *   window moves from time to time (similar to the real traces);
+ * - "random": the addresses from all the code areas, chosen randomly;
+ * - "alternating": each address belongs to a different code area than 
+ *   the previous one.
+ * The number of translations per second is reported for each stream. */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include <cstdlib>
+#include <ctime>
+
+#include <libelf.h>
+
+#include "module_info.h"
+
+using namespace std;
+/* ====================================================================== */
+
+/* Required by ModuleInfo. */
+bool debug_mode = false;
+/* ====================================================================== */
+
+/* Synthetic parameters of the code areas. */
+static const unsigned int init_size = 0x2000;
+static const unsigned int core_size = 0x20000;
+static const unsigned int area_base = 0xa0000000;
+static const unsigned int area_step = 0x100000;
+
+struct Area
+{
+	unsigned int addr;
+	unsigned int size;
+};
+
+static double
+get_time()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The name of the module the kernel would use, see 
+ * ModuleInfo::add_module(). */
+static string
+module_name(const string &path)
+{
+	size_t beg = path.find_last_of('/');
+	string name = path.substr(beg == string::npos ? 0 : beg + 1);
+	
+	name = name.substr(0, name.find(".ko"));
+	name = name.substr(0, name.find(".debug"));
+	
+	for (size_t i = 0; i < name.size(); ++i) {
+		if (name[i] == '-')
+			name[i] = '_';
+	}
+	return name;
+}
+
+static unsigned int
+random_addr(const Area &area)
+{
+	return area.addr + (unsigned int)rand() % area.size;
+}
+
+static void
+run_bench(const char *stream_name, const vector<unsigned int> &addrs)
+{
+	/* Prevent optimizing the translation out */
+	unsigned int checksum = 0;
+	
+	double start = get_time();
+	for (size_t i = 0; i < addrs.size(); ++i)
+		checksum += ModuleInfo::effective_address(addrs[i]);
+	double elapsed = get_time() - start;
+	
+	cout << stream_name << ": " << addrs.size() << " lookups in " 
+		<< elapsed << " s, " << (long)(addrs.size() / elapsed) 
+		<< " lookups/s (checksum " << checksum << ").\n";
+}
+
+int 
+main(int argc, char *argv[])
+{
+	if (argc < 3) {
+		cerr << "Usage: bench_process_trace_addr <n-lookups> "
+			<< "<module_file> [<module_file> ...]" << endl;
+		return EXIT_FAILURE;
+	}
+	
+	if (elf_version(EV_CURRENT) == EV_NONE) {
+		cerr << "Failed to initialize libelf: " << elf_errmsg(-1) 
+			<< endl;
+		return EXIT_FAILURE;
+	}
+	
+	size_t nr_lookups = (size_t)atol(argv[1]);
+	vector<Area> areas;
+	
+	try {
+		for (int i = 2; i < argc; ++i) {
+			unsigned int init_addr = 
+				area_base + (i - 2) * 2 * area_step;
+			unsigned int core_addr = init_addr + area_step;
+			
+			ModuleInfo::add_module(argv[i], "./");
+			ModuleInfo::on_module_load(module_name(argv[i]),
+				init_addr, init_size, core_addr, core_size);
+			
+			Area init = {init_addr, init_size};
+			Area core = {core_addr, core_size};
+			areas.push_back(init);
+			areas.push_back(core);
+		}
+		
+		vector<unsigned int> addrs(nr_lookups);
+		
+		srand(1);
+		size_t cur = 0;
+		unsigned int window = random_addr(areas[cur]);
+		for (size_t i = 0; i < nr_lookups; ++i) {
+			if (rand() % 256 == 0) {
+				cur = rand() % areas.size();
+				window = random_addr(areas[cur]);
+			}
+			/* The window may end up outside of the area, so
+			 * wrap it around. */
+			unsigned int off = window - areas[cur].addr +
+				(unsigned int)rand() % 256;
+			addrs[i] = areas[cur].addr + off % areas[cur].size;
+		}
+		run_bench("local", addrs);
+		
+		for (size_t i = 0; i < nr_lookups; ++i)
+			addrs[i] = random_addr(areas[rand() % areas.size()]);
+		run_bench("random", addrs);
+		
+		for (size_t i = 0; i < nr_lookups; ++i)
+			addrs[i] = random_addr(areas[i % areas.size()]);
+		run_bench("alternating", addrs);
+	}
+	catch (runtime_error &e) {
+		cerr << e.what() << endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+/* ====================================================================== */
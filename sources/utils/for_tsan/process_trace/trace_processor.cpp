@@ -14,6 +14,7 @@
 
 #include <iostream>
 #include <sstream>
+#include <algorithm>
 
 #include <cassert>
 #include <cstdlib>
@@ -25,7 +26,6 @@
 #include <fcntl.h>
 
 #include <errno.h>
-#include <poll.h>
 #include <sys/wait.h>
 
 #include <kedr/object_types.h>
@@ -38,39 +38,17 @@ using namespace std;
 extern bool debug_mode;
 /* ====================================================================== */
 
-/* A simple class that wraps a pointer to a malloc'ed memory block and frees
- * that memory in its dtor. */
-class MemHelper
-{
-public:
-	explicit MemHelper(void *p = NULL)
-		: ptr(p)
-	{ }
-	
-	~MemHelper()
-	{
-		free(ptr);
-	}
-	
-private:
-	/* Prohibit copying and assignment. */
-	MemHelper(const MemHelper &other);
-	MemHelper & operator=(const MemHelper &p);
-	
-public:
-	/* [NB] Do not call free for this pointer other than in the dtor
-	 * of this class. */
-	void *ptr;
-};
-/* ====================================================================== */
-
 /* [NB] The failures in the child process will not be detected until the
  * main process tries to pass the data to the child. */
-TraceProcessor::TraceProcessor(const std::vector<const char *> &args)
-	: nrec(0), nr_tids(0)
+TraceProcessor::TraceProcessor(const std::vector<const char *> &args,
+			       const TraceIndex *index, unsigned int nr_jobs)
+	: reader(STDIN_FILENO, index, nr_jobs), nr_tids(0), 
+	  report_thread_started(false)
 {
 	assert(!args.empty());
 
+	pthread_mutex_init(&report_mutex, NULL);
+	
 	if (debug_mode)
 		return;
 	
@@ -174,6 +152,20 @@ TraceProcessor::TraceProcessor(const std::vector<const char *> &args)
 		/* Parent */
 		close(in_pipe[0]);
 		close(out_pipe[1]);
+		
+		ret = pthread_create(&report_thread, NULL, 
+				     report_thread_func, this);
+		if (ret != 0) {
+			/* The handler application will get EOF and exit. */
+			close(in_pipe[1]);
+			close(out_pipe[0]);
+			pthread_mutex_destroy(&report_mutex);
+			
+			throw TraceProcessor::Error(
+			string("Failed to create a thread: ") +
+				strerror(ret));
+		}
+		report_thread_started = true;
 	}
 }
 
@@ -182,15 +174,25 @@ TraceProcessor::TraceProcessor(const std::vector<const char *> &args)
 TraceProcessor::~TraceProcessor()
 {
 	if (debug_mode) {
+		flush_debug_output();
+		
 		cerr << "\nList of threads:\n\n";
 		for (size_t i = 1; i < thread_names.size(); ++i)
 			cerr << "T" << i << "\t" << thread_names[i] << "\n";
 		
 		fflush(stdout);
 		fflush(stderr);
+		pthread_mutex_destroy(&report_mutex);
 		return;
 	}
 	
+	try {
+		feed_handler();
+	}
+	catch (runtime_error &e) {
+		cerr << e.what() << endl;
+	}
+	
 	int ret;
 	ret = close(in_pipe[1]); 
 	if (ret == -1) {
@@ -217,6 +219,7 @@ TraceProcessor::~TraceProcessor()
 	}
 	
 	fflush(stdout);
+	pthread_mutex_destroy(&report_mutex);
 }
 
 /* A wrapper around execvp(). Calls _exit(EXIT_FAILURE) if an internal error
@@ -356,106 +359,121 @@ TraceProcessor::process_report_line(const string &s)
 	}
 }
 
+/* Processes the report lines received so far. If 'at_end' is true, the
+ * handler application has finished and the last line is processed even if
+ * it is not terminated by '\n'.
+ *
+ * Throws TraceProcessor::Error() if the output of the application could not
+ * be read. */
 void
-TraceProcessor::do_report_line()
+TraceProcessor::process_report_data(bool at_end)
 {
-	char c;
-	ssize_t len;
-	string s = "";
-
-	len = read(out_pipe[0], &c, 1);
+	string data;
+	string error;
 	
-	while (len == 1) {
-		if (c == '\n') {
-			process_report_line(s);
-			return;
+	pthread_mutex_lock(&report_mutex);
+	data.swap(report_data);
+	error = report_error;
+	pthread_mutex_unlock(&report_mutex);
+	
+	size_t pos = 0;
+	size_t next;
+	
+	while ((next = data.find('\n', pos)) != string::npos) {
+		if (report_tail.empty()) {
+			process_report_line(data.substr(pos, next - pos));
 		}
-		
-		s = s + c;
-		len = read(out_pipe[0], &c, 1);
+		else {
+			report_tail.append(data, pos, next - pos);
+			process_report_line(report_tail);
+			report_tail.clear();
+		}
+		pos = next + 1;
 	}
-
-	if (len == 0) {
-		if (!s.empty())
-			process_report_line(s);
+	report_tail.append(data, pos, string::npos);
+	
+	if (at_end && !report_tail.empty()) {
+		process_report_line(report_tail);
+		report_tail.clear();
 	}
-	else if (len == -1) {
+	
+	if (!error.empty()) {
 		throw TraceProcessor::Error(
 	string("Failed to read the output of the handler application: ") + 
-			strerror(errno));
+			error);
 	}
-	return;
 }
 
-/* Puts a line (a string) to be processed to the standard input of
- * the handler application. The string must not contain newline 
- * characters. A newline ('\n') will be appended automatically.
- *
- * Throws TraceProcessor::Error() if errors occur. */
-void
-TraceProcessor::put_line(const string &s)
+void *
+TraceProcessor::report_thread_func(void *arg)
 {
-	/* Writing data to the pipe should either be done completely in one 
-	 * step or fail. Note that write() will block if the application
-	 * is not ready to consume the data yet (i.e. the pipe is full). */
-	ssize_t ret = write(in_pipe[1], s.c_str(), s.size());
-
-	if (ret == -1) {
-		throw TraceProcessor::Error(
-		string("Failed to pass data to the handler application: ") + 
-			strerror(errno));
-	}
-	else if (ret != (ssize_t)s.size()) {
-		throw TraceProcessor::Error(
-		string("Failed to pass data to the handler application: ") + 
-			"the application accepted only part of the data.");
-	}
-	
-	ret = write(in_pipe[1], "\n", 1);
-	if (ret != 1) {
-		throw TraceProcessor::Error(
-		"Failed to pass a newline to the handler application.");
-	}
+	TraceProcessor *tp = (TraceProcessor *)arg;
+	tp->read_report();
+	return NULL;
 }
 
-/* Check if there are data available for reading. */
-bool 
-TraceProcessor::data_available()
+/* Executed in a separate thread. Reads the output of the handler 
+ * application until EOF and stores it for processing in the main thread.
+ * [NB] The thread must not use ModuleInfo and must not output anything,
+ * this is done by the main thread. */
+void
+TraceProcessor::read_report()
 {
-	struct pollfd pollfd;
-	pollfd.fd = out_pipe[0];
-	pollfd.events = POLLIN;
+	char buf[4096];
 	
-	errno = 0;
-	int ret = poll(&pollfd, 1, 0);
-	if (ret == -1) {
-		if (errno == EAGAIN)
-			return false;
-		else {
-			throw TraceProcessor::Error(string(
-		"Failed to check if a part of the report is available: ") + 
-				strerror(errno));
+	while (true) {
+		ssize_t len = read(out_pipe[0], buf, sizeof(buf));
+		if (len == 0)
+			break;
+		
+		if (len == -1) {
+			if (errno == EINTR)
+				continue;
+			
+			int err = errno;
+			pthread_mutex_lock(&report_mutex);
+			report_error = strerror(err);
+			pthread_mutex_unlock(&report_mutex);
+			break;
 		}
+		
+		pthread_mutex_lock(&report_mutex);
+		report_data.append(buf, (size_t)len);
+		pthread_mutex_unlock(&report_mutex);
 	}
-	else if (ret == 1) {
-		/* poll returns the number of pollfd instances for which
-		 * .revents is non-zero. This way, if POLLHUP or POLLERR 
-		 * flags are set for an instance, it will also be reported
-		 * this way. We need to check that that POLLIN is set. */
-		if (pollfd.revents & POLLIN)
-			return true;
-	}
-	
-	return false;
 }
 
+/* Passes the lines accumulated in 'tsan_output' to the standard input of 
+ * the handler application and processes the report lines received so 
+ * far.
+ *
+ * Throws TraceProcessor::Error() if errors occur. */
 void
-TraceProcessor::do_line(const string &s)
+TraceProcessor::feed_handler()
 {
-	while (data_available())
-		do_report_line();
+	const char *data = tsan_output.data();
+	size_t size = tsan_output.size();
+	
+	/* Note that write() will block if the application is not ready to
+	 * consume the data yet (i.e. the pipe is full). The application 
+	 * is not blocked by its own output meanwhile, because that output 
+	 * is read by another thread. */
+	while (size != 0) {
+		ssize_t ret = write(in_pipe[1], data, size);
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			
+			throw TraceProcessor::Error(
+		string("Failed to pass data to the handler application: ") + 
+				strerror(errno));
+		}
+		data += ret;
+		size -= (size_t)ret;
+	}
+	tsan_output.clear();
 	
-	put_line(s);
+	process_report_data(false);
 }
 
 /* Wait for the handler application to terminate and process its remaining 
@@ -463,38 +481,32 @@ TraceProcessor::do_line(const string &s)
 void
 TraceProcessor::process_remaining_output()
 {
-	while (true) {
-		pid_t p = waitpid(pid, NULL, WNOHANG);
-		
-		if (p == -1) {
+	/* The thread finishes when the application closes its output, 
+	 * which usually means the application has finished. */
+	if (report_thread_started) {
+		pthread_join(report_thread, NULL);
+		report_thread_started = false;
+	}
+	
+	process_report_data(true);
+	
+	while (waitpid(pid, NULL, 0) == -1) {
+		if (errno != EINTR) {
 			throw TraceProcessor::Error(string(
 		"Failed to wait for the handler application to finish: ") +
-				+ strerror(errno));
-			break;
-		}
-		else if (p == 0) {
-			/* The child process has not finished yet. */
-			while (data_available())
-				do_report_line();
-			sleep(1);
-		}
-		else {
-			/* The child process has finished. */
-			while (data_available())
-				do_report_line();
-			break;
+				strerror(errno));
 		}
 	}
 }
 /* ====================================================================== */
 
 /* Returns the code address (pc, start address of a function, ...) 
- * corresponding to the given raw address. Sign-extension is performed if 
- * needed. */
+ * corresponding to the given raw address. The addresses are recorded in
+ * full, so this is just a conversion. */
 static unsigned long
-code_address_from_raw(__u32 raw)
+code_address_from_raw(__u64 raw)
 {
-	return (unsigned long)(long)(__s32)raw;
+	return (unsigned long)raw;
 }
 
 void
@@ -505,71 +517,27 @@ TraceProcessor::output_tsan_event(const char *name, unsigned int tid,
 	if (pc != 0) 
 		pc = ModuleInfo::effective_address(pc);
 	
-	ostringstream out;
-	out << name << hex << " " << tid << " " << pc << " " << addr_id
-		<< " " << size;
+	tsan_output.event(name, tid, pc, addr_id, size);
+	
+	if (!tsan_output.isFull())
+		return;
 	
 	if (!debug_mode) {
-		do_line(out.str());
+		feed_handler();
 	}
 	else {
-		cout << out.str() << "\n";
+		flush_debug_output();
 	}
 }
 
-/* Allocates memory for an event record and reads the record from the file.
- * Returns the pointer to the record if successful, NULL if there is nothing
- * to read.
- * Throws 'TraceProcessor::Error' on error. */
-struct kedr_tr_event_header *
-TraceProcessor::read_record(FILE *fd)
+/* In the debug mode, the lines for TSan are accumulated in the buffer and
+ * are output to stdout when the buffer becomes full or when the
+ * processing ends. */
+void
+TraceProcessor::flush_debug_output()
 {
-	struct kedr_tr_event_header header;
-	size_t nr_read;
-	struct kedr_tr_event_header *record = NULL;
-	size_t rest_size;
-	
-	errno = 0;
-	nr_read = fread(&header, sizeof(header), 1, fd);
-	if (nr_read == 0) {
-		int e = errno;
-		if (feof(fd))
-			return NULL;
-		
-		throw TraceProcessor::Error(strerror(e));
-	}
-	
-	/* OK, having read the header, perform sanity checks and read the 
-	 * rest if needed. */
-	if ((int)header.event_size < (int)sizeof(header)) {
-		ostringstream err;
-		err << "Invalid data in the input file, record #" << nrec 
-			<< ": invalid value of 'event_size' field: " 
-			<< (int)header.event_size;
-		throw TraceProcessor::Error(err.str());
-	}
-	
-	record = (struct kedr_tr_event_header *)malloc(
-		(size_t)header.event_size);
-	if (record == NULL)
-		throw TraceProcessor::Error("Out of memory.");
-	
-	memcpy(record, &header, sizeof(header));
-	rest_size = (size_t)header.event_size - sizeof(header);
-	if (rest_size > 0) {
-		nr_read = fread((void *)((char *)record + sizeof(header)),
-			1, rest_size, fd);
-		if (nr_read < rest_size) {
-			ostringstream err;
-			err << "Record #" << nrec 
-				<< ": unexpected error or EOF.";
-			free(record);
-			throw TraceProcessor::Error(err.str());
-		}
-	}
-	
-	++nrec;
-	return record;
+	cout.write(tsan_output.data(), tsan_output.size());
+	tsan_output.clear();
 }
 
 unsigned int
@@ -589,7 +557,8 @@ TraceProcessor::get_tsan_thread_id(__u64 tid)
 }
 
 void
-TraceProcessor::handle_thread_start_event(struct kedr_tr_event_tstart *ev)
+TraceProcessor::handle_thread_start_event(
+	const struct kedr_tr_event_tstart *ev)
 {
 	tid_map_t::iterator it;
 	it = tid_map.find(ev->tid);
@@ -611,7 +580,7 @@ TraceProcessor::handle_thread_start_event(struct kedr_tr_event_tstart *ev)
 }
 
 void
-TraceProcessor::handle_thread_end_event(struct kedr_tr_event_tend *ev)
+TraceProcessor::handle_thread_end_event(const struct kedr_tr_event_tend *ev)
 {
 	tid_map_t::size_type n;
 	n = tid_map.erase(ev->tid);
@@ -623,6 +592,7 @@ TraceProcessor::handle_thread_end_event(struct kedr_tr_event_tend *ev)
 			<< (void *)(unsigned long)ev->tid;
 		throw TraceProcessor::Error(err.str());
 	}
+	thread_stacks.erase(ev->tid);
 
 	/* It is currently not needed to pass THR_END event to TSan. */
 }
@@ -650,7 +620,7 @@ TraceProcessor::report_memory_events(const struct kedr_tr_event_mem *ev)
 		else {
 			/* Neither read nor write? Invalid event. */
 			ostringstream err;
-			err << "Record #" << nrec << 
+			err << "Record #" << reader.get_nr_records() << 
 			": neither read nor write bit is set for event #" 
 				<< i << ".";
 			throw TraceProcessor::Error(err.str());
@@ -685,6 +655,61 @@ TraceProcessor::report_call_post_event(const struct kedr_tr_event_call *ev)
 	output_tsan_event("RTN_EXIT", tid, 0, 0, 0);
 }
 
+void
+TraceProcessor::handle_stack_event(const struct kedr_tr_event_stack *ev)
+{
+	/* The parent stacks are always added to the depot in the kernel 
+	 * before their children, so the IDs of the parents are smaller. */
+	if (ev->id == 0 || ev->parent >= ev->id || ev->pc == 0) {
+		ostringstream err;
+		err << "Record #" << reader.get_nr_records() 
+			<< ": invalid call stack " << ev->id << ".";
+		throw TraceProcessor::Error(err.str());
+	}
+	
+	if (ev->id >= stacks.size())
+		stacks.resize(ev->id + 1);
+	
+	stacks[ev->id].parent = ev->parent;
+	stacks[ev->id].pc = ev->pc;
+}
+
+void 
+TraceProcessor::report_thread_stack_event(
+	const struct kedr_tr_event_thread_stack *ev)
+{
+	unsigned int tid = get_tsan_thread_id(ev->tid);
+	vector<__u64> frames;
+	
+	for (__u32 id = ev->stack_id; id != 0; id = stacks[id].parent) {
+		if (id >= stacks.size() || stacks[id].pc == 0) {
+			ostringstream err;
+			err << "Record #" << reader.get_nr_records() 
+				<< ": unknown call stack " << id << ".";
+			throw TraceProcessor::Error(err.str());
+		}
+		frames.push_back(stacks[id].pc);
+	}
+	reverse(frames.begin(), frames.end());
+	
+	/* Report the calls that have returned and the new calls since the
+	 * previous stack of the thread, as the call events would. */
+	vector<__u64> &cur = thread_stacks[ev->tid];
+	size_t common = 0;
+	while (common < cur.size() && common < frames.size() &&
+	       cur[common] == frames[common])
+		++common;
+	
+	for (size_t i = cur.size(); i > common; --i)
+		output_tsan_event("RTN_EXIT", tid, 0, 0, 0);
+	
+	for (size_t i = common; i < frames.size(); ++i) {
+		output_tsan_event("RTN_CALL", tid, 
+				  code_address_from_raw(frames[i]), 0, 0);
+	}
+	cur.swap(frames);
+}
+
 void 
 TraceProcessor::report_alloc_event(
 	const struct kedr_tr_event_alloc_free *ev)
@@ -737,7 +762,7 @@ TraceProcessor::report_lock_event(const struct kedr_tr_event_sync *ev)
 	}
 	else {
 		ostringstream err;
-		err << "Record #" << nrec 
+		err << "Record #" << reader.get_nr_records() 
 			<< ": unknown type of the lock: " 
 			<< (unsigned int)lt << ".";
 		throw TraceProcessor::Error(err.str());
@@ -754,68 +779,72 @@ TraceProcessor::report_unlock_event(const struct kedr_tr_event_sync *ev)
 	output_tsan_event("UNLOCK", tid, pc, (unsigned long)ev->obj_id, 0);
 }
 
+/* ModuleInfo identifies the code of the modules by the lower 32 bits of
+ * the real addresses, which is enough for the module mapping space. */
 void 
-TraceProcessor::handle_target_load_event(struct kedr_tr_event_module *ev)
+TraceProcessor::handle_target_load_event(const struct kedr_tr_event_module *ev)
 {
-	ModuleInfo::on_module_load(ev->name, ev->init_addr, ev->init_size,
-				   ev->core_addr, ev->core_size);
+	ModuleInfo::on_module_load(ev->name, 
+				   (unsigned int)ev->init_addr, ev->init_size,
+				   (unsigned int)ev->core_addr, ev->core_size);
 }
 
 void 
-TraceProcessor::handle_target_unload_event(struct kedr_tr_event_module *ev)
+TraceProcessor::handle_target_unload_event(
+	const struct kedr_tr_event_module *ev)
 {
 	ModuleInfo::on_module_unload(ev->name);
 }
 
 void
-TraceProcessor::handle_fentry_event(struct kedr_tr_event_func *ev)
+TraceProcessor::handle_fentry_event(const struct kedr_tr_event_func *ev)
 {
-	ModuleInfo::on_function_entry(ev->func);
+	ModuleInfo::on_function_entry((unsigned int)ev->func);
 }
 
 void
-TraceProcessor::handle_fexit_event(struct kedr_tr_event_func *ev)
+TraceProcessor::handle_fexit_event(const struct kedr_tr_event_func *ev)
 {
-	ModuleInfo::on_function_exit(ev->func);
+	ModuleInfo::on_function_exit((unsigned int)ev->func);
 }
 
 void 
-TraceProcessor::process_record(struct kedr_tr_event_header *record)
+TraceProcessor::process_record(const struct kedr_tr_event_header *record)
 {
 	switch (record->type) {
 	case KEDR_TR_EVENT_TARGET_LOAD:
 		handle_target_load_event(
-			(struct kedr_tr_event_module *)record);
+			(const struct kedr_tr_event_module *)record);
 		break;
 
 	case KEDR_TR_EVENT_TARGET_UNLOAD:
 		handle_target_unload_event(
-			(struct kedr_tr_event_module *)record);
+			(const struct kedr_tr_event_module *)record);
 		break;
 
 	case KEDR_TR_EVENT_FENTRY:
 		handle_fentry_event(
-			(struct kedr_tr_event_func *)record);
+			(const struct kedr_tr_event_func *)record);
 		break;
 
 	case KEDR_TR_EVENT_FEXIT:
 		handle_fexit_event(
-			(struct kedr_tr_event_func *)record);
+			(const struct kedr_tr_event_func *)record);
 		break;
 
 	case KEDR_TR_EVENT_BLOCK_ENTER:
 		report_block_event(
-			(struct kedr_tr_event_block *)record);
+			(const struct kedr_tr_event_block *)record);
 		break;
 	
 	case KEDR_TR_EVENT_CALL_PRE:
 		report_call_pre_event(
-			(struct kedr_tr_event_call *)record);
+			(const struct kedr_tr_event_call *)record);
 		break;
 	
 	case KEDR_TR_EVENT_CALL_POST:
 		report_call_post_event(
-			(struct kedr_tr_event_call *)record);
+			(const struct kedr_tr_event_call *)record);
 		break;
 	
 	case KEDR_TR_EVENT_MEM:
@@ -825,134 +854,80 @@ TraceProcessor::process_record(struct kedr_tr_event_header *record)
 		 * how these operations should be treated. In the future,
 		 * they should be output somehow too. */
 		report_memory_events(
-			(struct kedr_tr_event_mem *)record);
+			(const struct kedr_tr_event_mem *)record);
 		break;
 	
 	case KEDR_TR_EVENT_ALLOC_POST:
 		report_alloc_event(
-			(struct kedr_tr_event_alloc_free *)record);
+			(const struct kedr_tr_event_alloc_free *)record);
 		break;
 	
 	case KEDR_TR_EVENT_FREE_PRE:
 		report_free_event(
-			(struct kedr_tr_event_alloc_free *)record);
+			(const struct kedr_tr_event_alloc_free *)record);
 		break;
 	
 	case KEDR_TR_EVENT_SIGNAL_PRE:
 		report_signal_event(
-			(struct kedr_tr_event_sync *)record);
+			(const struct kedr_tr_event_sync *)record);
 		break;
 	
 	case KEDR_TR_EVENT_WAIT_POST:
 		report_wait_event(
-			(struct kedr_tr_event_sync *)record);
+			(const struct kedr_tr_event_sync *)record);
 		break;
 	
 	case KEDR_TR_EVENT_LOCK_POST:
 		report_lock_event(
-			(struct kedr_tr_event_sync *)record);
+			(const struct kedr_tr_event_sync *)record);
 		break;
 		
 	case KEDR_TR_EVENT_UNLOCK_PRE:
 		report_unlock_event(
-			(struct kedr_tr_event_sync *)record);
+			(const struct kedr_tr_event_sync *)record);
 		break;
 
 	case KEDR_TR_EVENT_THREAD_START:
 		handle_thread_start_event(
-			(struct kedr_tr_event_tstart *)record);
+			(const struct kedr_tr_event_tstart *)record);
 		break;
 
 	case KEDR_TR_EVENT_THREAD_END:
 		handle_thread_end_event(
-			(struct kedr_tr_event_tend *)record);
+			(const struct kedr_tr_event_tend *)record);
 		break;
-		
-	default: 
-		break;
-	}
-}
-
-void
-TraceProcessor::process_compressed_events(
-	struct kedr_tr_event_header *record)
-{
-	struct kedr_tr_event_compressed *ec = 
-		(struct kedr_tr_event_compressed *)record;
-	if ((size_t)ec->orig_size < 
-		sizeof(struct kedr_tr_event_header)) {
-		ostringstream err;
-		err << "Record #" << nrec << ": " 
-			<< "invalid size of the data before compression: " 
-			<< (unsigned int)ec->orig_size << ".";
-		throw TraceProcessor::Error(err.str());
-	}
-	
-	MemHelper he(malloc(ec->orig_size));
-	unsigned char *events = (unsigned char *)he.ptr;
-	if (events == NULL)
-		throw TraceProcessor::Error("Out of memory.");
 	
-	unsigned long to_process = (unsigned long)ec->orig_size;
-	
-	int ret = lzo1x_decompress_safe(
-		ec->compressed, ec->compressed_size,
-		events, &to_process, NULL);
-	if (ret != LZO_E_OK || ec->orig_size != to_process) {
-		ostringstream err;
-		err << "Record #" << nrec << ": " 
-			<< "failed to decompress data, error code: " << ret;
-		throw TraceProcessor::Error(err.str());
-	}
+	case KEDR_TR_EVENT_STACK:
+		handle_stack_event(
+			(const struct kedr_tr_event_stack *)record);
+		break;
 	
-	while (to_process != 0) {
-		if (to_process < sizeof(
-			struct kedr_tr_event_header)) {
-			ostringstream err;
-			err << "Record #" << nrec << ": " 
-				<< "invalid size of a decompressed event.";
-			throw TraceProcessor::Error(err.str());
-		}
-		
-		struct kedr_tr_event_header *hdr = 
-			(struct kedr_tr_event_header *)events;
-		if (to_process < hdr->event_size) {
-			ostringstream err;
-			err << "Record #" << nrec << ": " 
-				<< "compressed event may be corrupted.";
-			throw TraceProcessor::Error(err.str());
-		}
-		
-		process_record(hdr);
+	case KEDR_TR_EVENT_THREAD_STACK:
+		report_thread_stack_event(
+			(const struct kedr_tr_event_thread_stack *)record);
+		break;
 		
-		events = events + hdr->event_size;
-		to_process -= hdr->event_size;
+	default: 
+		break;
 	}
 }
 
 void 
 TraceProcessor::process_trace()
 {
-	struct kedr_tr_event_header *record = NULL;
+	const struct kedr_tr_event_header *record;
 	
 	/* A fake "main" thread, T0 */
 	output_tsan_event("THR_START", 0, 0, 0, 0);
 	thread_names.clear();
 	thread_names.push_back("A fake \"main\" thread, T0");
 	
-	while (true) {
-		MemHelper r(read_record(stdin));
-		record = (struct kedr_tr_event_header *)r.ptr;
-		
-		if (record == NULL)
-			break;
-		
-		if (record->type == KEDR_TR_EVENT_COMPRESSED) {
-			process_compressed_events(record);
-		}
-		else {
+	try {
+		while ((record = reader.next_event()) != NULL)
 			process_record(record);
-		}
+	}
+	catch (RecordReader::Error &e) {
+		throw TraceProcessor::Error(e.what());
 	}
 }
 
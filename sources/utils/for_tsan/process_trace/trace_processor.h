@@ -3,6 +3,7 @@
 
 #include <linux/types.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include <cstdio>
 
@@ -12,6 +13,10 @@
 #include <map>
 
 #include <utils/simple_trace_recorder/recorder.h>
+#include <utils/simple_trace_recorder/record_reader.h>
+#include <utils/simple_trace_recorder/trace_index.h>
+#include <utils/simple_trace_recorder/parallel_reader.h>
+#include <kedr/utils/tsan_output.h>
 #include <lzo/minilzo.h>
 /* ====================================================================== */
 
@@ -28,7 +33,15 @@
  *
  * The handler applcaition is expected to process data from its stdin line 
  * by line. After reading a line, the application may output zero or more 
- * lines of report (each line is expected to be terminated by '\n'). */
+ * lines of report (each line is expected to be terminated by '\n'). 
+ *
+ * The lines for the handler application are accumulated in a buffer and
+ * passed to the application in large chunks. The output of the application
+ * is read by a separate thread as soon as it is available, so the
+ * application never waits for it to be consumed. The report lines are
+ * processed and output by the main thread in the order they have been
+ * received, each time a chunk of the trace has been passed to the 
+ * application and then when the application has finished. */
 class TraceProcessor
 {
 public:
@@ -49,9 +62,14 @@ public:
 	 * 'args' - args[0] is the path to the application's executable 
 	 * 	file. If the array contains more elements, the rest are the 
 	 *	arguments to the application (argv[1] .. argv[argc - 1]).
+	 * 'index' - the index of the trace, NULL if not available. If it is
+	 *	available, the trace is decoded by 'nr_jobs' threads, see
+	 *	parallel_reader.h.
 	 *
 	 * The ctor throws TraceProcessor::Error() on failure. */
-	TraceProcessor(const std::vector<const char *> &args);
+	TraceProcessor(const std::vector<const char *> &args, 
+		       const TraceIndex *index = NULL, 
+		       unsigned int nr_jobs = 1);
 	
 	/* [NB] The destructor waits for the handler application to exit
 	 * among other things and retrieves its remaining output. */
@@ -65,19 +83,20 @@ private:
 	static void launch_app(const char *file, const char * const argv[]);
 
 private:
-	void put_line(const std::string &s);
-	void do_line(const std::string &s);
+	void feed_handler();
 	void process_report_line(const std::string &s);
-	void do_report_line();
-	bool data_available();
+	void process_report_data(bool at_end);
 	void process_remaining_output();
+	
+	static void *report_thread_func(void *arg);
+	void read_report();
 	void output_thread_list();
 	
-	struct kedr_tr_event_header *read_record(FILE *fd);
 	unsigned int get_tsan_thread_id(__u64 tid);
 	void output_tsan_event(const char *name, unsigned int tid, 
 			       unsigned long pc, unsigned long addr_id, 
 			       unsigned long size);
+	void flush_debug_output();
 	
 	void report_memory_events(const struct kedr_tr_event_mem *ev);
 	void report_block_event(const struct kedr_tr_event_block *ev);
@@ -89,24 +108,29 @@ private:
 	void report_wait_event(const struct kedr_tr_event_sync *ev);
 	void report_lock_event(const struct kedr_tr_event_sync *ev);
 	void report_unlock_event(const struct kedr_tr_event_sync *ev);
+	void report_thread_stack_event(
+		const struct kedr_tr_event_thread_stack *ev);
 	
-	void handle_target_load_event(struct kedr_tr_event_module *ev);
-	void handle_target_unload_event(struct kedr_tr_event_module *ev);
+	void handle_target_load_event(const struct kedr_tr_event_module *ev);
+	void handle_target_unload_event(const struct kedr_tr_event_module *ev);
 
-	void handle_fentry_event(struct kedr_tr_event_func *ev);
-	void handle_fexit_event(struct kedr_tr_event_func *ev);
+	void handle_fentry_event(const struct kedr_tr_event_func *ev);
+	void handle_fexit_event(const struct kedr_tr_event_func *ev);
 
-	void handle_thread_start_event(struct kedr_tr_event_tstart *ev);
-	void handle_thread_end_event(struct kedr_tr_event_tend *ev);
+	void handle_thread_start_event(const struct kedr_tr_event_tstart *ev);
+	void handle_thread_end_event(const struct kedr_tr_event_tend *ev);
+	void handle_stack_event(const struct kedr_tr_event_stack *ev);
 	
-	void process_record(struct kedr_tr_event_header *record);
-	void process_compressed_events(struct kedr_tr_event_header *record);
+	void process_record(const struct kedr_tr_event_header *record);
 	
 private:
 	int in_pipe[2];
 	int out_pipe[2];
 	pid_t pid;
-	unsigned int nrec;
+	
+	/* The reader of the trace from stdin */
+	ParallelReader reader;
+	
 	unsigned int nr_tids;
 	
 	/* The mapping between the raw thread IDs reported by KernelStrider 
@@ -116,6 +140,43 @@ private:
 
 	/* Names of the threads corresponding to the IDs used by TSan */
 	std::vector<std::string> thread_names;
+	
+	/* The call stacks from STACK events, indexed by their IDs (see 
+	 * recorder.h). 'pc' is 0 for the stacks not seen yet. */
+	struct StackFrame
+	{
+		StackFrame() : parent(0), pc(0) {}
+		__u32 parent;
+		__u64 pc;
+	};
+	std::vector<StackFrame> stacks;
+	
+	/* The current call stacks of the threads from THREAD_STACK events
+	 * (the raw addresses of the calls, the outermost one first), by 
+	 * the raw thread IDs. */
+	typedef std::map<__u64, std::vector<__u64> > thread_stack_map_t;
+	thread_stack_map_t thread_stacks;
+	
+	/* The lines to be passed to TSan (or output in the debug mode). */
+	TsanLineBuffer tsan_output;
+	
+	/* The thread reading the output of the handler application. */
+	pthread_t report_thread;
+	bool report_thread_started;
+	
+	/* Protects 'report_data' and 'report_error'. */
+	pthread_mutex_t report_mutex;
+	
+	/* The data received from the handler application but not processed
+	 * yet. */
+	std::string report_data;
+	
+	/* Non-empty if the thread has failed to read the output. */
+	std::string report_error;
+	
+	/* The last incomplete line of the report received so far. Used 
+	 * only by the main thread. */
+	std::string report_tail;
 };
 /* ====================================================================== */
 
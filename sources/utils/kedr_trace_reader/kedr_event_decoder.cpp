@@ -0,0 +1,553 @@
+#include <kedr/kedr_trace_reader/kedr_event_decoder.h>
+
+#include <iostream>
+#include <stdexcept>
+
+#include <cstring> /* memcpy, memset */
+#include <cstddef> /* offsetof */
+
+#include <endian.h>
+#include <byteswap.h>
+
+/* Names of the event types, in order of KEDREvent::Type */
+static const char* typeNames[] =
+{
+    "ma",
+    "lma_update",
+    "lma_read",
+    "lma_write",
+    "ioma",
+    "mrb",
+    "mwb",
+    "mfb",
+    "alloc",
+    "free",
+    "lock",
+    "unlock",
+    "rlock",
+    "runlock",
+    "signal",
+    "wait",
+    "tcreate_before",
+    "tcreate_after",
+    "tjoin",
+    "fentry",
+    "fexit",
+    "fcpre",
+    "fcpost",
+};
+
+/* Description of the per-type field */
+struct FieldDesc
+{
+    const char* name;
+    enum KEDREventDecoder::FieldID id;
+};
+
+#define FIELDS_END {NULL, KEDREventDecoder::fieldTimestamp}
+
+static const FieldDesc fieldsLMA[] =
+{
+    {"pc", KEDREventDecoder::fieldPC},
+    {"addr", KEDREventDecoder::fieldAddr},
+    {"size", KEDREventDecoder::fieldSize},
+    FIELDS_END
+};
+
+static const FieldDesc fieldsIOMA[] =
+{
+    {"pc", KEDREventDecoder::fieldPC},
+    {"addr", KEDREventDecoder::fieldAddr},
+    {"size", KEDREventDecoder::fieldSize},
+    {"access_type", KEDREventDecoder::fieldAccessType},
+    FIELDS_END
+};
+
+static const FieldDesc fieldsPC[] =
+{
+    {"pc", KEDREventDecoder::fieldPC},
+    FIELDS_END
+};
+
+static const FieldDesc fieldsAlloc[] =
+{
+    {"pc", KEDREventDecoder::fieldPC},
+    {"size", KEDREventDecoder::fieldSize},
+    {"pointer", KEDREventDecoder::fieldPointer},
+    FIELDS_END
+};
+
+static const FieldDesc fieldsFree[] =
+{
+    {"pc", KEDREventDecoder::fieldPC},
+    {"pointer", KEDREventDecoder::fieldPointer},
+    FIELDS_END
+};
+
+/* Same for lock and signal/wait events */
+static const FieldDesc fieldsLock[] =
+{
+    {"pc", KEDREventDecoder::fieldPC},
+    {"object", KEDREventDecoder::fieldObject},
+    {"type", KEDREventDecoder::fieldObjectType},
+    FIELDS_END
+};
+
+static const FieldDesc fieldsChildTid[] =
+{
+    {"pc", KEDREventDecoder::fieldPC},
+    {"child_tid", KEDREventDecoder::fieldChildTid},
+    FIELDS_END
+};
+
+static const FieldDesc fieldsFEE[] =
+{
+    {"func", KEDREventDecoder::fieldFunc},
+    FIELDS_END
+};
+
+static const FieldDesc fieldsFC[] =
+{
+    {"pc", KEDREventDecoder::fieldPC},
+    {"func", KEDREventDecoder::fieldFunc},
+    FIELDS_END
+};
+
+static const FieldDesc fieldsNone[] =
+{
+    FIELDS_END
+};
+
+/* Fields for every event type, in order of KEDREvent::Type */
+static const FieldDesc* typeFieldDescs[] =
+{
+    fieldsNone, /* 'ma' is processed specially */
+    fieldsLMA,
+    fieldsLMA,
+    fieldsLMA,
+    fieldsIOMA,
+    fieldsPC,
+    fieldsPC,
+    fieldsPC,
+    fieldsAlloc,
+    fieldsFree,
+    fieldsLock,
+    fieldsLock,
+    fieldsLock,
+    fieldsLock,
+    fieldsLock,
+    fieldsLock,
+    fieldsPC,
+    fieldsChildTid,
+    fieldsChildTid,
+    fieldsFEE,
+    fieldsFEE,
+    fieldsFC,
+    fieldsFC,
+};
+
+static const FieldDesc fieldsMA[] =
+{
+    {"pc", KEDREventDecoder::fieldMAPC},
+    {"addr", KEDREventDecoder::fieldMAAddr},
+    {"size", KEDREventDecoder::fieldMASize},
+    {"access_type", KEDREventDecoder::fieldMAAccessType},
+    FIELDS_END
+};
+
+#undef FIELDS_END
+
+/* Helpers for search typed variables */
+static const CTFVar& findVar(const CTFReader& reader, const std::string& name)
+{
+    const CTFVar* var = reader.findVar(name);
+    if(var == NULL)
+    {
+        std::cerr << "Failed to find variable '" << name << "'.\n";
+        throw std::invalid_argument("Invalid variable name");
+    }
+    return *var;
+}
+
+static const CTFVarInt& findInt(const CTFReader& reader, const std::string& name)
+{
+    const CTFVar& var = findVar(reader, name);
+    if(!var.isInt())
+    {
+        std::cerr << "Variable with name '" << name << "' is not integer.\n";
+        throw std::invalid_argument("Invalid variable type");
+    }
+    return static_cast<const CTFVarInt&>(var);
+}
+
+static const CTFVarEnum& findEnum(const CTFReader& reader, const std::string& name)
+{
+    const CTFVar& var = findVar(reader, name);
+    if(!var.isEnum())
+    {
+        std::cerr << "Variable with name '" << name << "' is not enumeration.\n";
+        throw std::invalid_argument("Invalid variable type");
+    }
+    return static_cast<const CTFVarEnum&>(var);
+}
+
+static const CTFVarArray& findArray(const CTFReader& reader, const std::string& name)
+{
+    const CTFVar& var = findVar(reader, name);
+    if(!var.isArray())
+    {
+        std::cerr << "Variable with name '" << name << "' is not array-like.\n";
+        throw std::invalid_argument("Invalid variable type");
+    }
+    return static_cast<const CTFVarArray&>(var);
+}
+
+/*
+ * Create field for given variable.
+ *
+ * Return false if field cannot be read using fast path.
+ */
+static bool createField(const CTFVarInt& var, enum KEDREventDecoder::FieldID id,
+    KEDREventDecoder::Field& field)
+{
+    field.id = id;
+    field.var = &var;
+    field.offset = -1;
+
+    const CTFTypeInt* type = var.getType();
+
+    int size = var.getSize();
+    int align = var.getAlignment();
+
+    field.isSigned = type->isSigned();
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+    field.needSwap = type->getByteOrder() != CTFTypeInt::le;
+#else
+    field.needSwap = type->getByteOrder() != CTFTypeInt::be;
+#endif
+    field.sizeBytes = size / 8;
+
+    if((size != 8) && (size != 16) && (size != 32) && (size != 64))
+        return false;
+    if((align <= 0) || (align % 8)) return false;
+
+    return true;
+}
+
+/* Read integer field from the memory. */
+static inline uint64_t readField(const char* p,
+    const KEDREventDecoder::Field& field)
+{
+    switch(field.sizeBytes)
+    {
+    case 1:
+        return field.isSigned ? (uint64_t)(int64_t)*(const int8_t*)p
+            : (uint64_t)*(const uint8_t*)p;
+    case 2:
+    {
+        uint16_t val;
+        memcpy(&val, p, sizeof(val));
+        if(field.needSwap) val = bswap_16(val);
+        return field.isSigned ? (uint64_t)(int64_t)(int16_t)val : val;
+    }
+    case 4:
+    {
+        uint32_t val;
+        memcpy(&val, p, sizeof(val));
+        if(field.needSwap) val = bswap_32(val);
+        return field.isSigned ? (uint64_t)(int64_t)(int32_t)val : val;
+    }
+    default:
+    {
+        uint64_t val;
+        memcpy(&val, p, sizeof(val));
+        if(field.needSwap) val = bswap_64(val);
+        return val;
+    }
+    }
+}
+
+/* Store value of the field into the event structure */
+static inline void storeField(KEDREvent& event, int subeventIndex,
+    enum KEDREventDecoder::FieldID id, uint64_t val)
+{
+    switch(id)
+    {
+    case KEDREventDecoder::fieldTimestamp: event.timestamp = val; break;
+    case KEDREventDecoder::fieldTid: event.tid = val; break;
+    case KEDREventDecoder::fieldCounter: event.counter = (int32_t)val; break;
+    case KEDREventDecoder::fieldPC: event.pc = val; break;
+    case KEDREventDecoder::fieldAddr: event.addr = val; break;
+    case KEDREventDecoder::fieldSize: event.size = val; break;
+    case KEDREventDecoder::fieldAccessType: event.accessType = (uint32_t)val; break;
+    case KEDREventDecoder::fieldPointer: event.pointer = val; break;
+    case KEDREventDecoder::fieldObject: event.object = val; break;
+    case KEDREventDecoder::fieldObjectType: event.objectType = (uint32_t)val; break;
+    case KEDREventDecoder::fieldFunc: event.func = val; break;
+    case KEDREventDecoder::fieldChildTid: event.childTid = val; break;
+    case KEDREventDecoder::fieldMAPC:
+        event.subevents[subeventIndex].pc = val; break;
+    case KEDREventDecoder::fieldMAAddr:
+        event.subevents[subeventIndex].addr = val; break;
+    case KEDREventDecoder::fieldMASize:
+        event.subevents[subeventIndex].size = val; break;
+    case KEDREventDecoder::fieldMAAccessType:
+        event.subevents[subeventIndex].accessType = (uint32_t)val; break;
+    case KEDREventDecoder::fieldNSubevents:
+        event.nSubevents = (int)val; break;
+    }
+}
+
+/* Clear all fields in the event except subevents. */
+static inline void clearEvent(KEDREvent& event)
+{
+    memset(&event, 0, offsetof(KEDREvent, subevents));
+}
+
+KEDREventDecoder::KEDREventDecoder(const CTFReader& reader)
+    : typeVar(findEnum(reader, "stream.event.header.type")),
+    maArrayVar(findArray(reader, "event.fields.ma")),
+    maElemVar(findVar(reader, "event.fields.ma[]")),
+    layoutFast(true), maxAlign(1), maLearned(false), maStride(0)
+{
+    if(typeVar.getSize() != 8) layoutFast = false;
+
+    static const struct
+    {
+        const char* name;
+        enum FieldID id;
+    } contextFieldDescs[] =
+    {
+        {"stream.event.context.timestamp", fieldTimestamp},
+        {"stream.event.context.tid", fieldTid},
+        {"stream.event.context.counter", fieldCounter},
+    };
+
+    for(int i = 0; i < (int)(sizeof(contextFieldDescs) / sizeof(contextFieldDescs[0])); i++)
+    {
+        Field field;
+        if(!createField(findInt(reader, contextFieldDescs[i].name),
+            contextFieldDescs[i].id, field)) layoutFast = false;
+        contextFields.push_back(field);
+    }
+
+    int nTypes = sizeof(typeNames) / sizeof(typeNames[0]);
+    typeFields.resize(nTypes);
+
+    for(int type = 0; type < nTypes; type++)
+    {
+        for(const FieldDesc* desc = typeFieldDescs[type]; desc->name; desc++)
+        {
+            Field field;
+            if(!createField(findInt(reader, std::string("event.fields.")
+                + typeNames[type] + "." + desc->name), desc->id, field))
+                layoutFast = false;
+            typeFields[type].push_back(field);
+        }
+    }
+
+    for(const FieldDesc* desc = fieldsMA; desc->name; desc++)
+    {
+        Field field;
+        if(!createField(findInt(reader, std::string("event.fields.ma[].")
+            + desc->name), desc->id, field)) layoutFast = false;
+        maFields.push_back(field);
+    }
+
+    if(!createField(findInt(reader, "event.context.ma.n_subevents"),
+        fieldNSubevents, maNSubevents)) layoutFast = false;
+
+    /* Map enumeration values into event types */
+    const CTFTypeEnum* typeEnum = typeVar.getType();
+    int nValues = typeEnum->getNValues();
+    enumIndexToType.resize(nValues, KEDREvent::typeUnknown);
+    for(int i = 1; i < nValues; i++)
+    {
+        const std::string& name = typeEnum->valueToStr(i);
+        for(int type = 0; type < nTypes; type++)
+        {
+            if(name == typeNames[type])
+            {
+                enumIndexToType[i] = (enum KEDREvent::Type)type;
+                break;
+            }
+        }
+    }
+
+    if(layoutFast)
+    {
+        /* Determine maximum alignment */
+        for(int i = 0; i < (int)contextFields.size(); i++)
+        {
+            int align = contextFields[i].var->getAlignment() / 8;
+            if(align > maxAlign) maxAlign = align;
+        }
+        for(int type = 0; type < nTypes; type++)
+        {
+            for(int i = 0; i < (int)typeFields[type].size(); i++)
+            {
+                int align = typeFields[type][i].var->getAlignment() / 8;
+                if(align > maxAlign) maxAlign = align;
+            }
+        }
+        for(int i = 0; i < (int)maFields.size(); i++)
+        {
+            int align = maFields[i].var->getAlignment() / 8;
+            if(align > maxAlign) maxAlign = align;
+        }
+        /* Raw type value is 8-bit integer */
+        layouts.resize(256 * maxAlign);
+    }
+
+    fast = layoutFast;
+}
+
+void KEDREventDecoder::setFast(bool fast)
+{
+    this->fast = fast && layoutFast;
+}
+
+void KEDREventDecoder::decodeGeneric(CTFReader::Event& event,
+    KEDREvent& result)
+{
+    clearEvent(result);
+
+    result.type = enumIndexToType[typeVar.getValue(event)];
+
+    for(int i = 0; i < (int)contextFields.size(); i++)
+    {
+        const Field& field = contextFields[i];
+        storeField(result, 0, field.id, field.var->getUInt64(event));
+    }
+
+    if(result.type == KEDREvent::typeUnknown) return;
+
+    const std::vector<Field>& fields = typeFields[result.type];
+    for(int i = 0; i < (int)fields.size(); i++)
+    {
+        const Field& field = fields[i];
+        storeField(result, 0, field.id, field.var->getUInt64(event));
+    }
+
+    if(result.type == KEDREvent::typeMA)
+    {
+        int i = 0;
+        for(CTFVarArray::ElemIterator elemIter(maArrayVar, event);
+            elemIter;
+            ++elemIter, ++i)
+        {
+            for(int j = 0; j < (int)maFields.size(); j++)
+            {
+                const Field& field = maFields[j];
+                storeField(result, i, field.id,
+                    field.var->getUInt64(*elemIter));
+            }
+        }
+        result.nSubevents = i;
+    }
+}
+
+void KEDREventDecoder::learnLayout(CTFReader::Event& event, int eventStart,
+    Layout& layout)
+{
+    layout.type = enumIndexToType[typeVar.getValue(event)];
+    layout.offsets.clear();
+
+    for(int i = 0; i < (int)contextFields.size(); i++)
+    {
+        layout.offsets.push_back(
+            (contextFields[i].var->getStartOffset(event) - eventStart) / 8);
+    }
+
+    if(layout.type != KEDREvent::typeUnknown)
+    {
+        const std::vector<Field>& fields = typeFields[layout.type];
+        for(int i = 0; i < (int)fields.size(); i++)
+        {
+            layout.offsets.push_back(
+                (fields[i].var->getStartOffset(event) - eventStart) / 8);
+        }
+    }
+
+    if(layout.type == KEDREvent::typeMA)
+    {
+        layout.nSubeventsOffset =
+            (maNSubevents.var->getStartOffset(event) - eventStart) / 8;
+        layout.maStartOffset =
+            (maArrayVar.getStartOffset(event) - eventStart) / 8;
+    }
+
+    layout.isLearned = true;
+}
+
+void KEDREventDecoder::learnMA(CTFReader::Event& event)
+{
+    CTFVarArray::ElemIterator elemIter(maArrayVar, event);
+    if(!elemIter) return;
+
+    int elemStart = maElemVar.getStartOffset(*elemIter);
+    int elemAlign = maElemVar.getAlignment(*elemIter);
+    int elemSize = maElemVar.getSize(*elemIter);
+
+    for(int i = 0; i < (int)maFields.size(); i++)
+    {
+        maFields[i].offset =
+            (maFields[i].var->getStartOffset(*elemIter) - elemStart) / 8;
+    }
+
+    maStride = ((elemSize + elemAlign - 1) / elemAlign) * elemAlign / 8;
+
+    maLearned = true;
+}
+
+void KEDREventDecoder::decodeFast(CTFReader::Event& event, KEDREvent& result)
+{
+    int eventStart = event.getStartOffset();
+    const char* p = event.mapStart() + eventStart / 8;
+
+    unsigned char typeRaw = *(const unsigned char*)p;
+
+    Layout& layout = layouts[typeRaw * maxAlign + (eventStart / 8) % maxAlign];
+    if(!layout.isLearned) learnLayout(event, eventStart, layout);
+
+    clearEvent(result);
+    result.type = layout.type;
+
+    int offsetIndex = 0;
+    for(int i = 0; i < (int)contextFields.size(); i++, offsetIndex++)
+    {
+        const Field& field = contextFields[i];
+        storeField(result, 0, field.id,
+            readField(p + layout.offsets[offsetIndex], field));
+    }
+
+    if(result.type == KEDREvent::typeUnknown) return;
+
+    const std::vector<Field>& fields = typeFields[result.type];
+    for(int i = 0; i < (int)fields.size(); i++, offsetIndex++)
+    {
+        const Field& field = fields[i];
+        storeField(result, 0, field.id,
+            readField(p + layout.offsets[offsetIndex], field));
+    }
+
+    if(result.type == KEDREvent::typeMA)
+    {
+        result.nSubevents = (int)readField(p + layout.nSubeventsOffset,
+            maNSubevents);
+        if(result.nSubevents == 0) return;
+
+        if(!maLearned) learnMA(event);
+
+        const char* elem = p + layout.maStartOffset;
+        for(int i = 0; i < result.nSubevents; i++, elem += maStride)
+        {
+            for(int j = 0; j < (int)maFields.size(); j++)
+            {
+                const Field& field = maFields[j];
+                storeField(result, i, field.id,
+                    readField(elem + field.offset, field));
+            }
+        }
+    }
+}
@@ -0,0 +1,448 @@
+#include <kedr/kedr_trace_reader/kedr_prefetch_iterator.h>
+
+#include <iostream>
+#include <stdexcept>
+
+#include <cstring> /* strerror */
+#include <cstddef> /* offsetof */
+
+/* Size of one chunk of decoded events, in bytes */
+static const size_t chunkSize = 64 * 1024;
+/* Number of chunks per stream */
+static const int nChunks = 4;
+
+/* Maximum size of the record(with all subevents). */
+static const size_t recordSizeMax =
+	(sizeof(KEDRTraceReader::PrefetchEventIterator::Record) + 7) & ~(size_t)7;
+
+typedef KEDRTraceReader::PrefetchEventIterator::Record Record;
+typedef KEDRTraceReader::PrefetchEventIterator::Chunk Chunk;
+typedef KEDRTraceReader::PrefetchEventIterator::Stream Stream;
+
+KEDRTraceReader::PrefetchEventIterator::Stream::Stream(
+	KEDRTraceReader& traceReader, CTFReader::Event* event)
+	: traceReader(&traceReader), event(event), decoder(traceReader),
+	threadStarted(false), stop(false), chunk(NULL), current(NULL),
+	seq(0), packetCounter(0)
+{
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&cond, NULL);
+
+	for(int i = 0; i < nChunks; i++)
+	{
+		Chunk* chunkNew = new Chunk;
+		/* Use 64-bit elements for align records */
+		chunkNew->data = (char*)new uint64_t[chunkSize / sizeof(uint64_t)];
+		chunkNew->used = 0;
+		chunkNew->last = false;
+
+		chunks.push_back(chunkNew);
+		chunksFree.push_back(chunkNew);
+	}
+}
+
+KEDRTraceReader::PrefetchEventIterator::Stream::~Stream(void)
+{
+	for(int i = 0; i < (int)chunks.size(); i++)
+	{
+		delete[] (uint64_t*)chunks[i]->data;
+		delete chunks[i];
+	}
+
+	pthread_cond_destroy(&cond);
+	pthread_mutex_destroy(&mutex);
+
+	if(event) event->unref();
+}
+
+void KEDRTraceReader::PrefetchEventIterator::writeRecord(Stream& stream,
+	Chunk& chunk, bool packetStart)
+{
+	Record* record = (Record*)(chunk.data + chunk.used);
+
+	stream.decoder.decode(*stream.event, record->event);
+
+	record->packetStart = packetStart;
+	if(packetStart)
+	{
+		CTFReader::Packet& packet = stream.event->getPacket();
+		record->packetCount =
+			stream.traceReader->packetCountVar->getUInt32(packet);
+		record->lostEventsTotal =
+			stream.traceReader->lostEventsTotalVar->getUInt32(packet);
+	}
+
+	size_t size = offsetof(Record, event.subevents);
+	if(record->event.type == KEDREvent::typeMA)
+		size += record->event.nSubevents * sizeof(KEDREvent::MemoryAccess);
+	size = (size + 7) & ~(size_t)7;
+
+	record->size = size;
+	chunk.used += size;
+}
+
+/*
+ * Pass chunk to the iterator and take free one.
+ *
+ * Return NULL if thread should stop.
+ */
+static Chunk* exchangeChunk(Stream& stream, Chunk* chunk)
+{
+	Chunk* chunkNew = NULL;
+
+	pthread_mutex_lock(&stream.mutex);
+	if(chunk)
+	{
+		stream.chunksFull.push_back(chunk);
+		pthread_cond_broadcast(&stream.cond);
+	}
+	while(!stream.stop && (!chunk || !chunk->last))
+	{
+		if(!stream.chunksFree.empty())
+		{
+			chunkNew = stream.chunksFree.front();
+			stream.chunksFree.pop_front();
+			break;
+		}
+		pthread_cond_wait(&stream.cond, &stream.mutex);
+	}
+	pthread_mutex_unlock(&stream.mutex);
+
+	if(chunkNew)
+	{
+		chunkNew->used = 0;
+		chunkNew->last = false;
+	}
+
+	return chunkNew;
+}
+
+void* KEDRTraceReader::PrefetchEventIterator::streamThread(void* arg)
+{
+	Stream& stream = *(Stream*)arg;
+
+	Chunk* chunk = exchangeChunk(stream, NULL);
+	if(!chunk) return NULL;
+
+	try
+	{
+		writeRecord(stream, *chunk, true);
+
+		while(true)
+		{
+			bool packetStart;
+			if(stream.event->nextInPacket())
+			{
+				packetStart = false;
+			}
+			else if(stream.event->next())
+			{
+				packetStart = true;
+			}
+			else
+			{
+				break;
+			}
+
+			if(chunk->used + recordSizeMax > chunkSize)
+			{
+				chunk = exchangeChunk(stream, chunk);
+				if(!chunk) return NULL;
+			}
+
+			writeRecord(stream, *chunk, packetStart);
+		}
+	}
+	catch(std::exception& e)
+	{
+		chunk->error = e.what();
+	}
+	catch(...)
+	{
+		chunk->error = "Unknown error";
+	}
+
+	/* Stream is exhausted */
+	stream.event->unref();
+	stream.event = NULL;
+
+	chunk->last = true;
+	exchangeChunk(stream, chunk);
+
+	return NULL;
+}
+
+KEDRTraceReader::PrefetchEventIterator::PrefetchEventIterator(
+	KEDRTraceReader& traceReader) : traceReader(&traceReader), seq(0)
+{
+	std::vector<std::string> streamFilenames;
+	traceReader.findStreamFiles(streamFilenames);
+
+	try
+	{
+		/* Start all threads before waiting any of them. */
+		for(int i = 0; i < (int)streamFilenames.size(); i++)
+		{
+			CTFReader::Event* event = traceReader.openStream(streamFilenames[i]);
+			Stream* stream;
+			try
+			{
+				stream = new Stream(traceReader, event);
+			}
+			catch(...)
+			{
+				event->unref();
+				throw;
+			}
+			streams.push_back(stream);
+
+			int result = pthread_create(&stream->thread, NULL,
+				streamThread, stream);
+			if(result)
+			{
+				std::cerr << "Failed to create thread for read stream '"
+					<< streamFilenames[i] << "': " << strerror(result) << ".\n";
+				throw std::runtime_error("Failed to create thread");
+			}
+			stream->threadStarted = true;
+		}
+
+		/* Insert streams into the heap in order they have found. */
+		for(int i = 0; i < (int)streams.size(); i++)
+		{
+			Stream& stream = *streams[i];
+			if(!nextRecord(stream)) continue;
+
+			stream.seq = seq++;
+			heap.push_back(i);
+			siftUp(heap.size() - 1);
+
+			checkFirstPacket(stream);
+		}
+	}
+	catch(...)
+	{
+		destroy();
+		throw;
+	}
+}
+
+KEDRTraceReader::PrefetchEventIterator::~PrefetchEventIterator(void)
+{
+	destroy();
+}
+
+void KEDRTraceReader::PrefetchEventIterator::destroy(void)
+{
+	for(int i = 0; i < (int)streams.size(); i++)
+	{
+		Stream& stream = *streams[i];
+		if(!stream.threadStarted) continue;
+
+		pthread_mutex_lock(&stream.mutex);
+		stream.stop = true;
+		pthread_cond_broadcast(&stream.cond);
+		pthread_mutex_unlock(&stream.mutex);
+	}
+
+	for(int i = 0; i < (int)streams.size(); i++)
+	{
+		Stream* stream = streams[i];
+		if(stream->threadStarted) pthread_join(stream->thread, NULL);
+
+		delete stream;
+	}
+
+	streams.clear();
+	heap.clear();
+}
+
+bool KEDRTraceReader::PrefetchEventIterator::nextChunk(Stream& stream)
+{
+	Chunk* chunk = stream.chunk;
+
+	pthread_mutex_lock(&stream.mutex);
+	if(chunk)
+	{
+		stream.chunksFree.push_back(chunk);
+		pthread_cond_broadcast(&stream.cond);
+	}
+	while(stream.chunksFull.empty())
+		pthread_cond_wait(&stream.cond, &stream.mutex);
+
+	chunk = stream.chunksFull.front();
+	stream.chunksFull.pop_front();
+	pthread_mutex_unlock(&stream.mutex);
+
+	stream.chunk = chunk;
+
+	if(!chunk->error.empty())
+	{
+		std::string error = chunk->error;
+		/* Stream is unusable after the error. */
+		chunk->used = 0;
+		chunk->last = true;
+		chunk->error.clear();
+
+		std::cerr << "Failed to read KEDR trace stream: " << error << ".\n";
+		throw std::runtime_error(error);
+	}
+
+	return chunk->used != 0;
+}
+
+bool KEDRTraceReader::PrefetchEventIterator::nextRecord(Stream& stream)
+{
+	if(stream.current)
+	{
+		char* next = (char*)stream.current + stream.current->size;
+		if(next < stream.chunk->data + stream.chunk->used)
+		{
+			stream.current = (Record*)next;
+			return true;
+		}
+	}
+
+	do
+	{
+		if(stream.chunk && stream.chunk->last)
+		{
+			stream.current = NULL;
+			return false;
+		}
+	} while(!nextChunk(stream));
+
+	stream.current = (Record*)stream.chunk->data;
+	return true;
+}
+
+bool KEDRTraceReader::PrefetchEventIterator::isStreamBefore(
+	int stream1, int stream2) const
+{
+	const Stream& s1 = *streams[stream1];
+	const Stream& s2 = *streams[stream2];
+
+	const KEDREvent& event1 = s1.current->event;
+	const KEDREvent& event2 = s2.current->event;
+
+	if(traceReader->isEventOlder(event1.timestamp, event1.counter,
+		event2.timestamp, event2.counter)) return true;
+	if(traceReader->isEventOlder(event2.timestamp, event2.counter,
+		event1.timestamp, event1.counter)) return false;
+	/* Same as for EventIterator, stream inserted earlier goes first */
+	return s1.seq < s2.seq;
+}
+
+void KEDRTraceReader::PrefetchEventIterator::siftUp(int pos)
+{
+	while(pos > 0)
+	{
+		int parent = (pos - 1) / 2;
+		if(!isStreamBefore(heap[pos], heap[parent])) break;
+
+		int tmp = heap[pos];
+		heap[pos] = heap[parent];
+		heap[parent] = tmp;
+		pos = parent;
+	}
+}
+
+void KEDRTraceReader::PrefetchEventIterator::siftDown(int pos)
+{
+	int size = heap.size();
+	while(true)
+	{
+		int child = pos * 2 + 1;
+		if(child >= size) break;
+		if((child + 1 < size) && isStreamBefore(heap[child + 1], heap[child]))
+			child++;
+		if(!isStreamBefore(heap[child], heap[pos])) break;
+
+		int tmp = heap[pos];
+		heap[pos] = heap[child];
+		heap[child] = tmp;
+		pos = child;
+	}
+}
+
+void KEDRTraceReader::PrefetchEventIterator::checkFirstPacket(Stream& stream)
+{
+	const Record& record = *stream.current;
+
+	stream.packetCounter = record.packetCount;
+
+	if(!traceReader->eventsLost())
+	{
+		/* Check whether events lost. */
+		if((record.packetCount != 0) || (record.lostEventsTotal != 0))
+		{
+			traceReader->setEventsLost();
+		}
+	}
+}
+
+void KEDRTraceReader::PrefetchEventIterator::checkNextPacket(Stream& stream)
+{
+	const Record& record = *stream.current;
+
+	uint32_t packetCountOld = stream.packetCounter;
+	uint32_t packetCountNew = record.packetCount;
+
+	stream.packetCounter = packetCountNew;
+
+	if(!traceReader->eventsLost())
+	{
+		/* Check whether events lost. */
+		if(record.lostEventsTotal != 0)
+		{
+			//debug
+			std::cerr << "Lost events before packet ends: "
+				<< record.lostEventsTotal << "." << std::endl;
+			traceReader->setEventsLost();
+		}
+		else if(packetCountNew != packetCountOld + 1)
+		{
+			//debug
+			std::cerr << "Lost packets between " << packetCountOld
+				<< " and " << packetCountNew << "." << std::endl;
+			traceReader->setEventsLost();
+		}
+	}
+}
+
+KEDRTraceReader::PrefetchEventIterator&
+KEDRTraceReader::PrefetchEventIterator::operator++(void)
+{
+	Stream& stream = *streams[heap[0]];
+
+	bool hasNext;
+	try
+	{
+		hasNext = nextRecord(stream);
+	}
+	catch(...)
+	{
+		/* Drop failed stream. */
+		heap[0] = heap.back();
+		heap.pop_back();
+		if(!heap.empty()) siftDown(0);
+		throw;
+	}
+
+	if(hasNext)
+	{
+		stream.seq = seq++;
+		siftDown(0);
+
+		if(stream.current->packetStart) checkNextPacket(stream);
+	}
+	else
+	{
+		/* Stream is exhausted. */
+		heap[0] = heap.back();
+		heap.pop_back();
+		if(!heap.empty()) siftDown(0);
+	}
+
+	return *this;
+}
@@ -74,38 +74,6 @@ void KEDRTraceReader::exceptions(KEDRTraceReader::TraceState except)
 }
 
 
-class KEDRTraceReader::EventIterator::StreamInfo::RefStream
-{
-public:
-	/* Create stream from given file */
-	RefStream(const std::string& filename): refs(1), file(filename.c_str())
-	{
-		if(!file)
-		{
-			std::cerr << "Failed to open stream file '" << filename << "'.\n";
-			throw std::runtime_error("Failed to open stream file");
-		}
-		
-		//debug
-		std::cerr << "Open KEDR trace stream file '" << filename << "'.\n";
-	}
-	
-	/* Return standard stream */
-	std::istream& getStream(void) {return file;}
-	
-	void ref(void) {++refs;}
-	void unref(void) {if(--refs == 0) delete this;}
-
-private:
-	/* Object must be created in the heap */
-	~RefStream(void) {}
-
-	int refs;
-
-	std::ifstream file;
-};
-
-
 /* Comparision of timestamps, which takes into account int type overflow */
 static inline bool isTimestampAfter(uint64_t ts1, uint64_t ts2)
 {
@@ -114,17 +82,21 @@ static inline bool isTimestampAfter(uint64_t ts1, uint64_t ts2)
 
 bool KEDRTraceReader::isEventOlder(Event& event1, Event& event2) const
 {
-	uint64_t timestamp1 = timestampVar->getUInt64(event1);
-	uint64_t timestamp2 = timestampVar->getUInt64(event2);
-	
+	return isEventOlder(timestampVar->getUInt64(event1),
+		counterVar->getInt32(event1),
+		timestampVar->getUInt64(event2),
+		counterVar->getInt32(event2));
+}
+
+bool KEDRTraceReader::isEventOlder(uint64_t timestamp1, int32_t counter1,
+	uint64_t timestamp2, int32_t counter2) const
+{
 	if(isTimestampAfter(timestamp1, timestamp2 + time_precision))
 		return false;
 	else if(isTimestampAfter(timestamp2, timestamp1 + time_precision))
 		return true;
 	else
 	{
-		int32_t counter1 = counterVar->getInt32(event1);
-		int32_t counter2 = counterVar->getInt32(event2);
 		// TODO: process case when not all bits in counter are meaningfull.
 		return counter1 - counter2 < 0;
 	}
@@ -180,56 +152,98 @@ void KEDRTraceReader::EventIterator::reorderLast(void)
 
 KEDRTraceReader::EventIterator::EventIterator(void) {}
 
-KEDRTraceReader::EventIterator::EventIterator(KEDRTraceReader& traceReader)
-	: traceReader(&traceReader)
+void KEDRTraceReader::findStreamFiles(std::vector<std::string>& filenames) const
 {
-	DIR* dir = opendir(traceReader.dirname.c_str());
+	DIR* dir = opendir(dirname.c_str());
 	if(!dir)
 	{
 		std::cerr << "Failed to open trace directory '"
-			<< traceReader.dirname << "': " << strerror(errno) << ".\n";
+			<< dirname << "': " << strerror(errno) << ".\n";
 		throw std::runtime_error("Failed to open trace directory");
 	}
+
+	for(struct dirent* entry = readdir(dir);
+		entry != NULL;
+		entry = readdir(dir))
+	{
+		if(entry->d_type != DT_REG) continue;/* Not a regular file */
+		/* Open file and check, that it starts with CTF magic number */
+		std::string streamFilename = dirname + "/" + entry->d_name;
+		int streamFD = open(streamFilename.c_str(), O_RDONLY);
+		if(streamFD == -1)
+		{
+			std::cerr << "Failed to open file '" << streamFilename
+				<< "' in trace directory. Ignore.\n";
+			continue;
+		}
+		uint32_t magic;
+		int result = read(streamFD, &magic, sizeof(magic));
+		close(streamFD);
+		/* Ignore file in case of any error */
+		if(result != sizeof(magic)) continue;
+
+		if((magic != htobe32(CTFReader::magicValue))
+			&& (magic != htole32(CTFReader::magicValue))) continue;
+
+		/* File contains stream */
+		filenames.push_back(streamFilename);
+	}
+	closedir(dir);
+}
+
+CTFReader::Event* KEDRTraceReader::openStream(const std::string& streamFilename)
+{
+	StreamMap* streamMap = new StreamMap(streamFilename);
+
+	//debug
+	std::cerr << "Open KEDR trace stream file '" << streamFilename << "'.\n";
+
+	Packet* packet;
+	try
+	{
+		packet = new Packet(*this, *streamMap);
+	}
+	catch(...)
+	{
+		streamMap->unref();
+		throw;
+	}
+	/* Now mapping is held by the packet. */
+	streamMap->unref();
+
+	Event* event;
+	try
+	{
+		event = new Event(*packet);
+	}
+	catch(...)
+	{
+		packet->unref();
+		throw;
+	}
+
+	packet->unref();
+
+	return event;
+}
+
+KEDRTraceReader::EventIterator::EventIterator(KEDRTraceReader& traceReader)
+	: traceReader(&traceReader)
+{
+	std::vector<std::string> streamFilenames;
+	traceReader.findStreamFiles(streamFilenames);
+
 	try
 	{
-		for(struct dirent* entry = readdir(dir);
-			entry != NULL;
-			entry = readdir(dir))
+		for(int i = 0; i < (int)streamFilenames.size(); i++)
 		{
-			if(entry->d_type != DT_REG) continue;/* Not a regular file */
-			/* Open file and check, that it starts with CTF magic number */
-			std::string streamFilename = traceReader.dirname + "/" + entry->d_name;
-			int streamFD = open(streamFilename.c_str(), O_RDONLY);
-			if(streamFD == -1)
-			{
-				std::cerr << "Failed to open file '" << streamFilename
-					<< "' in trace directory. Ignore.\n";
-				continue;
-			}
-			uint32_t magic;
-			int result = read(streamFD, &magic, sizeof(magic));
-			close(streamFD);
-			/* Ignore file in case of any error */
-			if(result != sizeof(magic)) continue;
-			
-			if((magic != htobe32(CTFReader::magicValue))
-				&& (magic != htole32(CTFReader::magicValue))) continue;
-			
-			/* File contains stream */
-			
-			StreamInfo::RefStream* refStream =
-				new StreamInfo::RefStream(streamFilename);
-			Packet* packet =
-				new Packet(traceReader, refStream->getStream());
-			Event* event = new Event(*packet);
-			
-			packet->unref();
-			
-			uint32_t packetCount = traceReader.packetCountVar->getUInt32(*packet);
+			Event* event = traceReader.openStream(streamFilenames[i]);
+			Packet& packet = event->getPacket();
+
+			uint32_t packetCount = traceReader.packetCountVar->getUInt32(packet);
 
 			StreamInfo streamInfo;
 			streamInfo.event = event;
-			streamInfo.refStream = refStream;
 			streamInfo.packetCounter = packetCount;
 
 			streamEvents.push_back(streamInfo);
@@ -239,7 +253,7 @@ KEDRTraceReader::EventIterator::EventIterator(KEDRTraceReader& traceReader)
 			{
 				/* Check whether events lost. */
 				uint32_t lostEventsTotal =
-					traceReader.lostEventsTotalVar->getUInt32(*packet);
+					traceReader.lostEventsTotalVar->getUInt32(packet);
 
 				if((packetCount != 0) || (lostEventsTotal != 0))
 				{
@@ -250,16 +264,13 @@ KEDRTraceReader::EventIterator::EventIterator(KEDRTraceReader& traceReader)
 	}
 	catch(...)
 	{
-		closedir(dir);
 		for(int i = (int)streamEvents.size() - 1; i >= 0 ; --i)
 		{
-			streamEvents[i].refStream->unref();
 			streamEvents[i].event->unref();
 		}
-		
+
 		throw;
 	}
-	closedir(dir);
 }
 
 KEDRTraceReader::EventIterator::EventIterator(const EventIterator& iter)
@@ -267,7 +278,6 @@ KEDRTraceReader::EventIterator::EventIterator(const EventIterator& iter)
 {
 	for(int i = 0; i < (int)streamEvents.size(); i++)
 	{
-		streamEvents[i].refStream->ref();
 		streamEvents[i].event->ref();
 	}
 }
@@ -276,7 +286,6 @@ KEDRTraceReader::EventIterator::~EventIterator(void)
 {
 	for(int i = (int)streamEvents.size() - 1; i >= 0 ; --i)
 	{
-		streamEvents[i].refStream->unref();
 		streamEvents[i].event->unref();
 	}
 }
@@ -330,7 +339,7 @@ KEDRTraceReader::EventIterator& KEDRTraceReader::EventIterator::operator++(void)
 	else
 	{
 		/* Event is last in the stream. Destroy current stream. */
-		streamInfo.refStream->unref();
+		event->unref();
 		streamEvents.resize(streamEvents.size() - 1);
 	}
 	return *this;
@@ -0,0 +1,180 @@
+/*
+ * Benchmark of KEDR events decoding.
+ *
+ * Usage:
+ *
+ *   bench_kedr_event_decoder <trace-dir>
+ *
+ * measures decoding of the existing trace, while
+ *
+ *   bench_kedr_event_decoder <trace-dir> <meta-template> <n-events>
+ *
+ * firstly generates synthetic trace with given number of events
+ * in <trace-dir>.
+ *
+ * For every mode(iteration only, iteration with generic decoding,
+ * iteration with fast decoding, iteration with PrefetchEventIterator)
+ * number of events decoded per second is reported.
+ */
+
+#include <kedr/kedr_trace_reader/kedr_trace_reader.h>
+#include <kedr/kedr_trace_reader/kedr_event_decoder.h>
+#include <kedr/kedr_trace_reader/kedr_prefetch_iterator.h>
+
+#include "trace_generator.h"
+
+#include <stdexcept>
+#include <iostream>
+
+#include <cstdlib>
+#include <ctime>
+
+enum BenchMode
+{
+	modeIterate = 0,
+	modeGeneric,
+	modeFast,
+	modePrefetch
+};
+
+static const char* modeNames[] =
+{
+	"iteration only",
+	"generic decoding",
+	"fast decoding",
+	"prefetch iterator"
+};
+
+static double getTime(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void generateTrace(const std::string& traceDir,
+	const std::string& metaTemplateFilename, int nEvents)
+{
+	static const int nCPUs = 4;
+
+	KEDRTraceGenerator generator(metaTemplateFilename, traceDir, nCPUs);
+
+	KEDREvent* event = new KEDREvent;
+	memset(event, 0, sizeof(*event));
+
+	/* Mostly memory accesses, as in real traces. */
+	for(int i = 0; i < nEvents; i++)
+	{
+		event->timestamp = 1000 + i;
+		event->tid = 0x1000 + rand() % 16;
+		event->counter = i;
+
+		int r = rand() % 16;
+		if(r < 12)
+		{
+			event->type = KEDREvent::typeMA;
+			event->nSubevents = 1 + rand() % 8;
+			for(int j = 0; j < event->nSubevents; j++)
+			{
+				event->subevents[j].pc = 0xffffffffa0000000ULL + rand();
+				event->subevents[j].addr = 0xffff880000000000ULL + rand();
+				event->subevents[j].size = 4;
+				event->subevents[j].accessType = 1 + rand() % 3;
+			}
+		}
+		else if(r < 14)
+		{
+			event->type = (r == 12) ? KEDREvent::typeFEntry : KEDREvent::typeFExit;
+			event->func = 0xffffffffa0000000ULL + rand();
+		}
+		else
+		{
+			event->type = (r == 14) ? KEDREvent::typeLock : KEDREvent::typeUnlock;
+			event->pc = 0xffffffffa0000000ULL + rand();
+			event->object = 0xffff880000000000ULL + rand();
+			event->objectType = 0;
+		}
+
+		generator.addEvent(i % nCPUs, *event);
+	}
+
+	delete event;
+}
+
+static void runBench(const std::string& traceDir, enum BenchMode mode)
+{
+	KEDRTraceReader reader(traceDir);
+
+	KEDREventDecoder decoder(reader);
+	if(mode == modeGeneric) decoder.setFast(false);
+	else if((mode == modeFast) && !decoder.isFast())
+	{
+		std::cout << modeNames[mode] << ": not supported for the trace.\n";
+		return;
+	}
+
+	KEDREvent* event = new KEDREvent;
+	/* Prevent optimizing decoding out */
+	uint64_t checksum = 0;
+	long nEvents = 0;
+
+	double start = getTime();
+
+	if(mode == modePrefetch)
+	{
+		for(KEDRTraceReader::PrefetchEventIterator iter(reader); iter; ++iter)
+		{
+			checksum += iter->timestamp + iter->pc + iter->nSubevents;
+			nEvents++;
+		}
+	}
+	else
+	{
+		for(KEDRTraceReader::EventIterator iter(reader); iter; ++iter)
+		{
+			if(mode != modeIterate)
+			{
+				decoder.decode(*iter, *event);
+				checksum += event->timestamp + event->pc + event->nSubevents;
+			}
+			nEvents++;
+		}
+	}
+
+	double elapsed = getTime() - start;
+
+	delete event;
+
+	std::cout << modeNames[mode] << ": " << nEvents << " events in "
+		<< elapsed << " s, " << (long)(nEvents / elapsed)
+		<< " events/s (checksum " << checksum << ").\n";
+}
+
+int main(int argc, char *argv[])
+{
+	if((argc != 2) && (argc != 4))
+	{
+		std::cerr << "Usage: bench_kedr_event_decoder <trace-dir> "
+			"[<meta-template> <n-events>]" << std::endl;
+		return 1;
+	}
+
+	std::string traceDir = argv[1];
+
+	try
+	{
+		if(argc == 4) generateTrace(traceDir, argv[2], atoi(argv[3]));
+
+		runBench(traceDir, modeIterate);
+		runBench(traceDir, modeGeneric);
+		runBench(traceDir, modeFast);
+		runBench(traceDir, modePrefetch);
+	}
+	catch(std::exception& e)
+	{
+		std::cerr << "Exception occures: " << e.what() << "." << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
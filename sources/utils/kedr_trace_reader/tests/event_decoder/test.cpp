@@ -0,0 +1,262 @@
+/*
+ * Test that fast decoding of KEDR events gives same results
+ * as generic CTF interpretation and as values written into the trace.
+ *
+ * Usage: test_kedr_event_decoder <meta-template> <trace-dir>
+ *
+ * Trace is generated in <trace-dir> from the KEDR metadata template.
+ */
+
+#include <kedr/kedr_trace_reader/kedr_trace_reader.h>
+#include <kedr/kedr_trace_reader/kedr_event_decoder.h>
+
+#include "trace_generator.h"
+
+#include <stdexcept>
+#include <iostream>
+#include <vector>
+
+#include <cstdlib>
+
+static std::string metaTemplateFilename;
+static std::string traceDir;
+
+static int test1(void);
+
+int main(int argc, char *argv[])
+{
+	if(argc != 3)
+	{
+		std::cerr << "Usage: test_kedr_event_decoder <meta-template> <trace-dir>"
+			<< std::endl;
+		return 1;
+	}
+
+	metaTemplateFilename = argv[1];
+	traceDir = argv[2];
+
+	int result;
+
+#define RUN_TEST(test_func, test_name) do {\
+    try {result = test_func(); }\
+	catch(std::exception& e) \
+	{ \
+		std::cerr << "Exception occures in '" << test_name << "': " \
+			<< e.what() << "." << std::endl; \
+		return 1; \
+    } \
+    if(result) return result; \
+}while(0)
+
+	RUN_TEST(test1, "all-types");
+
+	return 0;
+}
+
+/* Pseudo-random value, which uses all bits of size_t */
+static uint64_t randomValue(void)
+{
+	uint64_t val = ((uint64_t)rand() << 33) ^ ((uint64_t)rand() << 12)
+		^ (uint64_t)rand();
+	return (size_t)val;
+}
+
+/* Fill event of given type with random values */
+static void fillEvent(KEDREvent& event, enum KEDREvent::Type type,
+	int counter)
+{
+	memset(&event, 0, sizeof(event));
+
+	event.type = type;
+	event.timestamp = 1000 + counter * 10;
+	event.tid = randomValue();
+	/* Counter is used as index of the expected event */
+	event.counter = counter;
+
+	switch(type)
+	{
+	case KEDREvent::typeMA:
+		event.nSubevents = 1 + rand() % 8;
+		for(int i = 0; i < event.nSubevents; i++)
+		{
+			event.subevents[i].pc = randomValue();
+			event.subevents[i].addr = randomValue();
+			event.subevents[i].size = rand() % 16 + 1;
+			event.subevents[i].accessType = rand() % 3 + 1;
+		}
+	break;
+	case KEDREvent::typeLMAUpdate:
+	case KEDREvent::typeLMARead:
+	case KEDREvent::typeLMAWrite:
+		event.pc = randomValue();
+		event.addr = randomValue();
+		event.size = randomValue();
+	break;
+	case KEDREvent::typeIOMA:
+		event.pc = randomValue();
+		event.addr = randomValue();
+		event.size = randomValue();
+		event.accessType = rand() % 3 + 1;
+	break;
+	case KEDREvent::typeMRB:
+	case KEDREvent::typeMWB:
+	case KEDREvent::typeMFB:
+	case KEDREvent::typeTCBefore:
+		event.pc = randomValue();
+	break;
+	case KEDREvent::typeAlloc:
+		event.pc = randomValue();
+		event.size = randomValue();
+		event.pointer = randomValue();
+	break;
+	case KEDREvent::typeFree:
+		event.pc = randomValue();
+		event.pointer = randomValue();
+	break;
+	case KEDREvent::typeLock:
+	case KEDREvent::typeUnlock:
+	case KEDREvent::typeRLock:
+	case KEDREvent::typeRUnlock:
+	case KEDREvent::typeSignal:
+	case KEDREvent::typeWait:
+		event.pc = randomValue();
+		event.object = randomValue();
+		event.objectType = rand() % 4;
+	break;
+	case KEDREvent::typeTCAfter:
+	case KEDREvent::typeTJoin:
+		event.pc = randomValue();
+		event.childTid = randomValue();
+	break;
+	case KEDREvent::typeFEntry:
+	case KEDREvent::typeFExit:
+		event.func = randomValue();
+	break;
+	case KEDREvent::typeFCPre:
+	case KEDREvent::typeFCPost:
+		event.pc = randomValue();
+		event.func = randomValue();
+	break;
+	default:
+	break;
+	}
+}
+
+/* Compare decoded event with expected one */
+static int compareEvents(const KEDREvent& event, const KEDREvent& expected,
+	const char* decodeMode)
+{
+#define CHECK_FIELD(field) do { \
+	if(event.field != expected.field) { \
+		std::cerr << "Event with counter " << expected.counter \
+			<< ": " << decodeMode << " decoding gives " << event.field \
+			<< " for field '" #field "', expected " << expected.field \
+			<< "." << std::endl; \
+		return 1; \
+	} \
+}while(0)
+
+	CHECK_FIELD(type);
+	CHECK_FIELD(timestamp);
+	CHECK_FIELD(tid);
+	CHECK_FIELD(counter);
+	CHECK_FIELD(pc);
+	CHECK_FIELD(addr);
+	CHECK_FIELD(size);
+	CHECK_FIELD(accessType);
+	CHECK_FIELD(pointer);
+	CHECK_FIELD(object);
+	CHECK_FIELD(objectType);
+	CHECK_FIELD(func);
+	CHECK_FIELD(childTid);
+
+	if(expected.type != KEDREvent::typeMA) return 0;
+
+	CHECK_FIELD(nSubevents);
+	for(int i = 0; i < expected.nSubevents; i++)
+	{
+		CHECK_FIELD(subevents[i].pc);
+		CHECK_FIELD(subevents[i].addr);
+		CHECK_FIELD(subevents[i].size);
+		CHECK_FIELD(subevents[i].accessType);
+	}
+#undef CHECK_FIELD
+	return 0;
+}
+
+/*
+ * Generate trace with events of all types in different streams
+ * and check decoded events.
+ */
+int test1(void)
+{
+	static const int nCPUs = 3;
+	static const int nEvents = 5000;
+
+	std::vector<KEDREvent> expected(nEvents);
+
+	{
+		KEDRTraceGenerator generator(metaTemplateFilename, traceDir, nCPUs);
+
+		srand(1);
+		for(int i = 0; i < nEvents; i++)
+		{
+			enum KEDREvent::Type type =
+				(enum KEDREvent::Type)(rand() % KEDREvent::typeUnknown);
+			fillEvent(expected[i], type, i);
+			generator.addEvent(rand() % nCPUs, expected[i]);
+		}
+	}
+
+	KEDRTraceReader reader(traceDir);
+
+	KEDREventDecoder decoder(reader);
+	if(!decoder.isFast())
+	{
+		std::cerr << "Fast path is not used for KEDR trace." << std::endl;
+		return 1;
+	}
+
+	/* Decode one copy of the event in fast mode, another - in generic. */
+	KEDREvent* eventFast = new KEDREvent;
+	KEDREvent* eventGeneric = new KEDREvent;
+
+	int nEventsRead = 0;
+	int result = 0;
+	for(KEDRTraceReader::EventIterator iter(reader); iter; ++iter)
+	{
+		decoder.decodeFast(*iter, *eventFast);
+		decoder.decodeGeneric(*iter, *eventGeneric);
+
+		if((eventGeneric->counter < 0) || (eventGeneric->counter >= nEvents))
+		{
+			std::cerr << "Incorrect counter of the event: "
+				<< eventGeneric->counter << "." << std::endl;
+			result = 1;
+			break;
+		}
+
+		const KEDREvent& eventExpected = expected[eventGeneric->counter];
+
+		result = compareEvents(*eventGeneric, eventExpected, "generic");
+		if(result) break;
+		result = compareEvents(*eventFast, eventExpected, "fast");
+		if(result) break;
+
+		nEventsRead++;
+	}
+
+	delete eventFast;
+	delete eventGeneric;
+
+	if(result) return result;
+
+	if(nEventsRead != nEvents)
+	{
+		std::cerr << "Expected " << nEvents << " events to be read, but "
+			<< nEventsRead << " are read." << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
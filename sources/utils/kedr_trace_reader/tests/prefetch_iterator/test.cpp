@@ -0,0 +1,263 @@
+/*
+ * Test that PrefetchEventIterator returns events in the same order
+ * and detects lost events at the same points as EventIterator.
+ *
+ * Usage: test_kedr_prefetch_iterator <meta-template> <work-dir>
+ *
+ * Traces are generated in subdirectories of <work-dir>.
+ */
+
+#include <kedr/kedr_trace_reader/kedr_trace_reader.h>
+#include <kedr/kedr_trace_reader/kedr_prefetch_iterator.h>
+#include <kedr/kedr_trace_reader/kedr_event_decoder.h>
+
+#include "trace_generator.h"
+
+#include <stdexcept>
+#include <iostream>
+#include <vector>
+
+#include <cstdlib>
+
+static std::string metaTemplateFilename;
+static std::string workDir;
+
+static int test1(void);
+static int test2(void);
+
+int main(int argc, char *argv[])
+{
+	if(argc != 3)
+	{
+		std::cerr << "Usage: test_kedr_prefetch_iterator <meta-template> <work-dir>"
+			<< std::endl;
+		return 1;
+	}
+
+	metaTemplateFilename = argv[1];
+	workDir = argv[2];
+
+	int result;
+
+#define RUN_TEST(test_func, test_name) do {\
+    try {result = test_func(); }\
+	catch(std::exception& e) \
+	{ \
+		std::cerr << "Exception occures in '" << test_name << "': " \
+			<< e.what() << "." << std::endl; \
+		return 1; \
+    } \
+    if(result) return result; \
+}while(0)
+
+	RUN_TEST(test1, "order");
+	RUN_TEST(test2, "lost-events");
+
+	return 0;
+}
+
+/*
+ * Event identificator, which is stored in the 'tid' field.
+ *
+ * Value -1 in the sequence means that lost events are detected.
+ */
+typedef std::vector<long> EventSequence;
+static const long eventsLostMark = -1;
+
+/* Read sequence of events using EventIterator */
+static void readSequence(const std::string& traceDir, EventSequence& seq)
+{
+	KEDRTraceReader reader(traceDir);
+	KEDREventDecoder decoder(reader);
+	KEDREvent* event = new KEDREvent;
+
+	try
+	{
+		KEDRTraceReader::EventIterator iter(reader);
+		while(iter)
+		{
+			decoder.decode(*iter, *event);
+			seq.push_back((long)event->tid);
+			try
+			{
+				++iter;
+			}
+			catch(KEDRTraceReader::LostEventsException&)
+			{
+				seq.push_back(eventsLostMark);
+			}
+		}
+	}
+	catch(...)
+	{
+		delete event;
+		throw;
+	}
+
+	delete event;
+}
+
+/* Read sequence of events using PrefetchEventIterator */
+static void readSequencePrefetch(const std::string& traceDir,
+	EventSequence& seq)
+{
+	KEDRTraceReader reader(traceDir);
+
+	KEDRTraceReader::PrefetchEventIterator iter(reader);
+	while(iter)
+	{
+		seq.push_back((long)iter->tid);
+		try
+		{
+			++iter;
+		}
+		catch(KEDRTraceReader::LostEventsException&)
+		{
+			seq.push_back(eventsLostMark);
+		}
+	}
+}
+
+static int compareSequences(const EventSequence& seq,
+	const EventSequence& seqPrefetch, int nEvents)
+{
+	for(int i = 0; (i < (int)seq.size()) && (i < (int)seqPrefetch.size()); i++)
+	{
+		if(seq[i] != seqPrefetch[i])
+		{
+			std::cerr << "Element " << i << " in sequence differs: "
+				<< seq[i] << " for EventIterator, "
+				<< seqPrefetch[i] << " for PrefetchEventIterator."
+				<< std::endl;
+			return 1;
+		}
+	}
+	if(seq.size() != seqPrefetch.size())
+	{
+		std::cerr << "EventIterator reads " << seq.size()
+			<< " elements, but PrefetchEventIterator reads "
+			<< seqPrefetch.size() << " elements." << std::endl;
+		return 1;
+	}
+
+	int nEventsRead = 0;
+	for(int i = 0; i < (int)seq.size(); i++)
+		if(seq[i] != eventsLostMark) nEventsRead++;
+
+	if(nEventsRead != nEvents)
+	{
+		std::cerr << "Expected " << nEvents << " events to be read, but "
+			<< nEventsRead << " are read." << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Fill event for test with given identificator */
+static void fillEvent(KEDREvent& event, long id)
+{
+	memset(&event, 0, sizeof(event));
+	event.tid = id;
+	if(id % 3)
+	{
+		event.type = KEDREvent::typeMA;
+		event.nSubevents = 1 + id % 5;
+		for(int i = 0; i < event.nSubevents; i++)
+		{
+			event.subevents[i].pc = 0x1000 + id;
+			event.subevents[i].addr = 0x2000 + i;
+			event.subevents[i].size = 4;
+			event.subevents[i].accessType = 1;
+		}
+	}
+	else
+	{
+		event.type = KEDREvent::typeFEntry;
+		event.func = 0x3000 + id;
+	}
+}
+
+/*
+ * Many streams with events, which timestamps and counters may coincide.
+ */
+int test1(void)
+{
+	static const int nCPUs = 16;
+	static const int nEvents = 20000;
+
+	std::string traceDir = workDir + "/trace_order";
+
+	{
+		KEDRTraceGenerator generator(metaTemplateFilename, traceDir, nCPUs);
+		KEDREvent* event = new KEDREvent;
+
+		srand(2);
+		for(int i = 0; i < nEvents; i++)
+		{
+			fillEvent(*event, i);
+			/* Timestamps differ more than time precision every 50 events. */
+			event->timestamp = (uint64_t)(i / 50) * 200000000;
+			/* Several events has same counter. */
+			event->counter = i / 3;
+			generator.addEvent(rand() % nCPUs, *event);
+		}
+
+		delete event;
+	}
+
+	EventSequence seq, seqPrefetch;
+
+	readSequence(traceDir, seq);
+	readSequencePrefetch(traceDir, seqPrefetch);
+
+	return compareSequences(seq, seqPrefetch, nEvents);
+}
+
+/* Events lost in some streams. */
+int test2(void)
+{
+	static const int nCPUs = 3;
+	static const int nEvents = 6000;
+
+	std::string traceDir = workDir + "/trace_lost";
+
+	{
+		KEDRTraceGenerator generator(metaTemplateFilename, traceDir, nCPUs);
+		KEDREvent* event = new KEDREvent;
+
+		for(int i = 0; i < nEvents; i++)
+		{
+			fillEvent(*event, i);
+			event->timestamp = 1000 + i * 10;
+			event->counter = i;
+			generator.addEvent(i % nCPUs, *event);
+
+			if(i == nEvents / 2) generator.loseEvents(1, 5);
+		}
+
+		delete event;
+	}
+
+	EventSequence seq, seqPrefetch;
+
+	readSequence(traceDir, seq);
+	readSequencePrefetch(traceDir, seqPrefetch);
+
+	int result = compareSequences(seq, seqPrefetch, nEvents);
+	if(result) return result;
+
+	/* Lost events should be detected exactly once. */
+	int nLost = 0;
+	for(int i = 0; i < (int)seq.size(); i++)
+		if(seq[i] == eventsLostMark) nLost++;
+
+	if(nLost != 1)
+	{
+		std::cerr << "Lost events are detected " << nLost
+			<< " times, expected once." << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,371 @@
+/*
+ * Generator of synthetic traces in KEDR format.
+ *
+ * Metadata is created from the template used by KEDR itself
+ * (output/ctf_meta_template), with parameters of the current machine.
+ * Streams contain events described by KEDREvent structures.
+ *
+ * Used by tests and benchmarks of the KEDR trace reader.
+ */
+
+#ifndef KEDR_TRACE_GENERATOR_H
+#define KEDR_TRACE_GENERATOR_H
+
+#include <kedr/kedr_trace_reader/kedr_event_decoder.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <stdexcept>
+
+#include <cstring>
+#include <cerrno>
+
+#include <endian.h>
+#include <sys/stat.h> /* mkdir */
+
+class KEDRTraceGenerator
+{
+public:
+	/*
+	 * Create trace in directory 'dirname' with 'nCPUs' streams.
+	 *
+	 * 'metaTemplateFilename' is a path to the KEDR metadata template.
+	 */
+	KEDRTraceGenerator(const std::string& metaTemplateFilename,
+		const std::string& dirname, int nCPUs);
+	~KEDRTraceGenerator(void) {finish();}
+
+	/* Add event into the stream for given cpu. */
+	void addEvent(int cpu, const KEDREvent& event);
+	/*
+	 * Add (emulate) lost events into the stream for given cpu.
+	 *
+	 * Counter will be reflected in the next packet of that stream.
+	 */
+	void loseEvents(int cpu, int nEvents) {streams[cpu].lostEvents += nEvents;}
+
+	/* Flush all packets and close streams. */
+	void finish(void);
+
+	/* Maximum size of the packet, in bytes */
+	static const int maxPacketSize = 4096;
+private:
+	struct Stream
+	{
+		std::ofstream* s;
+		/* Content of the current packet */
+		std::vector<char> packet;
+		uint64_t timestampBegin;
+		uint64_t timestampEnd;
+		uint32_t packetCount;
+		uint32_t lostEvents;
+		int cpu;
+	};
+	std::vector<Stream> streams;
+
+	unsigned char uuid[16];
+
+	void startPacket(Stream& stream);
+	void flushPacket(Stream& stream);
+
+	/* Append data to the buffer after aligning it. */
+	template<class T>
+	static void put(std::vector<char>& buf, T val)
+	{
+		while(buf.size() % sizeof(T)) buf.push_back(0);
+		const char* p = (const char*)&val;
+		buf.insert(buf.end(), p, p + sizeof(T));
+	}
+
+	template<class T>
+	static void putAt(std::vector<char>& buf, size_t offset, T val)
+	{
+		memcpy(&buf[offset], &val, sizeof(T));
+	}
+};
+
+/* Layout of the packet header and context, same as in trace_definition.h */
+static const size_t packetContextOffset = 24;
+static const size_t packetContentSizeOffset = packetContextOffset + 24;
+static const size_t packetSizeOffset = packetContextOffset + 26;
+
+inline KEDRTraceGenerator::KEDRTraceGenerator(
+	const std::string& metaTemplateFilename,
+	const std::string& dirname, int nCPUs)
+{
+	for(int i = 0; i < 16; i++) uuid[i] = (unsigned char)(i * 17 + 1);
+
+	if((mkdir(dirname.c_str(), 0755) == -1) && (errno != EEXIST))
+	{
+		std::cerr << "Failed to create trace directory '" << dirname
+			<< "': " << strerror(errno) << ".\n";
+		throw std::runtime_error("Failed to create trace directory");
+	}
+
+	/* Metadata */
+	std::ifstream templateStream(metaTemplateFilename.c_str());
+	if(!templateStream)
+	{
+		std::cerr << "Failed to open metadata template '"
+			<< metaTemplateFilename << "'.\n";
+		throw std::runtime_error("Failed to open metadata template");
+	}
+	std::string metaTemplate;
+	std::getline(templateStream, metaTemplate, '\0');
+
+	std::ostringstream uuidStr;
+	uuidStr << std::hex;
+	for(int i = 0; i < 16; i++)
+	{
+		if((i == 4) || (i == 6) || (i == 8) || (i == 10)) uuidStr << '-';
+		uuidStr.width(2);
+		uuidStr.fill('0');
+		uuidStr << (int)uuid[i];
+	}
+
+	std::ostringstream pointerBitsStr;
+	pointerBitsStr << sizeof(void*) * 8;
+	std::ostringstream nrCPUsStr;
+	nrCPUsStr << nCPUs;
+	std::ostringstream sizeTSpec;
+	sizeTSpec << "size = " << sizeof(size_t) * 8 << "; align = "
+		<< sizeof(size_t) * 8 << "; signed = false;";
+
+	const struct
+	{
+		const char* name;
+		std::string value;
+	} params[] =
+	{
+		{"uuid", uuidStr.str()},
+		{"pointer_bits", pointerBitsStr.str()},
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+		{"byte_order", "le"},
+#else
+		{"byte_order", "be"},
+#endif
+		{"nr_cpus", nrCPUsStr.str()},
+		{"uint8_t_spec", "size = 8; align = 8; signed = false;"},
+		{"int16_t_spec", "size = 16; align = 16; signed = true;"},
+		{"uint16_t_spec", "size = 16; align = 16; signed = false;"},
+		{"int32_t_spec", "size = 32; align = 32; signed = true;"},
+		{"uint32_t_spec", "size = 32; align = 32; signed = false;"},
+		{"uint64_t_spec", "size = 64; align = 64; signed = false;"},
+		{"size_t_spec", sizeTSpec.str()},
+	};
+
+	std::string meta;
+	size_t pos = 0;
+	while(true)
+	{
+		size_t paramStart = metaTemplate.find('$', pos);
+		if(paramStart == std::string::npos) break;
+		size_t paramEnd = metaTemplate.find('$', paramStart + 1);
+		if(paramEnd == std::string::npos) break;
+
+		meta.append(metaTemplate, pos, paramStart - pos);
+
+		std::string name(metaTemplate, paramStart + 1, paramEnd - paramStart - 1);
+		int i;
+		for(i = 0; i < (int)(sizeof(params) / sizeof(params[0])); i++)
+		{
+			if(name == params[i].name) break;
+		}
+		if(i == (int)(sizeof(params) / sizeof(params[0])))
+		{
+			std::cerr << "Unknown parameter '" << name
+				<< "' in metadata template.\n";
+			throw std::runtime_error("Unknown template parameter");
+		}
+		meta += params[i].value;
+
+		pos = paramEnd + 1;
+	}
+	meta.append(metaTemplate, pos, std::string::npos);
+
+	std::ofstream metaStream((dirname + "/metadata").c_str());
+	metaStream << meta;
+	if(!metaStream)
+	{
+		std::cerr << "Failed to write metadata into trace directory '"
+			<< dirname << "'.\n";
+		throw std::runtime_error("Failed to write metadata");
+	}
+
+	/* Streams */
+	streams.resize(nCPUs);
+	for(int cpu = 0; cpu < nCPUs; cpu++)
+	{
+		Stream& stream = streams[cpu];
+		std::ostringstream streamFilename;
+		streamFilename << dirname << "/stream_" << cpu;
+
+		stream.s = new std::ofstream(streamFilename.str().c_str(),
+			std::ios::out | std::ios::binary | std::ios::trunc);
+		if(!*stream.s)
+		{
+			std::cerr << "Failed to create stream file '"
+				<< streamFilename.str() << "'.\n";
+			delete stream.s;
+			stream.s = NULL;
+			throw std::runtime_error("Failed to create stream file");
+		}
+		stream.packetCount = 0;
+		stream.lostEvents = 0;
+		stream.cpu = cpu;
+	}
+}
+
+inline void KEDRTraceGenerator::startPacket(Stream& stream)
+{
+	std::vector<char>& buf = stream.packet;
+
+	buf.clear();
+	/* Header */
+	put<uint32_t>(buf, 0xC1FC1FC1);
+	buf.insert(buf.end(), uuid, uuid + 16);
+	put<uint8_t>(buf, 0); /* stream_type */
+	put<uint8_t>(buf, (uint8_t)stream.cpu);
+	/* Context (filled when packet is flushed) */
+	put<uint64_t>(buf, 0);
+	put<uint64_t>(buf, 0);
+	put<uint32_t>(buf, 0);
+	put<uint32_t>(buf, 0);
+	put<uint16_t>(buf, 0);
+	put<uint16_t>(buf, 0);
+}
+
+inline void KEDRTraceGenerator::flushPacket(Stream& stream)
+{
+	std::vector<char>& buf = stream.packet;
+	if(buf.empty()) return;
+
+	putAt<uint64_t>(buf, packetContextOffset, stream.timestampBegin);
+	putAt<uint64_t>(buf, packetContextOffset + 8, stream.timestampEnd);
+	putAt<uint32_t>(buf, packetContextOffset + 16, stream.packetCount);
+	putAt<uint32_t>(buf, packetContextOffset + 20, stream.lostEvents);
+	putAt<uint16_t>(buf, packetContentSizeOffset, (uint16_t)(buf.size() * 8));
+	putAt<uint16_t>(buf, packetSizeOffset, (uint16_t)(buf.size() * 8));
+
+	stream.s->write(&buf[0], buf.size());
+
+	stream.packetCount++;
+	buf.clear();
+}
+
+inline void KEDRTraceGenerator::addEvent(int cpu, const KEDREvent& event)
+{
+	Stream& stream = streams[cpu];
+
+	std::vector<char>& buf = stream.packet;
+	if(buf.empty())
+	{
+		startPacket(stream);
+		stream.timestampBegin = event.timestamp;
+	}
+	size_t eventStart = buf.size();
+
+	/* Event header and stream context */
+	put<uint8_t>(buf, (uint8_t)event.type);
+	put<uint64_t>(buf, event.timestamp);
+	put<size_t>(buf, (size_t)event.tid);
+	put<int32_t>(buf, event.counter);
+
+	/* Per-type fields */
+	switch(event.type)
+	{
+	case KEDREvent::typeMA:
+		put<uint8_t>(buf, (uint8_t)event.nSubevents);
+		for(int i = 0; i < event.nSubevents; i++)
+		{
+			const KEDREvent::MemoryAccess& ma = event.subevents[i];
+			put<size_t>(buf, (size_t)ma.pc);
+			put<size_t>(buf, (size_t)ma.addr);
+			put<size_t>(buf, (size_t)ma.size);
+			put<uint8_t>(buf, (uint8_t)ma.accessType);
+		}
+	break;
+	case KEDREvent::typeLMAUpdate:
+	case KEDREvent::typeLMARead:
+	case KEDREvent::typeLMAWrite:
+		put<size_t>(buf, (size_t)event.pc);
+		put<size_t>(buf, (size_t)event.addr);
+		put<size_t>(buf, (size_t)event.size);
+	break;
+	case KEDREvent::typeIOMA:
+		put<size_t>(buf, (size_t)event.pc);
+		put<size_t>(buf, (size_t)event.addr);
+		put<size_t>(buf, (size_t)event.size);
+		put<uint8_t>(buf, (uint8_t)event.accessType);
+	break;
+	case KEDREvent::typeMRB:
+	case KEDREvent::typeMWB:
+	case KEDREvent::typeMFB:
+	case KEDREvent::typeTCBefore:
+		put<size_t>(buf, (size_t)event.pc);
+	break;
+	case KEDREvent::typeAlloc:
+		put<size_t>(buf, (size_t)event.pc);
+		put<size_t>(buf, (size_t)event.size);
+		put<size_t>(buf, (size_t)event.pointer);
+	break;
+	case KEDREvent::typeFree:
+		put<size_t>(buf, (size_t)event.pc);
+		put<size_t>(buf, (size_t)event.pointer);
+	break;
+	case KEDREvent::typeLock:
+	case KEDREvent::typeUnlock:
+	case KEDREvent::typeRLock:
+	case KEDREvent::typeRUnlock:
+	case KEDREvent::typeSignal:
+	case KEDREvent::typeWait:
+		put<size_t>(buf, (size_t)event.pc);
+		put<size_t>(buf, (size_t)event.object);
+		put<uint8_t>(buf, (uint8_t)event.objectType);
+	break;
+	case KEDREvent::typeTCAfter:
+	case KEDREvent::typeTJoin:
+		put<size_t>(buf, (size_t)event.pc);
+		put<size_t>(buf, (size_t)event.childTid);
+	break;
+	case KEDREvent::typeFEntry:
+	case KEDREvent::typeFExit:
+		put<size_t>(buf, (size_t)event.func);
+	break;
+	case KEDREvent::typeFCPre:
+	case KEDREvent::typeFCPost:
+		put<size_t>(buf, (size_t)event.pc);
+		put<size_t>(buf, (size_t)event.func);
+	break;
+	default:
+		throw std::logic_error("Unknown event type for generate");
+	}
+
+	if((buf.size() > (size_t)maxPacketSize) && (eventStart > packetSizeOffset + 2))
+	{
+		/* Event doesn't fit into current packet. */
+		buf.resize(eventStart);
+		flushPacket(stream);
+		addEvent(cpu, event);
+		return;
+	}
+
+	stream.timestampEnd = event.timestamp;
+}
+
+inline void KEDRTraceGenerator::finish(void)
+{
+	for(int i = 0; i < (int)streams.size(); i++)
+	{
+		Stream& stream = streams[i];
+		if(!stream.s) continue;
+		flushPacket(stream);
+		delete stream.s;
+		stream.s = NULL;
+	}
+}
+
+#endif /* KEDR_TRACE_GENERATOR_H */
@@ -0,0 +1,1055 @@
+/* ========================================================================
+ * Copyright (C) 2014, ROSA Laboratory
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ ======================================================================== */
+
+/* This module checks the memory accesses it receives from the core with
+ * the lockset algorithm (as in Eraser) right in the kernel and reports
+ * only the accesses that are not consistently protected by any lock to the
+ * system log. It is intended for the cases when recording all the events
+ * and analyzing them in the user space (see simple_trace_recorder) costs
+ * too much. The results are approximate: the lockset algorithm knows
+ * nothing about the synchronization other than locks, so it may report
+ * false positives. The reported accesses may then be analyzed in detail
+ * with other tools.
+ *
+ * For each memory location (an aligned 8-byte granule, see
+ * KEDR_LS_GRANULE_SHIFT), the module keeps its state and its candidate
+ * lockset, i.e. the set of the locks held by all the threads that
+ * accessed it so far:
+ * - VIRGIN: not accessed yet (the location is not in the shadow at all);
+ * - EXCLUSIVE: accessed by one thread only, the lockset is not used;
+ * - SHARED: read by several threads, written by at most one of them
+ *   before the others read it; the lockset is refined but empty lockset
+ *   is not reported;
+ * - SHARED_MODIFIED: written by a thread after another thread has
+ *   accessed it; the lockset is refined and the access is reported if the
+ *   lockset becomes empty. The location is not checked after that.
+ * The writes refine the lockset only with the locks held for writing (all
+ * locks except KEDR_LT_RLOCK). When a memory area is allocated, the state
+ * of its locations is forgotten.
+ *
+ * The report contains the offending access and the last access to the
+ * same location made by another thread, if known ("the first conflicting
+ * access"). No more than 'max_reports' reports are output for a session,
+ * the rest are only counted.
+ *
+ * The shadow of the memory locations is allocated when the module is
+ * loaded and its size is limited by 'shadow_memory_kb' parameter. The
+ * shadow is split into KEDR_LS_NR_SHARDS shards by the hash of the
+ * locations. When a shard is full, its least recently accessed location
+ * is evicted, i.e. it gets back to VIRGIN state. This may only hide some
+ * races, not produce false reports. The counters in debugfs show how the
+ * shadow is used and how many accesses have been checked.
+ *
+ * Notes for developers.
+ * The events come from all CPUs. Each shard of the shadow has its own
+ * lock, its own range of the hash buckets and its own lists of the used
+ * and the free locations, so that the accesses to the unrelated memory
+ * locations do not contend for the same lock. The table of the locks held
+ * by the threads is split the same way by the hash of the thread IDs.
+ * check_access() copies the locks held by the thread first and then
+ * checks each location under the lock of its shard, so at most one lock
+ * is held at a time. The locks are taken with the interrupts disabled
+ * because the event handlers may be called in atomic context including
+ * the interrupt handlers.
+ *
+ * 'accesses_checked' and 'locks_untracked' counters are updated without
+ * synchronization, like the similar counters in the core, so they may be
+ * slightly inaccurate if the events come from several CPUs at once. */
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/init.h>
+#include <linux/errno.h>
+#include <linux/kernel.h>
+#include <linux/spinlock.h>
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/bug.h>		/* BUG_ON */
+#include <linux/log2.h>
+#include <linux/hash.h>
+#include <linux/list.h>
+#include <linux/vmalloc.h>
+#include <linux/string.h>
+
+#include <kedr/kedr_mem/core_api.h>
+#include <kedr/object_types.h>
+
+#include <kedr_ls_config.h>
+
+#include "config.h"
+/* ====================================================================== */
+
+#define KEDR_MSG_PREFIX "[" KEDR_LS_KMODULE_NAME "] "
+/* ====================================================================== */
+
+MODULE_AUTHOR("Eugene A. Shatokhin");
+MODULE_LICENSE("GPL");
+/* ====================================================================== */
+
+/* The upper limit on the memory used for the shadow of the memory
+ * locations, in kilobytes. */
+unsigned int shadow_memory_kb = 4096;
+module_param(shadow_memory_kb, uint, S_IRUGO);
+
+/* The maximum number of the reports to output to the system log during a
+ * session. The races found after that are only counted. 0 means no
+ * limit. */
+unsigned int max_reports = 100;
+module_param(max_reports, uint, S_IRUGO);
+/* ====================================================================== */
+
+/* A directory for the module in debugfs. */
+static struct dentry *debugfs_dir_dentry = NULL;
+static const char *debugfs_dir_name = KEDR_LS_KMODULE_NAME;
+
+static struct dentry *accesses_checked_file = NULL;
+static struct dentry *races_found_file = NULL;
+static struct dentry *locations_used_file = NULL;
+static struct dentry *locations_evicted_file = NULL;
+static struct dentry *shadow_bytes_file = NULL;
+static struct dentry *locks_untracked_file = NULL;
+
+/* The number of the memory accesses checked and the number of the
+ * locations found to be accessed without consistent locking. */
+static u64 accesses_checked = 0;
+static u64 races_found = 0;
+
+/* The memory allocated for the shadow, in bytes. */
+static u64 shadow_bytes = 0;
+
+/* The number of the locks that could not be recorded because a thread
+ * held too many locks or a location had too many locks in its lockset.
+ * Non-zero value means some of the reports may be false positives. */
+static u64 locks_untracked = 0;
+/* ====================================================================== */
+
+/* The size of the memory locations is 2^KEDR_LS_GRANULE_SHIFT bytes. */
+#define KEDR_LS_GRANULE_SHIFT 3
+
+/* If a memory access spans more locations than this, only the first ones
+ * are checked. This bounds the time spent on the large accesses like
+ * string operations. */
+#define KEDR_LS_MAX_GRANULES 16
+
+/* The maximum number of locks in the candidate lockset of a location. The
+ * locksets only shrink, so the limit only matters when the location
+ * becomes shared by the threads. */
+#define KEDR_LS_MAX_LOCKS 4
+
+/* The number of the shards of the shadow and of the table of the threads,
+ * each with its own lock. */
+#define KEDR_LS_SHARD_BITS 4
+#define KEDR_LS_NR_SHARDS (1 << KEDR_LS_SHARD_BITS)
+
+enum kedr_ls_state {
+	KEDR_LS_EXCLUSIVE = 0,
+	KEDR_LS_SHARED,
+	KEDR_LS_SHARED_MODIFIED,
+
+	/* The race has been reported, the location is no longer checked.*/
+	KEDR_LS_REPORTED
+};
+
+/* A memory access, for the reports. 'pc' is 0 if there is no access. */
+struct kedr_ls_access
+{
+	unsigned long tid;
+	unsigned long pc;
+	enum kedr_memory_event_type type;
+};
+
+struct kedr_ls_location
+{
+	/* The chain of the hash table of the shadow. */
+	struct hlist_node hlist;
+
+	/* The list of the used locations, the most recently accessed one
+	 * first, or the list of the free locations. */
+	struct list_head list;
+
+	/* The address of the location >> KEDR_LS_GRANULE_SHIFT. */
+	unsigned long granule;
+
+	enum kedr_ls_state state;
+
+	unsigned int nr_locks;
+	unsigned long locks[KEDR_LS_MAX_LOCKS];
+
+	/* The last access and the last access by a thread other than the
+	 * one that made 'last'. In EXCLUSIVE state, 'last.tid' is the
+	 * thread owning the location. */
+	struct kedr_ls_access last;
+	struct kedr_ls_access other;
+};
+
+/* A shard of the shadow. It owns the hash buckets with the given value of
+ * the upper KEDR_LS_SHARD_BITS bits of the index and the locations in
+ * these buckets. */
+struct kedr_ls_shard
+{
+	spinlock_t lock;
+
+	/* The used locations of the shard, the most recently accessed one
+	 * first, and the free ones. */
+	struct list_head used_list;
+	struct list_head free_list;
+
+	/* The number of the locations currently in the shard and the number
+	 * of the locations evicted from it because it was full. */
+	unsigned long nr_used;
+	u64 nr_evicted;
+} ____cacheline_aligned_in_smp;
+
+/* The shadow. The locations are allocated when the module is loaded and
+ * are distributed evenly among the shards. The number of the hash buckets
+ * is a power of 2 not greater than the number of the locations. */
+static struct kedr_ls_location *locations = NULL;
+static unsigned int nr_locations = 0;
+
+static struct hlist_head *shadow_table = NULL;
+static unsigned int shadow_hash_bits = 0;
+
+static struct kedr_ls_shard shards[KEDR_LS_NR_SHARDS];
+/* ====================================================================== */
+
+/* The locks held by the threads. This is a hash table with open
+ * addressing split into KEDR_LS_NR_SHARDS shards, the probe sequences wrap
+ * around within a shard. The key of an element is TID + 1 because the IDs
+ * of the interrupt "threads" (the numbers of the CPUs) may be 0. The
+ * removed elements are marked with KEDR_LS_THREAD_REMOVED rather than with
+ * 0 to keep the probe sequences of other elements intact. If the shard is
+ * full, the thread is considered to hold no locks. */
+#define KEDR_LS_THREAD_HASH_BITS 10
+#define KEDR_LS_THREAD_SHARD_SIZE \
+	(1 << (KEDR_LS_THREAD_HASH_BITS - KEDR_LS_SHARD_BITS))
+#define KEDR_LS_MAX_PROBES 32
+#define KEDR_LS_THREAD_REMOVED (~0UL)
+
+/* The maximum number of the locks a thread may hold at the same time. */
+#define KEDR_LS_MAX_LOCKS_HELD 16
+
+struct kedr_ls_held_lock
+{
+	unsigned long id;
+
+	/* Non-zero if the lock is held for writing. */
+	int write;
+};
+
+struct kedr_ls_thread
+{
+	unsigned long key;
+	unsigned int nr_locks;
+	struct kedr_ls_held_lock locks[KEDR_LS_MAX_LOCKS_HELD];
+};
+
+struct kedr_ls_thread_shard
+{
+	spinlock_t lock;
+	struct kedr_ls_thread threads[KEDR_LS_THREAD_SHARD_SIZE];
+} ____cacheline_aligned_in_smp;
+
+static struct kedr_ls_thread_shard thread_shards[KEDR_LS_NR_SHARDS];
+
+/* The number of the races found and the number of the reports output to
+ * the system log in this session are protected by 'report_lock'. */
+static unsigned int nr_reports = 0;
+static DEFINE_SPINLOCK(report_lock);
+/* ====================================================================== */
+
+static struct kedr_ls_thread_shard *
+thread_shard(unsigned long tid)
+{
+	return &thread_shards[hash_long(tid, KEDR_LS_SHARD_BITS)];
+}
+
+static unsigned int
+thread_pos(unsigned long tid)
+{
+	return (unsigned int)hash_long(tid, KEDR_LS_THREAD_HASH_BITS) &
+		(KEDR_LS_THREAD_SHARD_SIZE - 1);
+}
+
+/* The functions below should be called with the lock of the shard
+ * locked. */
+static struct kedr_ls_thread *
+find_thread(struct kedr_ls_thread_shard *ts, unsigned long tid)
+{
+	unsigned long key = tid + 1;
+	unsigned int pos = thread_pos(tid);
+	unsigned int i;
+
+	for (i = 0; i < KEDR_LS_MAX_PROBES; ++i) {
+		if (ts->threads[pos].key == key)
+			return &ts->threads[pos];
+		if (ts->threads[pos].key == 0)
+			break;
+		pos = (pos + 1) & (KEDR_LS_THREAD_SHARD_SIZE - 1);
+	}
+	return NULL;
+}
+
+/* Returns the element for the thread, adds it if it is not there yet.
+ * Returns NULL if there is no room for it. */
+static struct kedr_ls_thread *
+get_thread(struct kedr_ls_thread_shard *ts, unsigned long tid)
+{
+	unsigned long key = tid + 1;
+	struct kedr_ls_thread *t;
+	unsigned int pos;
+	unsigned int i;
+
+	t = find_thread(ts, tid);
+	if (t != NULL)
+		return t;
+
+	pos = thread_pos(tid);
+	for (i = 0; i < KEDR_LS_MAX_PROBES; ++i) {
+		t = &ts->threads[pos];
+		if (t->key == 0 || t->key == KEDR_LS_THREAD_REMOVED) {
+			t->key = key;
+			t->nr_locks = 0;
+			return t;
+		}
+		pos = (pos + 1) & (KEDR_LS_THREAD_SHARD_SIZE - 1);
+	}
+	return NULL;
+}
+
+/* Copies the locks held by the thread to 't'. */
+static void
+get_held_locks(unsigned long tid, struct kedr_ls_thread *t)
+{
+	struct kedr_ls_thread_shard *ts = thread_shard(tid);
+	struct kedr_ls_thread *found;
+	unsigned long irq_flags;
+
+	t->key = tid + 1;
+	t->nr_locks = 0;
+
+	spin_lock_irqsave(&ts->lock, irq_flags);
+	found = find_thread(ts, tid);
+	if (found != NULL) {
+		t->nr_locks = found->nr_locks;
+		memcpy(&t->locks[0], &found->locks[0],
+			found->nr_locks * sizeof(t->locks[0]));
+	}
+	spin_unlock_irqrestore(&ts->lock, irq_flags);
+}
+
+/* Non-zero if the thread holds the lock, for writing if 'write' is
+ * non-zero. */
+static int
+thread_holds_lock(const struct kedr_ls_thread *t, unsigned long lock_id,
+	int write)
+{
+	unsigned int i;
+
+	if (t == NULL)
+		return 0;
+
+	for (i = 0; i < t->nr_locks; ++i) {
+		if (t->locks[i].id == lock_id &&
+		    (t->locks[i].write || !write))
+			return 1;
+	}
+	return 0;
+}
+/* ====================================================================== */
+
+static struct hlist_head *
+shadow_bucket(unsigned long granule)
+{
+	return &shadow_table[hash_long(granule, shadow_hash_bits)];
+}
+
+/* The shard owning the bucket of the location, see create_shadow(). */
+static struct kedr_ls_shard *
+shadow_shard(unsigned long granule)
+{
+	return &shards[hash_long(granule, shadow_hash_bits) >>
+		(shadow_hash_bits - KEDR_LS_SHARD_BITS)];
+}
+
+/* The functions below should be called with the lock of the shard of the
+ * location locked. */
+static struct kedr_ls_location *
+find_location(unsigned long granule)
+{
+	struct kedr_ls_location *loc;
+	struct hlist_node *node;
+
+	hlist_for_each(node, shadow_bucket(granule)) {
+		loc = hlist_entry(node, struct kedr_ls_location, hlist);
+		if (loc->granule == granule)
+			return loc;
+	}
+	return NULL;
+}
+
+static void
+forget_location(struct kedr_ls_shard *sh, struct kedr_ls_location *loc)
+{
+	hlist_del(&loc->hlist);
+	list_move(&loc->list, &sh->free_list);
+	--sh->nr_used;
+}
+
+/* Adds the location to the shard in EXCLUSIVE state. If the shard is
+ * full, its least recently accessed location is evicted. */
+static struct kedr_ls_location *
+add_location(struct kedr_ls_shard *sh, unsigned long granule,
+	const struct kedr_ls_access *acc)
+{
+	struct kedr_ls_location *loc;
+
+	if (list_empty(&sh->free_list)) {
+		loc = list_entry(sh->used_list.prev,
+				 struct kedr_ls_location, list);
+		forget_location(sh, loc);
+		++sh->nr_evicted;
+	}
+
+	loc = list_first_entry(&sh->free_list, struct kedr_ls_location,
+			       list);
+	loc->granule = granule;
+	loc->state = KEDR_LS_EXCLUSIVE;
+	loc->nr_locks = 0;
+	loc->last = *acc;
+	memset(&loc->other, 0, sizeof(loc->other));
+
+	hlist_add_head(&loc->hlist, shadow_bucket(granule));
+	list_move(&loc->list, &sh->used_list);
+	++sh->nr_used;
+	return loc;
+}
+
+/* The location becomes shared: its lockset is the set of the locks the
+ * thread holds. */
+static void
+init_lockset(struct kedr_ls_location *loc, const struct kedr_ls_thread *t,
+	int write)
+{
+	unsigned int i;
+
+	loc->nr_locks = 0;
+	if (t == NULL)
+		return;
+
+	for (i = 0; i < t->nr_locks; ++i) {
+		if (write && !t->locks[i].write)
+			continue;
+
+		if (loc->nr_locks == KEDR_LS_MAX_LOCKS) {
+			++locks_untracked;
+			break;
+		}
+		loc->locks[loc->nr_locks] = t->locks[i].id;
+		++loc->nr_locks;
+	}
+}
+
+/* Removes the locks the thread does not hold from the lockset of the
+ * location. */
+static void
+refine_lockset(struct kedr_ls_location *loc, const struct kedr_ls_thread *t,
+	int write)
+{
+	unsigned int i;
+	unsigned int n = 0;
+
+	for (i = 0; i < loc->nr_locks; ++i) {
+		if (thread_holds_lock(t, loc->locks[i], write)) {
+			loc->locks[n] = loc->locks[i];
+			++n;
+		}
+	}
+	loc->nr_locks = n;
+}
+
+/* Checks the access to the location and updates its state. Returns
+ * non-zero if the access should be reported, 'conflict' is the access it
+ * conflicts with then. */
+static int
+check_location(struct kedr_ls_shard *sh, unsigned long granule,
+	const struct kedr_ls_access *acc, const struct kedr_ls_thread *t,
+	struct kedr_ls_access *conflict)
+{
+	struct kedr_ls_location *loc;
+	int write = (acc->type != KEDR_ET_MREAD);
+
+	loc = find_location(granule);
+	if (loc == NULL) {
+		add_location(sh, granule, acc);
+		return 0;
+	}
+	list_move(&loc->list, &sh->used_list);
+
+	switch (loc->state) {
+	case KEDR_LS_EXCLUSIVE:
+		if (loc->last.tid == acc->tid)
+			break;
+
+		init_lockset(loc, t, write);
+		loc->state = (write ?
+			KEDR_LS_SHARED_MODIFIED : KEDR_LS_SHARED);
+		break;
+
+	case KEDR_LS_SHARED:
+		refine_lockset(loc, t, write);
+		if (write)
+			loc->state = KEDR_LS_SHARED_MODIFIED;
+		break;
+
+	case KEDR_LS_SHARED_MODIFIED:
+		refine_lockset(loc, t, write);
+		break;
+
+	case KEDR_LS_REPORTED:
+		return 0;
+	}
+
+	if (loc->last.tid != acc->tid)
+		loc->other = loc->last;
+	loc->last = *acc;
+
+	if (loc->state != KEDR_LS_SHARED_MODIFIED || loc->nr_locks != 0)
+		return 0;
+
+	loc->state = KEDR_LS_REPORTED;
+	*conflict = loc->other;
+	return 1;
+}
+
+/* The number of the locations in all the shards. The shards are not
+ * locked, so the result is only an estimate if the events come from
+ * several CPUs at once. */
+static unsigned long
+count_used_locations(void)
+{
+	unsigned long nr = 0;
+	unsigned int i;
+
+	for (i = 0; i < KEDR_LS_NR_SHARDS; ++i)
+		nr += shards[i].nr_used;
+	return nr;
+}
+
+/* Forgets the locations in [addr, addr + size). Takes the locks of the
+ * shards as needed. */
+static void
+forget_area(unsigned long addr, unsigned long size)
+{
+	unsigned long first = addr >> KEDR_LS_GRANULE_SHIFT;
+	unsigned long last = (addr + size - 1) >> KEDR_LS_GRANULE_SHIFT;
+	struct kedr_ls_location *loc;
+	struct kedr_ls_location *tmp;
+	struct kedr_ls_shard *sh;
+	unsigned long irq_flags;
+	unsigned long g;
+	unsigned int i;
+
+	/* Look for each granule of the area or go through all the used
+	 * locations, whichever is faster. */
+	if (last - first < count_used_locations()) {
+		for (g = first; g <= last; ++g) {
+			sh = shadow_shard(g);
+			spin_lock_irqsave(&sh->lock, irq_flags);
+			loc = find_location(g);
+			if (loc != NULL)
+				forget_location(sh, loc);
+			spin_unlock_irqrestore(&sh->lock, irq_flags);
+		}
+		return;
+	}
+
+	for (i = 0; i < KEDR_LS_NR_SHARDS; ++i) {
+		sh = &shards[i];
+		spin_lock_irqsave(&sh->lock, irq_flags);
+		list_for_each_entry_safe(loc, tmp, &sh->used_list, list) {
+			if (loc->granule >= first && loc->granule <= last)
+				forget_location(sh, loc);
+		}
+		spin_unlock_irqrestore(&sh->lock, irq_flags);
+	}
+}
+
+static void
+reset_shadow(void)
+{
+	unsigned int bucket_bits = shadow_hash_bits - KEDR_LS_SHARD_BITS;
+	struct kedr_ls_shard *sh;
+	unsigned long irq_flags;
+	unsigned int i;
+	unsigned int k;
+
+	for (i = 0; i < KEDR_LS_NR_SHARDS; ++i) {
+		sh = &shards[i];
+		spin_lock_irqsave(&sh->lock, irq_flags);
+
+		INIT_LIST_HEAD(&sh->used_list);
+		INIT_LIST_HEAD(&sh->free_list);
+		for (k = i; k < nr_locations; k += KEDR_LS_NR_SHARDS)
+			list_add_tail(&locations[k].list, &sh->free_list);
+
+		for (k = 0; k < (1U << bucket_bits); ++k)
+			INIT_HLIST_HEAD(&shadow_table[(i << bucket_bits) + k]);
+
+		sh->nr_used = 0;
+		sh->nr_evicted = 0;
+		spin_unlock_irqrestore(&sh->lock, irq_flags);
+	}
+
+	for (i = 0; i < KEDR_LS_NR_SHARDS; ++i) {
+		spin_lock_irqsave(&thread_shards[i].lock, irq_flags);
+		memset(&thread_shards[i].threads[0], 0,
+			sizeof(thread_shards[i].threads));
+		spin_unlock_irqrestore(&thread_shards[i].lock, irq_flags);
+	}
+}
+/* ====================================================================== */
+
+static const char *
+access_type_name(enum kedr_memory_event_type type)
+{
+	switch (type) {
+	case KEDR_ET_MREAD:
+		return "read";
+	case KEDR_ET_MWRITE:
+		return "write";
+	default:
+		return "update";
+	}
+}
+
+static void
+report_race(unsigned long addr, unsigned long size,
+	const struct kedr_ls_access *acc,
+	const struct kedr_ls_access *conflict)
+{
+	if (conflict->pc == 0) {
+		pr_warning(KEDR_MSG_PREFIX
+	"Possible race: %s of [%lx, %lx) at %pS (thread: %lx), "
+	"no lock protects it consistently.\n",
+			access_type_name(acc->type), addr, addr + size,
+			(void *)acc->pc, acc->tid);
+		return;
+	}
+
+	pr_warning(KEDR_MSG_PREFIX
+	"Possible race: %s of [%lx, %lx) at %pS (thread: %lx) "
+	"and %s at %pS (thread: %lx), no lock protects them consistently.\n",
+		access_type_name(acc->type), addr, addr + size,
+		(void *)acc->pc, acc->tid,
+		access_type_name(conflict->type),
+		(void *)conflict->pc, conflict->tid);
+}
+
+static void
+check_access(unsigned long tid, unsigned long pc, unsigned long addr,
+	unsigned long size, enum kedr_memory_event_type type)
+{
+	unsigned long irq_flags;
+	struct kedr_ls_access acc;
+	struct kedr_ls_access conflict;
+	struct kedr_ls_access unused;
+	struct kedr_ls_thread t;
+	struct kedr_ls_shard *sh;
+	unsigned long first;
+	unsigned long last;
+	unsigned long g;
+	int found = 0;
+	int report = 0;
+
+	if (size == 0)
+		return;
+
+	acc.tid = tid;
+	acc.pc = pc;
+	acc.type = type;
+
+	first = addr >> KEDR_LS_GRANULE_SHIFT;
+	last = (addr + size - 1) >> KEDR_LS_GRANULE_SHIFT;
+	if (last - first >= KEDR_LS_MAX_GRANULES)
+		last = first + KEDR_LS_MAX_GRANULES - 1;
+
+	++accesses_checked;
+	get_held_locks(tid, &t);
+
+	for (g = first; g <= last; ++g) {
+		sh = shadow_shard(g);
+		spin_lock_irqsave(&sh->lock, irq_flags);
+
+		/* Report each access at most once even if it races on
+		 * several locations. */
+		if (check_location(sh, g, &acc, &t,
+				   (found ? &unused : &conflict)))
+			found = 1;
+		spin_unlock_irqrestore(&sh->lock, irq_flags);
+	}
+
+	if (!found)
+		return;
+
+	spin_lock_irqsave(&report_lock, irq_flags);
+	++races_found;
+	if (max_reports == 0 || nr_reports < max_reports) {
+		++nr_reports;
+		report = 1;
+	}
+	spin_unlock_irqrestore(&report_lock, irq_flags);
+
+	if (report)
+		report_race(addr, size, &acc, &conflict);
+}
+/* ====================================================================== */
+
+static void
+on_session_start(struct kedr_event_handlers *eh)
+{
+	unsigned long irq_flags;
+
+	reset_shadow();
+
+	spin_lock_irqsave(&report_lock, irq_flags);
+	nr_reports = 0;
+	races_found = 0;
+	spin_unlock_irqrestore(&report_lock, irq_flags);
+
+	accesses_checked = 0;
+	locks_untracked = 0;
+}
+
+static void
+on_session_end(struct kedr_event_handlers *eh)
+{
+	pr_info(KEDR_MSG_PREFIX
+	"Session ended: %llu access(es) checked, %llu possible race(s) found.\n",
+		(unsigned long long)accesses_checked,
+		(unsigned long long)races_found);
+}
+
+static void
+begin_memory_events(struct kedr_event_handlers *eh, unsigned long tid,
+	unsigned long num_events, void **pdata)
+{
+	*pdata = NULL;
+}
+
+static void
+end_memory_events(struct kedr_event_handlers *eh, unsigned long tid,
+	void *data)
+{
+}
+
+static void
+on_memory_event(struct kedr_event_handlers *eh,
+	unsigned long tid, unsigned long pc,
+	unsigned long addr, unsigned long size,
+	enum kedr_memory_event_type type, void *data)
+{
+	/* The event did not actually happen. */
+	if (addr == 0)
+		return;
+
+	check_access(tid, pc, addr, size, type);
+}
+
+static void
+on_alloc_post(struct kedr_event_handlers *eh, unsigned long tid,
+	unsigned long pc, unsigned long size, unsigned long addr)
+{
+	if (addr == 0 || size == 0)
+		return;
+
+	forget_area(addr, size);
+}
+
+static void
+on_lock_post(struct kedr_event_handlers *eh, unsigned long tid,
+	unsigned long pc, unsigned long lock_id, enum kedr_lock_type type)
+{
+	struct kedr_ls_thread_shard *ts = thread_shard(tid);
+	unsigned long irq_flags;
+	struct kedr_ls_thread *t;
+
+	spin_lock_irqsave(&ts->lock, irq_flags);
+	t = get_thread(ts, tid);
+	if (t == NULL || t->nr_locks == KEDR_LS_MAX_LOCKS_HELD) {
+		++locks_untracked;
+		goto out;
+	}
+
+	t->locks[t->nr_locks].id = lock_id;
+	t->locks[t->nr_locks].write = (type != KEDR_LT_RLOCK);
+	++t->nr_locks;
+out:
+	spin_unlock_irqrestore(&ts->lock, irq_flags);
+}
+
+static void
+on_unlock_pre(struct kedr_event_handlers *eh, unsigned long tid,
+	unsigned long pc, unsigned long lock_id, enum kedr_lock_type type)
+{
+	struct kedr_ls_thread_shard *ts = thread_shard(tid);
+	unsigned long irq_flags;
+	struct kedr_ls_thread *t;
+	unsigned int i;
+
+	spin_lock_irqsave(&ts->lock, irq_flags);
+	t = find_thread(ts, tid);
+	if (t == NULL)
+		goto out;
+
+	/* The locks are usually released in the reverse order. */
+	for (i = t->nr_locks; i > 0; --i) {
+		if (t->locks[i - 1].id != lock_id)
+			continue;
+
+		--t->nr_locks;
+		memmove(&t->locks[i - 1], &t->locks[i],
+			(t->nr_locks - (i - 1)) * sizeof(t->locks[0]));
+		break;
+	}
+
+	if (t->nr_locks == 0)
+		t->key = KEDR_LS_THREAD_REMOVED;
+out:
+	spin_unlock_irqrestore(&ts->lock, irq_flags);
+}
+
+static void
+on_thread_end(struct kedr_event_handlers *eh, unsigned long tid)
+{
+	struct kedr_ls_thread_shard *ts = thread_shard(tid);
+	unsigned long irq_flags;
+	struct kedr_ls_thread *t;
+
+	spin_lock_irqsave(&ts->lock, irq_flags);
+	t = find_thread(ts, tid);
+	if (t != NULL)
+		t->key = KEDR_LS_THREAD_REMOVED;
+	spin_unlock_irqrestore(&ts->lock, irq_flags);
+}
+
+struct kedr_event_handlers eh = {
+	.owner 			= THIS_MODULE,
+
+	.on_session_start	= on_session_start,
+	.on_session_end		= on_session_end,
+
+	.begin_memory_events	= begin_memory_events,
+	.end_memory_events	= end_memory_events,
+	.on_memory_event	= on_memory_event,
+
+	/* The locked operations and I/O operations are not checked: the
+	 * former are atomic, the latter access the device memory. */
+
+	.on_alloc_post 		= on_alloc_post,
+
+	.on_lock_post 		= on_lock_post,
+	.on_unlock_pre 		= on_unlock_pre,
+
+	.on_thread_end		= on_thread_end,
+};
+/* ====================================================================== */
+
+static void
+destroy_shadow(void)
+{
+	vfree(shadow_table);
+	shadow_table = NULL;
+	vfree(locations);
+	locations = NULL;
+}
+
+static int
+create_shadow(void)
+{
+	unsigned long bytes = (unsigned long)shadow_memory_kb << 10;
+	unsigned long nr;
+	unsigned int i;
+
+	/* Each location needs a bucket of the hash table at most. Each
+	 * shard needs at least one bucket and one location. */
+	nr = bytes / (sizeof(struct kedr_ls_location) +
+		      sizeof(struct hlist_head));
+	if (nr < KEDR_LS_NR_SHARDS) {
+		pr_warning(KEDR_MSG_PREFIX
+			"'shadow_memory_kb' is too small.\n");
+		return -EINVAL;
+	}
+	nr_locations = (unsigned int)nr;
+	shadow_hash_bits = ilog2(nr_locations);
+
+	locations = vmalloc(nr_locations * sizeof(struct kedr_ls_location));
+	if (locations == NULL)
+		return -ENOMEM;
+
+	shadow_table = vmalloc((1U << shadow_hash_bits) *
+		sizeof(struct hlist_head));
+	if (shadow_table == NULL) {
+		vfree(locations);
+		locations = NULL;
+		return -ENOMEM;
+	}
+
+	shadow_bytes = (u64)nr_locations * sizeof(struct kedr_ls_location) +
+		(u64)(1U << shadow_hash_bits) * sizeof(struct hlist_head);
+
+	for (i = 0; i < KEDR_LS_NR_SHARDS; ++i) {
+		spin_lock_init(&shards[i].lock);
+		spin_lock_init(&thread_shards[i].lock);
+	}
+	reset_shadow();
+	return 0;
+}
+/* ====================================================================== */
+
+static int
+locations_used_get(void *data, u64 *val)
+{
+	*val = count_used_locations();
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(locations_used_fops, locations_used_get, NULL,
+	"%llu\n");
+
+static int
+locations_evicted_get(void *data, u64 *val)
+{
+	unsigned int i;
+
+	*val = 0;
+	for (i = 0; i < KEDR_LS_NR_SHARDS; ++i)
+		*val += shards[i].nr_evicted;
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(locations_evicted_fops, locations_evicted_get,
+	NULL, "%llu\n");
+
+static void
+remove_debugfs_files(void)
+{
+	debugfs_remove(locks_untracked_file);
+	debugfs_remove(shadow_bytes_file);
+	debugfs_remove(locations_evicted_file);
+	debugfs_remove(locations_used_file);
+	debugfs_remove(races_found_file);
+	debugfs_remove(accesses_checked_file);
+}
+
+static int
+create_debugfs_files(void)
+{
+	const char *name = "ERROR";
+
+	BUG_ON(debugfs_dir_dentry == NULL);
+
+	name = "accesses_checked";
+	accesses_checked_file = debugfs_create_u64(name, S_IRUGO,
+		debugfs_dir_dentry, &accesses_checked);
+	if (accesses_checked_file == NULL)
+		goto out;
+
+	name = "races_found";
+	races_found_file = debugfs_create_u64(name, S_IRUGO,
+		debugfs_dir_dentry, &races_found);
+	if (races_found_file == NULL)
+		goto out;
+
+	name = "locations_used";
+	locations_used_file = debugfs_create_file(name, S_IRUGO,
+		debugfs_dir_dentry, NULL, &locations_used_fops);
+	if (locations_used_file == NULL)
+		goto out;
+
+	name = "locations_evicted";
+	locations_evicted_file = debugfs_create_file(name, S_IRUGO,
+		debugfs_dir_dentry, NULL, &locations_evicted_fops);
+	if (locations_evicted_file == NULL)
+		goto out;
+
+	name = "shadow_bytes";
+	shadow_bytes_file = debugfs_create_u64(name, S_IRUGO,
+		debugfs_dir_dentry, &shadow_bytes);
+	if (shadow_bytes_file == NULL)
+		goto out;
+
+	name = "locks_untracked";
+	locks_untracked_file = debugfs_create_u64(name, S_IRUGO,
+		debugfs_dir_dentry, &locks_untracked);
+	if (locks_untracked_file == NULL)
+		goto out;
+
+	return 0;
+out:
+	pr_warning(KEDR_MSG_PREFIX
+		"Failed to create a file in debugfs (\"%s\").\n",
+		name);
+	remove_debugfs_files();
+	return -ENOMEM;
+}
+/* ====================================================================== */
+
+static void __exit
+ls_cleanup_module(void)
+{
+	/* Unregister the event handlers first. */
+	kedr_unregister_event_handlers(&eh);
+
+	remove_debugfs_files();
+	debugfs_remove(debugfs_dir_dentry);
+	destroy_shadow();
+}
+
+static int __init
+ls_init_module(void)
+{
+	int ret = 0;
+
+	ret = create_shadow();
+	if (ret != 0)
+		return ret;
+
+	debugfs_dir_dentry = debugfs_create_dir(debugfs_dir_name, NULL);
+	if (debugfs_dir_dentry == NULL) {
+		pr_warning(KEDR_MSG_PREFIX
+			"Failed to create a directory in debugfs\n");
+		ret = -EINVAL;
+		goto out_destroy;
+	}
+	if (IS_ERR(debugfs_dir_dentry)) {
+		pr_warning(KEDR_MSG_PREFIX "Debugfs is not supported\n");
+		ret = -ENODEV;
+		goto out_destroy;
+	}
+
+	ret = create_debugfs_files();
+	if (ret != 0)
+		goto out_rmdir;
+
+	/* [NB] Register event handlers only after everything else has
+	 * been initialized. */
+	ret = kedr_register_event_handlers(&eh);
+	if (ret != 0)
+		goto out_rm_files;
+	return 0;
+
+out_rm_files:
+	remove_debugfs_files();
+out_rmdir:
+	debugfs_remove(debugfs_dir_dentry);
+out_destroy:
+	destroy_shadow();
+	return ret;
+}
+
+module_init(ls_init_module);
+module_exit(ls_cleanup_module);
+/* ====================================================================== */
@@ -0,0 +1,280 @@
+/* This module generates a sequence of events to test the lockset-based
+ * race filter.
+ * The generator provides an implementation of KernelStrider core API, so
+ * the filter should be built using the .symvers file of this module rather
+ * than that of kedr_mem_core.ko.
+ *
+ * To start the event generator, write something to
+ * "test_ls_event_gen/start" in debugfs. The filter must be loaded before
+ * that. */
+
+/* ========================================================================
+ * Copyright (C) 2014, ROSA Laboratory
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ ======================================================================== */
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/init.h>
+#include <linux/errno.h>
+#include <linux/kernel.h>
+#include <linux/bug.h>
+#include <linux/debugfs.h>
+
+#include <kedr/kedr_mem/core_api.h>
+#include <kedr/object_types.h>
+/* ====================================================================== */
+
+#define KEDR_MSG_PREFIX "[test_ls_event_gen] "
+/* ====================================================================== */
+
+MODULE_AUTHOR("Eugene A. Shatokhin");
+MODULE_LICENSE("GPL");
+/* ====================================================================== */
+
+/* A directory for the module in debugfs. */
+static struct dentry *debugfs_dir_dentry = NULL;
+const char *debugfs_dir_name = "test_ls_event_gen";
+
+/* Writing to this file will trigger the event generator. */
+static struct dentry *start_file = NULL;
+static const char *start_file_name = "start";
+/* ====================================================================== */
+
+/* The current set of event handlers, NULL if not specified. */
+struct kedr_event_handlers *cur_eh = NULL;
+/* ====================================================================== */
+
+static unsigned long tid1 = 0x1234;
+static unsigned long tid2 = 0x5678;
+
+static unsigned long lock1 = 0x10000;
+static unsigned long lock2 = 0x10040;
+
+static unsigned long pc = 0x400100;
+
+/* The memory locations, the filter tracks aligned 8-byte granules. */
+static unsigned long addr1 = 0x20000;
+static unsigned long addr2 = 0x20008;
+static unsigned long addr3 = 0x20010;
+static unsigned long addr4 = 0x20100;
+static unsigned long addr5 = 0x20018;
+/* ====================================================================== */
+
+/* An implementation of the core API, suitable for testing. Here we do not
+ * care about the synchronization issues because there must be at most one
+ * user of this API (the test build of the filter). */
+int
+kedr_register_event_handlers(struct kedr_event_handlers *eh)
+{
+	BUG_ON(eh == NULL || eh->owner == NULL);
+
+	if (cur_eh != NULL) {
+		pr_err(KEDR_MSG_PREFIX
+	"Attempt to register event handlers while some handlers are "
+	"already registered.\n");
+		return -EINVAL;
+	}
+
+	cur_eh = eh;
+	return 0;
+}
+EXPORT_SYMBOL(kedr_register_event_handlers);
+
+void
+kedr_unregister_event_handlers(struct kedr_event_handlers *eh)
+{
+	BUG_ON(eh == NULL || eh->owner == NULL);
+	BUG_ON(cur_eh != eh);
+
+	cur_eh = NULL;
+}
+EXPORT_SYMBOL(kedr_unregister_event_handlers);
+/* ====================================================================== */
+
+static int
+callbacks_ok(void)
+{
+	return (cur_eh != NULL &&
+		cur_eh->on_session_start != NULL &&
+		cur_eh->on_session_end != NULL &&
+		cur_eh->begin_memory_events != NULL &&
+		cur_eh->end_memory_events != NULL &&
+		cur_eh->on_memory_event != NULL &&
+		cur_eh->on_alloc_post != NULL &&
+		cur_eh->on_lock_post != NULL &&
+		cur_eh->on_unlock_pre != NULL);
+}
+
+static void
+gen_access(unsigned long tid, unsigned long addr,
+	enum kedr_memory_event_type type)
+{
+	void *data = NULL;
+
+	cur_eh->begin_memory_events(cur_eh, tid, 1, &data);
+	cur_eh->on_memory_event(cur_eh, tid, pc, addr, 8, type, data);
+	cur_eh->end_memory_events(cur_eh, tid, data);
+	pc += 4;
+}
+
+static void
+gen_lock(unsigned long tid, unsigned long lock_id,
+	enum kedr_lock_type type)
+{
+	cur_eh->on_lock_post(cur_eh, tid, pc, lock_id, type);
+	pc += 4;
+}
+
+static void
+gen_unlock(unsigned long tid, unsigned long lock_id,
+	enum kedr_lock_type type)
+{
+	cur_eh->on_unlock_pre(cur_eh, tid, pc, lock_id, type);
+	pc += 4;
+}
+
+/* The sequence of events contains 3 races (see test.sh) among 12 memory
+ * accesses. */
+static int
+generate_events(void)
+{
+	if (!callbacks_ok())
+		return -EINVAL;
+
+	cur_eh->on_session_start(cur_eh);
+
+	/* addr1: always accessed with lock1 held, no race. */
+	gen_lock(tid1, lock1, KEDR_LT_SPINLOCK);
+	gen_access(tid1, addr1, KEDR_ET_MWRITE);
+	gen_unlock(tid1, lock1, KEDR_LT_SPINLOCK);
+
+	gen_lock(tid2, lock1, KEDR_LT_SPINLOCK);
+	gen_access(tid2, addr1, KEDR_ET_MUPDATE);
+	gen_unlock(tid2, lock1, KEDR_LT_SPINLOCK);
+
+	/* addr2: initialized by one thread, read by another one (no race
+	 * yet), then written by the latter without locks. Race #1. */
+	gen_access(tid1, addr2, KEDR_ET_MWRITE);
+	gen_access(tid2, addr2, KEDR_ET_MREAD);
+	gen_access(tid2, addr2, KEDR_ET_MWRITE);
+
+	/* addr3: written with different locks held. The lockset is only
+	 * computed from the second access on, so the race is found at the
+	 * third one. Race #2. */
+	gen_lock(tid1, lock1, KEDR_LT_MUTEX);
+	gen_access(tid1, addr3, KEDR_ET_MWRITE);
+	gen_unlock(tid1, lock1, KEDR_LT_MUTEX);
+
+	gen_lock(tid2, lock2, KEDR_LT_MUTEX);
+	gen_access(tid2, addr3, KEDR_ET_MWRITE);
+	gen_unlock(tid2, lock2, KEDR_LT_MUTEX);
+
+	gen_lock(tid1, lock1, KEDR_LT_MUTEX);
+	gen_access(tid1, addr3, KEDR_ET_MWRITE);
+	gen_unlock(tid1, lock1, KEDR_LT_MUTEX);
+
+	/* addr4: the memory is reallocated between the accesses, no
+	 * race. */
+	cur_eh->on_alloc_post(cur_eh, tid1, pc, 64, addr4);
+	gen_access(tid1, addr4, KEDR_ET_MWRITE);
+	cur_eh->on_alloc_post(cur_eh, tid2, pc, 64, addr4);
+	gen_access(tid2, addr4, KEDR_ET_MWRITE);
+
+	/* addr5: written with the rwlock held for writing by one thread
+	 * and for reading by another one. Race #3. */
+	gen_lock(tid1, lock2, KEDR_LT_WLOCK);
+	gen_access(tid1, addr5, KEDR_ET_MWRITE);
+	gen_unlock(tid1, lock2, KEDR_LT_WLOCK);
+
+	gen_lock(tid2, lock2, KEDR_LT_RLOCK);
+	gen_access(tid2, addr5, KEDR_ET_MWRITE);
+	gen_unlock(tid2, lock2, KEDR_LT_RLOCK);
+
+	cur_eh->on_session_end(cur_eh);
+	return 0;
+}
+/* ====================================================================== */
+
+static int
+start_file_open(struct inode *inode, struct file *filp)
+{
+	return nonseekable_open(inode, filp);
+}
+
+static int
+start_file_release(struct inode *inode, struct file *filp)
+{
+	return 0;
+}
+
+static ssize_t
+start_file_write(struct file *filp, const char __user *buf, size_t count,
+	loff_t *f_pos)
+{
+	int ret;
+	ret = generate_events();
+	if (ret != 0)
+		return (ssize_t)ret;
+
+	*f_pos += count; /* as if we have written something */
+	return count;
+}
+
+static const struct file_operations start_file_ops = {
+	.owner = THIS_MODULE,
+	.open = start_file_open,
+	.release = start_file_release,
+	.write = start_file_write,
+};
+/* ====================================================================== */
+
+static int __init
+test_init_module(void)
+{
+	int ret = 0;
+
+	debugfs_dir_dentry = debugfs_create_dir(debugfs_dir_name, NULL);
+	if (debugfs_dir_dentry == NULL) {
+		pr_warning(KEDR_MSG_PREFIX
+			"Failed to create a directory in debugfs\n");
+		ret = -EINVAL;
+		goto out;
+	}
+	if (IS_ERR(debugfs_dir_dentry)) {
+		pr_warning(KEDR_MSG_PREFIX "Debugfs is not supported\n");
+		ret = -ENODEV;
+		goto out;
+	}
+
+	start_file = debugfs_create_file(start_file_name,
+		S_IWUSR | S_IWGRP, debugfs_dir_dentry, NULL,
+		&start_file_ops);
+	if (start_file == NULL) {
+		pr_warning(KEDR_MSG_PREFIX
+			"Failed to create a file in debugfs (\"%s\").\n",
+			start_file_name);
+		ret = -ENOMEM;
+		goto out_rmdir;
+	}
+	return 0;
+
+out_rmdir:
+	debugfs_remove(debugfs_dir_dentry);
+out:
+	return ret;
+}
+
+static void __exit
+test_cleanup_module(void)
+{
+	debugfs_remove(start_file);
+	debugfs_remove(debugfs_dir_dentry);
+}
+
+module_init(test_init_module);
+module_exit(test_cleanup_module);
+/* ====================================================================== */
@@ -0,0 +1,180 @@
+/* kedr_st_rec_index - creates the index of a trace file saved by the
+ * simple trace recorder, see trace_index.h.
+ *
+ * Usage:
+ *	kedr_st_rec_index [--show] <trace_file> [<index_file>]
+ *
+ * The index is saved to <index_file>, <trace_file>.idx by default. The
+ * index can then be passed to tsan_process_trace (--index) and
+ * test_trace_to_text (-i) to decode the trace in several threads and to
+ * select the events to process.
+ *
+ * With --show, the index is not created but loaded from <index_file> and
+ * its contents are output to stdout in a human-readable form. */
+
+/* ========================================================================
+ * Copyright (C) 2014, ROSA Laboratory
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ ======================================================================== */
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <lzo/minilzo.h>
+
+#include "recorder.h"
+#include "record_reader.h"
+#include "trace_index.h"
+
+using namespace std;
+/* ====================================================================== */
+
+static void
+usage()
+{
+	cerr << "Usage:\n\tkedr_st_rec_index [--show] <trace_file> "
+		"[<index_file>]" << endl;
+}
+
+static const char *
+record_type_to_string(unsigned int type)
+{
+	switch (type) {
+	case KEDR_TR_EVENT_SESSION_START:
+		return "session start";
+	case KEDR_TR_EVENT_SESSION_END:
+		return "session end";
+	case KEDR_TR_EVENT_COMPRESSED:
+		return "series (lzo)";
+	case KEDR_TR_EVENT_COMPACT:
+		return "series (lzo, compact)";
+	case KEDR_TR_EVENT_CHUNK:
+		return "series";
+	default:
+		return "event";
+	}
+}
+
+static void
+show_index(const TraceIndex &index)
+{
+	const vector<struct kedr_tr_index_record> &records =
+		index.get_records();
+	const vector<struct kedr_tr_index_module> &modules =
+		index.get_modules();
+	const vector<struct kedr_tr_index_thread> &threads =
+		index.get_threads();
+
+	cout << "Events: " << index.get_nr_events() << ", records: "
+		<< records.size() << endl;
+
+	cout << "\nRecords (number: offset, size, events, type):" << endl;
+	for (size_t i = 0; i < records.size(); ++i) {
+		const struct kedr_tr_index_record &r = records[i];
+
+		cout << i << ": " << r.offset << ", " << r.size << ", ";
+		if (r.nr_events == 0)
+			cout << "-";
+		else
+			cout << r.first_event << "-"
+				<< r.first_event + r.nr_events - 1;
+		cout << ", " << record_type_to_string(r.type);
+		if ((r.flags & KEDR_TR_INDEX_BLOCKS) != 0)
+			cout << ", blocks";
+		if ((r.flags & KEDR_TR_INDEX_TARGET) != 0)
+			cout << ", target";
+		cout << endl;
+	}
+
+	cout << "\nTargets (event, record, what):" << endl;
+	for (size_t i = 0; i < modules.size(); ++i) {
+		const struct kedr_tr_index_module &m = modules[i];
+
+		cout << m.event << ", " << m.record << ", "
+			<< (m.type == KEDR_TR_EVENT_TARGET_LOAD ?
+				"load " : "unload ")
+			<< m.name << endl;
+	}
+
+	cout << "\nThreads (tid: events, event range, record range):"
+		<< endl;
+	for (size_t i = 0; i < threads.size(); ++i) {
+		const struct kedr_tr_index_thread &t = threads[i];
+
+		cout << "0x" << hex << t.tid << dec << ": " << t.nr_events
+			<< ", " << t.first_event << "-" << t.last_event
+			<< ", " << t.first_record << "-" << t.last_record
+			<< endl;
+	}
+}
+/* ====================================================================== */
+
+int
+main(int argc, char *argv[])
+{
+	bool show = false;
+	string trace_file;
+	string index_file;
+	TraceIndex index;
+	int fd;
+	int i = 1;
+
+	if (argc > 1 && strcmp(argv[1], "--show") == 0) {
+		show = true;
+		++i;
+	}
+
+	if (argc - i < 1 || argc - i > 2) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	trace_file = argv[i];
+	index_file = (argc - i == 2) ? argv[i + 1] : trace_file + ".idx";
+
+	if (lzo_init() != LZO_E_OK) {
+		cerr << "Failed to initialize LZO library." << endl;
+		return EXIT_FAILURE;
+	}
+
+	fd = open(trace_file.c_str(), O_RDONLY);
+	if (fd == -1) {
+		cerr << "Failed to open " << trace_file << ": "
+			<< strerror(errno) << endl;
+		return EXIT_FAILURE;
+	}
+
+	try {
+		if (show) {
+			index.load(index_file);
+			index.check(fd);
+			show_index(index);
+		}
+		else {
+			index.build(fd);
+			index.save(index_file);
+		}
+	}
+	catch (runtime_error &e) {
+		cerr << "Error: " << e.what() << endl;
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	close(fd);
+	return EXIT_SUCCESS;
+}
+/* ====================================================================== */
@@ -28,7 +28,17 @@
  * 
  * [NB] The module is not required to notify the user-space part about each 
  * new event stored in the buffer. This is done for each 'notify_mark' pages
- * written and also when "session end" event is received. 
+ * written and also when "session end" event is received. If 
+ * 'adaptive_notify' is set, the number of pages is increased while the 
+ * reader keeps up and is reset to 'notify_mark' when it falls behind. 
+ *
+ * If 'flight_recorder' is set, the module does not wake up the reader as
+ * the data arrive. Instead, it discards the oldest records when the buffer
+ * is full, so the buffer always contains the latest events. When a trigger
+ * fires (a write to "snapshot" file in debugfs, an oops, an entry to the 
+ * function specified by 'snapshot_func' or the end of the session), the 
+ * contents of the buffer are "frozen" and the reader is woken up to save 
+ * them, see struct kedr_tr_start_page.
  *
  * Notes for developers.
  * Some of the events written to the output buffer are compressed, see 
@@ -67,9 +77,21 @@
 #include <linux/sched.h>
 #include <linux/vmalloc.h>
 #include <linux/string.h>
+#include <linux/version.h>
 #include <linux/lzo.h>		/* LZO1X compression support */
+#include <linux/list.h>
+#include <linux/kallsyms.h>
+#include <linux/kdebug.h>	/* register_die_notifier */
+#include <linux/bitmap.h>
+
+/* LZ4 compression is available in the kernels 3.11 and newer. */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 11, 0)
+# define KEDR_TR_HAVE_LZ4
+# include <linux/lz4.h>
+#endif
 
 #include <kedr/kedr_mem/core_api.h>
+#include <kedr/kedr_mem/block_info.h>
 #include <kedr/object_types.h>
 
 #include <simple_trace_recorder/recorder.h>
@@ -93,11 +115,22 @@ MODULE_LICENSE("GPL");
 #define KEDR_TR_MAX_DATA_PAGES 65536
 #define KEDR_TR_B0_DATA_PAGES 32
 
-/* Number of data pages in the buffer B0. Must be a power of 2 because
- * 'nr_data_pages' (see below) must be a power of 2 as well. 
+/* The IDs of the call stacks recorded in the current series are marked in
+ * a bitmap (see 'call_stacks' parameter). The stacks with larger IDs are
+ * recorded again each time they are needed. */
+#define KEDR_TR_MAX_STACK_IDS 65536
+
+/* The ID of the call stack for the events that are recorded without the 
+ * call stack information. */
+#define KEDR_TR_NO_STACK ((unsigned int)-1)
+
+/* Number of data pages in the buffer B0, i.e. the maximum size of a series
+ * of events compressed at once ("chunk_pages" parameter). Larger series 
+ * usually compress better but the reader gets the data in larger portions.
  * Do not use large numbers here because the compression of B0 may 
  * occasionally be done in interrupt context. */
 static unsigned int b0_nr_data_pages = KEDR_TR_B0_DATA_PAGES;
+module_param_named(chunk_pages, b0_nr_data_pages, uint, S_IRUGO);
 
 /* Number of data pages in the output buffer. Must be a power of 2. Must be 
  * less than or equal to KEDR_TR_MAX_DATA_PAGES but no less than 
@@ -110,6 +143,16 @@ module_param(nr_data_pages, uint, S_IRUGO);
  * up the process waiting (in poll()) for the data to become available for
  * reading. */
 static unsigned int notify_mark = 1;
+module_param(notify_mark, uint, S_IRUGO);
+
+/* If non-zero, the number of data pages to be filled before the reader is 
+ * woken up is adjusted at runtime: it is doubled (up to 1/4 of the buffer)
+ * each time the reader comes back to poll() with little data left in the 
+ * buffer and is reset to 'notify_mark' when the buffer gets more than half
+ * full or some events are lost. So the reader keeping up with the stream
+ * is woken up less often. */
+static int adaptive_notify = 0;
+module_param(adaptive_notify, int, S_IRUGO);
 
 /* If non-zero, function entry/exit and call pre/post events will not be
  * recorded in the trace. 
@@ -122,6 +165,53 @@ static unsigned int notify_mark = 1;
  * the event will be in the trace. */
 int no_call_events = 0;
 module_param(no_call_events, int, S_IRUGO);
+
+/* If non-zero, the call stacks of the threads are recorded for their 
+ * memory access, "alloc", "free", barrier and synchronization events as
+ * STACK and THREAD_STACK events (see recorder.h). Each call stack is 
+ * recorded at most once per series of events, the events only refer to
+ * the stacks by their IDs. This keeps the call stack information in the 
+ * trace at a fraction of the cost of the call-related events, so the 
+ * latter are not recorded then ('no_call_events' is set automatically). 
+ * The core must maintain the shadow call stacks for that (see 
+ * 'shadow_call_stacks' parameter of the core), the module fails to load
+ * otherwise. Only supported in the compact format of the trace. */
+static int call_stacks = 0;
+module_param(call_stacks, int, S_IRUGO);
+
+/* The algorithm to compress the series of events with: "lzo" (default), 
+ * "lz4", "lz4hc" or "none". LZ4 is usually faster than LZO but compresses 
+ * a bit worse, LZ4HC compresses better but is much slower. "none" may be
+ * useful if the disk bandwidth is not the bottleneck but the CPU time 
+ * is. */
+static char *compressor = "lzo";
+module_param(compressor, charp, S_IRUGO);
+
+/* The format of the series of events in the trace, see recorder.h:
+ * 1 - event structures, 
+ * 2 - compact format (default). 
+ * The compact format makes the trace several times smaller before
+ * compression, so fewer data are compressed and copied. */
+static unsigned int trace_format = 2;
+module_param(trace_format, uint, S_IRUGO);
+
+/* If non-zero, the module operates in the "flight recorder" mode: the new
+ * records overwrite the oldest ones and the data are passed to the reader
+ * only when a snapshot is taken. This allows to keep the latest events 
+ * in long tests without the cost of saving all the data. */
+static int flight_recorder = 0;
+module_param(flight_recorder, int, S_IRUGO);
+
+/* Flight recorder mode only. If non-zero, a snapshot is taken when an 
+ * oops happens. */
+static int snapshot_on_oops = 1;
+module_param(snapshot_on_oops, int, S_IRUGO);
+
+/* Flight recorder mode only. If not empty, a snapshot is taken each time 
+ * the function with this name is called in a target module. The name may
+ * be given as "<module>:<function>" too. */
+static char *snapshot_func = "";
+module_param(snapshot_func, charp, S_IRUGO);
 /* ====================================================================== */
 
 /* A directory for the module in debugfs and the file needed to access the
@@ -132,6 +222,10 @@ static const char *debugfs_dir_name = KEDR_ST_REC_KMODULE_NAME;
 static struct dentry *buffer_file = NULL;
 static const char *buffer_file_name = "buffer";
 
+/* Writing to this file takes a snapshot in the flight recorder mode. */
+static struct dentry *snapshot_file = NULL;
+static const char *snapshot_file_name = "snapshot";
+
 /* A mutex to serialize operations with the buffer file. */
 static DEFINE_MUTEX(buffer_file_mutex);
 
@@ -169,8 +263,166 @@ static atomic_t buffer_file_available = ATOMIC_INIT(1);
  * The accesses to this variable must be protected by 'eh_lock'. */
 static int signal_on_next_poll = 0;
 
-/* The LZO1X compressor working memory */
-static void *lzo_wrkmem = NULL;
+/* The current number of data pages to be filled before the reader is woken
+ * up, 'notify_mark' <= cur_notify_mark <= max_notify_mark. It differs from
+ * 'notify_mark' only if 'adaptive_notify' is set.
+ *
+ * The accesses to this variable must be protected by 'eh_lock'. */
+static unsigned int cur_notify_mark;
+static unsigned int max_notify_mark;
+
+/* The value of 'events_lost' when the reader last called poll(). */
+static u64 events_lost_seen = 0;
+
+/* The total amount of data written to the output buffer, including the 
+ * unused space at the ends of the pages. The position of a record in the 
+ * stream of data is the value of this counter at the moment the record is
+ * written. 
+ *
+ * The accesses to this variable must be protected by 'eh_lock'. */
+static u64 written_total = 0;
+/* ====================================================================== */
+
+/* The data for the flight recorder mode. 
+ * The accesses to these must be protected by 'eh_lock'. */
+
+/* Special values of the positions of the records in the stream. */
+
+/* There is no such record (yet). */
+#define KEDR_TR_POS_NONE	((u64)(-1))
+/* The record is in B0 now. */
+#define KEDR_TR_POS_CACHED	((u64)(-2))
+/* The record has been lost. */
+#define KEDR_TR_POS_LOST	((u64)0)
+
+/* The information about a target needed to process the snapshots: the
+ * copy of its "target load" record and the positions of that record and
+ * of "target unload" record in the stream. */
+struct flight_target
+{
+	struct list_head list;
+	struct kedr_tr_event_module ev;
+	u64 load_pos;
+	u64 unload_pos;
+};
+
+/* The targets in the order they were loaded. */
+static LIST_HEAD(flight_targets);
+
+/* The number of the positions in 'flight_targets' equal to 
+ * KEDR_TR_POS_CACHED. */
+static unsigned int flight_nr_cached = 0;
+
+/* The position of "session start" record. */
+static u64 session_start_pos = KEDR_TR_POS_NONE;
+
+/* Non-zero if a snapshot has been taken and has not been consumed by the
+ * reader yet. 'start_page->frozen' is set to the same value but as the
+ * reader may write to that page, the module itself relies on this 
+ * variable only. */
+static int flight_frozen = 0;
+
+/* The start address of 'snapshot_func', 0 if it is not known (yet). 
+ * Set when the targets are loaded and unloaded, read in the handlers of
+ * function entry events on other CPUs without locking, so it is only
+ * accessed via ACCESS_ONCE(). */
+static unsigned long snapshot_func_addr = 0;
+
+/* The state of the encoder of the compact format for a thread, see 
+ * recorder.h. */
+struct compact_thread
+{
+	u64 tid;
+	
+	/* The previous code and data addresses and block ID for the 
+	 * thread. */
+	u64 code;
+	u64 data;
+	u64 block;
+	
+	/* The ID of the call stack recorded for the thread in the last 
+	 * THREAD_STACK event of the series, KEDR_TR_NO_STACK if none. */
+	unsigned int stack;
+};
+
+/* The threads that have events in B0. The last element is for the threads
+ * that got no number in the series. 
+ * The accesses to these must be protected by 'eh_lock'. */
+static struct compact_thread compact_threads[KEDR_TR_COMPACT_MAX_THREADS + 1];
+static unsigned int compact_nr_threads = 0;
+
+/* The thread of the previous event in B0, NULL if there is none. */
+static struct compact_thread *compact_cur = NULL;
+
+/* The call stacks recorded in B0 and the code address of the last STACK
+ * event there (see 'call_stacks' parameter). The accesses to these must 
+ * be protected by 'eh_lock'. */
+static DECLARE_BITMAP(compact_stacks, KEDR_TR_MAX_STACK_IDS);
+static u64 compact_stack_pc = 0;
+
+/* Non-zero if the memory events from the blocks of code may be recorded
+ * as the references to the BLOCK_INFO events (compact format only, see 
+ * recorder.h). It is reset when a series with BLOCK_INFO events is lost,
+ * so that the trace never refers to the blocks the readers know nothing 
+ * about. 'b0_has_block_info' is non-zero if B0 contains BLOCK_INFO 
+ * events. 
+ * The accesses to these must be protected by 'eh_lock'. */
+static int use_block_ids = 0;
+static int b0_has_block_info = 0;
+
+/* The memory accesses collected by the handlers of memory events before 
+ * they are written to B0. */
+struct mem_events
+{
+	unsigned long tid;
+	unsigned int nr_events;
+	__u32 read_mask;
+	__u32 write_mask;
+	
+	/* The block of code the events are from, NULL if not known. */
+	const struct kedr_block_info *info;
+	
+	/* The number of the possible events on_memory_event() has been 
+	 * called for so far and the mask of those of them that actually
+	 * happened (bit #i - for info->events[i]). */
+	unsigned int nr_calls;
+	__u32 block_mask;
+	
+	struct {
+		unsigned long addr;
+		unsigned long size;
+		unsigned long pc;
+	} ops[1];
+};
+
+/* A compression algorithm. */
+struct compressor
+{
+	/* The name of the algorithm as specified in 'compressor' parameter.
+	 */
+	const char *name;
+	enum kedr_tr_compressor_type type;
+	
+	/* Size of the working memory needed for compression. */
+	unsigned long wrkmem_size;
+	
+	/* (optional) Prepare the algorithm for use and release it, 
+	 * respectively. get() returns 0 on success, an error code on 
+	 * failure. */
+	int (*get)(void);
+	void (*put)(void);
+	
+	/* Compresses 'src_len' bytes at 'src' to 'dst' which is large 
+	 * enough for the worst case. Sets '*dst_len' to the size of the 
+	 * compressed data. Returns 0 on success, an error code on failure.
+	 */
+	int (*compress)(const unsigned char *src, size_t src_len, 
+		unsigned char *dst, size_t *dst_len, void *wrkmem);
+};
+
+/* The algorithm in use and its working memory. */
+static struct compressor *comp = NULL;
+static void *comp_wrkmem = NULL;
 /* ====================================================================== */
 
 /* A wait queue for the reader to wait on until enough data become 
@@ -195,29 +447,73 @@ static u64 events_lost = 0;
 
 /* The file in debugfs for this counter. */
 static struct dentry *events_lost_file = NULL;
+
+/* Number of times the reader has been woken up. Together with the amount of
+ * data saved by the reader, it shows how well the notifications are 
+ * batched. 
+ *
+ * This counter should be updated with 'eh_lock' taken. */
+static u64 nr_wakeups = 0;
+
+/* The file in debugfs for this counter. */
+static struct dentry *nr_wakeups_file = NULL;
 /* ====================================================================== */
 
-/* Are there at least 'notify_mark' pages of data available for reading in 
- * the buffer? 
+/* Are there at least 'cur_notify_mark' pages of data available for reading
+ * in the buffer? 
  * 'wp' and 'rp' are the current read and write positions in the buffer.
  * Must be called with 'eh_lock' locked. */
 static int
 enough_data_available(__u32 wp, __u32 rp)
 {
 	unsigned int available = (wp - rp) & (buffer_size - 1);
-	return (available >= (notify_mark << PAGE_SHIFT));
+	return (available >= (cur_notify_mark << PAGE_SHIFT));
 }
 
 /* Must be called with 'eh_lock' locked. 
  * Note that the reader may miss the notification if it is not waiting on 
  * 'reader_queue' at the moment. This should not be a problem, though: as 
  * long as there is a reason to wake up the reader, the notifications will
- * be sent again and again. wake_up() should be rather cheap 
- * performance-wise if there are no processes to wake up. */
+ * be sent again and again. 
+ * 
+ * The reader adds itself to 'reader_queue' in poll() before it checks the
+ * write position with 'eh_lock' taken, so it is enough to check whether 
+ * the queue is empty here: the reader either is already in the queue or 
+ * will see the new write position. This way, the lock of the wait queue is
+ * not taken each time the data are written while no one is waiting. */
 static void
 notify_reader(void)
 {
-	wake_up(&reader_queue);
+	if (waitqueue_active(&reader_queue)) {
+		++nr_wakeups;
+		wake_up(&reader_queue);
+	}
+}
+
+/* Adjusts 'cur_notify_mark' when the reader comes for more data. 
+ * 'available' - the amount of data in the buffer at that moment, i.e. the 
+ * data written while the reader was processing the previous portion.
+ * 
+ * [NB] poll() may call the file's poll method again after the reader has 
+ * been woken up, so 'available' may also be slightly more than 
+ * 'cur_notify_mark' pages. This is why the threshold for "falling behind" 
+ * is half of the buffer rather than 'max_notify_mark'.
+ *
+ * Must be called with 'eh_lock' locked. */
+static void
+update_notify_mark(unsigned int available)
+{
+	if (available > (buffer_size >> 1) || events_lost != events_lost_seen) {
+		/* The reader falls behind, wake it up as soon as possible. */
+		cur_notify_mark = notify_mark;
+	}
+	else if (available < (cur_notify_mark << (PAGE_SHIFT - 1))) {
+		/* The reader keeps up, it may process larger portions. */
+		cur_notify_mark *= 2;
+		if (cur_notify_mark > max_notify_mark)
+			cur_notify_mark = max_notify_mark;
+	}
+	events_lost_seen = events_lost;
 }
 /* ====================================================================== */
 
@@ -235,19 +531,24 @@ get_read_pos(void)
  * and to make sure other CPUs will see this write to 'write_pos' only 
  * after these writes to the buffer.
  * 
- * The function notifies the reader if there is enough data available.
+ * The function notifies the reader if there is enough data available 
+ * (except in the flight recorder mode, where the reader is notified only 
+ * when a snapshot is taken).
  * 'rp' - read position as it was before the writing to the buffer began.
  * 
  * Must be called with 'eh_lock' locked. */
 static void
 set_write_pos_and_notify(__u32 new_write_pos, __u32 rp)
 {
+	written_total += 
+		(new_write_pos - start_page->write_pos) & (buffer_size - 1);
+
 	/* Make sure all writes to the buffer have completed before we
 	 * update 'write_pos'. */
 	smp_wmb();
 	start_page->write_pos = new_write_pos;
 	
-	if (enough_data_available(new_write_pos, rp))
+	if (!flight_recorder && enough_data_available(new_write_pos, rp))
 		notify_reader();
 }
 
@@ -305,6 +606,113 @@ b0_buffer_write_pos(void)
 {
 	return (void *)((unsigned long)b0_buffer + b0_data_size);
 }
+/* ====================================================================== */
+
+/* Encoding of the events in the compact format, see recorder.h. 
+ * The functions must be called with 'eh_lock' locked. */
+
+/* Starts a new series of events, to be called when B0 becomes empty. */
+static void
+compact_reset(void)
+{
+	compact_nr_threads = 0;
+	compact_cur = NULL;
+	
+	if (call_stacks) {
+		bitmap_zero(compact_stacks, KEDR_TR_MAX_STACK_IDS);
+		compact_stack_pc = 0;
+	}
+}
+
+static unsigned char *
+compact_put_num(unsigned char *p, u64 val)
+{
+	while (val >= 0x80) {
+		*p++ = (unsigned char)(val | 0x80);
+		val >>= 7;
+	}
+	*p++ = (unsigned char)val;
+	return p;
+}
+
+/* Writes the difference between 'val' and '*prev' and updates '*prev'. */
+static unsigned char *
+compact_put_addr(unsigned char *p, u64 val, u64 *prev)
+{
+	s64 delta = (s64)(val - *prev);
+	
+	*prev = val;
+	return compact_put_num(p, ((u64)delta << 1) ^ (u64)(delta >> 63));
+}
+
+/* Writes the tag with the given flags, followed by the type of the event
+ * if the type does not fit in the tag. */
+static unsigned char *
+compact_put_tag(unsigned char *p, enum kedr_tr_event_type et, 
+	unsigned char flags)
+{
+	if ((unsigned int)et <= KEDR_TR_COMPACT_TYPE_MASK) {
+		*p++ = (unsigned char)et | flags;
+		return p;
+	}
+	
+	*p++ = KEDR_TR_COMPACT_EXTENDED | flags;
+	return compact_put_num(p, (u64)et);
+}
+
+/* Writes the tag and the reference to the thread and makes the thread 
+ * current ('compact_cur'). */
+static unsigned char *
+compact_put_header(unsigned char *p, enum kedr_tr_event_type et, u64 tid)
+{
+	struct compact_thread *ct = compact_cur;
+	unsigned int i;
+	
+	if (ct != NULL && ct->tid == tid)
+		return compact_put_tag(p, et, KEDR_TR_COMPACT_SAME_THREAD);
+	
+	p = compact_put_tag(p, et, 0);
+	for (i = 0; i < compact_nr_threads; ++i) {
+		if (compact_threads[i].tid == tid) {
+			compact_cur = &compact_threads[i];
+			return compact_put_num(p, i + 1);
+		}
+	}
+	
+	*p++ = 0;
+	p = compact_put_num(p, tid);
+	
+	/* If the table is full, the last element is used. */
+	ct = &compact_threads[compact_nr_threads];
+	if (compact_nr_threads < KEDR_TR_COMPACT_MAX_THREADS)
+		++compact_nr_threads;
+	
+	ct->tid = tid;
+	ct->code = 0;
+	ct->data = 0;
+	ct->block = 0;
+	ct->stack = KEDR_TR_NO_STACK;
+	compact_cur = ct;
+	return p;
+}
+
+/* Returns the state of the thread that compact_put_header() would use 
+ * for the thread without resetting it, NULL if there is none. */
+static struct compact_thread *
+compact_find_thread(u64 tid)
+{
+	unsigned int i;
+	
+	if (compact_cur != NULL && compact_cur->tid == tid)
+		return compact_cur;
+	
+	for (i = 0; i < compact_nr_threads; ++i) {
+		if (compact_threads[i].tid == tid)
+			return &compact_threads[i];
+	}
+	return NULL;
+}
+/* ====================================================================== */
 
 /* Returns non-zero if a record of the given size would not cross page 
  * boundary when written to the buffer at the position 'wp'; 0 otherwise. 
@@ -343,6 +751,104 @@ complete_buffer_page(__u32 wp)
 	return to_next_page(wp);
 }
 
+/* The position of the record following the one at 'rp' in the buffer. 
+ * Must be called with 'eh_lock' locked. */
+static __u32
+next_record_pos(__u32 rp)
+{
+	struct kedr_tr_event_header *h;
+	
+	if (fits_to_page(rp, sizeof(*h))) {
+		h = buffer_pos_to_addr(rp);
+		if (h->type != KEDR_TR_EVENT_SKIP)
+			return (rp + h->event_size) & (buffer_size - 1);
+	}
+	return to_next_page(rp) & (buffer_size - 1);
+}
+
+/* Flight recorder mode: discards the oldest records in the buffer until 
+ * there is enough space for 'size' bytes at 'wp'. Returns the new read 
+ * position. 
+ *
+ * The reader does not access the data and 'read_pos' while no snapshot is
+ * taken, so the module may update 'read_pos' itself.
+ * 
+ * Must be called with 'eh_lock' locked. */
+static __u32
+flight_make_space(__u32 wp, __u32 rp, unsigned int size)
+{
+	if (buffer_has_space(wp, rp, size))
+		return rp;
+	
+	do {
+		rp = next_record_pos(rp);
+	} while (!buffer_has_space(wp, rp, size));
+	
+	start_page->read_pos = rp;
+	return rp;
+}
+
+/* The position in the stream corresponding to the position 'pos' in the 
+ * buffer, assuming the data between 'pos' and the current write position
+ * have not been written yet. 
+ *
+ * Must be called with 'eh_lock' locked. */
+static u64
+stream_pos(__u32 pos)
+{
+	return written_total + 
+		((pos - start_page->write_pos) & (buffer_size - 1));
+}
+
+/* The position in the stream corresponding to the current read position.
+ *
+ * Must be called with 'eh_lock' locked. */
+static u64
+stream_read_pos(void)
+{
+	return written_total - 
+		((start_page->write_pos - get_read_pos()) & (buffer_size - 1));
+}
+
+/* Sets the positions of the records from B0 after B0 has been output (to 
+ * 'pos' in the stream) or lost (pos is KEDR_TR_POS_LOST).
+ *
+ * Must be called with 'eh_lock' locked. */
+static void
+flight_set_cached_pos(u64 pos)
+{
+	struct flight_target *ft;
+	
+	if (flight_nr_cached == 0)
+		return;
+
+	list_for_each_entry(ft, &flight_targets, list) {
+		if (ft->load_pos == KEDR_TR_POS_CACHED)
+			ft->load_pos = pos;
+		if (ft->unload_pos == KEDR_TR_POS_CACHED)
+			ft->unload_pos = pos;
+	}
+	flight_nr_cached = 0;
+}
+
+/* Removes the information about the targets that is no longer needed: the
+ * targets that were unloaded before 'pos' in the stream. 
+ *
+ * Must be called with 'eh_lock' locked. */
+static void
+flight_remove_old_targets(u64 pos)
+{
+	struct flight_target *ft;
+	struct flight_target *tmp;
+	
+	list_for_each_entry_safe(ft, tmp, &flight_targets, list) {
+		if (ft->unload_pos < pos) {
+			list_del(&ft->list);
+			kfree(ft);
+		}
+	}
+}
+
 /* Performs the common operations needed before writing a record to the 
  * buffer: checks if there is available space, deals with the page 
  * boundaries, etc. 
@@ -357,6 +863,13 @@ complete_buffer_page(__u32 wp)
 static __u32
 record_write_common(__u32 wp, __u32 rp, unsigned int size)
 {
+	if (flight_recorder && !flight_frozen) {
+		unsigned int gap = 0;
+		if (!fits_to_page(wp, size))
+			gap = to_next_page(wp) - wp;
+		rp = flight_make_space(wp, rp, gap + size);
+	}
+	
 	if (!buffer_has_space(wp, rp, size)) {
 		++events_lost;
 		return KEDR_TR_NO_SPACE;
@@ -375,35 +888,279 @@ record_write_common(__u32 wp, __u32 rp, unsigned int size)
 	return wp & (buffer_size - 1);
 }
 
+static int
+lzo_compress(const unsigned char *src, size_t src_len, unsigned char *dst,
+	     size_t *dst_len, void *wrkmem)
+{
+	int ret = lzo1x_1_compress(src, src_len, dst, dst_len, wrkmem);
+	return (ret == LZO_E_OK ? 0 : ret);
+}
+
+static int
+none_compress(const unsigned char *src, size_t src_len, unsigned char *dst,
+	      size_t *dst_len, void *wrkmem)
+{
+	memcpy(dst, src, src_len);
+	*dst_len = src_len;
+	return 0;
+}
+
+#ifdef KEDR_TR_HAVE_LZ4
+/* LZ4 compression may be built as a separate module or not built at all,
+ * so the functions are looked up when the compressor is selected rather 
+ * than referred to directly. This way, this module does not depend on 
+ * the LZ4 modules if LZ4 is not used. */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 11, 0)
+static int (*lz4_func)(const unsigned char *src, size_t src_len, 
+	unsigned char *dst, size_t *dst_len, void *wrkmem) = NULL;
+
+static int
+lz4_get(void)
+{
+	lz4_func = symbol_request(lz4_compress);
+	return (lz4_func != NULL ? 0 : -ENOENT);
+}
+
+static void
+lz4_put(void)
+{
+	symbol_put(lz4_compress);
+}
+
+static int
+lz4hc_get(void)
+{
+	lz4_func = symbol_request(lz4hc_compress);
+	return (lz4_func != NULL ? 0 : -ENOENT);
+}
+
+static void
+lz4hc_put(void)
+{
+	symbol_put(lz4hc_compress);
+}
+
+static int
+lz4_compress_any(const unsigned char *src, size_t src_len, 
+		 unsigned char *dst, size_t *dst_len, void *wrkmem)
+{
+	return lz4_func(src, src_len, dst, dst_len, wrkmem);
+}
+#define lz4_do_compress lz4_compress_any
+#define lz4hc_do_compress lz4_compress_any
+
+#else /* the API of LZ4 v1.7+ */
+static int (*lz4_func)(const char *src, char *dst, int src_len, 
+	int dst_capacity, void *wrkmem) = NULL;
+static int (*lz4hc_func)(const char *src, char *dst, int src_len, 
+	int dst_capacity, int level, void *wrkmem) = NULL;
+
+static int
+lz4_get(void)
+{
+	lz4_func = symbol_request(LZ4_compress_default);
+	return (lz4_func != NULL ? 0 : -ENOENT);
+}
+
+static void
+lz4_put(void)
+{
+	symbol_put(LZ4_compress_default);
+}
+
+static int
+lz4hc_get(void)
+{
+	lz4hc_func = symbol_request(LZ4_compress_HC);
+	return (lz4hc_func != NULL ? 0 : -ENOENT);
+}
+
+static void
+lz4hc_put(void)
+{
+	symbol_put(LZ4_compress_HC);
+}
+
+static int
+lz4_do_compress(const unsigned char *src, size_t src_len, 
+		unsigned char *dst, size_t *dst_len, void *wrkmem)
+{
+	int ret = lz4_func((const char *)src, (char *)dst, (int)src_len, 
+		LZ4_COMPRESSBOUND(src_len), wrkmem);
+	if (ret <= 0)
+		return -EINVAL;
+	
+	*dst_len = ret;
+	return 0;
+}
+
+static int
+lz4hc_do_compress(const unsigned char *src, size_t src_len, 
+		  unsigned char *dst, size_t *dst_len, void *wrkmem)
+{
+	int ret = lz4hc_func((const char *)src, (char *)dst, (int)src_len, 
+		LZ4_COMPRESSBOUND(src_len), LZ4HC_DEFAULT_CLEVEL, wrkmem);
+	if (ret <= 0)
+		return -EINVAL;
+	
+	*dst_len = ret;
+	return 0;
+}
+#endif
+#endif /* KEDR_TR_HAVE_LZ4 */
+
+static struct compressor compressors[] = {
+	{
+		.name = "lzo", 
+		.type = KEDR_TR_COMPRESSOR_LZO,
+		.wrkmem_size = LZO1X_1_MEM_COMPRESS,
+		.compress = lzo_compress,
+	},
+#ifdef KEDR_TR_HAVE_LZ4
+	{
+		.name = "lz4", 
+		.type = KEDR_TR_COMPRESSOR_LZ4,
+		.wrkmem_size = LZ4_MEM_COMPRESS,
+		.get = lz4_get,
+		.put = lz4_put,
+		.compress = lz4_do_compress,
+	},
+	{
+		.name = "lz4hc", 
+		.type = KEDR_TR_COMPRESSOR_LZ4HC,
+		.wrkmem_size = LZ4HC_MEM_COMPRESS,
+		.get = lz4hc_get,
+		.put = lz4hc_put,
+		.compress = lz4hc_do_compress,
+	},
+#endif
+	{
+		.name = "none", 
+		.type = KEDR_TR_COMPRESSOR_NONE,
+		.wrkmem_size = 0,
+		.compress = none_compress,
+	},
+};
+
+/* Compresses the series of events in 'buf' to B1. Returns the size of the
+ * resulting record, 0 if the compression has failed.
+ * 
+ * The series compressed with LZO are stored in KEDR_TR_EVENT_COMPRESSED or
+ * KEDR_TR_EVENT_COMPACT records as before, so that the traces recorded 
+ * with the default settings can be read by the older tools too. */
 static __u32
-lzo1x_compress_buf(void *buf, size_t buf_size)
+compress_buf(void *buf, size_t buf_size)
 {
 	__u32 event_size;
-	size_t compressed_size;
-	struct kedr_tr_event_compressed *ec = b1_buffer;
+	size_t compressed_size = 0;
 	int ret;
 	
-	ret = lzo1x_1_compress(buf, buf_size, &ec->compressed[0], 
-			       &compressed_size, lzo_wrkmem);
-	if (ret != LZO_E_OK) {
-		pr_warning(KEDR_MSG_PREFIX 
-			"lzo1x_compress_buf() failed, error: %d.\n", ret);
-		return 0;
+	if (comp->type == KEDR_TR_COMPRESSOR_LZO) {
+		struct kedr_tr_event_compressed *ec = b1_buffer;
+		
+		ret = comp->compress(buf, buf_size, &ec->compressed[0], 
+			&compressed_size, comp_wrkmem);
+		if (ret != 0)
+			goto fail;
+		
+		event_size = sizeof(struct kedr_tr_event_compressed) - 1 + 
+			compressed_size;
+		ec->header.type = (trace_format == 1 ? 
+			KEDR_TR_EVENT_COMPRESSED : KEDR_TR_EVENT_COMPACT);
+		ec->header.event_size = event_size;
+		ec->orig_size = buf_size;
+		ec->compressed_size = compressed_size;
+	}
+	else {
+		struct kedr_tr_event_chunk *ec = b1_buffer;
+		
+		ret = comp->compress(buf, buf_size, &ec->compressed[0], 
+			&compressed_size, comp_wrkmem);
+		if (ret != 0)
+			goto fail;
+		
+		event_size = sizeof(struct kedr_tr_event_chunk) - 1 + 
+			compressed_size;
+		ec->header.type = KEDR_TR_EVENT_CHUNK;
+		ec->header.event_size = event_size;
+		ec->orig_size = buf_size;
+		ec->compressed_size = compressed_size;
+		ec->format = (__u8)trace_format;
+		ec->compressor = (__u8)comp->type;
+		ec->reserved = 0;
 	}
-
-	event_size = sizeof(struct kedr_tr_event_compressed) - 1 + 
-		compressed_size;
-	ec->header.type = KEDR_TR_EVENT_COMPRESSED;
-	ec->header.event_size = event_size;
-	ec->orig_size = buf_size;
-	ec->compressed_size = compressed_size;
 	return event_size;
+
+fail:
+	pr_warning(KEDR_MSG_PREFIX 
+		"Failed to compress the data (\"%s\"), error: %d.\n", 
+		comp->name, ret);
+	return 0;
+}
+
+/* Finds the compressor specified by the user and prepares it for use. */
+static int __init
+compressor_init(void)
+{
+	unsigned int i;
+	int ret;
+	
+	for (i = 0; i < ARRAY_SIZE(compressors); ++i) {
+		if (strcmp(compressors[i].name, compressor) == 0) {
+			comp = &compressors[i];
+			break;
+		}
+	}
+	
+	if (comp == NULL) {
+		pr_warning(KEDR_MSG_PREFIX
+			"Unknown or unsupported compressor: \"%s\".\n", 
+			compressor);
+		return -EINVAL;
+	}
+	
+	if (comp->get != NULL) {
+		ret = comp->get();
+		if (ret != 0) {
+			pr_warning(KEDR_MSG_PREFIX
+	"The kernel does not provide the compressor \"%s\".\n",
+				comp->name);
+			return ret;
+		}
+	}
+	
+	if (comp->wrkmem_size != 0) {
+		comp_wrkmem = vmalloc(comp->wrkmem_size);
+		if (comp_wrkmem == NULL) {
+			pr_warning(KEDR_MSG_PREFIX
+	"Failed to allocate the working memory for the compressor (%lu bytes)\n",
+				comp->wrkmem_size);
+			if (comp->put != NULL)
+				comp->put();
+			return -ENOMEM;
+		}
+	}
+	return 0;
+}
+
+static void
+compressor_cleanup(void)
+{
+	vfree(comp_wrkmem);
+	comp_wrkmem = NULL;
+	
+	if (comp->put != NULL)
+		comp->put();
 }
 
 /* Compress the contents of B0 to B1 and copy the result to the output 
  * buffer if there is enough space there. Otherwise, the events from B0 are 
  * considered lost. After this function completes, B0 and B1 will be 
- * available as if they were empty again. */
+ * available as if they were empty again. 
+ *
+ * In the flight recorder mode, the oldest records are discarded to make 
+ * room for the new one. While a snapshot is being read, the events from B0
+ * are lost. */
 static void
 compress_b0_to_output(void)
 {
@@ -413,11 +1170,25 @@ compress_b0_to_output(void)
 	__u32 pos = 0;
 	void *where = NULL;
 
+	if (flight_frozen) {
+		b0_data_size = 0;
+		compact_reset();
+		goto out_lost;
+	}
+
 	rp = get_read_pos();
 	wp = start_page->write_pos;
 
-	nbytes = lzo1x_compress_buf(b0_buffer, b0_data_size);
+	nbytes = compress_buf(b0_buffer, b0_data_size);
 	b0_data_size = 0; /* Mark the buffer empty. */
+	compact_reset();
+	
+	if (nbytes != 0 && flight_recorder) {
+		unsigned int gap = 0;
+		if (!fits_to_page(wp, sizeof(struct kedr_tr_event_header)))
+			gap = to_next_page(wp) - wp;
+		rp = flight_make_space(wp, rp, gap + nbytes);
+	}
 	
 	if (nbytes == 0 || !buffer_has_space(wp, rp, nbytes))
 		goto out_lost;
@@ -428,6 +1199,8 @@ compress_b0_to_output(void)
 	if (!buffer_has_space(wp, rp, nbytes))
 		goto out_lost;
 
+	flight_set_cached_pos(stream_pos(wp));
+
 	/* Write the event page by page. Note that it is not needed to start
 	 * from a page boundary here. */
 	while (nbytes != 0) {
@@ -446,13 +1219,267 @@ compress_b0_to_output(void)
 	}
 
 	cached_events_num = 0;
+	b0_has_block_info = 0;
 	set_write_pos_and_notify(wp, rp);
 	return;
 
-out_lost:
-	events_lost += cached_events_num;
-	cached_events_num = 0;
-	return;
+out_lost:
+	flight_set_cached_pos(KEDR_TR_POS_LOST);
+	events_lost += cached_events_num;
+	cached_events_num = 0;
+	if (b0_has_block_info) {
+		use_block_ids = 0;
+		b0_has_block_info = 0;
+	}
+	return;
+}
+/* ====================================================================== */
+
+/* The maximum size of the tag and the reference to the thread. */
+#define KEDR_TR_COMPACT_HEADER_SIZE (1 + 2 * KEDR_TR_COMPACT_MAX_NUM_SIZE)
+
+/* The maximum sizes of the encoded STACK and THREAD_STACK events. */
+#define KEDR_TR_COMPACT_STACK_SIZE (1 + 4 * KEDR_TR_COMPACT_MAX_NUM_SIZE)
+#define KEDR_TR_COMPACT_THREAD_STACK_SIZE \
+	(KEDR_TR_COMPACT_HEADER_SIZE + 2 * KEDR_TR_COMPACT_MAX_NUM_SIZE)
+
+/* Makes sure B0 has room for an encoded event of at most 'max_size' bytes
+ * and writes the tag and the reference to the thread there. Returns the 
+ * position to write the fields of the event to. */
+static unsigned char *
+compact_begin(enum kedr_tr_event_type et, unsigned long tid, 
+	unsigned int max_size)
+{
+	if (!b0_buffer_has_space(max_size))
+		compress_b0_to_output();
+	
+	return compact_put_header(b0_buffer_write_pos(), et, (u64)tid);
+}
+
+/* Accounts for the event that ends before 'end' in B0. */
+static void
+compact_end(unsigned char *end)
+{
+	b0_data_size = (unsigned int)(end - (unsigned char *)b0_buffer);
+	++cached_events_num;
+}
+
+/* Returns the ID of the current call stack of the thread to record with 
+ * its event, KEDR_TR_NO_STACK if the call stack is not to be recorded. 
+ * The core only provides the call stack of the current thread. */
+static unsigned int
+get_stack_id(unsigned long tid)
+{
+	if (!call_stacks || tid != kedr_get_thread_id())
+		return KEDR_TR_NO_STACK;
+	
+	return kedr_get_stack_id(tid);
+}
+
+static int
+compact_stack_recorded(unsigned int id)
+{
+	return (id == 0 || 
+		(id < KEDR_TR_MAX_STACK_IDS && test_bit(id, compact_stacks)));
+}
+
+/* The number of STACK events needed to record the given stack in B0. */
+static unsigned int
+compact_count_stacks(unsigned int id)
+{
+	unsigned long pc;
+	unsigned int parent;
+	unsigned int nr = 0;
+	
+	for (; !compact_stack_recorded(id); id = parent) {
+		if (kedr_get_stack_frame(id, &pc, &parent) != 0)
+			break;
+		++nr;
+	}
+	return nr;
+}
+
+/* Writes THREAD_STACK event for the thread to B0 if the call stack of the
+ * thread has changed since the last such event in the series, along with
+ * STACK events for the parts of the stack not recorded in the series yet.
+ * Makes sure B0 also has room for the event of at most 'max_size' bytes 
+ * to be written after these, so that they all get to the same series. */
+static void
+compact_put_stack(unsigned long tid, unsigned int stack_id, 
+	unsigned int max_size)
+{
+	struct compact_thread *ct;
+	unsigned char *p;
+	unsigned long pc;
+	unsigned int parent;
+	unsigned int id;
+	
+	if (stack_id == KEDR_TR_NO_STACK)
+		return;
+	
+	ct = compact_find_thread((u64)tid);
+	if (ct != NULL && ct->stack == stack_id)
+		return;
+	
+	if (!b0_buffer_has_space(
+		compact_count_stacks(stack_id) * KEDR_TR_COMPACT_STACK_SIZE + 
+		KEDR_TR_COMPACT_THREAD_STACK_SIZE + max_size)) {
+		compress_b0_to_output();
+		
+		/* Unlikely: the stack is too deep to fit into B0 with the
+		 * event. Record it as empty then. */
+		if (!b0_buffer_has_space(compact_count_stacks(stack_id) * 
+			KEDR_TR_COMPACT_STACK_SIZE + 
+			KEDR_TR_COMPACT_THREAD_STACK_SIZE + max_size))
+			stack_id = 0;
+	}
+	
+	p = b0_buffer_write_pos();
+	for (id = stack_id; !compact_stack_recorded(id); id = parent) {
+		if (kedr_get_stack_frame(id, &pc, &parent) != 0)
+			break;
+		
+		p = compact_put_tag(p, KEDR_TR_EVENT_STACK, 0);
+		p = compact_put_num(p, id);
+		p = compact_put_num(p, parent);
+		p = compact_put_addr(p, pc, &compact_stack_pc);
+		if (id < KEDR_TR_MAX_STACK_IDS)
+			__set_bit(id, compact_stacks);
+	}
+	
+	p = compact_put_header(p, KEDR_TR_EVENT_THREAD_STACK, (u64)tid);
+	p = compact_put_num(p, stack_id);
+	compact_cur->stack = stack_id;
+	
+	/* These events are not counted, they only accompany the event to be
+	 * written next. */
+	b0_data_size = (unsigned int)(p - (unsigned char *)b0_buffer);
+}
+
+/* Same as compact_begin() but records the call stack of the thread before
+ * the event if needed. */
+static unsigned char *
+compact_begin_stack(enum kedr_tr_event_type et, unsigned long tid, 
+	unsigned int stack_id, unsigned int max_size)
+{
+	compact_put_stack(tid, stack_id, max_size);
+	return compact_begin(et, tid, max_size);
+}
+
+/* Makes sure B0 has room for an event structure of the given size and 
+ * returns the position to write it to. In the compact format, the tag 
+ * is written before the structure. */
+static void *
+b0_struct_write_pos(enum kedr_tr_event_type et, unsigned int size)
+{
+	unsigned char *p;
+	
+	if (trace_format == 1) {
+		if (!b0_buffer_has_space(size))
+			compress_b0_to_output();
+		return b0_buffer_write_pos();
+	}
+	
+	if (!b0_buffer_has_space(size + 1))
+		compress_b0_to_output();
+	
+	p = b0_buffer_write_pos();
+	*p = (unsigned char)et | KEDR_TR_COMPACT_STRUCT;
+	++b0_data_size;
+	return p + 1;
+}
+/* ====================================================================== */
+
+/* Flight recorder mode: places the copies of the records needed to process
+ * the snapshot starting at 'start' in the stream to the start page. These 
+ * are the records for "session start" and for the loading of the targets 
+ * not unloaded before 'start', if these records are not in the buffer.
+ *
+ * Must be called with 'eh_lock' locked. */
+static void
+flight_fill_header(u64 start)
+{
+	struct flight_target *ft;
+	struct kedr_tr_event_session *es;
+	unsigned int size = 0;
+	
+	if (session_start_pos < start) {
+		es = (struct kedr_tr_event_session *)&start_page->header[0];
+		es->header.type = KEDR_TR_EVENT_SESSION_START;
+		es->header.event_size = sizeof(*es);
+		size += sizeof(*es);
+	}
+	
+	list_for_each_entry(ft, &flight_targets, list) {
+		if (ft->load_pos >= start || ft->unload_pos < start)
+			continue;
+		
+		if (size + sizeof(ft->ev) > KEDR_TR_SNAPSHOT_HEADER_SIZE) {
+			pr_warning(KEDR_MSG_PREFIX 
+	"Too many targets, some will be missing in the snapshot.\n");
+			break;
+		}
+		memcpy(&start_page->header[size], &ft->ev, sizeof(ft->ev));
+		size += sizeof(ft->ev);
+	}
+	start_page->header_size = size;
+}
+
+/* Flight recorder mode: takes a snapshot of the data currently in the 
+ * buffer and wakes up the reader. Until the reader has read the data, the
+ * new events are not written to the buffer.
+ *
+ * Must be called with 'eh_lock' locked. */
+static void
+flight_take_snapshot(void)
+{
+	if (!flight_recorder || flight_frozen)
+		return;
+	
+	/* The latest events should be in the snapshot too. */
+	if (cached_events_num != 0)
+		compress_b0_to_output();
+	
+	flight_fill_header(stream_read_pos());
+	
+	flight_frozen = 1;
+	++start_page->snapshot_seq;
+	
+	/* The reader should see the header before 'frozen'. */
+	smp_wmb();
+	start_page->frozen = 1;
+	
+	signal_on_next_poll = 1;
+	notify_reader();
+}
+
+/* Flight recorder mode: resumes recording after the reader has read the
+ * snapshot.
+ *
+ * Must be called with 'eh_lock' locked. */
+static void
+flight_resume(void)
+{
+	flight_frozen = 0;
+	start_page->frozen = 0;
+	flight_remove_old_targets(written_total);
+}
+
+/* Flight recorder mode: forgets the data from the previous session, if 
+ * any. 
+ *
+ * Must be called with 'eh_lock' locked. */
+static void
+flight_reset(void)
+{
+	flight_frozen = 0;
+	start_page->frozen = 0;
+	start_page->read_pos = start_page->write_pos;
+	
+	/* The targets loaded at this moment, if any, will be reported as
+	 * if they were loaded before the session. */
+	flight_remove_old_targets(written_total);
+	session_start_pos = KEDR_TR_POS_NONE;
 }
 /* ====================================================================== */
 
@@ -553,6 +1580,23 @@ buffer_file_poll(struct file *filp, poll_table *wait)
 	poll_wait(filp, &reader_queue, wait);
 	
 	spin_lock_irqsave(&eh_lock, irq_flags);
+	if (flight_recorder) {
+		/* The reader has read all the data of the snapshot. */
+		if (flight_frozen && ((start_page->write_pos - 
+		    get_read_pos()) & (buffer_size - 1)) == 0)
+			flight_resume();
+		
+		signal_on_next_poll = 0;
+		if (flight_frozen)
+			ret = POLLIN | POLLRDNORM;
+		goto out;
+	}
+	
+	if (adaptive_notify) {
+		update_notify_mark((start_page->write_pos - get_read_pos()) &
+				   (buffer_size - 1));
+	}
+	
 	if (signal_on_next_poll) {
 		ret = POLLIN | POLLRDNORM;
 		signal_on_next_poll = 0;
@@ -577,6 +1621,52 @@ static const struct file_operations buffer_file_ops = {
 	.mmap		= buffer_file_mmap,
 	.poll		= buffer_file_poll,
 };
+
+/* Writing anything to "snapshot" file takes a snapshot in the flight 
+ * recorder mode. */
+static ssize_t 
+snapshot_file_write(struct file *filp, const char __user *buf, size_t count,
+	loff_t *f_pos)
+{
+	unsigned long irq_flags;
+	
+	if (!flight_recorder)
+		return -EINVAL;
+	
+	spin_lock_irqsave(&eh_lock, irq_flags);
+	flight_take_snapshot();
+	spin_unlock_irqrestore(&eh_lock, irq_flags);
+	return count;
+}
+
+static const struct file_operations snapshot_file_ops = {
+	.owner 		= THIS_MODULE,
+	.write		= snapshot_file_write,
+};
+/* ====================================================================== */
+
+/* Flight recorder mode: takes a snapshot when an oops happens. The reader
+ * can save it if the system survives the oops. */
+static int
+flight_die_notify(struct notifier_block *nb, unsigned long val, void *data)
+{
+	unsigned long irq_flags;
+	
+	if (val != DIE_OOPS)
+		return NOTIFY_DONE;
+	
+	/* The oops might have happened while 'eh_lock' was held, do not 
+	 * wait for it then. */
+	if (spin_trylock_irqsave(&eh_lock, irq_flags)) {
+		flight_take_snapshot();
+		spin_unlock_irqrestore(&eh_lock, irq_flags);
+	}
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block flight_die_nb = {
+	.notifier_call = flight_die_notify,
+};
 /* ====================================================================== */
 
 static void
@@ -590,8 +1680,16 @@ handle_session_event_impl(enum kedr_tr_event_type et)
 
 	spin_lock_irqsave(&eh_lock, irq_flags);
 
-	if (et == KEDR_TR_EVENT_SESSION_START)
+	if (et == KEDR_TR_EVENT_SESSION_START) {
 		events_lost = 0;
+		events_lost_seen = 0;
+		nr_wakeups = 0;
+		cur_notify_mark = notify_mark;
+		use_block_ids = 1;
+		
+		if (flight_recorder)
+			flight_reset();
+	}
 	
 	/* If session is ending, output the events accumulated in B0. */
 	if (et == KEDR_TR_EVENT_SESSION_END && cached_events_num != 0) {
@@ -608,10 +1706,18 @@ handle_session_event_impl(enum kedr_tr_event_type et)
 	ev->header.type = et;
 	ev->header.event_size = size;
 
+	if (et == KEDR_TR_EVENT_SESSION_START)
+		session_start_pos = stream_pos(wp);
+
 	wp += size;
 	set_write_pos_and_notify(wp, rp);
 
 	if (et == KEDR_TR_EVENT_SESSION_END) {
+		/* The end of the session is a trigger for a snapshot too. 
+		 * If the previous snapshot is still being read, the reader
+		 * will get this event with it. */
+		flight_take_snapshot();
+		
 		/* This helps if the reader is not currently waiting... */
 		signal_on_next_poll = 1;
 
@@ -626,23 +1732,95 @@ out:
 	spin_unlock_irqrestore(&eh_lock, irq_flags);
 }
 
+/* Flight recorder mode: keeps track of the loaded targets, see 
+ * struct flight_target. 'ft' is the new structure to use if the target 
+ * has been loaded (NULL if it could not be allocated), 'ev' - the record
+ * for the event.
+ *
+ * Must be called with 'eh_lock' locked. */
+static void
+flight_handle_load_unload(enum kedr_tr_event_type et, 
+	struct kedr_tr_event_module *ev, struct flight_target *ft)
+{
+	if (et == KEDR_TR_EVENT_TARGET_LOAD) {
+		if (ft == NULL)
+			return;
+		
+		/* A good time to forget the targets unloaded long ago. */
+		flight_remove_old_targets(stream_read_pos());
+		
+		memcpy(&ft->ev, ev, sizeof(*ev));
+		ft->load_pos = KEDR_TR_POS_CACHED;
+		ft->unload_pos = KEDR_TR_POS_NONE;
+		list_add_tail(&ft->list, &flight_targets);
+		++flight_nr_cached;
+		return;
+	}
+	
+	list_for_each_entry(ft, &flight_targets, list) {
+		if (ft->unload_pos == KEDR_TR_POS_NONE && 
+		    strncmp(ft->ev.name, ev->name, sizeof(ev->name)) == 0) {
+			ft->unload_pos = KEDR_TR_POS_CACHED;
+			++flight_nr_cached;
+			return;
+		}
+	}
+}
+
+/* Flight recorder mode: finds the address of 'snapshot_func' when a target
+ * is loaded and forgets it when the target containing it is unloaded. */
+static void
+flight_update_snapshot_func(enum kedr_tr_event_type et, struct module *mod)
+{
+	unsigned long addr;
+	unsigned long init = (unsigned long)module_init_addr(mod);
+	unsigned long core = (unsigned long)module_core_addr(mod);
+	
+	if (!flight_recorder || snapshot_func[0] == 0)
+		return;
+	
+	if (et == KEDR_TR_EVENT_TARGET_LOAD) {
+		if (ACCESS_ONCE(snapshot_func_addr) != 0)
+			return;
+		
+		addr = kallsyms_lookup_name(snapshot_func);
+		if ((addr >= init && addr < init + init_text_size(mod)) ||
+		    (addr >= core && addr < core + core_text_size(mod)))
+			ACCESS_ONCE(snapshot_func_addr) = addr;
+		return;
+	}
+	
+	addr = ACCESS_ONCE(snapshot_func_addr);
+	if ((addr >= init && addr < init + init_text_size(mod)) ||
+	    (addr >= core && addr < core + core_text_size(mod)))
+		ACCESS_ONCE(snapshot_func_addr) = 0;
+}
+
 static void
 handle_load_unload_impl(enum kedr_tr_event_type et, struct module *mod)
 {
 	unsigned long irq_flags;
 	struct kedr_tr_event_module *ev;
 	unsigned int size = (unsigned int)sizeof(*ev);
+	struct flight_target *ft = NULL;
 
 	/* [NB] It is OK to access the fields of 'mod' here because the
 	 * target module cannot go away while "target load" and "target
 	 * unload" handlers are executed. Therefore, 'mod' remains valid,
 	 * the core ensures that. */
 	
+	if (flight_recorder && et == KEDR_TR_EVENT_TARGET_LOAD) {
+		ft = kzalloc(sizeof(*ft), GFP_KERNEL);
+		if (ft == NULL) {
+			pr_warning(KEDR_MSG_PREFIX 
+	"Not enough memory, the snapshots may lack the information about %s.\n",
+				module_name(mod));
+		}
+	}
+	flight_update_snapshot_func(et, mod);
+	
 	spin_lock_irqsave(&eh_lock, irq_flags);
-	if (!b0_buffer_has_space(size))
-		compress_b0_to_output();
-
-	ev = b0_buffer_write_pos();
+	ev = b0_struct_write_pos(et, size);
 	memset(ev, 0, size);
 	
 	ev->header.type = et;
@@ -650,15 +1828,18 @@ handle_load_unload_impl(enum kedr_tr_event_type et, struct module *mod)
 	strncpy(ev->name, module_name(mod), KEDR_TARGET_NAME_LEN);
 
 	if (et == KEDR_TR_EVENT_TARGET_LOAD) {
-		ev->init_addr = (__u32)(unsigned long)module_init_addr(mod);
+		ev->init_addr = (__u64)(unsigned long)module_init_addr(mod);
 		if (ev->init_addr != 0)
 			ev->init_size = (__u32)init_text_size(mod);
 
-		ev->core_addr = (__u32)(unsigned long)module_core_addr(mod);
+		ev->core_addr = (__u64)(unsigned long)module_core_addr(mod);
 		if (ev->core_addr != 0)
 			ev->core_size = (__u32)core_text_size(mod);
 	}
 	
+	if (flight_recorder)
+		flight_handle_load_unload(et, ev, ft);
+	
 	++cached_events_num;
 	b0_data_size += size;
 
@@ -672,22 +1853,37 @@ handle_function_event_impl(enum kedr_tr_event_type et, unsigned long tid,
 	unsigned long irq_flags;
 	struct kedr_tr_event_func *ev;
 	unsigned int size = (unsigned int)sizeof(*ev);
+	unsigned char *p;
+	unsigned long snapshot_addr = ACCESS_ONCE(snapshot_func_addr);
+	int trigger = (et == KEDR_TR_EVENT_FENTRY && 
+		       snapshot_addr != 0 && func == snapshot_addr);
 
-	if (no_call_events)
+	if (no_call_events && !trigger)
 		return;
 	
 	spin_lock_irqsave(&eh_lock, irq_flags);
-	if (!b0_buffer_has_space(size))
-		compress_b0_to_output();
-
-	ev = b0_buffer_write_pos();
-	ev->header.type = et;
-	ev->header.event_size = size;
-	ev->tid = (__u64)tid;
-	ev->func = (__u32)func;
-
-	++cached_events_num;
-	b0_data_size += size;
+	if (!no_call_events && trace_format != 1) {
+		p = compact_begin(et, tid, KEDR_TR_COMPACT_HEADER_SIZE + 
+				  KEDR_TR_COMPACT_MAX_NUM_SIZE);
+		p = compact_put_addr(p, func, &compact_cur->code);
+		compact_end(p);
+	}
+	else if (!no_call_events) {
+		if (!b0_buffer_has_space(size))
+			compress_b0_to_output();
+
+		ev = b0_buffer_write_pos();
+		ev->header.type = et;
+		ev->header.event_size = size;
+		ev->tid = (__u64)tid;
+		ev->func = (__u64)func;
+
+		++cached_events_num;
+		b0_data_size += size;
+	}
+	
+	if (trigger)
+		flight_take_snapshot();
 
 	spin_unlock_irqrestore(&eh_lock, irq_flags);
 }
@@ -699,11 +1895,21 @@ handle_call_impl(enum kedr_tr_event_type et, unsigned long tid,
 	unsigned long irq_flags;
 	struct kedr_tr_event_call *ev;
 	unsigned int size = (unsigned int)sizeof(*ev);	
+	unsigned char *p;
 	
 	if (no_call_events)
 		return;
 	
 	spin_lock_irqsave(&eh_lock, irq_flags);
+	if (trace_format != 1) {
+		p = compact_begin(et, tid, KEDR_TR_COMPACT_HEADER_SIZE + 
+				  2 * KEDR_TR_COMPACT_MAX_NUM_SIZE);
+		p = compact_put_addr(p, pc, &compact_cur->code);
+		p = compact_put_addr(p, func, &compact_cur->code);
+		compact_end(p);
+		goto out;
+	}
+	
 	if (!b0_buffer_has_space(size))
 		compress_b0_to_output();
 
@@ -711,12 +1917,12 @@ handle_call_impl(enum kedr_tr_event_type et, unsigned long tid,
 	ev->header.type = et;
 	ev->header.event_size = size;
 	ev->tid = (__u64)tid;
-	ev->func = (__u32)func;
-	ev->pc = (__u32)pc;
+	ev->func = (__u64)func;
+	ev->pc = (__u64)pc;
 
 	++cached_events_num;
 	b0_data_size += size;
-
+out:
 	spin_unlock_irqrestore(&eh_lock, irq_flags);
 }
 
@@ -744,6 +1950,41 @@ on_unload(struct kedr_event_handlers *eh, struct module *mod)
 	handle_load_unload_impl(KEDR_TR_EVENT_TARGET_UNLOAD, mod);
 }
 
+/* The handler is set only if the compact format is used and the module 
+ * does not operate in the flight recorder mode: the snapshots could lack
+ * the BLOCK_INFO events otherwise. */
+static void
+on_block_info(struct kedr_event_handlers *eh, struct module *mod, 
+	const struct kedr_block_info *info)
+{
+	unsigned long irq_flags;
+	struct kedr_tr_event_block_info *ev;
+	unsigned int size;
+	unsigned long i;
+	
+	size = sizeof(*ev) + (info->max_events - 1) * sizeof(ev->ops[0]);
+	
+	spin_lock_irqsave(&eh_lock, irq_flags);
+	ev = b0_struct_write_pos(KEDR_TR_EVENT_BLOCK_INFO, size);
+	ev->header.type = KEDR_TR_EVENT_BLOCK_INFO;
+	ev->header.event_size = size;
+	ev->id = (__u32)info->id;
+	ev->max_events = (__u32)info->max_events;
+	ev->read_mask = info->read_mask;
+	ev->write_mask = info->write_mask;
+	ev->string_mask = info->string_mask;
+	
+	for (i = 0; i < info->max_events; ++i) {
+		ev->ops[i].pc = (__u64)info->events[i].pc;
+		ev->ops[i].size = (__u32)info->events[i].size;
+	}
+	
+	++cached_events_num;
+	b0_data_size += size;
+	b0_has_block_info = 1;
+	spin_unlock_irqrestore(&eh_lock, irq_flags);
+}
+
 static void 
 on_function_entry(struct kedr_event_handlers *eh, unsigned long tid, 
 	unsigned long func)
@@ -776,11 +2017,10 @@ static void
 begin_memory_events(struct kedr_event_handlers *eh, unsigned long tid, 
 	unsigned long num_events, void **pdata)
 {
-	struct kedr_tr_event_mem *ev;
+	struct mem_events *ev;
 	
-	ev = kzalloc(sizeof(struct kedr_tr_event_mem) + 
-		(num_events - 1) * sizeof(struct kedr_tr_event_mem_op), 
-		GFP_ATOMIC);
+	ev = kzalloc(sizeof(struct mem_events) + 
+		(num_events - 1) * sizeof(ev->ops[0]), GFP_ATOMIC);
 	if (ev == NULL) {
 		pr_warning(KEDR_MSG_PREFIX 
 "begin_memory_events(): not enough memory to record %lu access(es).\n",
@@ -789,31 +2029,49 @@ begin_memory_events(struct kedr_event_handlers *eh, unsigned long tid,
 		return;
 	}
 	
-	/* ev->header.nr_events is now 0 */
-	ev->header.type = KEDR_TR_EVENT_MEM;
-	ev->tid = (__u64)tid;
+	/* ev->nr_events is now 0 */
+	ev->tid = tid;
 	*pdata = ev; 
 }
 
+static void 
+begin_block_events(struct kedr_event_handlers *eh, unsigned long tid, 
+	const struct kedr_block_info *info, void **pdata)
+{
+	struct mem_events *ev;
+	
+	begin_memory_events(eh, tid, info->max_events, pdata);
+	ev = *pdata;
+	if (ev != NULL)
+		ev->info = info;
+}
+
 static void 
 on_memory_event(struct kedr_event_handlers *eh, unsigned long tid, 
 	unsigned long pc, unsigned long addr, unsigned long size, 
 	enum kedr_memory_event_type type,
 	void *data)
 {
-	struct kedr_tr_event_mem *ev = (struct kedr_tr_event_mem *)data;
+	struct mem_events *ev = (struct mem_events *)data;
 	__u32 event_bit;
 	unsigned int nr;
 	
-	if (addr == 0 || ev == NULL)
+	if (ev == NULL)
+		return;
+	
+	nr = ev->nr_calls++;
+	if (addr == 0)
 		return;
 	
+	if (ev->info != NULL)
+		ev->block_mask |= (__u32)1 << nr;
+	
 	nr = ev->nr_events;
 	event_bit = 1 << nr;
 	
-	ev->mem_ops[nr].addr = (__u64)addr;
-	ev->mem_ops[nr].size = (__u32)size;
-	ev->mem_ops[nr].pc   = (__u32)pc;
+	ev->ops[nr].addr = addr;
+	ev->ops[nr].size = size;
+	ev->ops[nr].pc   = pc;
 	
 	switch (type) {
 	case KEDR_ET_MREAD:
@@ -836,58 +2094,168 @@ on_memory_event(struct kedr_event_handlers *eh, unsigned long tid,
 }
 
 static void
-report_block_enter_event(__u64 tid, __u32 pc)
+report_block_enter_event(unsigned long tid, unsigned long pc, 
+	unsigned int stack_id)
 {
 	unsigned long irq_flags;
 	struct kedr_tr_event_block *ev;
 	unsigned int size = (unsigned int)sizeof(*ev);	
+	unsigned char *p;
 	
 	spin_lock_irqsave(&eh_lock, irq_flags);
+	if (trace_format != 1) {
+		p = compact_begin_stack(KEDR_TR_EVENT_BLOCK_ENTER, tid, 
+			stack_id, KEDR_TR_COMPACT_HEADER_SIZE + 
+			KEDR_TR_COMPACT_MAX_NUM_SIZE);
+		p = compact_put_addr(p, pc, &compact_cur->code);
+		compact_end(p);
+		goto out;
+	}
+	
 	if (!b0_buffer_has_space(size))
 		compress_b0_to_output();
 
 	ev = b0_buffer_write_pos();
 	ev->header.type = KEDR_TR_EVENT_BLOCK_ENTER;
 	ev->header.event_size = size;
-	ev->tid = tid;
-	ev->pc = pc;
+	ev->tid = (__u64)tid;
+	ev->pc = (__u64)pc;
 
 	++cached_events_num;
 	b0_data_size += size;
-
+out:
 	spin_unlock_irqrestore(&eh_lock, irq_flags);
 }
 
+/* Writes the memory events to B0 in the compact format. */
+static void
+compact_put_mem_events(struct mem_events *ev, unsigned int stack_id)
+{
+	unsigned char *p;
+	unsigned int i;
+	
+	p = compact_begin_stack(KEDR_TR_EVENT_MEM, ev->tid, stack_id,
+		KEDR_TR_COMPACT_HEADER_SIZE + 
+		3 * KEDR_TR_COMPACT_MAX_NUM_SIZE * (ev->nr_events + 1));
+	p = compact_put_num(p, ev->nr_events);
+	p = compact_put_num(p, ev->read_mask);
+	p = compact_put_num(p, ev->write_mask);
+	
+	for (i = 0; i < ev->nr_events; ++i) {
+		p = compact_put_addr(p, ev->ops[i].pc, &compact_cur->code);
+		p = compact_put_addr(p, ev->ops[i].addr, &compact_cur->data);
+		p = compact_put_num(p, ev->ops[i].size);
+	}
+	compact_end(p);
+}
+
+/* Writes the memory events from a block of code to B0 as a reference to 
+ * the BLOCK_INFO event for that block, see recorder.h. */
+static void
+compact_put_block_events(struct mem_events *ev, unsigned int stack_id)
+{
+	const struct kedr_block_info *info = ev->info;
+	unsigned char *p;
+	unsigned char *tag;
+	unsigned int i;
+	unsigned int nr = 0;
+	__u32 extra_write_mask = 0;
+	__u32 bit;
+	
+	p = compact_begin_stack(KEDR_TR_EVENT_MEM, ev->tid, stack_id,
+		KEDR_TR_COMPACT_HEADER_SIZE + 
+		2 * KEDR_TR_COMPACT_MAX_NUM_SIZE * (ev->nr_events + 2));
+	
+	/* The tag is at the current end of the data in B0. */
+	tag = b0_buffer_write_pos();
+	*tag |= KEDR_TR_COMPACT_BLOCK;
+	
+	for (i = 0, bit = 1; i < info->max_events; ++i, bit <<= 1) {
+		if (!(ev->block_mask & bit))
+			continue;
+		if ((ev->write_mask & ((__u32)1 << nr)) && 
+		    !(info->write_mask & bit))
+			extra_write_mask |= bit;
+		++nr;
+	}
+	
+	p = compact_put_addr(p, info->id, &compact_cur->block);
+	p = compact_put_num(p, 
+		((u64)ev->block_mask << 1) | (extra_write_mask != 0));
+	if (extra_write_mask != 0)
+		p = compact_put_num(p, extra_write_mask);
+	
+	nr = 0;
+	for (i = 0, bit = 1; i < info->max_events; ++i, bit <<= 1) {
+		if (!(ev->block_mask & bit))
+			continue;
+		p = compact_put_addr(p, ev->ops[nr].addr, &compact_cur->data);
+		if (info->string_mask & bit)
+			p = compact_put_num(p, ev->ops[nr].size);
+		++nr;
+	}
+	compact_end(p);
+	
+	/* The record stands for the "block enter" event as well. */
+	++cached_events_num;
+}
+
 static void
 end_memory_events(struct kedr_event_handlers *eh, unsigned long tid, 
 	void *data)
 {
 	unsigned long irq_flags;
 	unsigned int size;
-	struct kedr_tr_event_mem *ev = (struct kedr_tr_event_mem *)data;
-	void *where = NULL;
+	struct mem_events *ev = (struct mem_events *)data;
+	struct kedr_tr_event_mem *where;
+	unsigned int i;
+	unsigned int stack_id;
 	
 	if (ev == NULL || ev->nr_events == 0) {
 		kfree(ev);
 		return;
 	}
 	
-	report_block_enter_event(ev->tid, ev->mem_ops[0].pc);
+	stack_id = get_stack_id(ev->tid);
+	if (ev->info != NULL) {
+		spin_lock_irqsave(&eh_lock, irq_flags);
+		if (use_block_ids) {
+			compact_put_block_events(ev, stack_id);
+			goto out;
+		}
+		spin_unlock_irqrestore(&eh_lock, irq_flags);
+	}
 	
-	size = sizeof(struct kedr_tr_event_mem) + 
-		(ev->nr_events - 1) * sizeof(struct kedr_tr_event_mem_op);
-	ev->header.event_size = size;
+	report_block_enter_event(ev->tid, ev->ops[0].pc, stack_id);
 	
 	spin_lock_irqsave(&eh_lock, irq_flags);
+	if (trace_format != 1) {
+		compact_put_mem_events(ev, stack_id);
+		goto out;
+	}
+	
+	size = sizeof(struct kedr_tr_event_mem) + 
+		(ev->nr_events - 1) * sizeof(struct kedr_tr_event_mem_op);
 	if (!b0_buffer_has_space(size))
 		compress_b0_to_output();
 
 	where = b0_buffer_write_pos();
-	memcpy(where, ev, size);
+	where->header.type = KEDR_TR_EVENT_MEM;
+	where->header.event_size = size;
+	where->tid = (__u64)ev->tid;
+	where->nr_events = ev->nr_events;
+	where->read_mask = ev->read_mask;
+	where->write_mask = ev->write_mask;
+	
+	for (i = 0; i < ev->nr_events; ++i) {
+		where->mem_ops[i].addr = (__u64)ev->ops[i].addr;
+		where->mem_ops[i].size = (__u32)ev->ops[i].size;
+		where->mem_ops[i].pc   = (__u64)ev->ops[i].pc;
+	}
 	
 	++cached_events_num;
 	b0_data_size += size;
-
+out:
 	spin_unlock_irqrestore(&eh_lock, irq_flags);
 	kfree(ev);
 }
@@ -900,41 +2268,60 @@ handle_locked_and_io_impl(enum kedr_tr_event_type et, unsigned long tid,
 	unsigned long irq_flags;
 	struct kedr_tr_event_mem *ev;
 	unsigned int size = (unsigned int)sizeof(*ev);	
-	
-	spin_lock_irqsave(&eh_lock, irq_flags);
-	if (!b0_buffer_has_space(size))
-		compress_b0_to_output();
-
-	ev = b0_buffer_write_pos();
-	ev->header.type = et;
-	ev->header.event_size = size;
-	ev->nr_events = 1;
-	ev->tid = (__u64)tid;
-	
-	ev->mem_ops[0].addr = (__u64)addr;
-	ev->mem_ops[0].size = (__u32)sz;
-	ev->mem_ops[0].pc   = (__u32)pc;
+	__u32 read_mask = 0;
+	__u32 write_mask = 0;
+	unsigned char *p;
+	unsigned int stack_id = get_stack_id(tid);
 	
 	switch (type) {
 	case KEDR_ET_MREAD:
-		ev->read_mask = 1;
+		read_mask = 1;
 		break;
 	case KEDR_ET_MWRITE:
-		ev->write_mask = 1;
+		write_mask = 1;
 		break;
 	case KEDR_ET_MUPDATE:
-		ev->read_mask = 1;
-		ev->write_mask = 1;
+		read_mask = 1;
+		write_mask = 1;
 		break;
 	default:
 		pr_warning(KEDR_MSG_PREFIX 
 	"handle_locked_and_io_impl(): unknown type of memory access: %d.\n",
 			(int)type);
 	};
+	
+	spin_lock_irqsave(&eh_lock, irq_flags);
+	if (trace_format != 1) {
+		p = compact_begin_stack(et, tid, stack_id, 
+			KEDR_TR_COMPACT_HEADER_SIZE + 
+			5 * KEDR_TR_COMPACT_MAX_NUM_SIZE);
+		p = compact_put_num(p, read_mask);
+		p = compact_put_num(p, write_mask);
+		p = compact_put_addr(p, pc, &compact_cur->code);
+		p = compact_put_addr(p, addr, &compact_cur->data);
+		p = compact_put_num(p, sz);
+		compact_end(p);
+		goto out;
+	}
+	
+	if (!b0_buffer_has_space(size))
+		compress_b0_to_output();
+
+	ev = b0_buffer_write_pos();
+	ev->header.type = et;
+	ev->header.event_size = size;
+	ev->nr_events = 1;
+	ev->tid = (__u64)tid;
+	ev->read_mask = read_mask;
+	ev->write_mask = write_mask;
+	
+	ev->mem_ops[0].addr = (__u64)addr;
+	ev->mem_ops[0].size = (__u32)sz;
+	ev->mem_ops[0].pc   = (__u64)pc;
 
 	++cached_events_num;
 	b0_data_size += size;
-
+out:
 	spin_unlock_irqrestore(&eh_lock, irq_flags);
 }
 
@@ -963,8 +2350,20 @@ handle_memory_barrier_impl(enum kedr_tr_event_type et, unsigned long tid,
 	unsigned long irq_flags;
 	struct kedr_tr_event_barrier *ev;
 	unsigned int size = (unsigned int)sizeof(*ev);	
+	unsigned char *p;
+	unsigned int stack_id = get_stack_id(tid);
 	
 	spin_lock_irqsave(&eh_lock, irq_flags);
+	if (trace_format != 1) {
+		p = compact_begin_stack(et, tid, stack_id, 
+			KEDR_TR_COMPACT_HEADER_SIZE + 
+			2 * KEDR_TR_COMPACT_MAX_NUM_SIZE);
+		p = compact_put_num(p, (u64)type);
+		p = compact_put_addr(p, pc, &compact_cur->code);
+		compact_end(p);
+		goto out;
+	}
+	
 	if (!b0_buffer_has_space(size))
 		compress_b0_to_output();
 
@@ -977,7 +2376,7 @@ handle_memory_barrier_impl(enum kedr_tr_event_type et, unsigned long tid,
 
 	++cached_events_num;
 	b0_data_size += size;
-
+out:
 	spin_unlock_irqrestore(&eh_lock, irq_flags);
 }
 
@@ -1004,8 +2403,21 @@ handle_alloc_free_impl(enum kedr_tr_event_type et, unsigned long tid,
 	unsigned long irq_flags;
 	struct kedr_tr_event_alloc_free *ev;
 	unsigned int size = (unsigned int)sizeof(*ev);	
+	unsigned char *p;
+	unsigned int stack_id = get_stack_id(tid);
 	
 	spin_lock_irqsave(&eh_lock, irq_flags);
+	if (trace_format != 1) {
+		p = compact_begin_stack(et, tid, stack_id, 
+			KEDR_TR_COMPACT_HEADER_SIZE + 
+			3 * KEDR_TR_COMPACT_MAX_NUM_SIZE);
+		p = compact_put_addr(p, pc, &compact_cur->code);
+		p = compact_put_addr(p, addr, &compact_cur->data);
+		p = compact_put_num(p, sz);
+		compact_end(p);
+		goto out;
+	}
+	
 	if (!b0_buffer_has_space(size))
 		compress_b0_to_output();
 
@@ -1019,7 +2431,7 @@ handle_alloc_free_impl(enum kedr_tr_event_type et, unsigned long tid,
 
 	++cached_events_num;
 	b0_data_size += size;
-
+out:
 	spin_unlock_irqrestore(&eh_lock, irq_flags);
 }
 
@@ -1059,8 +2471,21 @@ handle_sync_event_impl(enum kedr_tr_event_type et, unsigned long tid,
 	unsigned long irq_flags;
 	struct kedr_tr_event_sync *ev;
 	unsigned int size = (unsigned int)sizeof(*ev);	
+	unsigned char *p;
+	unsigned int stack_id = get_stack_id(tid);
 	
 	spin_lock_irqsave(&eh_lock, irq_flags);
+	if (trace_format != 1) {
+		p = compact_begin_stack(et, tid, stack_id, 
+			KEDR_TR_COMPACT_HEADER_SIZE + 
+			3 * KEDR_TR_COMPACT_MAX_NUM_SIZE);
+		p = compact_put_num(p, obj_type);
+		p = compact_put_addr(p, pc, &compact_cur->code);
+		p = compact_put_addr(p, obj_id, &compact_cur->data);
+		compact_end(p);
+		goto out;
+	}
+	
 	if (!b0_buffer_has_space(size))
 		compress_b0_to_output();
 
@@ -1074,7 +2499,7 @@ handle_sync_event_impl(enum kedr_tr_event_type et, unsigned long tid,
 
 	++cached_events_num;
 	b0_data_size += size;
-
+out:
 	spin_unlock_irqrestore(&eh_lock, irq_flags);
 }
 
@@ -1155,10 +2580,7 @@ on_thread_start(struct kedr_event_handlers *eh, unsigned long tid,
 	unsigned int size = (unsigned int)sizeof(*ev);
 
 	spin_lock_irqsave(&eh_lock, irq_flags);
-	if (!b0_buffer_has_space(size))
-		compress_b0_to_output();
-
-	ev = b0_buffer_write_pos();
+	ev = b0_struct_write_pos(KEDR_TR_EVENT_THREAD_START, size);
 	memset(ev, 0, size);
 	
 	ev->header.type = KEDR_TR_EVENT_THREAD_START;
@@ -1181,8 +2603,16 @@ on_thread_end(struct kedr_event_handlers *eh, unsigned long tid)
 	unsigned long irq_flags;
 	struct kedr_tr_event_tend *ev;
 	unsigned int size = (unsigned int)sizeof(*ev);
+	unsigned char *p;
 
 	spin_lock_irqsave(&eh_lock, irq_flags);
+	if (trace_format != 1) {
+		p = compact_begin(KEDR_TR_EVENT_THREAD_END, tid, 
+				  KEDR_TR_COMPACT_HEADER_SIZE);
+		compact_end(p);
+		goto out;
+	}
+	
 	if (!b0_buffer_has_space(size))
 		compress_b0_to_output();
 
@@ -1195,7 +2625,7 @@ on_thread_end(struct kedr_event_handlers *eh, unsigned long tid)
 
 	++cached_events_num;
 	b0_data_size += size;
-
+out:
 	spin_unlock_irqrestore(&eh_lock, irq_flags);
 }
 
@@ -1216,6 +2646,9 @@ struct kedr_event_handlers eh = {
 	.begin_memory_events	= begin_memory_events,
 	.end_memory_events	= end_memory_events,
 	.on_memory_event	= on_memory_event,
+	
+	.on_block_info		= on_block_info,
+	.begin_block_events	= begin_block_events,
 
 	/* We do not need to set pre handlers for locked memory operations
 	 * and I/O operations accessing memory, post handlers are enough. */
@@ -1322,8 +2755,9 @@ create_b1_buffer(void)
 {
 	unsigned int b1_size; 
 	
-	/* (-1) for unsigned char compressed[1]. */
-	b1_size = (unsigned int)sizeof(struct kedr_tr_event_compressed) - 1
+	/* (-1) for unsigned char compressed[1]. The worst case for LZO is 
+	 * also enough for LZ4 and for the uncompressed data. */
+	b1_size = (unsigned int)sizeof(struct kedr_tr_event_chunk) - 1
 		+ lzo1x_worst_compress(b0_nr_data_pages * PAGE_SIZE);
 	
 	b1_buffer = vmalloc(b1_size);
@@ -1342,6 +2776,10 @@ test_remove_debugfs_files(void)
 		debugfs_remove(buffer_file);
 	if (events_lost_file != NULL)
 		debugfs_remove(events_lost_file);
+	if (nr_wakeups_file != NULL)
+		debugfs_remove(nr_wakeups_file);
+	if (snapshot_file != NULL)
+		debugfs_remove(snapshot_file);
 }
 
 static int 
@@ -1365,6 +2803,20 @@ test_create_debugfs_files(void)
 	if (events_lost_file == NULL)
 		goto out;
 	
+	name = "nr_wakeups";
+	nr_wakeups_file = debugfs_create_u64(name, S_IRUGO, 
+		debugfs_dir_dentry, &nr_wakeups);
+	if (nr_wakeups_file == NULL)
+		goto out;
+	
+	snapshot_file = debugfs_create_file(snapshot_file_name, 
+		S_IWUSR | S_IWGRP, debugfs_dir_dentry, NULL, 
+		&snapshot_file_ops);
+	if (snapshot_file == NULL) {
+		name = snapshot_file_name;
+		goto out;
+	}
+	
 	return 0;
 out:
 	pr_warning(KEDR_MSG_PREFIX 
@@ -1377,13 +2829,26 @@ out:
 static void __exit
 test_cleanup_module(void)
 {
+	if (flight_recorder && snapshot_on_oops)
+		unregister_die_notifier(&flight_die_nb);
+	
 	/* Unregister the event handlers first. */
 	kedr_unregister_event_handlers(&eh);
 	
 	test_remove_debugfs_files();
 	debugfs_remove(debugfs_dir_dentry);
 	
-	vfree(lzo_wrkmem);
+	/* Nothing can use the list now, no need to lock. */
+	while (!list_empty(&flight_targets)) {
+		struct flight_target *ft = list_first_entry(
+			&flight_targets, struct flight_target, list);
+		list_del(&ft->list);
+		kfree(ft);
+	}
+	
+	compressor_cleanup();
+	destroy_b1_buffer();
+	destroy_b0_buffer();
 	destroy_page_buffer();
 	return;
 }
@@ -1407,6 +2872,12 @@ test_init_module(void)
 		return -EINVAL;
 	}
 	
+	if (b0_nr_data_pages < 1) {
+		pr_warning(KEDR_MSG_PREFIX
+			"'chunk_pages' must be a positive value.\n");
+		return -EINVAL;
+	}
+	
 	if (nr_data_pages < 2 * b0_nr_data_pages) {
 		pr_warning(KEDR_MSG_PREFIX
 	"'nr_data_pages' must not be less than %u.\n", 
@@ -1414,6 +2885,32 @@ test_init_module(void)
 		return -EINVAL;
 	}
 	
+	if (trace_format != 1 && trace_format != 2) {
+		pr_warning(KEDR_MSG_PREFIX
+	"Invalid value of 'trace_format' (%u): must be 1 or 2.\n",
+			trace_format);
+		return -EINVAL;
+	}
+	
+	if (trace_format == 1 || flight_recorder) {
+		eh.on_block_info = NULL;
+		eh.begin_block_events = NULL;
+	}
+	
+	if (trace_format == 1)
+		call_stacks = 0;
+	
+	if (call_stacks && !kedr_shadow_stacks_enabled()) {
+		pr_warning(KEDR_MSG_PREFIX
+"'call_stacks' requires the core to maintain the shadow call stacks, "
+"load the core with 'shadow_call_stacks=1'.\n");
+		return -EINVAL;
+	}
+	
+	/* The call-related events would duplicate the call stacks. */
+	if (call_stacks)
+		no_call_events = 1;
+	
 	if (notify_mark < 1 || notify_mark > nr_data_pages) {
 		pr_warning(KEDR_MSG_PREFIX
 "'notify_mark' must be a positive value not greater than 'nr_data_pages'.\n");
@@ -1422,9 +2919,18 @@ test_init_module(void)
 	
 	buffer_size = nr_data_pages << PAGE_SHIFT;
 	
-	ret = create_page_buffer();
+	cur_notify_mark = notify_mark;
+	max_notify_mark = nr_data_pages / 4;
+	if (max_notify_mark < notify_mark)
+		max_notify_mark = notify_mark;
+	
+	ret = compressor_init();
 	if (ret != 0)
 		return ret;
+	
+	ret = create_page_buffer();
+	if (ret != 0)
+		goto out_cleanup_comp;
 
 	ret = create_b0_buffer();
 	if (ret != 0)
@@ -1457,14 +2963,11 @@ test_init_module(void)
 	if (ret != 0)
 		goto out_rm_files;
 	
-	/* Allocate space for the LZO1X compressor working memory */
-	lzo_wrkmem = vmalloc(LZO1X_1_MEM_COMPRESS);
-	if(lzo_wrkmem == NULL) {
+	if (flight_recorder && snapshot_on_oops &&
+	    register_die_notifier(&flight_die_nb) != 0) {
 		pr_warning(KEDR_MSG_PREFIX
-			"Failed to allocate lzo wrkmem (%lu bytes)\n",
-			(unsigned long)LZO1X_1_MEM_COMPRESS);
-		ret = -ENOMEM;
-		goto out_rm_files;
+	"Failed to register die notifier, no snapshots will be taken on oops.\n");
+		snapshot_on_oops = 0;
 	}
 	return 0;
 
@@ -1478,6 +2981,8 @@ out_free_b0:
 	destroy_b0_buffer();	
 out_free_pgbuf:
 	destroy_page_buffer();
+out_cleanup_comp:
+	compressor_cleanup();
 	return ret;
 }
 
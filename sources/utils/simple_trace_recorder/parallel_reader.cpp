@@ -0,0 +1,373 @@
+/* parallel_reader.cpp - reading of the events from a trace file saved by
+ * the simple trace recorder, decompressing and decoding the series of
+ * events in several threads. */
+
+/* ========================================================================
+ * Copyright (C) 2014, ROSA Laboratory
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ ======================================================================== */
+
+#include <sstream>
+#include <new>
+
+#include <cstring>
+#include <cstddef>
+#include <stdint.h>
+
+#include <sys/mman.h>
+
+#include "parallel_reader.h"
+
+using namespace std;
+/* ====================================================================== */
+
+/* How many series each worker may decode ahead of the one being read. */
+static const size_t series_per_worker = 2;
+/* ====================================================================== */
+
+ParallelReader::ParallelReader(int fd, const TraceIndex *index,
+			       unsigned int nr_jobs)
+	: seq_reader(NULL), index(index), nr_jobs(nr_jobs), map(NULL),
+	  map_size(0), first_record(0), end_record(0), first_event(0),
+	  last_event((uint64_t)-1), event_no(0), master(NULL),
+	  master_active(false), cur_record(0), cur_started(false),
+	  cur_pos(NULL), cur_end(NULL), workers_started(false), window(0),
+	  next_dispatch(0), blocks_pending(0), consume_pos(0),
+	  stopping(false)
+{
+	if (index == NULL) {
+		seq_reader = new RecordReader(fd);
+		return;
+	}
+
+	if (this->nr_jobs == 0)
+		this->nr_jobs = 1;
+
+	try {
+		index->check(fd);
+		map = trace_map_file(fd, map_size);
+	}
+	catch (TraceIndex::Error &e) {
+		throw RecordReader::Error(e.what());
+	}
+
+	master = new RecordReader(map, 0);
+	end_record = index->get_records().size();
+	window = this->nr_jobs * series_per_worker;
+	slots.resize(window);
+
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&work_cond, NULL);
+	pthread_cond_init(&done_cond, NULL);
+}
+
+ParallelReader::~ParallelReader()
+{
+	if (index == NULL) {
+		delete seq_reader;
+		return;
+	}
+
+	stop_workers();
+
+	pthread_cond_destroy(&done_cond);
+	pthread_cond_destroy(&work_cond);
+	pthread_mutex_destroy(&mutex);
+
+	delete master;
+	if (map != NULL)
+		munmap((void *)map, map_size);
+}
+
+void
+ParallelReader::set_range(uint64_t first, uint64_t last)
+{
+	if (index == NULL)
+		throw RecordReader::Error(
+			"The index of the trace is needed to select the events.");
+
+	if (first > last || first >= index->get_nr_events()) {
+		ostringstream err;
+		err << "Invalid range of events: " << first << "-" << last
+			<< ", the trace contains " << index->get_nr_events()
+			<< " event(s).";
+		throw RecordReader::Error(err.str());
+	}
+
+	first_event = first;
+	last_event = last;
+	first_record = index->find_record(first);
+	end_record = index->find_record(last);
+	if (end_record < index->get_records().size())
+		++end_record;
+}
+
+unsigned int
+ParallelReader::get_nr_records() const
+{
+	if (index == NULL)
+		return seq_reader->get_nr_records();
+
+	return (unsigned int)cur_record + 1;
+}
+/* ====================================================================== */
+
+/* Whether the record is decoded in the thread reading the events rather
+ * than by a worker. */
+bool
+ParallelReader::is_decoded_here(size_t rec) const
+{
+	const struct kedr_tr_index_record &r = index->get_records()[rec];
+	return ((r.flags & KEDR_TR_INDEX_SERIES) == 0 ||
+		(r.flags & KEDR_TR_INDEX_BLOCKS) != 0);
+}
+
+/* Returns the first series with BLOCK_INFO events starting from 'rec',
+ * 'end_record' if there are none. */
+size_t
+ParallelReader::next_blocks_record(size_t rec) const
+{
+	const vector<struct kedr_tr_index_record> &records =
+		index->get_records();
+
+	for (; rec < end_record; ++rec) {
+		if ((records[rec].flags & KEDR_TR_INDEX_BLOCKS) != 0)
+			break;
+	}
+	return rec;
+}
+
+void *
+ParallelReader::worker_thread_func(void *arg)
+{
+	Worker *w = (Worker *)arg;
+	w->owner->run_worker(w);
+	return NULL;
+}
+
+void
+ParallelReader::run_worker(Worker *w)
+{
+	const vector<struct kedr_tr_index_record> &records =
+		index->get_records();
+
+	pthread_mutex_lock(&mutex);
+	for (;;) {
+		/* The records decoded by the reading thread are skipped. */
+		while (next_dispatch < blocks_pending &&
+		       is_decoded_here(next_dispatch))
+			++next_dispatch;
+
+		if (stopping || next_dispatch >= end_record)
+			break;
+
+		if (next_dispatch >= blocks_pending ||
+		    next_dispatch >= consume_pos + window) {
+			pthread_cond_wait(&work_cond, &mutex);
+			continue;
+		}
+
+		size_t rec = next_dispatch++;
+		Slot &slot = slots[rec % window];
+		slot.done = false;
+		slot.error.clear();
+
+		/* The master does not change the information about the
+		 * blocks until all the series before the next BLOCK_INFO
+		 * series have been read, so it is safe to copy it. */
+		if (w->reader->get_nr_block_infos() !=
+		    master->get_nr_block_infos())
+			w->reader->copy_blocks(*master);
+		pthread_mutex_unlock(&mutex);
+
+		try {
+			const struct kedr_tr_event_header *ev;
+
+			slot.events.clear();
+			w->reader->set_data(map + records[rec].offset,
+					    records[rec].size, rec);
+			while ((ev = w->reader->next_event()) != NULL) {
+				const unsigned char *p =
+					(const unsigned char *)ev;
+				slot.events.insert(slot.events.end(), p,
+						   p + ev->event_size);
+			}
+		}
+		catch (RecordReader::Error &e) {
+			slot.error = e.what();
+		}
+		catch (std::bad_alloc &e) {
+			slot.error = "Out of memory.";
+		}
+
+		pthread_mutex_lock(&mutex);
+		slot.done = true;
+		pthread_cond_broadcast(&done_cond);
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+void
+ParallelReader::start_workers()
+{
+	workers_started = true;
+
+	/* The series with BLOCK_INFO events before the first record to be
+	 * read are needed to decode the series after them. */
+	const vector<struct kedr_tr_index_record> &records =
+		index->get_records();
+	for (size_t rec = 0; rec < first_record; ++rec) {
+		if ((records[rec].flags & KEDR_TR_INDEX_BLOCKS) == 0)
+			continue;
+
+		master->set_data(map + records[rec].offset, records[rec].size,
+				 rec);
+		while (master->next_event() != NULL) {}
+	}
+
+	next_dispatch = first_record;
+	consume_pos = first_record;
+	blocks_pending = next_blocks_record(first_record);
+
+	workers.resize(nr_jobs);
+	for (size_t i = 0; i < workers.size(); ++i) {
+		workers[i].owner = this;
+		workers[i].reader = new RecordReader(map, 0);
+	}
+
+	for (size_t i = 0; i < workers.size(); ++i) {
+		if (pthread_create(&workers[i].thread, NULL,
+				   worker_thread_func, &workers[i]) != 0) {
+			workers.resize(i);
+			stop_workers();
+			throw RecordReader::Error(
+				"Failed to create a worker thread.");
+		}
+	}
+}
+
+void
+ParallelReader::stop_workers()
+{
+	pthread_mutex_lock(&mutex);
+	stopping = true;
+	pthread_cond_broadcast(&work_cond);
+	pthread_mutex_unlock(&mutex);
+
+	for (size_t i = 0; i < workers.size(); ++i) {
+		pthread_join(workers[i].thread, NULL);
+		delete workers[i].reader;
+	}
+	workers.clear();
+}
+/* ====================================================================== */
+
+/* Makes the next record current. Returns false if there are no records
+ * left. */
+bool
+ParallelReader::next_record()
+{
+	const vector<struct kedr_tr_index_record> &records =
+		index->get_records();
+
+	if (cur_started)
+		++cur_record;
+	else
+		cur_record = first_record;
+	cur_started = true;
+
+	pthread_mutex_lock(&mutex);
+	consume_pos = cur_record;
+	pthread_cond_broadcast(&work_cond);
+
+	if (cur_record >= end_record) {
+		pthread_mutex_unlock(&mutex);
+		return false;
+	}
+
+	event_no = records[cur_record].first_event;
+	if (is_decoded_here(cur_record)) {
+		pthread_mutex_unlock(&mutex);
+
+		master->set_data(map + records[cur_record].offset,
+				 records[cur_record].size, cur_record);
+		master_active = true;
+		return true;
+	}
+
+	Slot &slot = slots[cur_record % window];
+	while (cur_record >= next_dispatch || !slot.done)
+		pthread_cond_wait(&done_cond, &mutex);
+	pthread_mutex_unlock(&mutex);
+
+	if (!slot.error.empty())
+		throw RecordReader::Error(slot.error);
+
+	cur_pos = slot.events.empty() ? NULL : &slot.events[0];
+	cur_end = cur_pos + slot.events.size();
+	return true;
+}
+
+const struct kedr_tr_event_header *
+ParallelReader::next_event_impl()
+{
+	const struct kedr_tr_event_header *ev;
+
+	if (!workers_started)
+		start_workers();
+
+	for (;;) {
+		if (master_active) {
+			ev = master->next_event();
+			if (ev != NULL)
+				return ev;
+
+			master_active = false;
+
+			/* The information about the blocks from this series
+			 * is now known, the workers may proceed. */
+			const struct kedr_tr_index_record &r =
+				index->get_records()[cur_record];
+			if ((r.flags & KEDR_TR_INDEX_BLOCKS) != 0) {
+				pthread_mutex_lock(&mutex);
+				blocks_pending =
+					next_blocks_record(cur_record + 1);
+				pthread_cond_broadcast(&work_cond);
+				pthread_mutex_unlock(&mutex);
+			}
+		}
+		else if (cur_pos != cur_end) {
+			ev = (const struct kedr_tr_event_header *)cur_pos;
+			cur_pos += ev->event_size;
+			return ev;
+		}
+
+		if (!next_record())
+			return NULL;
+	}
+}
+
+const struct kedr_tr_event_header *
+ParallelReader::next_event()
+{
+	const struct kedr_tr_event_header *ev;
+
+	if (index == NULL)
+		return seq_reader->next_event();
+
+	for (;;) {
+		if (event_no > last_event)
+			return NULL;
+
+		ev = next_event_impl();
+		if (ev == NULL)
+			return NULL;
+
+		if (event_no++ >= first_event)
+			return ev;
+	}
+}
+/* ====================================================================== */
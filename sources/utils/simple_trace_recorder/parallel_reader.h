@@ -0,0 +1,184 @@
+/* parallel_reader.h - reading of the events from a trace file saved by the
+ * simple trace recorder, decompressing and decoding the series of events
+ * in several threads.
+ *
+ * If the index of the trace is available (see trace_index.h), the series
+ * of events are decompressed and decoded by the worker threads, several
+ * series ahead of the one being read, and the events are returned in
+ * the same order as RecordReader returns them. The series with BLOCK_INFO
+ * events and the records other than series are decoded in the thread
+ * calling next_event(): the series after a BLOCK_INFO series are not
+ * decoded until the information about the blocks from it is known.
+ *
+ * The index also allows to read only a given range of events without
+ * decoding the series before it, except those with BLOCK_INFO events.
+ *
+ * If the index is not available, the events are read by RecordReader in
+ * the thread calling next_event(), no worker threads are used.
+ *
+ * [NB] lzo_init() must be called before the events are read. */
+
+/* ========================================================================
+ * Copyright (C) 2014, ROSA Laboratory
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ ======================================================================== */
+
+#ifndef PARALLEL_READER_H_1802_INCLUDED
+#define PARALLEL_READER_H_1802_INCLUDED
+
+#include <cstddef>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <string>
+#include <vector>
+
+#include "recorder.h"
+#include "record_reader.h"
+#include "trace_index.h"
+/* ====================================================================== */
+
+class ParallelReader
+{
+public:
+	/* Creates the reader for the trace file with the given descriptor.
+	 * 'index' is the index of the trace, NULL if it is not available.
+	 * The index must remain valid while the reader exists. 'nr_jobs' is
+	 * the number of the worker threads to use if the index is
+	 * available.
+	 *
+	 * With the index, the file must be a regular file, the records are
+	 * read from its beginning. Without the index, the records are read
+	 * from the current position of the file. The descriptor is not
+	 * closed when the reader is destroyed.
+	 *
+	 * Throws RecordReader::Error() on failure. */
+	ParallelReader(int fd, const TraceIndex *index, unsigned int nr_jobs);
+	~ParallelReader();
+
+	/* Only the events with numbers [first, last] will be returned.
+	 * Requires the index. Must be called before the first call to
+	 * next_event().
+	 *
+	 * Throws RecordReader::Error() on failure. */
+	void set_range(uint64_t first, uint64_t last);
+
+	/* Returns the next event from the trace, NULL if there are no
+	 * events left, see RecordReader::next_event().
+	 *
+	 * The returned event remains valid until the next call to this
+	 * method.
+	 *
+	 * Throws RecordReader::Error() if the trace is corrupted or cannot
+	 * be read. */
+	const struct kedr_tr_event_header *next_event();
+
+	/* The number of records read from the file so far, including the
+	 * current one. Useful for error messages. */
+	unsigned int get_nr_records() const;
+
+private:
+	/* Prohibit copying and assignment. */
+	ParallelReader(const ParallelReader &other);
+	ParallelReader & operator=(const ParallelReader &other);
+
+	/* The results of decoding of a series by a worker thread. */
+	struct Slot
+	{
+		/* The decoded events, one after another. */
+		std::vector<unsigned char> events;
+
+		/* True if the series has been decoded. */
+		bool done;
+
+		/* Non-empty if an error has occurred. */
+		std::string error;
+
+		Slot() : done(false)
+		{}
+	};
+
+	/* A worker thread and the reader it uses to decode the series. */
+	struct Worker
+	{
+		ParallelReader *owner;
+		RecordReader *reader;
+		pthread_t thread;
+	};
+
+	static void *worker_thread_func(void *arg);
+	void run_worker(Worker *w);
+	void start_workers();
+	void stop_workers();
+
+	bool is_decoded_here(size_t rec) const;
+	size_t next_blocks_record(size_t rec) const;
+	bool next_record();
+	const struct kedr_tr_event_header *next_event_impl();
+
+private:
+	/* The reader used if there is no index. */
+	RecordReader *seq_reader;
+
+	const TraceIndex *index;
+	unsigned int nr_jobs;
+
+	const unsigned char *map;
+	size_t map_size;
+
+	/* The records [first_record, end_record) are to be read. */
+	size_t first_record;
+	size_t end_record;
+
+	/* The range of the events to be returned. */
+	uint64_t first_event;
+	uint64_t last_event;
+
+	/* The number of the next event to be returned. */
+	uint64_t event_no;
+
+	/* The reader decoding the series in the current thread. It also
+	 * keeps the information about the blocks of code for the workers.
+	 */
+	RecordReader *master;
+
+	/* True if the current record is decoded by 'master'. */
+	bool master_active;
+
+	/* The current record and its events decoded by a worker that have
+	 * not been returned yet, if any. */
+	size_t cur_record;
+	bool cur_started;
+	const unsigned char *cur_pos;
+	const unsigned char *cur_end;
+
+	std::vector<Worker> workers;
+	bool workers_started;
+
+	/* The results for the records [cur_record, cur_record + window),
+	 * the record 'rec' uses slots[rec % window]. */
+	std::vector<Slot> slots;
+	size_t window;
+
+	/* Protect the fields below and 'slots'. */
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+
+	/* The next record to be decoded by the workers. */
+	size_t next_dispatch;
+
+	/* The first series with BLOCK_INFO events that has not been
+	 * decoded yet. The workers decode only the series before it. */
+	size_t blocks_pending;
+
+	/* The record being read by the caller of next_event(). */
+	size_t consume_pos;
+
+	bool stopping;
+};
+/* ====================================================================== */
+#endif // PARALLEL_READER_H_1802_INCLUDED
@@ -0,0 +1,856 @@
+/* record_reader.cpp - reading of the event records from the binary trace
+ * file saved by the simple trace recorder. */
+
+/* ========================================================================
+ * Copyright (C) 2014, ROSA Laboratory
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ ======================================================================== */
+
+#include <sstream>
+
+#include <cstdlib>
+#include <cstring>
+#include <cstddef>
+#include <stdint.h>
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <errno.h>
+
+#include <lzo/minilzo.h>
+
+#include "record_reader.h"
+
+using namespace std;
+/* ====================================================================== */
+
+/* Initial size of the buffer for the data read from a file that cannot be
+ * mapped. The buffer grows if a record does not fit into it. */
+static const size_t buf_size_initial = 1024 * 1024;
+/* ====================================================================== */
+
+RecordReader::RecordReader(int fd)
+	: fd(fd), map(NULL), map_size(0), buf(NULL), buf_size(0),
+	  data(NULL), data_end(NULL), events_buf(NULL), events_buf_size(0),
+	  events(NULL), events_end(NULL), nrec(0), pos(0), record_offset(0),
+	  compact(false), nr_threads(0), cur_thread(NULL), stack_pc(0),
+	  nr_block_infos(0), mem_pending(false)
+{
+	struct stat st;
+	off_t start = lseek(fd, 0, SEEK_CUR);
+	
+	if (start != (off_t)-1)
+		pos = (uint64_t)start;
+
+	/* If the file is a regular one, map the data starting from the
+	 * current position. If mapping fails for some reason (the file is
+	 * too large for the address space, etc.), read() it as if it was
+	 * a pipe. */
+	if (start != (off_t)-1 && fstat(fd, &st) == 0 && 
+	    S_ISREG(st.st_mode) && st.st_size > start &&
+	    (uint64_t)st.st_size <= (uint64_t)(size_t)-1) {
+		void *p = mmap(NULL, (size_t)st.st_size, PROT_READ,
+			       MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED) {
+			map = (unsigned char *)p;
+			map_size = (size_t)st.st_size;
+			madvise(map, map_size, MADV_SEQUENTIAL);
+
+			data = map + start;
+			data_end = map + map_size;
+			return;
+		}
+	}
+
+	buf = (unsigned char *)malloc(buf_size_initial);
+	if (buf == NULL)
+		throw RecordReader::Error("Out of memory.");
+
+	buf_size = buf_size_initial;
+	data = buf;
+	data_end = buf;
+}
+
+RecordReader::RecordReader(const void *records, size_t size)
+	: fd(-1), map(NULL), map_size(0), buf(NULL), buf_size(0),
+	  data(NULL), data_end(NULL), events_buf(NULL), events_buf_size(0),
+	  events(NULL), events_end(NULL), nrec(0), pos(0), record_offset(0),
+	  compact(false), nr_threads(0), cur_thread(NULL), stack_pc(0),
+	  nr_block_infos(0), mem_pending(false)
+{
+	set_data(records, size);
+}
+
+void
+RecordReader::set_data(const void *records, size_t size, 
+		       unsigned int nr_records)
+{
+	data = (const unsigned char *)records;
+	data_end = data + size;
+	pos = 0;
+	nrec = nr_records;
+	events = NULL;
+	events_end = NULL;
+	mem_pending = false;
+}
+
+void
+RecordReader::copy_blocks(const RecordReader &other)
+{
+	blocks = other.blocks;
+	block_ops = other.block_ops;
+	nr_block_infos = other.nr_block_infos;
+}
+
+RecordReader::~RecordReader()
+{
+	if (map != NULL)
+		munmap(map, map_size);
+
+	free(buf);
+	free(events_buf);
+}
+
+/* Makes sure at least 'size' bytes of the unprocessed data are available
+ * starting from 'data'. Returns false if the end of the file is reached
+ * before that. */
+bool
+RecordReader::ensure_data(size_t size)
+{
+	size_t avail = (size_t)(data_end - data);
+	if (avail >= size)
+		return true;
+
+	if (map != NULL || fd == -1)
+		return false;
+
+	/* Move the unprocessed data to the beginning of the buffer and
+	 * read more. */
+	if (size > buf_size) {
+		size_t new_size = buf_size;
+		while (new_size < size)
+			new_size *= 2;
+
+		unsigned char *p = (unsigned char *)malloc(new_size);
+		if (p == NULL)
+			throw RecordReader::Error("Out of memory.");
+
+		memcpy(p, data, avail);
+		free(buf);
+		buf = p;
+		buf_size = new_size;
+	}
+	else if (data != buf) {
+		memmove(buf, data, avail);
+	}
+	data = buf;
+	data_end = buf + avail;
+
+	while (avail < size) {
+		ssize_t ret = read(fd, buf + avail, buf_size - avail);
+		if (ret == 0)
+			return false;
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			throw RecordReader::Error(strerror(errno));
+		}
+		avail += (size_t)ret;
+		data_end = buf + avail;
+	}
+	return true;
+}
+
+/* Returns the next record from the file or NULL if there is nothing to
+ * read. */
+const struct kedr_tr_event_header *
+RecordReader::next_record()
+{
+	const struct kedr_tr_event_header *header;
+
+	if (!ensure_data(sizeof(*header))) {
+		if (data == data_end)
+			return NULL;
+
+		ostringstream err;
+		err << "Record #" << nrec << ": unexpected error or EOF.";
+		throw RecordReader::Error(err.str());
+	}
+
+	/* Perform sanity checks and make sure the rest of the record is
+	 * available. */
+	header = (const struct kedr_tr_event_header *)data;
+	if ((int)header->event_size < (int)sizeof(*header)) {
+		ostringstream err;
+		err << "Invalid data in the input file, record #" << nrec
+			<< ": invalid value of 'event_size' field: "
+			<< (int)header->event_size;
+		throw RecordReader::Error(err.str());
+	}
+
+	if (!ensure_data(header->event_size)) {
+		ostringstream err;
+		err << "Record #" << nrec << ": unexpected error or EOF.";
+		throw RecordReader::Error(err.str());
+	}
+
+	/* ensure_data() could have moved the data. */
+	header = (const struct kedr_tr_event_header *)data;
+	data += header->event_size;
+	
+	record_offset = pos;
+	pos += header->event_size;
+
+	++nrec;
+	return header;
+}
+
+/* Decompresses the data in LZ4 block format (produced by both LZ4 and
+ * LZ4HC compressors). Returns true if the data have been decompressed
+ * successfully and occupy exactly 'dst_len' bytes, false otherwise.
+ * The data are checked so that a corrupted trace cannot cause reads or
+ * writes outside of the buffers. */
+static bool
+lz4_decompress(const unsigned char *src, size_t src_len,
+	       unsigned char *dst, size_t dst_len)
+{
+	const unsigned char *ip = src;
+	const unsigned char *ip_end = src + src_len;
+	unsigned char *op = dst;
+	unsigned char *op_end = dst + dst_len;
+
+	while (ip < ip_end) {
+		unsigned int token = *ip++;
+		size_t len = token >> 4;
+		size_t offset;
+		unsigned int b;
+
+		if (len == 15) {
+			do {
+				if (ip == ip_end)
+					return false;
+				b = *ip++;
+				len += b;
+			} while (b == 255);
+		}
+		if (len > (size_t)(ip_end - ip) ||
+		    len > (size_t)(op_end - op))
+			return false;
+
+		memcpy(op, ip, len);
+		ip += len;
+		op += len;
+
+		/* The last sequence contains only the literals. */
+		if (ip == ip_end)
+			break;
+
+		if (ip_end - ip < 2)
+			return false;
+		offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > (size_t)(op - dst))
+			return false;
+
+		len = token & 0x0f;
+		if (len == 15) {
+			do {
+				if (ip == ip_end)
+					return false;
+				b = *ip++;
+				len += b;
+			} while (b == 255);
+		}
+		len += 4;
+		if (len > (size_t)(op_end - op))
+			return false;
+
+		/* The source and the destination may overlap, copy byte
+		 * by byte. */
+		const unsigned char *match = op - offset;
+		for (; len != 0; --len)
+			*op++ = *match++;
+	}
+	return (op == op_end);
+}
+
+/* Returns the name of the compressor for the error messages. */
+static const char *
+compressor_name(unsigned int type)
+{
+	switch (type) {
+	case KEDR_TR_COMPRESSOR_NONE:
+		return "none";
+	case KEDR_TR_COMPRESSOR_LZO:
+		return "LZO";
+	case KEDR_TR_COMPRESSOR_LZ4:
+		return "LZ4";
+	case KEDR_TR_COMPRESSOR_LZ4HC:
+		return "LZ4HC";
+	default:
+		return "unknown";
+	}
+}
+
+void
+RecordReader::decompress(const struct kedr_tr_event_header *record)
+{
+	const unsigned char *compressed;
+	size_t compressed_size;
+	size_t orig_size;
+	size_t data_offset;
+	unsigned int comp_type;
+
+	/* The series compressed with LZO have their own kind of records,
+	 * the series compressed with other algorithms are in CHUNK 
+	 * records. */
+	if (record->type == KEDR_TR_EVENT_CHUNK) {
+		const struct kedr_tr_event_chunk *ec =
+			(const struct kedr_tr_event_chunk *)record;
+		data_offset = offsetof(struct kedr_tr_event_chunk,
+				       compressed);
+		if ((size_t)record->event_size < data_offset) {
+			ostringstream err;
+			err << "Record #" << nrec << ": "
+				<< "invalid size of the record.";
+			throw RecordReader::Error(err.str());
+		}
+
+		if (ec->format != 1 && ec->format != 2) {
+			ostringstream err;
+			err << "Record #" << nrec << ": "
+				<< "unknown format of the events: "
+				<< (unsigned int)ec->format << ".";
+			throw RecordReader::Error(err.str());
+		}
+
+		compressed = ec->compressed;
+		compressed_size = (size_t)ec->compressed_size;
+		orig_size = (size_t)ec->orig_size;
+		comp_type = ec->compressor;
+		compact = (ec->format == 2);
+	}
+	else {
+		const struct kedr_tr_event_compressed *ec =
+			(const struct kedr_tr_event_compressed *)record;
+		data_offset = offsetof(struct kedr_tr_event_compressed,
+				       compressed);
+		if ((size_t)record->event_size < data_offset) {
+			ostringstream err;
+			err << "Record #" << nrec << ": "
+				<< "invalid size of the record.";
+			throw RecordReader::Error(err.str());
+		}
+
+		compressed = ec->compressed;
+		compressed_size = (size_t)ec->compressed_size;
+		orig_size = (size_t)ec->orig_size;
+		comp_type = KEDR_TR_COMPRESSOR_LZO;
+		compact = (record->type == KEDR_TR_EVENT_COMPACT);
+	}
+
+	if (compressed_size > (size_t)record->event_size - data_offset) {
+		ostringstream err;
+		err << "Record #" << nrec << ": "
+			<< "invalid size of the compressed data.";
+		throw RecordReader::Error(err.str());
+	}
+
+	if (orig_size < sizeof(struct kedr_tr_event_header)) {
+		ostringstream err;
+		err << "Record #" << nrec << ": "
+			<< "invalid size of the data before compression: "
+			<< (unsigned int)orig_size << ".";
+		throw RecordReader::Error(err.str());
+	}
+
+	/* The data that were not compressed are used in place. */
+	if (comp_type == KEDR_TR_COMPRESSOR_NONE) {
+		if (compressed_size != orig_size) {
+			ostringstream err;
+			err << "Record #" << nrec << ": "
+				<< "invalid size of the uncompressed data.";
+			throw RecordReader::Error(err.str());
+		}
+		events = compressed;
+		events_end = compressed + compressed_size;
+		return;
+	}
+
+	if (orig_size > events_buf_size) {
+		unsigned char *p = (unsigned char *)realloc(
+			events_buf, orig_size);
+		if (p == NULL)
+			throw RecordReader::Error("Out of memory.");
+
+		events_buf = p;
+		events_buf_size = orig_size;
+	}
+
+	bool ok = false;
+	int ret = 0;
+	switch (comp_type) {
+	case KEDR_TR_COMPRESSOR_LZO: {
+		lzo_uint decompressed_size = (lzo_uint)orig_size;
+		ret = lzo1x_decompress_safe(
+			compressed, compressed_size,
+			events_buf, &decompressed_size, NULL);
+		ok = (ret == LZO_E_OK && orig_size == decompressed_size);
+		break;
+	}
+	case KEDR_TR_COMPRESSOR_LZ4:
+	case KEDR_TR_COMPRESSOR_LZ4HC:
+		ok = lz4_decompress(compressed, compressed_size, 
+				    events_buf, orig_size);
+		break;
+	default: {
+		ostringstream err;
+		err << "Record #" << nrec << ": "
+			<< "unknown compressor: " << comp_type << ".";
+		throw RecordReader::Error(err.str());
+	}
+	}
+
+	if (!ok) {
+		ostringstream err;
+		err << "Record #" << nrec << ": "
+			<< "failed to decompress data (" 
+			<< compressor_name(comp_type) << ")";
+		if (comp_type == KEDR_TR_COMPRESSOR_LZO)
+			err << ", error code: " << ret;
+		err << ".";
+		throw RecordReader::Error(err.str());
+	}
+
+	events = events_buf;
+	events_end = events_buf + orig_size;
+}
+
+const struct kedr_tr_event_header *
+RecordReader::next_event()
+{
+	const struct kedr_tr_event_header *hdr;
+	
+	if (mem_pending) {
+		mem_pending = false;
+		return &decoded.mem.header;
+	}
+
+	for (;;) {
+		while (events == events_end) {
+			hdr = next_record();
+			if (hdr == NULL || 
+			    (hdr->type != KEDR_TR_EVENT_COMPRESSED &&
+			     hdr->type != KEDR_TR_EVENT_COMPACT &&
+			     hdr->type != KEDR_TR_EVENT_CHUNK))
+				return hdr;
+
+			/* This also sets 'compact' according to the format
+			 * of the series. */
+			decompress(hdr);
+			
+			/* Each series is encoded independently. */
+			nr_threads = 0;
+			cur_thread = NULL;
+			stack_pc = 0;
+		}
+		
+		if (!compact)
+			break;
+		
+		/* NULL is returned for the BLOCK_INFO events, these are
+		 * not reported. */
+		hdr = next_compact_event();
+		if (hdr != NULL)
+			return hdr;
+	}
+
+	size_t to_process = (size_t)(events_end - events);
+
+	hdr = (const struct kedr_tr_event_header *)events;
+	if (to_process < sizeof(struct kedr_tr_event_header) ||
+	    (size_t)hdr->event_size < sizeof(struct kedr_tr_event_header)) {
+		ostringstream err;
+		err << "Record #" << nrec << ": "
+			<< "invalid size of a decompressed event.";
+		throw RecordReader::Error(err.str());
+	}
+
+	if (to_process < (size_t)hdr->event_size) {
+		ostringstream err;
+		err << "Record #" << nrec << ": "
+			<< "compressed event may be corrupted.";
+		throw RecordReader::Error(err.str());
+	}
+
+	events += hdr->event_size;
+	return hdr;
+}
+
+bool
+RecordReader::next_series(const unsigned char *&begin, 
+			  const unsigned char *&end, unsigned int &format)
+{
+	const struct kedr_tr_event_header *hdr;
+	
+	do {
+		hdr = next_record();
+		if (hdr == NULL)
+			return false;
+	}
+	while (hdr->type != KEDR_TR_EVENT_COMPRESSED &&
+	       hdr->type != KEDR_TR_EVENT_COMPACT &&
+	       hdr->type != KEDR_TR_EVENT_CHUNK);
+	
+	decompress(hdr);
+	begin = events;
+	end = events_end;
+	format = (compact ? 2 : 1);
+	
+	/* The events are not to be returned by next_event(). */
+	events = events_end;
+	return true;
+}
+/* ====================================================================== */
+
+void
+RecordReader::compact_error(const char *what)
+{
+	ostringstream err;
+	err << "Record #" << nrec << ": " << what;
+	throw RecordReader::Error(err.str());
+}
+
+uint64_t
+RecordReader::compact_num()
+{
+	uint64_t val = 0;
+	
+	for (unsigned int shift = 0; shift < 64; shift += 7) {
+		if (events == events_end)
+			break;
+		
+		unsigned char b = *events++;
+		val |= (uint64_t)(b & 0x7f) << shift;
+		if ((b & 0x80) == 0)
+			return val;
+	}
+	compact_error("invalid number in a compact event.");
+	return 0;
+}
+
+/* Reads the difference from the previous address, see recorder.h, and
+ * returns the address. */
+uint64_t
+RecordReader::compact_addr(uint64_t &prev)
+{
+	uint64_t val = compact_num();
+	
+	prev += (val >> 1) ^ (uint64_t)-(int64_t)(val & 1);
+	return prev;
+}
+
+void
+RecordReader::add_block_info(const struct kedr_tr_event_header *hdr)
+{
+	const struct kedr_tr_event_block_info *ev = 
+		(const struct kedr_tr_event_block_info *)hdr;
+	
+	if ((size_t)hdr->event_size < sizeof(*ev) || 
+	    ev->id == 0 || ev->max_events == 0 || ev->max_events > 32 ||
+	    (size_t)hdr->event_size != sizeof(*ev) + 
+		(ev->max_events - 1) * sizeof(struct kedr_tr_block_op))
+		compact_error("invalid information about a block.");
+	
+	if (ev->id >= blocks.size()) {
+		BlockInfo unknown = {0, 0, 0, 0, 0};
+		blocks.resize((size_t)ev->id + 1, unknown);
+	}
+	
+	/* If a block with the same ID is described again (e.g., in the
+	 * next session), its previous information is discarded. */
+	BlockInfo &bi = blocks[ev->id];
+	bi.max_events = ev->max_events;
+	bi.read_mask = ev->read_mask;
+	bi.write_mask = ev->write_mask;
+	bi.string_mask = ev->string_mask;
+	bi.first_op = block_ops.size();
+	block_ops.insert(block_ops.end(), &ev->ops[0], 
+			 &ev->ops[ev->max_events]);
+	++nr_block_infos;
+}
+
+/* Decodes a reference to a block (MEM | BLOCK, see recorder.h) into 
+ * "block enter" event, which is returned, and the memory access event, 
+ * which is placed to 'decoded' to be returned next. */
+const struct kedr_tr_event_header *
+RecordReader::decode_block_events(uint64_t tid, uint64_t &prev_block, 
+				  uint64_t &prev_addr)
+{
+	uint64_t id = compact_addr(prev_block);
+	if (id == 0 || id >= blocks.size() || blocks[id].max_events == 0)
+		compact_error("reference to an unknown block.");
+	
+	const BlockInfo &bi = blocks[id];
+	uint64_t val = compact_num();
+	uint64_t mask = val >> 1;
+	uint64_t extra_write_mask = 0;
+	
+	if (val & 1)
+		extra_write_mask = compact_num();
+	
+	if (mask == 0 || (mask >> bi.max_events) != 0)
+		compact_error("invalid mask of the memory accesses.");
+	
+	struct kedr_tr_event_mem *ev = &decoded.mem;
+	unsigned int nr = 0;
+	
+	ev->read_mask = 0;
+	ev->write_mask = 0;
+	for (unsigned int i = 0; i < bi.max_events; ++i) {
+		uint32_t bit = (uint32_t)1 << i;
+		if ((mask & bit) == 0)
+			continue;
+		
+		const struct kedr_tr_block_op &op = block_ops[bi.first_op + i];
+		struct kedr_tr_event_mem_op &mem_op = ev->mem_ops[nr];
+		
+		mem_op.pc = op.pc;
+		mem_op.addr = compact_addr(prev_addr);
+		if (bi.string_mask & bit)
+			mem_op.size = (__u32)compact_num();
+		else
+			mem_op.size = op.size;
+		
+		/* The same rules as the core uses to determine the types
+		 * of the events. */
+		if ((bi.write_mask | extra_write_mask) & bit) {
+			ev->write_mask |= (uint32_t)1 << nr;
+			if (bi.read_mask & bit)
+				ev->read_mask |= (uint32_t)1 << nr;
+		}
+		else {
+			ev->read_mask |= (uint32_t)1 << nr;
+		}
+		++nr;
+	}
+	
+	ev->header.type = KEDR_TR_EVENT_MEM;
+	ev->header.event_size = sizeof(*ev) + 
+		(nr - 1) * sizeof(struct kedr_tr_event_mem_op);
+	ev->tid = tid;
+	ev->nr_events = nr;
+	mem_pending = true;
+	
+	block_enter.header.type = KEDR_TR_EVENT_BLOCK_ENTER;
+	block_enter.header.event_size = sizeof(block_enter);
+	block_enter.tid = tid;
+	block_enter.pc = ev->mem_ops[0].pc;
+	return &block_enter.header;
+}
+
+const struct kedr_tr_event_header *
+RecordReader::next_compact_event()
+{
+	unsigned char tag = *events++;
+	unsigned int type = tag & KEDR_TR_COMPACT_TYPE_MASK;
+	
+	if (type == KEDR_TR_COMPACT_EXTENDED && 
+	    !(tag & KEDR_TR_COMPACT_STRUCT)) {
+		uint64_t val = compact_num();
+		if (val <= KEDR_TR_COMPACT_TYPE_MASK || 
+		    val >= KEDR_TR_EVENT_MAX)
+			compact_error("invalid type of a compact event.");
+		type = (unsigned int)val;
+	}
+	
+	if (type == KEDR_TR_EVENT_STACK) {
+		/* The event does not refer to a thread. */
+		struct kedr_tr_event_stack *ev = 
+			(struct kedr_tr_event_stack *)&decoded.mem.header;
+		ev->header.type = type;
+		ev->header.event_size = sizeof(*ev);
+		ev->id = (__u32)compact_num();
+		ev->parent = (__u32)compact_num();
+		ev->pc = compact_addr(stack_pc);
+		return &ev->header;
+	}
+	
+	if (tag & KEDR_TR_COMPACT_STRUCT) {
+		const struct kedr_tr_event_header *hdr =
+			(const struct kedr_tr_event_header *)events;
+		size_t to_process = (size_t)(events_end - events);
+		
+		if (to_process < sizeof(*hdr) || 
+		    (size_t)hdr->event_size < sizeof(*hdr) ||
+		    (size_t)hdr->event_size > to_process ||
+		    hdr->type != type)
+			compact_error("invalid event structure in a series.");
+		
+		events += hdr->event_size;
+		if (type == KEDR_TR_EVENT_BLOCK_INFO) {
+			add_block_info(hdr);
+			return NULL;
+		}
+		return hdr;
+	}
+	
+	if (tag & KEDR_TR_COMPACT_SAME_THREAD) {
+		if (cur_thread == NULL)
+			compact_error("the thread of the event is unknown.");
+	}
+	else {
+		uint64_t n = compact_num();
+		if (n == 0) {
+			uint64_t tid = compact_num();
+			
+			/* If the table is full, the last element is used. */
+			cur_thread = &threads[nr_threads];
+			if (nr_threads < KEDR_TR_COMPACT_MAX_THREADS)
+				++nr_threads;
+			
+			cur_thread->tid = tid;
+			cur_thread->code = 0;
+			cur_thread->data = 0;
+			cur_thread->block = 0;
+		}
+		else if (n <= nr_threads) {
+			cur_thread = &threads[n - 1];
+		}
+		else {
+			compact_error("invalid thread number in a series.");
+		}
+	}
+	
+	CompactThread *t = cur_thread;
+	struct kedr_tr_event_header *hdr = &decoded.mem.header;
+	hdr->type = type;
+	
+	if (tag & KEDR_TR_COMPACT_BLOCK) {
+		if (type != KEDR_TR_EVENT_MEM)
+			compact_error("unexpected reference to a block.");
+		return decode_block_events(t->tid, t->block, t->data);
+	}
+	
+	switch (type) {
+	case KEDR_TR_EVENT_FENTRY:
+	case KEDR_TR_EVENT_FEXIT: {
+		struct kedr_tr_event_func *ev = 
+			(struct kedr_tr_event_func *)hdr;
+		ev->header.event_size = sizeof(*ev);
+		ev->tid = t->tid;
+		ev->func = compact_addr(t->code);
+		break;
+	}
+	case KEDR_TR_EVENT_CALL_PRE:
+	case KEDR_TR_EVENT_CALL_POST: {
+		struct kedr_tr_event_call *ev = 
+			(struct kedr_tr_event_call *)hdr;
+		ev->header.event_size = sizeof(*ev);
+		ev->tid = t->tid;
+		ev->pc = compact_addr(t->code);
+		ev->func = compact_addr(t->code);
+		break;
+	}
+	case KEDR_TR_EVENT_MEM:
+	case KEDR_TR_EVENT_MEM_LOCKED:
+	case KEDR_TR_EVENT_MEM_IO: {
+		struct kedr_tr_event_mem *ev = &decoded.mem;
+		uint64_t nr = 1;
+		
+		if (type == KEDR_TR_EVENT_MEM) {
+			nr = compact_num();
+			if (nr == 0 || nr > 32)
+				compact_error("invalid number of memory "
+					      "accesses.");
+		}
+		ev->header.event_size = sizeof(*ev) + 
+			(nr - 1) * sizeof(struct kedr_tr_event_mem_op);
+		ev->tid = t->tid;
+		ev->nr_events = (__u32)nr;
+		ev->read_mask = (__u32)compact_num();
+		ev->write_mask = (__u32)compact_num();
+		
+		for (unsigned int i = 0; i < nr; ++i) {
+			ev->mem_ops[i].pc = compact_addr(t->code);
+			ev->mem_ops[i].addr = compact_addr(t->data);
+			ev->mem_ops[i].size = (__u32)compact_num();
+		}
+		break;
+	}
+	case KEDR_TR_EVENT_BLOCK_ENTER: {
+		struct kedr_tr_event_block *ev = 
+			(struct kedr_tr_event_block *)hdr;
+		ev->header.event_size = sizeof(*ev);
+		ev->tid = t->tid;
+		ev->pc = compact_addr(t->code);
+		break;
+	}
+	case KEDR_TR_EVENT_BARRIER_PRE:
+	case KEDR_TR_EVENT_BARRIER_POST: {
+		struct kedr_tr_event_barrier *ev = 
+			(struct kedr_tr_event_barrier *)hdr;
+		ev->header.event_size = sizeof(*ev);
+		ev->tid = t->tid;
+		ev->obj_type = (__u32)compact_num();
+		ev->pc = compact_addr(t->code);
+		break;
+	}
+	case KEDR_TR_EVENT_ALLOC_PRE:
+	case KEDR_TR_EVENT_ALLOC_POST:
+	case KEDR_TR_EVENT_FREE_PRE:
+	case KEDR_TR_EVENT_FREE_POST: {
+		struct kedr_tr_event_alloc_free *ev = 
+			(struct kedr_tr_event_alloc_free *)hdr;
+		ev->header.event_size = sizeof(*ev);
+		ev->tid = t->tid;
+		ev->pc = compact_addr(t->code);
+		ev->addr = compact_addr(t->data);
+		ev->size = (__u32)compact_num();
+		break;
+	}
+	case KEDR_TR_EVENT_LOCK_PRE:
+	case KEDR_TR_EVENT_LOCK_POST:
+	case KEDR_TR_EVENT_UNLOCK_PRE:
+	case KEDR_TR_EVENT_UNLOCK_POST:
+	case KEDR_TR_EVENT_SIGNAL_PRE:
+	case KEDR_TR_EVENT_SIGNAL_POST:
+	case KEDR_TR_EVENT_WAIT_PRE:
+	case KEDR_TR_EVENT_WAIT_POST: {
+		struct kedr_tr_event_sync *ev = 
+			(struct kedr_tr_event_sync *)hdr;
+		ev->header.event_size = sizeof(*ev);
+		ev->tid = t->tid;
+		ev->obj_type = (__u32)compact_num();
+		ev->pc = compact_addr(t->code);
+		ev->obj_id = compact_addr(t->data);
+		break;
+	}
+	case KEDR_TR_EVENT_THREAD_END: {
+		struct kedr_tr_event_tend *ev = 
+			(struct kedr_tr_event_tend *)hdr;
+		ev->header.event_size = sizeof(*ev);
+		ev->tid = t->tid;
+		break;
+	}
+	case KEDR_TR_EVENT_THREAD_STACK: {
+		struct kedr_tr_event_thread_stack *ev = 
+			(struct kedr_tr_event_thread_stack *)hdr;
+		ev->header.event_size = sizeof(*ev);
+		ev->tid = t->tid;
+		ev->stack_id = (__u32)compact_num();
+		break;
+	}
+	default:
+		compact_error("unexpected type of a compact event.");
+	}
+	return hdr;
+}
+/* ====================================================================== */
@@ -0,0 +1,234 @@
+/* record_reader.h - reading of the event records from the binary trace
+ * file saved by the simple trace recorder.
+ *
+ * The file is mapped to memory if possible and the records are accessed
+ * in place. If the file cannot be mapped (e.g. it is a pipe), the data are
+ * read into a buffer which is reused for all the records.
+ *
+ * The compressed series of events (KEDR_TR_EVENT_COMPRESSED,
+ * KEDR_TR_EVENT_COMPACT and KEDR_TR_EVENT_CHUNK) are decompressed into a 
+ * buffer which is reused too. So, once the buffers have grown large enough,
+ * no memory allocations are made per record. LZO and LZ4 (LZ4HC) 
+ * compressed series are supported as well as the uncompressed ones.
+ *
+ * The events in the compact format are decoded into the event structures
+ * defined in recorder.h, so the users of the reader get the same events
+ * from the traces of both formats. The reader keeps the information about
+ * the blocks of code from BLOCK_INFO events to restore "block enter" and 
+ * memory access events from the references to the blocks.
+ *
+ * [NB] lzo_init() must be called before the records are read. */
+
+/* ========================================================================
+ * Copyright (C) 2014, ROSA Laboratory
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ ======================================================================== */
+
+#ifndef RECORD_READER_H_1150_INCLUDED
+#define RECORD_READER_H_1150_INCLUDED
+
+#include <cstddef>
+#include <stdint.h>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "recorder.h"
+/* ====================================================================== */
+
+class RecordReader
+{
+public:
+	/* The methods of RecordReader throw this kind of exceptions when
+	 * an error occurs. */
+	class Error: public std::runtime_error
+	{
+	public:
+		Error(const std::string &what_arg) :
+			std::runtime_error(what_arg)
+		{}
+	};
+
+public:
+	/* Creates the reader for the file with the given descriptor. The
+	 * records are read from the current position of the file.
+	 * The descriptor is not closed when the reader is destroyed.
+	 *
+	 * Throws RecordReader::Error() on failure. */
+	RecordReader(int fd);
+
+	/* Creates the reader for the records in memory, 
+	 * [records, records + size). The data are not copied and must 
+	 * remain valid while they are being read. 
+	 *
+	 * Throws RecordReader::Error() on failure. */
+	RecordReader(const void *records, size_t size);
+	~RecordReader();
+
+	/* Makes the reader created for the records in memory read the 
+	 * records from [records, records + size) from now on. The 
+	 * information about the blocks of code obtained so far is kept, 
+	 * the events not returned yet are discarded. 'nr_records' is the 
+	 * number of the records before these ones in the trace, for the 
+	 * error messages. */
+	void set_data(const void *records, size_t size, 
+		      unsigned int nr_records = 0);
+
+	/* Returns the next event from the trace, NULL if there are no
+	 * events left. The events from the compressed series are returned
+	 * one by one, the records for the series themselves are not
+	 * returned. BLOCK_INFO events are used by the reader itself and 
+	 * are not returned.
+	 *
+	 * The returned event remains valid until the next call to this
+	 * method.
+	 *
+	 * Throws RecordReader::Error() if the trace is corrupted or cannot
+	 * be read. */
+	const struct kedr_tr_event_header *next_event();
+
+	/* Reads the next series of events and returns its decompressed 
+	 * data in [begin, end) and the format of the events (1 or 2) in 
+	 * 'format'. The records other than the series are skipped. Returns
+	 * false if there are no series left.
+	 *
+	 * The data remain valid until the next call to a method of the 
+	 * reader. This is for the tools that process the series as a whole
+	 * (e.g. to benchmark compression), it should not be mixed with 
+	 * next_event().
+	 *
+	 * Throws RecordReader::Error() if the trace is corrupted or cannot
+	 * be read. */
+	bool next_series(const unsigned char *&begin, 
+			 const unsigned char *&end, unsigned int &format);
+
+	/* The number of records read from the file so far. A compressed
+	 * series of events counts as a single record. Useful for error
+	 * messages. */
+	unsigned int get_nr_records() const
+	{
+		return nrec;
+	}
+
+	/* The offset of the last record read so far from the start of the
+	 * file (or from the start of the data in memory). */
+	uint64_t get_record_offset() const
+	{
+		return record_offset;
+	}
+
+	/* The number of BLOCK_INFO events processed so far. */
+	unsigned int get_nr_block_infos() const
+	{
+		return nr_block_infos;
+	}
+
+	/* Replaces the information about the blocks of code known to this
+	 * reader with a copy of that known to 'other'. This way, a series 
+	 * of events can be decoded by another reader than the one that 
+	 * has read the BLOCK_INFO events. */
+	void copy_blocks(const RecordReader &other);
+
+private:
+	/* Prohibit copying and assignment. */
+	RecordReader(const RecordReader &other);
+	RecordReader & operator=(const RecordReader &other);
+
+	const struct kedr_tr_event_header *next_record();
+	bool ensure_data(size_t size);
+	void decompress(const struct kedr_tr_event_header *record);
+	
+	const struct kedr_tr_event_header *next_compact_event();
+	void compact_error(const char *what);
+	uint64_t compact_num();
+	uint64_t compact_addr(uint64_t &prev);
+	void add_block_info(const struct kedr_tr_event_header *hdr);
+	const struct kedr_tr_event_header *decode_block_events(
+		uint64_t tid, uint64_t &prev_block, uint64_t &prev_addr);
+
+private:
+	/* The descriptor of the file, -1 if the records are read from 
+	 * memory. */
+	int fd;
+
+	/* The contents of the file if it is mapped, NULL otherwise. */
+	unsigned char *map;
+	size_t map_size;
+
+	/* The buffer for the data read from the file if it is not
+	 * mapped. */
+	unsigned char *buf;
+	size_t buf_size;
+
+	/* The data that have not been processed yet. */
+	const unsigned char *data;
+	const unsigned char *data_end;
+
+	/* The buffer for the decompressed events and the events from there
+	 * that have not been returned yet. */
+	unsigned char *events_buf;
+	size_t events_buf_size;
+	const unsigned char *events;
+	const unsigned char *events_end;
+
+	unsigned int nrec;
+
+	/* The offset of 'data' and of the last record read, see 
+	 * get_record_offset(). */
+	uint64_t pos;
+	uint64_t record_offset;
+	
+	/* The state of the decoder for the compact format, the same as 
+	 * the kernel part uses to encode the events, see recorder.h. */
+	struct CompactThread
+	{
+		uint64_t tid;
+		uint64_t code;
+		uint64_t data;
+		uint64_t block;
+	};
+	
+	/* Whether the current series is in the compact format. */
+	bool compact;
+	CompactThread threads[KEDR_TR_COMPACT_MAX_THREADS + 1];
+	unsigned int nr_threads;
+	CompactThread *cur_thread;
+	
+	/* The code address of the previous STACK event in the series. */
+	uint64_t stack_pc;
+	
+	/* The structure for the decoded event. */
+	union {
+		struct kedr_tr_event_mem mem;
+		unsigned char bytes[sizeof(struct kedr_tr_event_mem) + 
+			31 * sizeof(struct kedr_tr_event_mem_op)];
+	} decoded;
+	
+	/* The blocks of code from BLOCK_INFO events, indexed by the IDs 
+	 * of the blocks. 'max_events' is 0 for the unknown blocks. The 
+	 * information about the memory accesses of the block is in 
+	 * block_ops[first_op, first_op + max_events). */
+	struct BlockInfo
+	{
+		unsigned int max_events;
+		uint32_t read_mask;
+		uint32_t write_mask;
+		uint32_t string_mask;
+		size_t first_op;
+	};
+	std::vector<BlockInfo> blocks;
+	std::vector<struct kedr_tr_block_op> block_ops;
+	unsigned int nr_block_infos;
+	
+	/* The "block enter" event decoded from a reference to a block. If
+	 * 'mem_pending' is true, the memory access event from that block
+	 * is in 'decoded' and is to be returned next. */
+	struct kedr_tr_event_block block_enter;
+	bool mem_pending;
+};
+/* ====================================================================== */
+#endif // RECORD_READER_H_1150_INCLUDED
@@ -11,13 +11,30 @@
  * the "accumulator buffer" (B0), in the order they appear in the output
  * subsystem, without gaps inbetween. When an event arrives and B0 has no
  * free space for it, the contents of B0 are compressed to the temporary
- * storage buffer (B1). LZO is used for that, because it is already used in
- * the kernel and is said to be fast. The contents of B1 are then copied to
- * the output buffer (B2) which is visible from the user space. If the 
+ * storage buffer (B1). LZO is used for that by default, because it is 
+ * available in the kernel and is fast. Other algorithms can be selected 
+ * with 'compressor' parameter of the kernel part, the compression can also
+ * be disabled. The contents of B1 are then copied to the output buffer 
+ * (B2) which is visible from the user space. If the 
  * output buffer does not have enough space at the moment, the events 
  * accumulated so far are considered lost. Independent on the result of the
  * output, B0 and B1 are now considered free. The original event is then 
- * written to B0 and the process continues. */
+ * written to B0 and the process continues. 
+ *
+ * There are two formats of the events in B0, see 'trace_format' parameter
+ * of the kernel part. In the format #1, B0 contains the event structures 
+ * defined below and the compressed series are stored in 
+ * KEDR_TR_EVENT_COMPRESSED records. In the format #2 ("compact" format), 
+ * the events are encoded as described at the end of this file and the 
+ * compressed series are stored in KEDR_TR_EVENT_COMPACT records. The other
+ * records are the same in both formats, so the readers can tell the 
+ * formats apart by the types of the records. 
+ *
+ * If an algorithm other than LZO is used, the series of both formats are
+ * stored in KEDR_TR_EVENT_CHUNK records instead, which specify the format
+ * and the algorithm. LZO-compressed series are still stored as described 
+ * above, so that the traces recorded with the default settings can be 
+ * read by the older tools. */
 
 #ifndef RECORDER_H_1045_INCLUDED
 #define RECORDER_H_1045_INCLUDED
@@ -160,13 +177,51 @@ enum kedr_tr_event_type
 	 * Structure: kedr_tr_event_compressed.*/
 	KEDR_TR_EVENT_COMPRESSED = 29,
 
+	/* Same as KEDR_TR_EVENT_COMPRESSED but the decompressed data are
+	 * the events in the compact format (see below) rather than the 
+	 * event structures.
+	 * Structure: kedr_tr_event_compressed.*/
+	KEDR_TR_EVENT_COMPACT = 30,
+
+	/* Information about a block of code with memory accesses, known at
+	 * the instrumentation phase. Used only in the compact format, see
+	 * KEDR_TR_COMPACT_BLOCK below. 
+	 * Structure: kedr_tr_event_block_info. */
+	KEDR_TR_EVENT_BLOCK_INFO = 31,
+
+	/* A series of events in the format and compressed with the 
+	 * algorithm specified in the record.
+	 * Structure: kedr_tr_event_chunk. */
+	KEDR_TR_EVENT_CHUNK = 32,
+
+	/* A call stack: the stack with the ID 'parent' extended with the 
+	 * call instruction at 'pc' (see kedr_get_stack_frame() in 
+	 * kedr/kedr_mem/core_api.h). Only recorded if 'call_stacks' 
+	 * parameter of the kernel part is non-zero, in the compact format 
+	 * only. The STACK events for a stack and for all its parents are
+	 * recorded in a series before the first THREAD_STACK event that 
+	 * refers to that stack in the series. The IDs are unique within a 
+	 * session.
+	 * Structure: kedr_tr_event_stack. */
+	KEDR_TR_EVENT_STACK = 33,
+
+	/* The thread now has the call stack with the given ID, 0 if the 
+	 * stack is empty (the code not under analysis has called the 
+	 * current function). Recorded before the memory access, "alloc", 
+	 * "free", barrier and synchronization events of a thread if the 
+	 * call stack of the thread is not the same as in the previous 
+	 * THREAD_STACK event for that thread in the series. The call stack
+	 * does not include the function the event happens in, that is 
+	 * given by 'pc' of the event.
+	 * Structure: kedr_tr_event_thread_stack. */
+	KEDR_TR_EVENT_THREAD_STACK = 34,
+
 	/* The number of event types defined so far. */
 	KEDR_TR_EVENT_MAX
 };
 
-/* [NB] Only lower 32 bits of 'func' and 'pc' are stored. On x86-64, the 
- * higher 32 bits can be obtained by sign extension of the stored values:
- * full_value = (__u64)(__s64)(__s32)stored_value. */
+/* [NB] 'func', 'pc' and the addresses of the code areas of the modules are
+ * stored in full, as 64-bit values, on both x86-32 and x86-64. */
 
 struct kedr_tr_event_session
 {
@@ -196,11 +251,9 @@ struct kedr_tr_event_module
 	 * See linux/module.h and layout_sections() in kernel/module.c, as
 	 * of kernel versions 2.6.32 - 3.6.x.
 	 *
-	 * [NB] As "init" and "core" areas are in the module mapping space,
-	 * it is enough to store the lower 32 bits of them, the rule is the
-	 * same as for 'pc' values. */
-	__u32 init_addr;
-	__u32 core_addr;
+	 * [NB] The addresses are stored in full, like 'pc' values. */
+	__u64 init_addr;
+	__u64 core_addr;
 	__u32 init_size;
 	__u32 core_size;
 } __attribute__ ((packed));
@@ -209,15 +262,15 @@ struct kedr_tr_event_func
 {
 	struct kedr_tr_event_header header;
 	__u64 tid;
-	__u32 func;
+	__u64 func;
 } __attribute__ ((packed));
 
 struct kedr_tr_event_call
 {
 	struct kedr_tr_event_header header;
 	__u64 tid;
-	__u32 func;
-	__u32 pc;
+	__u64 func;
+	__u64 pc;
 } __attribute__ ((packed));
 
 /* One memory access operation. */
@@ -225,7 +278,7 @@ struct kedr_tr_event_mem_op
 {
 	__u64 addr;
 	__u32 size;
-	__u32 pc;
+	__u64 pc;
 } __attribute__ ((packed));
 
 /* For the ordinary (i.e. not locked) memory accesses, this is a sequence of 
@@ -269,7 +322,7 @@ struct kedr_tr_event_barrier
 	struct kedr_tr_event_header header;
 	__u64 tid;
 	__u32 obj_type;
-	__u32 pc;
+	__u64 pc;
 } __attribute__ ((packed));
 
 /* Note:
@@ -282,7 +335,7 @@ struct kedr_tr_event_alloc_free
 	__u64 tid;
 	__u64 addr;
 	__u32 size;
-	__u32 pc;
+	__u64 pc;
 } __attribute__ ((packed));
 
 /* A synchronization event (lock/unlock, signal/wait).
@@ -296,14 +349,38 @@ struct kedr_tr_event_sync
 	__u64 tid;
 	__u64 obj_id;
 	__u32 obj_type;
-	__u32 pc;
+	__u64 pc;
 } __attribute__ ((packed));
 
 struct kedr_tr_event_block
 {
 	struct kedr_tr_event_header header;
 	__u64 tid;
-	__u32 pc;
+	__u64 pc;
+} __attribute__ ((packed));
+
+/* Information about a block of code. 'id' is the ID the core has assigned
+ * to the block (see 'id' in struct kedr_block_info). For each possible 
+ * memory access in the block, the masks and ops[] contain the same data as
+ * struct kedr_block_info does. 'size' is the size of the memory area 
+ * accessed at a time for the string operations. */
+struct kedr_tr_block_op
+{
+	__u64 pc;
+	__u32 size;
+} __attribute__ ((packed));
+
+struct kedr_tr_event_block_info
+{
+	struct kedr_tr_event_header header;
+	__u32 id;
+	__u32 max_events;
+	__u32 read_mask;
+	__u32 write_mask;
+	__u32 string_mask;
+	
+	/* The array actually has 'max_events' elements. */
+	struct kedr_tr_block_op ops[1];
 } __attribute__ ((packed));
 
 /* "Thread start".
@@ -323,6 +400,24 @@ struct kedr_tr_event_tend
 	__u64 tid;
 } __attribute__ ((packed));
 
+/* A call stack, see KEDR_TR_EVENT_STACK. 'parent' is 0 if 'pc' is the 
+ * outermost call. */
+struct kedr_tr_event_stack
+{
+	struct kedr_tr_event_header header;
+	__u32 id;
+	__u32 parent;
+	__u64 pc;
+} __attribute__ ((packed));
+
+/* The current call stack of a thread, see KEDR_TR_EVENT_THREAD_STACK. */
+struct kedr_tr_event_thread_stack
+{
+	struct kedr_tr_event_header header;
+	__u64 tid;
+	__u32 stack_id;
+} __attribute__ ((packed));
+
 /* A compressed series of events. */
 struct kedr_tr_event_compressed
 {
@@ -337,8 +432,135 @@ struct kedr_tr_event_compressed
 	/* The compressed data. */
 	unsigned char compressed[1];
 } __attribute__ ((packed));
+
+/* Compression algorithms. */
+enum kedr_tr_compressor_type
+{
+	/* The data are stored as is. */
+	KEDR_TR_COMPRESSOR_NONE = 0,
+	
+	/* LZO1X-1. */
+	KEDR_TR_COMPRESSOR_LZO = 1,
+	
+	/* LZ4 and LZ4HC. Both produce the data in LZ4 block format, so 
+	 * they are decompressed the same way. */
+	KEDR_TR_COMPRESSOR_LZ4 = 2,
+	KEDR_TR_COMPRESSOR_LZ4HC = 3,
+	
+	KEDR_TR_COMPRESSOR_MAX
+};
+
+/* A series of events compressed with a given algorithm. */
+struct kedr_tr_event_chunk
+{
+	struct kedr_tr_event_header header;
+	
+	/* Size of the original series of events, in bytes. */
+	__u32 orig_size;
+	
+	/* Size of the compressed data at the end of this structure. */
+	__u32 compressed_size;
+	
+	/* Format of the events in the series, 1 or 2 (see 'trace_format'
+	 * parameter of the kernel part). */
+	__u8 format;
+	
+	/* The compression algorithm, see enum kedr_tr_compressor_type. */
+	__u8 compressor;
+	
+	__u16 reserved;
+	
+	/* The compressed data. */
+	unsigned char compressed[1];
+} __attribute__ ((packed));
 /* ====================================================================== */
 
+/* The compact format of the events (trace format #2). 
+ * 
+ * The decompressed data of a KEDR_TR_EVENT_COMPACT record is a sequence of
+ * events, each event starts with a tag byte: 
+ *   bits 0-4 - type of the event (enum kedr_tr_event_type) or 
+ *       KEDR_TR_COMPACT_EXTENDED for the types that do not fit there, 
+ *       the type follows the tag as a number then;
+ *   KEDR_TR_COMPACT_SAME_THREAD - the event is for the same thread as the
+ *       previous event of the series that has a thread;
+ *   KEDR_TR_COMPACT_STRUCT - the event structure defined above follows the
+ *       tag as is. Used for the rare events ("target load/unload", 
+ *       "thread start", "block info").
+ *   KEDR_TR_COMPACT_BLOCK - (MEM only) the memory accesses are from a 
+ *       block of code described by a BLOCK_INFO event earlier in the 
+ *       trace, see below.
+ *
+ * The other events have no headers. The fields of the event follow the 
+ * tag in the order listed below:
+ *   FENTRY, FEXIT:		[thread] func
+ *   CALL_PRE, CALL_POST:	[thread] pc func
+ *   MEM:			[thread] nr_events read_mask write_mask 
+ *				(pc addr size) * nr_events
+ *   MEM_LOCKED, MEM_IO:	[thread] read_mask write_mask pc addr size
+ *   BLOCK_ENTER:		[thread] pc
+ *   BARRIER_*:			[thread] obj_type pc
+ *   ALLOC_*, FREE_*:		[thread] pc addr size
+ *   LOCK_*, UNLOCK_*, SIGNAL_*, WAIT_*:
+ *				[thread] obj_type pc obj_id
+ *   THREAD_END:		[thread]
+ *   STACK:			id parent pc
+ *   THREAD_STACK:		[thread] stack_id
+ *   MEM | BLOCK:		[thread] id mask [extra_write_mask] 
+ *				(addr [size]) * popcount(mask)
+ *
+ * A MEM event with KEDR_TR_COMPACT_BLOCK replaces both the "block enter" 
+ * and the memory access events for a block of code. Only the data known
+ * in runtime are stored there, the rest is taken from the BLOCK_INFO event
+ * for the block with the given 'id'. Bit #i of 'mask' is set if ops[i] of
+ * the block was executed, the lowest bit of the stored number is set if
+ * 'extra_write_mask' follows: the bits for the ops that wrote to memory 
+ * although the block info does not say so (e.g. CMPXCHG). For each 
+ * executed op, 'addr' follows and then, for the string operations, the 
+ * full size of the accessed memory area. The decoded events are: 
+ * BLOCK_ENTER with 'pc' of the first executed op and MEM with all the 
+ * executed ops. The BLOCK_INFO events for the blocks of a target follow 
+ * the "target load" event of that target, they are not reported to the 
+ * users of the trace.
+ *
+ * All numbers are unsigned LEB128 varints (7 bits per byte, the lowest 
+ * bits first, the highest bit of each byte except the last one is set). 
+ *
+ * The code addresses (pc, func) are full 64-bit values. Each one is stored
+ * as the difference from the previous code address of the same thread in
+ * the series, zigzag-encoded (0, -1, 1, -2, ... are stored as 0, 1, 2, 3,
+ * ...). The data addresses (addr, obj_id) are stored the same way but 
+ * relative to the previous data address of the thread. The block IDs are 
+ * stored the same way, relative to the previous block ID of the thread. For
+ * a thread that has not been seen in the series yet, the previous 
+ * addresses and the block ID are 0. The code addresses of STACK events 
+ * are stored relative to the code address of the previous STACK event in
+ * the series (0 for the first one).
+ *
+ * [thread] is absent if KEDR_TR_COMPACT_SAME_THREAD is set. Otherwise, it
+ * is a number N. If N is not 0, the thread is the one assigned the number
+ * N - 1 in the series. If N is 0, the thread ID follows and, unless the 
+ * series has KEDR_TR_COMPACT_MAX_THREADS threads already, the thread is 
+ * assigned the next number (0, 1, ...). The threads with no number start
+ * with the previous addresses and block ID equal to 0 each time.
+ *
+ * Each series is encoded independently of the others. */
+#define KEDR_TR_COMPACT_TYPE_MASK	0x1f
+#define KEDR_TR_COMPACT_EXTENDED	0x00
+#define KEDR_TR_COMPACT_SAME_THREAD	0x20
+#define KEDR_TR_COMPACT_STRUCT		0x40
+#define KEDR_TR_COMPACT_BLOCK		0x80
+
+#define KEDR_TR_COMPACT_MAX_THREADS	64
+
+/* The maximum size of an encoded number. */
+#define KEDR_TR_COMPACT_MAX_NUM_SIZE	10
+/* ====================================================================== */
+
+/* Maximum size of the records placed before a snapshot in the flight
+ * recorder mode (see 'header' in struct kedr_tr_start_page). */
+#define KEDR_TR_SNAPSHOT_HEADER_SIZE 2048
+
 /* This structure is located at the beginning of the first page of the 
  * buffer and contains service data. The data pages that follow this page 
  * form a circular buffer (similar to the one used in kfifo subsystem). */
@@ -358,6 +580,29 @@ struct kedr_tr_start_page
 	 * buffer is completely full. */
 	__u32 read_pos;
 	__u32 write_pos;
+	
+	/* The fields below are used only in the flight recorder mode (see
+	 * 'flight_recorder' parameter of the kernel part). In that mode, 
+	 * the kernel part discards the oldest records itself to make room
+	 * for the new ones and the user-space part must not read the data 
+	 * until a snapshot is taken. 
+	 *
+	 * When a snapshot is taken, the kernel part increments 
+	 * 'snapshot_seq', sets 'frozen' and stops writing to the buffer 
+	 * (except for "session end" event). The snapshot consists of the 
+	 * records in 'header' followed by the records in the buffer. 
+	 * 'header' contains copies of the records needed to process the 
+	 * snapshot that are no longer in the buffer ("session start" and
+	 * "target load" events for the targets still loaded at the 
+	 * beginning of the snapshot).
+	 *
+	 * The snapshot is considered consumed and the kernel part resumes
+	 * recording when the reader calls poll() after it has set 
+	 * 'read_pos' to 'write_pos'. */
+	__u32 snapshot_seq;
+	__u32 frozen;
+	__u32 header_size;
+	unsigned char header[KEDR_TR_SNAPSHOT_HEADER_SIZE];
 };
 /* ====================================================================== */
 #endif /* RECORDER_H_1045_INCLUDED */
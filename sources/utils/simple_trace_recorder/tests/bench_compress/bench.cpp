@@ -0,0 +1,308 @@
+/*
+ * Benchmark of the compressors the simple trace recorder can use.
+ *
+ * Usage:
+ *
+ *   bench_st_rec_compress <trace_file> [<n-iterations>]
+ *
+ * The series of events are extracted from a trace recorded by the simple
+ * trace recorder (with any compressor) and then compressed and
+ * decompressed again with each of the compressors, the same way the
+ * kernel part and the readers of the trace do. For each compressor, the
+ * compression ratio and the compression and decompression speeds (MB/s of
+ * the uncompressed data) are reported.
+ *
+ * LZO1X-1 is used in the user space via miniLZO, LZ4 and LZ4HC - via
+ * liblz4 if it was available at build time. These are the same algorithms
+ * the kernel provides, so the ratios are the same as for the kernel part,
+ * the speeds should be close.
+ */
+
+/* ========================================================================
+ * Copyright (C) 2014, ROSA Laboratory
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ ======================================================================== */
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+
+#include <iostream>
+#include <iomanip>
+#include <stdexcept>
+#include <vector>
+
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <lzo/minilzo.h>
+
+#ifdef KEDR_TR_HAVE_LZ4
+# include <lz4.h>
+# include <lz4hc.h>
+#endif
+
+#include "record_reader.h"
+
+using namespace std;
+/* ====================================================================== */
+
+/* A series of events from the trace. */
+typedef vector<unsigned char> Series;
+
+struct Compressor
+{
+	const char *name;
+
+	/* Compresses 'src_len' bytes at 'src' to 'dst' which is large
+	 * enough for the worst case. Returns the size of the compressed
+	 * data, 0 on failure. */
+	size_t (*compress)(const unsigned char *src, size_t src_len,
+			   unsigned char *dst);
+
+	/* Decompresses the data into 'dst' of 'dst_len' bytes. Returns
+	 * false on failure. */
+	bool (*decompress)(const unsigned char *src, size_t src_len,
+			   unsigned char *dst, size_t dst_len);
+};
+
+/* Working memory for the compressors, large enough for each of them. */
+static vector<unsigned char> wrkmem;
+/* ====================================================================== */
+
+static size_t
+none_compress(const unsigned char *src, size_t src_len, unsigned char *dst)
+{
+	memcpy(dst, src, src_len);
+	return src_len;
+}
+
+static bool
+none_decompress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t dst_len)
+{
+	if (src_len != dst_len)
+		return false;
+	memcpy(dst, src, src_len);
+	return true;
+}
+
+static size_t
+lzo_compress(const unsigned char *src, size_t src_len, unsigned char *dst)
+{
+	lzo_uint dst_len = 0;
+	int ret = lzo1x_1_compress(src, src_len, dst, &dst_len, &wrkmem[0]);
+	return (ret == LZO_E_OK ? (size_t)dst_len : 0);
+}
+
+static bool
+lzo_decompress(const unsigned char *src, size_t src_len,
+	       unsigned char *dst, size_t dst_len)
+{
+	lzo_uint len = dst_len;
+	int ret = lzo1x_decompress_safe(src, src_len, dst, &len, NULL);
+	return (ret == LZO_E_OK && len == dst_len);
+}
+
+#ifdef KEDR_TR_HAVE_LZ4
+static size_t
+lz4_compress(const unsigned char *src, size_t src_len, unsigned char *dst)
+{
+	int ret = LZ4_compress_fast_extState(&wrkmem[0], (const char *)src,
+		(char *)dst, (int)src_len, LZ4_compressBound((int)src_len),
+		1);
+	return (ret > 0 ? (size_t)ret : 0);
+}
+
+/* The default compression level of LZ4HC in the kernel. */
+static const int lz4hc_level = 9;
+
+static size_t
+lz4hc_compress(const unsigned char *src, size_t src_len,
+	       unsigned char *dst)
+{
+	int ret = LZ4_compress_HC_extStateHC(&wrkmem[0], (const char *)src,
+		(char *)dst, (int)src_len, LZ4_compressBound((int)src_len),
+		lz4hc_level);
+	return (ret > 0 ? (size_t)ret : 0);
+}
+
+static bool
+lz4_decompress(const unsigned char *src, size_t src_len,
+	       unsigned char *dst, size_t dst_len)
+{
+	int ret = LZ4_decompress_safe((const char *)src, (char *)dst,
+		(int)src_len, (int)dst_len);
+	return (ret >= 0 && (size_t)ret == dst_len);
+}
+#endif
+
+static const Compressor compressors[] = {
+	{"none", none_compress, none_decompress},
+	{"lzo", lzo_compress, lzo_decompress},
+#ifdef KEDR_TR_HAVE_LZ4
+	{"lz4", lz4_compress, lz4_decompress},
+	{"lz4hc", lz4hc_compress, lz4_decompress},
+#endif
+};
+/* ====================================================================== */
+
+static double
+get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+load_series(int fd, vector<Series> &all, size_t &total, size_t &max_size)
+{
+	RecordReader reader(fd);
+	const unsigned char *begin;
+	const unsigned char *end;
+	unsigned int format;
+
+	total = 0;
+	max_size = 0;
+	while (reader.next_series(begin, end, format)) {
+		all.push_back(Series(begin, end));
+		total += (size_t)(end - begin);
+		if ((size_t)(end - begin) > max_size)
+			max_size = (size_t)(end - begin);
+	}
+}
+
+static void
+run_bench(const Compressor &comp, const vector<Series> &all,
+	  size_t total, size_t max_size, unsigned int n_iterations)
+{
+	/* The worst case for LZO is also enough for the others. */
+	vector<unsigned char> cbuf(max_size + max_size / 16 + 64 + 3);
+	vector<unsigned char> dbuf(max_size);
+	size_t compressed_total = 0;
+	double start;
+	double compress_time;
+	double decompress_time;
+
+	start = get_time();
+	for (unsigned int it = 0; it < n_iterations; ++it) {
+		for (size_t i = 0; i < all.size(); ++i) {
+			if (comp.compress(&all[i][0], all[i].size(),
+					  &cbuf[0]) == 0)
+				throw runtime_error(
+					string("Failed to compress data with ")
+					+ comp.name);
+		}
+	}
+	compress_time = get_time() - start;
+
+	/* Decompress each series right after it has been compressed
+	 * because only one compressed series is kept at a time. Only the
+	 * decompression is timed. */
+	decompress_time = 0.0;
+	for (size_t i = 0; i < all.size(); ++i) {
+		size_t csize = comp.compress(&all[i][0], all[i].size(),
+					     &cbuf[0]);
+		compressed_total += csize;
+		
+		start = get_time();
+		for (unsigned int it = 0; it < n_iterations; ++it) {
+			if (!comp.decompress(&cbuf[0], csize, &dbuf[0],
+					     all[i].size()))
+				throw runtime_error(
+					string("Failed to decompress data with ")
+					+ comp.name);
+		}
+		decompress_time += get_time() - start;
+
+		if (memcmp(&dbuf[0], &all[i][0], all[i].size()) != 0)
+			throw runtime_error(
+				string("Decompressed data do not match ")
+				+ "the original ones, " + comp.name);
+	}
+
+	double mbytes = (double)total * n_iterations / (1024.0 * 1024.0);
+	cout << setw(8) << comp.name << ": ratio "
+		<< fixed << setprecision(2)
+		<< (double)total / (double)compressed_total
+		<< ", compressed size " << compressed_total
+		<< ", compression " << setprecision(1)
+		<< mbytes / compress_time << " MB/s"
+		<< ", decompression " << mbytes / decompress_time << " MB/s"
+		<< endl;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int fd;
+	unsigned int n_iterations = 10;
+	vector<Series> all;
+	size_t total;
+	size_t max_size;
+
+	if (argc < 2 || argc > 3) {
+		cerr << "Usage: " << argv[0]
+			<< " <trace_file> [<n-iterations>]" << endl;
+		return EXIT_FAILURE;
+	}
+
+	if (argc == 3) {
+		n_iterations = (unsigned int)atoi(argv[2]);
+		if (n_iterations == 0) {
+			cerr << "Invalid number of iterations: "
+				<< argv[2] << endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (lzo_init() != LZO_E_OK) {
+		cerr << "Failed to initialize LZO library." << endl;
+		return EXIT_FAILURE;
+	}
+
+	wrkmem.resize(LZO1X_1_MEM_COMPRESS);
+#ifdef KEDR_TR_HAVE_LZ4
+	if (wrkmem.size() < (size_t)LZ4_sizeofState())
+		wrkmem.resize(LZ4_sizeofState());
+	if (wrkmem.size() < (size_t)LZ4_sizeofStateHC())
+		wrkmem.resize(LZ4_sizeofStateHC());
+#endif
+
+	fd = open(argv[1], O_RDONLY);
+	if (fd == -1) {
+		cerr << "Failed to open " << argv[1] << ": "
+			<< strerror(errno) << endl;
+		return EXIT_FAILURE;
+	}
+
+	try {
+		load_series(fd, all, total, max_size);
+		close(fd);
+
+		if (all.empty()) {
+			cerr << "No series of events found in the trace."
+				<< endl;
+			return EXIT_FAILURE;
+		}
+
+		cout << "Series of events: " << all.size()
+			<< ", total size: " << total << " byte(s)" << endl;
+
+		for (size_t i = 0;
+		     i < sizeof(compressors) / sizeof(compressors[0]); ++i)
+			run_bench(compressors[i], all, total, max_size,
+				  n_iterations);
+	}
+	catch (runtime_error &e) {
+		cerr << "Error: " << e.what() << endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -14,7 +14,11 @@
  * after a page has been filled and writing to the next page has started, 
  * the module will sleep. This allows the user-space part of the output 
  * system to keep up and retrieve the data from the buffer. If the parameter
- * is 0, the generator will not sleep. */
+ * is 0, the generator will not sleep. 
+ *
+ * The generator also provides the call stacks for some of the events, as
+ * if the core maintained the shadow call stacks. The output system only
+ * records these if it is loaded with 'call_stacks=1'. */
 
 /* ========================================================================
  * Copyright (C) 2012, KEDR development team
@@ -39,6 +43,7 @@
 #include <linux/debugfs.h>
 
 #include <kedr/kedr_mem/core_api.h>
+#include <kedr/kedr_mem/block_info.h>
 #include <kedr/object_types.h>
 
 #include <simple_trace_recorder/recorder.h>
@@ -91,6 +96,34 @@ static unsigned long lock1 = 0x1001abcd;
 
 static unsigned long func1 = KEDR_TEST_SIGN_EXT_64(0xc0123ffa);
 static unsigned long func2 = KEDR_TEST_SIGN_EXT_64(0xd123400b);
+
+/* The call stacks (see kedr_get_stack_frame() in core_api.h), the ID of
+ * a stack is the index of its element + 1. */
+static const struct {
+	unsigned long pc;
+	unsigned int parent;
+} stacks[] = {
+	{ KEDR_TEST_SIGN_EXT_64(0xc0127000), 0 },	/* 1 */
+	{ KEDR_TEST_SIGN_EXT_64(0xd1234010), 1 },	/* 2 */
+	{ KEDR_TEST_SIGN_EXT_64(0xd1234020), 1 },	/* 3 */
+	{ KEDR_TEST_SIGN_EXT_64(0xc0123f00), 2 },	/* 4 */
+};
+
+/* The thread the events are currently generated for, as seen by the
+ * output system (see kedr_get_thread_id()), and the ID of its current 
+ * call stack. Only the events of this thread have the call stacks. */
+static unsigned long cur_tid = 0;
+static unsigned int cur_stack = 0;
+
+/* The block with the maximum allowed number of memory accesses. If the 
+ * output system asks for the information about the blocks, the events 
+ * from this block are reported with begin_block_events(). The resulting 
+ * trace must be the same as if begin_memory_events() was used. */
+#define KEDR_TEST_NR_EVENTS_MAX 32
+static struct {
+	struct kedr_block_info info;
+	struct kedr_mem_event more_events[KEDR_TEST_NR_EVENTS_MAX - 1];
+} block_max;
 /* ====================================================================== */
 
 static void
@@ -147,8 +180,82 @@ kedr_get_event_handlers(void)
 	BUG_ON(cur_eh == NULL);
 	return cur_eh;
 }
+
+unsigned long
+kedr_get_thread_id(void)
+{
+	return (cur_tid != 0 ? cur_tid : (unsigned long)current);
+}
+EXPORT_SYMBOL(kedr_get_thread_id);
+
+int
+kedr_shadow_stacks_enabled(void)
+{
+	return 1;
+}
+EXPORT_SYMBOL(kedr_shadow_stacks_enabled);
+
+unsigned int
+kedr_get_stack_id(unsigned long tid)
+{
+	return (tid == cur_tid ? cur_stack : 0);
+}
+EXPORT_SYMBOL(kedr_get_stack_id);
+
+int
+kedr_get_stack_frame(unsigned int stack_id, unsigned long *pc, 
+	unsigned int *parent_id)
+{
+	if (stack_id == 0 || stack_id > ARRAY_SIZE(stacks))
+		return -EINVAL;
+	
+	*pc = stacks[stack_id - 1].pc;
+	*parent_id = stacks[stack_id - 1].parent;
+	return 0;
+}
+EXPORT_SYMBOL(kedr_get_stack_frame);
 /* ====================================================================== */
 
+/* Makes 'tid' the current thread with the given call stack. */
+static void
+set_cur_thread(unsigned long tid, unsigned int stack_id)
+{
+	cur_tid = tid;
+	cur_stack = stack_id;
+}
+
+/* A memory access with a single event. */
+static void
+gen_mem_event(unsigned long tid, unsigned long pc, unsigned long addr,
+	enum kedr_memory_event_type type)
+{
+	void *data = NULL;
+	
+	cur_eh->begin_memory_events(cur_eh, tid, 1, &data);
+	cur_eh->on_memory_event(cur_eh, tid, pc, addr, 4, type, data);
+	cur_eh->end_memory_events(cur_eh, tid, data);
+	sleep_after_event(sizeof(struct kedr_tr_event_mem));
+}
+
+static void
+init_block_max(void)
+{
+	struct kedr_block_info *info = &block_max.info;
+	unsigned int i;
+	
+	info->id = 1;
+	info->max_events = KEDR_TEST_NR_EVENTS_MAX;
+	for (i = 0; i < KEDR_TEST_NR_EVENTS_MAX; ++i) {
+		if (i % 3 != 1)
+			info->read_mask |= (u32)1 << i;
+		if (i % 3 != 2)
+			info->write_mask |= (u32)1 << i;
+		
+		info->events[i].pc = func1 + 6 + i;
+		info->events[i].size = 8 + 4 * i;
+	}
+}
+
 static int
 callbacks_ok(void)
 {
@@ -193,7 +300,7 @@ generate_events(void)
 	void *data1 = NULL;
 	void *data2 = NULL;
 	unsigned int nr_events1 = 16;
-	unsigned int nr_events_max = 32;
+	unsigned int nr_events_max = KEDR_TEST_NR_EVENTS_MAX;
 	unsigned int i;
 	
 	/* How many times to repeat certain events to make sure the amount
@@ -208,6 +315,10 @@ generate_events(void)
 	
 	cur_eh->on_target_loaded(cur_eh, target);
 	sleep_after_event(sizeof(struct kedr_tr_event_module));
+	
+	init_block_max();
+	if (cur_eh->on_block_info != NULL)
+		cur_eh->on_block_info(cur_eh, target, &block_max.info);
 
 	cur_eh->on_function_entry(cur_eh, tid1, func1);
 	sleep_after_event(sizeof(struct kedr_tr_event_func));
@@ -257,7 +368,14 @@ generate_events(void)
 	
 	/* A block with the maximum allowed number of the actual events. */
 	data1 = NULL;
-	cur_eh->begin_memory_events(cur_eh, tid1, nr_events_max, &data1);
+	if (cur_eh->begin_block_events != NULL) {
+		cur_eh->begin_block_events(cur_eh, tid1, &block_max.info, 
+			&data1);
+	}
+	else {
+		cur_eh->begin_memory_events(cur_eh, tid1, nr_events_max, 
+			&data1);
+	}
 	for (i = 0; i < nr_events_max; ++i) {
 		enum kedr_memory_event_type et = KEDR_ET_MREAD;
 		if (i % 3 == 0)
@@ -434,6 +552,32 @@ generate_events(void)
 		KEDR_SWT_COMMON);
 	sleep_after_event(sizeof(struct kedr_tr_event_sync));
 	
+	/* Call stacks. The stacks 4 and 3 share the parent (1) and so do
+	 * the events of "thread 1" with the stack 2. Each stack must be 
+	 * recorded once, THREAD_STACK - only when the stack of the thread 
+	 * changes. */
+	set_cur_thread(tid1, 4);
+	gen_mem_event(tid1, func1 + 0x7000, addr1, KEDR_ET_MREAD);
+	gen_mem_event(tid1, func1 + 0x7004, addr1, KEDR_ET_MWRITE);
+	
+	set_cur_thread(tid2, 3);
+	gen_mem_event(tid2, func2 + 0x7000, addr1, KEDR_ET_MREAD);
+	
+	set_cur_thread(tid1, 2);
+	cur_eh->on_lock_pre(cur_eh, tid1, func2 + 0x7010, lock1, 
+		KEDR_LT_SPINLOCK);
+	sleep_after_event(sizeof(struct kedr_tr_event_sync));
+	cur_eh->on_lock_post(cur_eh, tid1, func2 + 0x7010, lock1, 
+		KEDR_LT_SPINLOCK);
+	sleep_after_event(sizeof(struct kedr_tr_event_sync));
+	
+	set_cur_thread(tid2, 3);
+	gen_mem_event(tid2, func2 + 0x7004, addr1, KEDR_ET_MWRITE);
+	
+	set_cur_thread(tid1, 0);
+	gen_mem_event(tid1, func1 + 0x7008, addr1, KEDR_ET_MREAD);
+	set_cur_thread(0, 0);
+	
 	/* Make sure the amount of data to be transferred to the user space
 	 * is at least as large as several pages. */
 	for (i = 0; i < nr_repeat; ++i) {
@@ -7,7 +7,13 @@
  * The resulting trace will be output to stdout.
  *
  * Usage:
- *	test_trace_to_text <input_trace_file>
+ *	test_trace_to_text [-i <index_file>] [-j <jobs>] [-r <first>-<last>]
+ *		<input_trace_file>
+ *
+ * If the index of the trace is given (see kedr_st_rec_index), the series
+ * of events are decoded by <jobs> threads (1 by default). The index also
+ * allows to output only the events with numbers from <first> to <last>,
+ * inclusive.
  */
 
 /* ========================================================================
@@ -35,10 +41,17 @@
 #include <string>
 #include <stdexcept>
 
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+
 #include <kedr/object_types.h>
 #include <lzo/minilzo.h>
 
 #include "recorder.h"
+#include "record_reader.h"
+#include "trace_index.h"
+#include "parallel_reader.h"
 
 using namespace std;
 /* ====================================================================== */
@@ -47,20 +60,20 @@ static unsigned int nrec = 0;
 /* ====================================================================== */
 
 /* Returns the code address (pc, start address of a function, ...) 
- * corresponding to the given raw address. Sign-extension is performed if 
- * needed. */
+ * corresponding to the given raw address. The addresses are recorded in
+ * full, so this is just a conversion. */
 static unsigned long
-code_address_from_raw(__u32 raw)
+code_address_from_raw(__u64 raw)
 {
-	return (unsigned long)(long)(__s32)raw;
+	return (unsigned long)raw;
 }
 /* ====================================================================== */
 
 static void 
 usage()
 {
-	cerr << "Usage:\n\ttest_trace_to_text <input_trace_file>" 
-		<< endl;
+	cerr << "Usage:\n\ttest_trace_to_text [-i <index_file>] [-j <jobs>] "
+		"[-r <first>-<last>] <input_trace_file>" << endl;
 }
 /* ====================================================================== */
 
@@ -109,61 +122,6 @@ sw_type_to_string(enum kedr_sw_object_type t)
 /* ====================================================================== */
 
 
-/* Allocates memory for an event record and reads the record from the file.
- * Returns the pointer to the record if successful, NULL if there is nothing
- * to read.
- * Throws 'runtime_error' on error. */
-static struct kedr_tr_event_header *
-read_record(FILE *fd)
-{
-	struct kedr_tr_event_header header;
-	size_t nr_read;
-	struct kedr_tr_event_header *record = NULL;
-	size_t rest_size;
-	
-	errno = 0;
-	nr_read = fread(&header, sizeof(header), 1, fd);
-	if (nr_read == 0) {
-		int err = errno;
-		if (feof(fd))
-			return NULL;
-		
-		throw runtime_error(strerror(err));
-	}
-	
-	/* OK, having read the header, perform sanity checks and read the 
-	 * rest if needed. */
-	if ((int)header.event_size < (int)sizeof(header)) {
-		cerr << "Record #" << nrec 
-			<< ": invalid value of 'event_size' field: " 
-			<< (int)header.event_size << endl;
-		throw runtime_error(
-			"encountered invalid data in the input file.");
-	}
-	
-	record = (struct kedr_tr_event_header *)malloc(
-		(size_t)header.event_size);
-	if (record == NULL)
-		throw runtime_error("out of memory.");
-	
-	memcpy(record, &header, sizeof(header));
-	rest_size = (size_t)header.event_size - sizeof(header);
-	if (rest_size > 0) {
-		nr_read = fread((void *)((char *)record + sizeof(header)),
-			1, rest_size, fd);
-		if (nr_read < rest_size) {
-			cerr << "Record #" << nrec 
-				<< ": unexpected error or EOF." << endl;
-			free(record);
-			throw runtime_error(
-				"failed to read data.");
-		}
-	}
-	
-	++nrec;
-	return record;
-}
-
 static const char *
 get_maccess_type(__u32 read_mask, __u32 write_mask, unsigned int event_no)
 {
@@ -364,8 +322,24 @@ report_unlock_event(const struct kedr_tr_event_sync *ev, bool is_pre)
 		(unsigned long)ev->obj_id);
 }
 
+static void 
+report_stack_event(const struct kedr_tr_event_stack *ev)
+{
+	unsigned long pc = code_address_from_raw(ev->pc);
+	printf("STACK id=%u parent=%u pc=%lx\n", (unsigned int)ev->id,
+		(unsigned int)ev->parent, pc);
+}
+
+static void 
+report_thread_stack_event(const struct kedr_tr_event_thread_stack *ev)
+{
+	unsigned long tid = (unsigned long)ev->tid;
+	printf("TID=0x%lx THREAD_STACK id=%u\n", tid, 
+		(unsigned int)ev->stack_id);
+}
+
 static void
-process_record(kedr_tr_event_header *record)
+process_record(const struct kedr_tr_event_header *record)
 {
 	switch (record->type) {
 	case KEDR_TR_EVENT_SESSION_START:
@@ -373,127 +347,137 @@ process_record(kedr_tr_event_header *record)
 		break;
 
 	case KEDR_TR_EVENT_TARGET_LOAD:
-		report_load_event((struct kedr_tr_event_module *)record);
+		report_load_event((const struct kedr_tr_event_module *)record);
 		break;
 
 	case KEDR_TR_EVENT_TARGET_UNLOAD:
-		report_unload_event((struct kedr_tr_event_module *)record);
+		report_unload_event((const struct kedr_tr_event_module *)record);
 		break;
 
 	case KEDR_TR_EVENT_FENTRY:
 		report_func_event(
-			(struct kedr_tr_event_func *)record, true);
+			(const struct kedr_tr_event_func *)record, true);
 		break;
 
 	case KEDR_TR_EVENT_FEXIT:
 		report_func_event(
-			(struct kedr_tr_event_func *)record, false);
+			(const struct kedr_tr_event_func *)record, false);
 		break;
 
 	case KEDR_TR_EVENT_CALL_PRE:
 		report_call_event(
-			(struct kedr_tr_event_call *)record, true);
+			(const struct kedr_tr_event_call *)record, true);
 		break;
 
 	case KEDR_TR_EVENT_CALL_POST:
 		report_call_event(
-			(struct kedr_tr_event_call *)record, false);
+			(const struct kedr_tr_event_call *)record, false);
 		break;
 
 	case KEDR_TR_EVENT_MEM:
 		report_memory_events(
-			(struct kedr_tr_event_mem *)record);
+			(const struct kedr_tr_event_mem *)record);
 		break;
 
 	case KEDR_TR_EVENT_MEM_LOCKED:
 		report_locked_memory_event(
-			(struct kedr_tr_event_mem *)record);
+			(const struct kedr_tr_event_mem *)record);
 		break;
 
 	case KEDR_TR_EVENT_MEM_IO:
 		report_io_memory_event(
-			(struct kedr_tr_event_mem *)record);
+			(const struct kedr_tr_event_mem *)record);
 		break;
 
 	case KEDR_TR_EVENT_BARRIER_PRE:
 		report_barrier_event(
-			(struct kedr_tr_event_barrier *)record,
+			(const struct kedr_tr_event_barrier *)record,
 			true);
 		break;
 
 	case KEDR_TR_EVENT_BARRIER_POST:
 		report_barrier_event(
-			(struct kedr_tr_event_barrier *)record,
+			(const struct kedr_tr_event_barrier *)record,
 			false);
 		break;
 
 	case KEDR_TR_EVENT_ALLOC_PRE:
 		report_alloc_event(
-			(struct kedr_tr_event_alloc_free *)record,
+			(const struct kedr_tr_event_alloc_free *)record,
 			true);
 		break;
 
 	case KEDR_TR_EVENT_ALLOC_POST:
 		report_alloc_event(
-			(struct kedr_tr_event_alloc_free *)record,
+			(const struct kedr_tr_event_alloc_free *)record,
 			false);
 		break;
 
 	case KEDR_TR_EVENT_FREE_PRE:
 		report_free_event(
-			(struct kedr_tr_event_alloc_free *)record,
+			(const struct kedr_tr_event_alloc_free *)record,
 			true);
 		break;
 
 	case KEDR_TR_EVENT_FREE_POST:
 		report_free_event(
-			(struct kedr_tr_event_alloc_free *)record,
+			(const struct kedr_tr_event_alloc_free *)record,
 			false);
 		break;
 
 	case KEDR_TR_EVENT_SIGNAL_PRE:
 		report_signal_event(
-			(struct kedr_tr_event_sync *)record, true);
+			(const struct kedr_tr_event_sync *)record, true);
 		break;
 
 	case KEDR_TR_EVENT_SIGNAL_POST:
 		report_signal_event(
-			(struct kedr_tr_event_sync *)record, false);
+			(const struct kedr_tr_event_sync *)record, false);
 		break;
 
 	case KEDR_TR_EVENT_WAIT_PRE:
 		report_wait_event(
-			(struct kedr_tr_event_sync *)record, true);
+			(const struct kedr_tr_event_sync *)record, true);
 		break;
 
 	case KEDR_TR_EVENT_WAIT_POST:
 		report_wait_event(
-			(struct kedr_tr_event_sync *)record, false);
+			(const struct kedr_tr_event_sync *)record, false);
 		break;
 
 	case KEDR_TR_EVENT_LOCK_PRE:
 		report_lock_event(
-			(struct kedr_tr_event_sync *)record, true);
+			(const struct kedr_tr_event_sync *)record, true);
 		break;
 
 	case KEDR_TR_EVENT_LOCK_POST:
 		report_lock_event(
-			(struct kedr_tr_event_sync *)record, false);
+			(const struct kedr_tr_event_sync *)record, false);
 		break;
 
 	case KEDR_TR_EVENT_UNLOCK_PRE:
 		report_unlock_event(
-			(struct kedr_tr_event_sync *)record, true);
+			(const struct kedr_tr_event_sync *)record, true);
 		break;
 
 	case KEDR_TR_EVENT_UNLOCK_POST:
 		report_unlock_event(
-			(struct kedr_tr_event_sync *)record, false);
+			(const struct kedr_tr_event_sync *)record, false);
 		break;
 
 	case KEDR_TR_EVENT_BLOCK_ENTER:
 		report_block_event(
-			(struct kedr_tr_event_block *)record);
+			(const struct kedr_tr_event_block *)record);
+		break;
+
+	case KEDR_TR_EVENT_STACK:
+		report_stack_event(
+			(const struct kedr_tr_event_stack *)record);
+		break;
+
+	case KEDR_TR_EVENT_THREAD_STACK:
+		report_thread_stack_event(
+			(const struct kedr_tr_event_thread_stack *)record);
 		break;
 
 	case KEDR_TR_EVENT_THREAD_START:
@@ -505,85 +489,24 @@ process_record(kedr_tr_event_header *record)
 		cerr << "Record #" << nrec <<
 			": unknown event type: " << record->type <<
 			"." << endl;
-		free(record);
 		throw runtime_error("invalid event information.");
 		break;
 	}
 }
 
 static void
-process_compressed_record(kedr_tr_event_header *record)
+do_convert(int fd, const TraceIndex *index, unsigned int nr_jobs, 
+	   bool use_range, uint64_t first, uint64_t last)
 {
-	struct kedr_tr_event_compressed *ec =
-		(struct kedr_tr_event_compressed *)record;
-
-	if ((size_t)ec->orig_size <
-		sizeof(struct kedr_tr_event_header)) {
-		ostringstream err;
-		err << "Record #" << nrec << ": "
-			<< "invalid size of the data before compression: "
-			<< (unsigned int)ec->orig_size << ".";
-		throw runtime_error(err.str());
-	}
-
-	unsigned char *events = (unsigned char *)malloc(ec->orig_size);
-	if (events == NULL)
-		throw runtime_error("Out of memory.");
-
-	unsigned long to_process = (unsigned long)ec->orig_size;
-
-	int ret = lzo1x_decompress_safe(
-		ec->compressed, ec->compressed_size,
-		events, &to_process, NULL);
-	if (ret != LZO_E_OK || ec->orig_size != to_process) {
-		ostringstream err;
-		err << "Record #" << nrec << ": "
-			<< "failed to decompress data, error code: " << ret;
-		throw runtime_error(err.str());
-	}
-
-	while (to_process != 0) {
-		if (to_process < sizeof(
-			struct kedr_tr_event_header)) {
-			ostringstream err;
-			err << "Record #" << nrec << ": "
-				<< "invalid size of a decompressed event.";
-			throw runtime_error(err.str());
-		}
-
-		struct kedr_tr_event_header *hdr =
-			(struct kedr_tr_event_header *)events;
-		if (to_process < hdr->event_size) {
-			ostringstream err;
-			err << "Record #" << nrec << ": "
-				<< "compressed event may be corrupted.";
-			throw runtime_error(err.str());
-		}
-
-		process_record(hdr);
-
-		events = events + hdr->event_size;
-		to_process -= hdr->event_size;
-	}
-}
+	ParallelReader reader(fd, index, nr_jobs);
+	const struct kedr_tr_event_header *record;
 
-static void
-do_convert(FILE *fd)
-{
-	struct kedr_tr_event_header *record = NULL;
+	if (use_range)
+		reader.set_range(first, last);
 	
-	for (;;) {
-		record = read_record(fd);
-		if (record == NULL)
-			break;
-
-		if (record->type == KEDR_TR_EVENT_COMPRESSED) {
-			process_compressed_record(record);
-		}
-		else {
-			process_record(record);
-		}
-		free(record);
+	while ((record = reader.next_event()) != NULL) {
+		nrec = reader.get_nr_records();
+		process_record(record);
 	}
 }
 /* ====================================================================== */
@@ -591,10 +514,45 @@ do_convert(FILE *fd)
 int 
 main(int argc, char *argv[])
 {
-	FILE *fd;
+	int fd;
 	int ret = EXIT_SUCCESS;
+	int opt;
+	const char *index_file = NULL;
+	unsigned int nr_jobs = 1;
+	bool use_range = false;
+	unsigned long long first = 0;
+	unsigned long long last = 0;
+	TraceIndex index;
 	
-	if (argc != 2) {
+	while ((opt = getopt(argc, argv, "i:j:r:")) != -1) {
+		switch (opt) {
+		case 'i':
+			index_file = optarg;
+			break;
+		case 'j':
+			nr_jobs = (unsigned int)atoi(optarg);
+			if (nr_jobs == 0) {
+				cerr << "Invalid number of jobs: " 
+					<< optarg << endl;
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'r':
+			if (sscanf(optarg, "%llu-%llu", &first, &last) != 2 ||
+			    first > last) {
+				cerr << "Invalid range of events: " 
+					<< optarg << endl;
+				return EXIT_FAILURE;
+			}
+			use_range = true;
+			break;
+		default:
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+	
+	if (optind != argc - 1) {
 		usage();
 		return EXIT_FAILURE;
 	}
@@ -605,22 +563,26 @@ main(int argc, char *argv[])
 	}
 
 	errno = 0;
-	fd = fopen(argv[1], "r");
-	if (fd == NULL) {
-		cerr << "Failed to open " << argv[1] << ": "
+	fd = open(argv[optind], O_RDONLY);
+	if (fd == -1) {
+		cerr << "Failed to open " << argv[optind] << ": "
 			<< strerror(errno) << endl;
 		return EXIT_FAILURE;
 	}
 	
 	try {
-		do_convert(fd);
+		if (index_file != NULL)
+			index.load(index_file);
+		
+		do_convert(fd, (index_file != NULL ? &index : NULL), nr_jobs,
+			   use_range, (uint64_t)first, (uint64_t)last);
 	}
 	catch (runtime_error &e) {
 		cerr << "Error: " << e.what() << endl;
 		ret = EXIT_FAILURE;
 	}
 	
-	fclose(fd);
+	close(fd);
 	return ret;
 }
 /* ====================================================================== */
@@ -0,0 +1,372 @@
+/* trace_index.cpp - the index of a trace file saved by the simple trace
+ * recorder. */
+
+/* ========================================================================
+ * Copyright (C) 2014, ROSA Laboratory
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ ======================================================================== */
+
+#include <sstream>
+#include <algorithm>
+#include <map>
+
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <stdint.h>
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <errno.h>
+
+#include "record_reader.h"
+#include "trace_index.h"
+
+using namespace std;
+/* ====================================================================== */
+
+const unsigned char *
+trace_map_file(int fd, size_t &size)
+{
+	struct stat st;
+
+	if (fstat(fd, &st) != 0) {
+		throw TraceIndex::Error(
+			string("Failed to get the size of the trace: ") +
+			strerror(errno));
+	}
+
+	if (!S_ISREG(st.st_mode) ||
+	    (uint64_t)st.st_size > (uint64_t)(size_t)-1)
+		throw TraceIndex::Error(
+			"The trace must be a regular file to be indexed.");
+
+	size = (size_t)st.st_size;
+	if (size == 0)
+		return NULL;
+
+	void *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p == MAP_FAILED) {
+		throw TraceIndex::Error(
+			string("Failed to map the trace to memory: ") +
+			strerror(errno));
+	}
+	return (const unsigned char *)p;
+}
+/* ====================================================================== */
+
+TraceIndex::TraceIndex()
+	: trace_size(0), nr_events(0)
+{}
+
+/* Returns true if the event has a thread ID, false otherwise. */
+static bool
+event_has_tid(const struct kedr_tr_event_header *ev)
+{
+	switch (ev->type) {
+	case KEDR_TR_EVENT_SESSION_START:
+	case KEDR_TR_EVENT_SESSION_END:
+	case KEDR_TR_EVENT_TARGET_LOAD:
+	case KEDR_TR_EVENT_TARGET_UNLOAD:
+		return false;
+	default:
+		break;
+	}
+
+	/* The thread ID follows the header in all other events. */
+	return ((size_t)ev->event_size >=
+		sizeof(struct kedr_tr_event_header) + sizeof(__u64));
+}
+
+static void
+build_error(unsigned int nrec, const char *what)
+{
+	ostringstream err;
+	err << "Record #" << nrec << ": " << what;
+	throw TraceIndex::Error(err.str());
+}
+
+void
+TraceIndex::build(int fd)
+{
+	size_t size = 0;
+	const unsigned char *map = trace_map_file(fd, size);
+	RecordReader reader(map, 0);
+
+	/* tid => index in 'threads' */
+	std::map<uint64_t, size_t> thread_map;
+	std::map<uint64_t, size_t>::iterator it;
+
+	trace_size = size;
+	nr_events = 0;
+	records.clear();
+	modules.clear();
+	threads.clear();
+
+	try {
+		size_t offset = 0;
+		while (offset < size) {
+			const struct kedr_tr_event_header *hdr =
+				(const struct kedr_tr_event_header *)
+					(map + offset);
+			const struct kedr_tr_event_header *ev;
+			struct kedr_tr_index_record rec;
+			unsigned int nr_block_infos;
+
+			if (size - offset < sizeof(*hdr))
+				build_error(records.size(),
+					    "unexpected end of the trace.");
+
+			if ((size_t)hdr->event_size < sizeof(*hdr) ||
+			    (size_t)hdr->event_size > size - offset)
+				build_error(records.size(),
+					    "invalid size of the record.");
+
+			memset(&rec, 0, sizeof(rec));
+			rec.offset = offset;
+			rec.first_event = nr_events;
+			rec.size = hdr->event_size;
+			rec.type = hdr->type;
+
+			switch (hdr->type) {
+			case KEDR_TR_EVENT_COMPRESSED:
+			case KEDR_TR_EVENT_COMPACT:
+			case KEDR_TR_EVENT_CHUNK:
+				rec.flags |= KEDR_TR_INDEX_SERIES;
+				break;
+			case KEDR_TR_EVENT_SESSION_START:
+			case KEDR_TR_EVENT_SESSION_END:
+				rec.flags |= KEDR_TR_INDEX_SESSION;
+				break;
+			default:
+				break;
+			}
+
+			nr_block_infos = reader.get_nr_block_infos();
+			reader.set_data(hdr, (size_t)hdr->event_size,
+					records.size());
+			while ((ev = reader.next_event()) != NULL) {
+				if (ev->type == KEDR_TR_EVENT_TARGET_LOAD ||
+				    ev->type == KEDR_TR_EVENT_TARGET_UNLOAD) {
+					const struct kedr_tr_event_module *em =
+					(const struct kedr_tr_event_module *)ev;
+					struct kedr_tr_index_module m;
+
+					memset(&m, 0, sizeof(m));
+					m.event = nr_events;
+					m.record = records.size();
+					m.type = ev->type;
+					/* The name may be not terminated
+					 * in a damaged trace. */
+					memcpy(m.name, em->name,
+					       KEDR_TARGET_NAME_LEN);
+					m.name[KEDR_TARGET_NAME_LEN] = 0;
+					modules.push_back(m);
+					rec.flags |= KEDR_TR_INDEX_TARGET;
+				}
+				else if (event_has_tid(ev)) {
+					__u64 tid;
+					memcpy(&tid, (const char *)ev +
+					       sizeof(*ev), sizeof(tid));
+
+					it = thread_map.find(tid);
+					if (it == thread_map.end()) {
+						struct kedr_tr_index_thread t;
+						t.tid = tid;
+						t.nr_events = 0;
+						t.first_event = nr_events;
+						t.first_record = records.size();
+						threads.push_back(t);
+						it = thread_map.insert(
+							make_pair(tid,
+							threads.size() - 1))
+							.first;
+					}
+
+					struct kedr_tr_index_thread &t =
+						threads[it->second];
+					++t.nr_events;
+					t.last_event = nr_events;
+					t.last_record = records.size();
+				}
+				++nr_events;
+				++rec.nr_events;
+			}
+			if (reader.get_nr_block_infos() != nr_block_infos)
+				rec.flags |= KEDR_TR_INDEX_BLOCKS;
+
+			records.push_back(rec);
+			offset += (size_t)hdr->event_size;
+		}
+	}
+	catch (...) {
+		if (map != NULL)
+			munmap((void *)map, size);
+		throw;
+	}
+
+	if (map != NULL)
+		munmap((void *)map, size);
+}
+/* ====================================================================== */
+
+void
+TraceIndex::save(const string &path) const
+{
+	struct kedr_tr_index_header hdr;
+	FILE *f;
+	bool ok;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(&hdr.magic[0], KEDR_TR_INDEX_MAGIC, KEDR_TR_INDEX_MAGIC_LEN);
+	hdr.version = KEDR_TR_INDEX_VERSION;
+	hdr.trace_size = trace_size;
+	hdr.nr_events = nr_events;
+	hdr.nr_records = records.size();
+	hdr.nr_modules = (__u32)modules.size();
+	hdr.nr_threads = (__u32)threads.size();
+
+	f = fopen(path.c_str(), "wb");
+	if (f == NULL) {
+		throw TraceIndex::Error(
+			string("Failed to create ") + path + ": " +
+			strerror(errno));
+	}
+
+	ok = (fwrite(&hdr, sizeof(hdr), 1, f) == 1);
+	if (ok && !records.empty())
+		ok = (fwrite(&records[0], sizeof(records[0]),
+			     records.size(), f) == records.size());
+	if (ok && !modules.empty())
+		ok = (fwrite(&modules[0], sizeof(modules[0]),
+			     modules.size(), f) == modules.size());
+	if (ok && !threads.empty())
+		ok = (fwrite(&threads[0], sizeof(threads[0]),
+			     threads.size(), f) == threads.size());
+
+	if (fclose(f) != 0)
+		ok = false;
+
+	if (!ok)
+		throw TraceIndex::Error(
+			string("Failed to write the index to ") + path);
+}
+
+/* Reads 'nr' items of type T from the file to 'v'. */
+template <typename T> static bool
+read_items(FILE *f, std::vector<T> &v, uint64_t nr)
+{
+	/* Do not trust the numbers from the file too much: a corrupted
+	 * header must not lead to a huge allocation. */
+	v.clear();
+	while (nr != 0) {
+		T item;
+		if (fread(&item, sizeof(item), 1, f) != 1)
+			return false;
+		v.push_back(item);
+		--nr;
+	}
+	return true;
+}
+
+void
+TraceIndex::load(const string &path)
+{
+	struct kedr_tr_index_header hdr;
+	FILE *f;
+	bool ok;
+
+	f = fopen(path.c_str(), "rb");
+	if (f == NULL) {
+		throw TraceIndex::Error(
+			string("Failed to open ") + path + ": " +
+			strerror(errno));
+	}
+
+	ok = (fread(&hdr, sizeof(hdr), 1, f) == 1 &&
+	      memcmp(&hdr.magic[0], KEDR_TR_INDEX_MAGIC,
+		     KEDR_TR_INDEX_MAGIC_LEN) == 0);
+	if (!ok) {
+		fclose(f);
+		throw TraceIndex::Error(path + " is not a trace index.");
+	}
+
+	if (hdr.version != KEDR_TR_INDEX_VERSION) {
+		fclose(f);
+		ostringstream err;
+		err << path << ": unsupported version of the index: "
+			<< hdr.version << ".";
+		throw TraceIndex::Error(err.str());
+	}
+
+	ok = read_items(f, records, hdr.nr_records) &&
+		read_items(f, modules, hdr.nr_modules) &&
+		read_items(f, threads, hdr.nr_threads);
+	fclose(f);
+	if (!ok)
+		throw TraceIndex::Error(path + ": the index is truncated.");
+
+	trace_size = hdr.trace_size;
+	nr_events = hdr.nr_events;
+
+	/* Make sure the records are consistent, so that the users of the
+	 * index can rely on that. */
+	uint64_t offset = 0;
+	uint64_t event = 0;
+	for (size_t i = 0; i < records.size(); ++i) {
+		if (records[i].offset != offset ||
+		    records[i].first_event != event ||
+		    records[i].size < sizeof(struct kedr_tr_event_header))
+			throw TraceIndex::Error(
+				path + ": the index is corrupted.");
+		offset += records[i].size;
+		event += records[i].nr_events;
+	}
+	if (offset != trace_size || event != nr_events)
+		throw TraceIndex::Error(path + ": the index is corrupted.");
+}
+/* ====================================================================== */
+
+void
+TraceIndex::check(int fd) const
+{
+	struct stat st;
+
+	if (fstat(fd, &st) != 0) {
+		throw TraceIndex::Error(
+			string("Failed to get the size of the trace: ") +
+			strerror(errno));
+	}
+
+	if (!S_ISREG(st.st_mode) || (uint64_t)st.st_size != trace_size)
+		throw TraceIndex::Error(
+			"The index does not match the trace.");
+}
+
+static bool
+first_event_less(uint64_t event, const struct kedr_tr_index_record &rec)
+{
+	return event < rec.first_event;
+}
+
+size_t
+TraceIndex::find_record(uint64_t event) const
+{
+	if (event >= nr_events)
+		return records.size();
+
+	/* The last record starting at or before the event. The records
+	 * without events, if any, start at the same event as the next
+	 * record, so they are skipped this way. */
+	vector<struct kedr_tr_index_record>::const_iterator pos =
+		upper_bound(records.begin(), records.end(), event,
+			    first_event_less);
+	return (size_t)(pos - records.begin()) - 1;
+}
+/* ====================================================================== */
@@ -0,0 +1,221 @@
+/* trace_index.h - the index of a trace file saved by the simple trace
+ * recorder.
+ *
+ * The records of a trace file can only be found by reading the file from
+ * the beginning, and the events in a series must be decompressed and
+ * decoded to find out what the series contains. The index is a separate
+ * file ("sidecar") that lists the records with their offsets in the trace
+ * file, the numbers of the events they contain, the positions of "target
+ * load" and "target unload" events and the ranges of records and events
+ * for each thread. With the index, the tools can decode the series in
+ * parallel (see parallel_reader.h) and start from a given event without
+ * decoding the trace from the beginning.
+ *
+ * Each series of events is encoded independently: the thread table and
+ * the previous addresses of the compact format are reset at the start of
+ * each series, see recorder.h. The only state carried from one series to
+ * the next one is the information about the blocks of code from
+ * BLOCK_INFO events, so the index marks the records containing such
+ * events rather than storing the state of the decoder for each record.
+ *
+ * The events are numbered from 0 in the order RecordReader::next_event()
+ * returns them.
+ *
+ * The index file has the following structure (all numbers are in the byte
+ * order of the machine the index has been created on):
+ *   struct kedr_tr_index_header;
+ *   struct kedr_tr_index_record[header.nr_records];
+ *   struct kedr_tr_index_module[header.nr_modules];
+ *   struct kedr_tr_index_thread[header.nr_threads]; */
+
+/* ========================================================================
+ * Copyright (C) 2014, ROSA Laboratory
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ ======================================================================== */
+
+#ifndef TRACE_INDEX_H_1734_INCLUDED
+#define TRACE_INDEX_H_1734_INCLUDED
+
+#include <cstddef>
+#include <stdint.h>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "recorder.h"
+/* ====================================================================== */
+
+/* The first bytes of an index file. */
+#define KEDR_TR_INDEX_MAGIC "KEDRTIDX"
+#define KEDR_TR_INDEX_MAGIC_LEN 8
+
+#define KEDR_TR_INDEX_VERSION 1
+
+struct kedr_tr_index_header
+{
+	char magic[KEDR_TR_INDEX_MAGIC_LEN];
+	__u32 version;
+	__u32 reserved;
+
+	/* Size of the trace file the index has been created for. Used to
+	 * detect the indexes that do not match the trace. */
+	__u64 trace_size;
+
+	/* The total number of events in the trace. */
+	__u64 nr_events;
+
+	__u64 nr_records;
+	__u32 nr_modules;
+	__u32 nr_threads;
+} __attribute__ ((packed));
+
+/* Flags for the records. */
+enum kedr_tr_index_flags
+{
+	/* A series of events. */
+	KEDR_TR_INDEX_SERIES = 0x1,
+
+	/* The series contains BLOCK_INFO events. The series after it may
+	 * refer to these blocks of code, so it must be decoded before
+	 * them. */
+	KEDR_TR_INDEX_BLOCKS = 0x2,
+
+	/* The record contains "target load" or "target unload" events. */
+	KEDR_TR_INDEX_TARGET = 0x4,
+
+	/* "Session start" or "session end" record. */
+	KEDR_TR_INDEX_SESSION = 0x8
+};
+
+/* A record of the trace. */
+struct kedr_tr_index_record
+{
+	/* Offset of the record in the trace file. */
+	__u64 offset;
+
+	/* The number of the first event in the record. */
+	__u64 first_event;
+
+	/* The size of the record, the same as 'event_size' in its
+	 * header. */
+	__u32 size;
+
+	/* The type of the record, see enum kedr_tr_event_type. */
+	__u32 type;
+
+	/* The number of events in the record. */
+	__u32 nr_events;
+
+	__u32 flags;
+} __attribute__ ((packed));
+
+/* "Target load" or "target unload" event. */
+struct kedr_tr_index_module
+{
+	/* The number of the event and the index of the record containing
+	 * it. */
+	__u64 event;
+	__u64 record;
+
+	/* KEDR_TR_EVENT_TARGET_LOAD or KEDR_TR_EVENT_TARGET_UNLOAD. */
+	__u32 type;
+	char name[KEDR_TARGET_NAME_LEN + 1];
+} __attribute__ ((packed));
+
+/* The events of a thread. */
+struct kedr_tr_index_thread
+{
+	__u64 tid;
+
+	/* The number of the events of this thread and the range of the
+	 * events containing them, [first_event, last_event]. */
+	__u64 nr_events;
+	__u64 first_event;
+	__u64 last_event;
+
+	/* The range of the records containing these events,
+	 * [first_record, last_record]. The offsets of these records
+	 * give the range of bytes in the trace file. */
+	__u64 first_record;
+	__u64 last_record;
+} __attribute__ ((packed));
+/* ====================================================================== */
+
+class TraceIndex
+{
+public:
+	/* The methods of TraceIndex throw this kind of exceptions when an
+	 * error occurs. */
+	class Error: public std::runtime_error
+	{
+	public:
+		Error(const std::string &what_arg) :
+			std::runtime_error(what_arg)
+		{}
+	};
+
+public:
+	/* Creates an empty index. */
+	TraceIndex();
+
+	/* Creates the index for the trace file with the given descriptor.
+	 * The file must be a regular file. The whole trace is decoded for
+	 * that.
+	 *
+	 * Throws TraceIndex::Error() on failure and RecordReader::Error() if
+	 * the trace is corrupted. */
+	void build(int fd);
+
+	/* Loads the index from the given file / saves it there.
+	 * Throw TraceIndex::Error() on failure. */
+	void load(const std::string &path);
+	void save(const std::string &path) const;
+
+	/* Checks if the index matches the trace file with the given
+	 * descriptor. Throws TraceIndex::Error() if it does not. */
+	void check(int fd) const;
+
+	/* Returns the index of the record containing the event with the
+	 * given number, the number of records if there is no such event. */
+	size_t find_record(uint64_t event) const;
+
+	uint64_t get_nr_events() const
+	{
+		return nr_events;
+	}
+
+	const std::vector<struct kedr_tr_index_record> &get_records() const
+	{
+		return records;
+	}
+
+	const std::vector<struct kedr_tr_index_module> &get_modules() const
+	{
+		return modules;
+	}
+
+	const std::vector<struct kedr_tr_index_thread> &get_threads() const
+	{
+		return threads;
+	}
+
+private:
+	uint64_t trace_size;
+	uint64_t nr_events;
+	std::vector<struct kedr_tr_index_record> records;
+	std::vector<struct kedr_tr_index_module> modules;
+	std::vector<struct kedr_tr_index_thread> threads;
+};
+/* ====================================================================== */
+
+/* Returns the size of the regular file with the given descriptor and maps
+ * the file to memory. Throws TraceIndex::Error() on failure. The mapping
+ * should be removed with munmap() when no longer needed. */
+const unsigned char *
+trace_map_file(int fd, size_t &size);
+/* ====================================================================== */
+#endif // TRACE_INDEX_H_1734_INCLUDED
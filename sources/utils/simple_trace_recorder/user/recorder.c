@@ -4,16 +4,36 @@
  * the file specified in its parameters. 
  * 
  * Usage: 
- * 	kedr_simple_trace_recorder <file_to_save_data_to>
+ * 	kedr_simple_trace_recorder [--stats] [--spin <usec>] 
+ *		<file_to_save_data_to>
  * 
  * <file_to_save_data_to> - path to the file to save the trace to. If the 
  * file does not exist, it will be created. The previous contents of the 
  * file will be cleared. 
  *
+ * If the kernel part operates in the flight recorder mode 
+ * ('flight_recorder' parameter is non-zero), the data are available only 
+ * when a snapshot is taken. Each snapshot is saved to a separate file, 
+ * <file_to_save_data_to>.<N>, where <N> is the sequence number of the 
+ * snapshot. <file_to_save_data_to> itself is not created in this mode.
+ *
+ * --stats - when finished, output the amount of data saved and the time 
+ * spent saving them to stderr. The drain rate can be compared with the rate
+ * the data arrived at ("average input rate") to see how much headroom the
+ * application has. The number of wake-ups per megabyte of data and the 
+ * time needed to save each portion of data are output too.
+ *
+ * --spin <usec> - after the available data have been saved, check for new 
+ * data for up to <usec> microseconds before going to sleep in poll(). This 
+ * reduces the delay between the moment the data become available and the 
+ * moment they are saved, at the cost of CPU time. Makes sense if a CPU can
+ * be dedicated to this application. 0 (default) means no spinning.
+ *
  * The application stops polling the file and exits when it sees
  * "session end" event or if it is interrupted by a signal. If the signal is
  * SIGINT (e.g., Ctrl+C) or SIGTERM (e.g., plain 'kill'), the application
- * also saves the remaining available data before exiting. */
+ * also saves the remaining available data before exiting. In the flight 
+ * recorder mode, it requests a snapshot and saves it in this case. */
 
 /* ========================================================================
  * Copyright (C) 2013-2014, ROSA Laboratory
@@ -28,6 +48,9 @@
  * by the Free Software Foundation.
  ======================================================================== */
 
+/* For clock_gettime(). */
+#define _POSIX_C_SOURCE 199309L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -38,6 +61,8 @@
 #include <poll.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
+#include <time.h>
 
 #include <simple_trace_recorder/recorder.h>
 #include <kedr_st_rec_config.h>
@@ -47,11 +72,13 @@
 #if defined(__i386__)
 #define tr_smp_mb()	asm volatile("lock; addl $0,0(%%esp)" ::: "memory")
 #define tr_smp_rmb()	tr_smp_mb()
+#define tr_cpu_relax()	asm volatile("rep; nop" ::: "memory")
 #endif
 
 #if defined(__x86_64__)
 #define tr_smp_mb()	asm volatile("mfence" ::: "memory")
 #define tr_smp_rmb()	asm volatile("lfence" ::: "memory")
+#define tr_cpu_relax()	asm volatile("rep; nop" ::: "memory")
 #endif
 /* ====================================================================== */
 
@@ -59,16 +86,24 @@ static const char *out_file = NULL;
 static const char *in_file = 
 	KEDR_ST_REC_DEBUGFS_DIR "/" KEDR_ST_REC_KMODULE_NAME "/buffer";
 
-/* The file containing the value of 'nr_data_pages' parameter of the kernel
- * module. */
-static const char *param_file = 
-	"/sys/module/" KEDR_ST_REC_KMODULE_NAME "/parameters/nr_data_pages";
+/* Writing to this file takes a snapshot in the flight recorder mode. */
+static const char *snapshot_file = 
+	KEDR_ST_REC_DEBUGFS_DIR "/" KEDR_ST_REC_KMODULE_NAME "/snapshot";
+
+/* The directory containing the files with the values of the parameters of
+ * the kernel module. */
+static const char *param_dir = 
+	"/sys/module/" KEDR_ST_REC_KMODULE_NAME "/parameters/";
 
 static unsigned int nr_data_pages = 0;
+static unsigned int flight_recorder = 0;
 static unsigned long page_size = 0;
 static unsigned int buffer_size = 0;
 
 static volatile int done = 0;
+
+/* Nonzero if "session end" event has been saved. */
+static int session_ended = 0;
 /* ====================================================================== */
 
 /* Returns the current write position in the buffer. Note that the 
@@ -107,8 +142,8 @@ set_read_pos(void *buffer, __u32 new_read_pos)
 static void
 print_usage(void)
 {
-	printf("Usage:\n\tkedr_simple_trace_recorder "
-		"<file_to_save_data_to>\n");
+	printf("Usage:\n\tkedr_simple_trace_recorder [--stats] "
+		"[--spin <usec>] <file_to_save_data_to>\n");
 }
 
 static int 
@@ -152,14 +187,115 @@ enough_space_for_header(__u32 rp)
 	return (offset + sizeof(struct kedr_tr_event_header) <= page_size);
 }
 
+/* The data to be written to the output file are collected as a list of
+ * segments of the mmapped buffer and then written with a single call to
+ * writev(). The records in a page follow each other without gaps, only the
+ * space at the end of a page may be unused (SKIP), so a segment usually
+ * covers all the records from a page or more (compressed series may cross
+ * page boundaries). */
+#define KEDR_NR_SEGMENTS 256
+
+static struct iovec segments[KEDR_NR_SEGMENTS];
+static unsigned int nr_segments = 0;
+
+/* How long to wait for new data actively before calling poll(), in 
+ * microseconds. */
+static unsigned long spin_usec = 0;
+
+/* Statistics, reported if '--stats' is specified. */
+static int show_stats = 0;
+static unsigned long long bytes_written = 0;
+static unsigned long long nr_writes = 0;
+static unsigned long long nr_wakeups = 0;
+static unsigned long long nr_drains = 0;
+static double drain_time = 0.0;
+static double drain_time_max = 0.0;
+
+static double
+get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Writes the collected segments to the output file. */
+static int
+write_segments(int fd_out)
+{
+	struct iovec *iov = &segments[0];
+	unsigned int nr = nr_segments;
+	ssize_t ret;
+
+	nr_segments = 0;
+	while (nr != 0) {
+		ret = writev(fd_out, iov, (int)nr);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr,
+				"Failed to write the events to the file: %s\n",
+				strerror(errno));
+			return 1;
+		}
+		++nr_writes;
+		bytes_written += (unsigned long long)ret;
+
+		/* Partial write, skip what has been written. */
+		while (nr != 0 && (size_t)ret >= iov->iov_len) {
+			ret -= (ssize_t)iov->iov_len;
+			++iov;
+			--nr;
+		}
+		if (nr != 0) {
+			iov->iov_base = (char *)iov->iov_base + ret;
+			iov->iov_len -= (size_t)ret;
+		}
+	}
+	return 0;
+}
+
+/* Adds the given area of the buffer to the data to be written. If the area
+ * immediately follows the last segment, that segment is extended. */
+static int
+add_segment(void *addr, size_t size, int fd_out)
+{
+	struct iovec *last;
+
+	if (nr_segments != 0) {
+		last = &segments[nr_segments - 1];
+		if ((char *)last->iov_base + last->iov_len == (char *)addr) {
+			last->iov_len += size;
+			return 0;
+		}
+	}
+
+	if (nr_segments == KEDR_NR_SEGMENTS && write_segments(fd_out) != 0)
+		return 1;
+
+	segments[nr_segments].iov_base = addr;
+	segments[nr_segments].iov_len = size;
+	++nr_segments;
+	return 0;
+}
+
 /* Reads the data currently available in the buffer and writes the event 
- * information to the output file. */
+ * information to the output file. 
+ *
+ * The records are not copied one by one: only their headers are examined to
+ * find where the unused space in each page begins, the runs of records are
+ * then written to the file directly from the buffer. */
 static int
-process_data(void *buffer, FILE *outf)
+process_data(void *buffer, int fd_out)
 {
 	__u32 wp;
 	__u32 rp;
 	struct kedr_tr_event_header *treh;
+	double start = 0.0;
+	int err = 0;
+
+	if (show_stats)
+		start = get_time();
 	
 	rp = get_read_pos(buffer);
 	wp = get_write_pos(buffer);
@@ -175,7 +311,8 @@ process_data(void *buffer, FILE *outf)
 		if (treh->type >= KEDR_TR_EVENT_MAX) {
 			fprintf(stderr, "Unknown event type: %u (pos=%u)\n",
 				(unsigned int)treh->type, (unsigned int)rp);
-			return 1;
+			err = 1;
+			break;
 		}
 		else if (treh->type == KEDR_TR_EVENT_SKIP) {
 			rp = skip_to_next_page(rp);
@@ -188,7 +325,8 @@ process_data(void *buffer, FILE *outf)
 				"Event size is too large: %u (pos=%u)\n",
 				(unsigned int)treh->event_size, 
 				(unsigned int)rp);
-			return 1;
+			err = 1;
+			break;
 		}
 
 		/* As the buffer "wraps" at the end, an event may cross the
@@ -198,54 +336,274 @@ process_data(void *buffer, FILE *outf)
 			/* Save the both parts of the event. */
 			__u32 size_part = (__u32)buffer_size - rp;
 
-			errno = 0;
-			fwrite(treh, (size_t)size_part, 1, outf);
-			if (errno != 0) {
-				fprintf(stderr,
-		"Failed to write an event (pos=%u) to the file: %s\n",
-					(unsigned int)rp,
-					strerror(errno));
-				return 1;
-			}
+			err = add_segment(treh, (size_t)size_part, fd_out);
+			if (err)
+				break;
 
-			fwrite(buffer_pos_to_addr(buffer, 0),
-			       (size_t)(treh->event_size - size_part),
-			       1,
-			       outf);
-			if (errno != 0) {
-				fprintf(stderr,
-		"Failed to write an event (pos=0) to the file: %s\n",
-					strerror(errno));
-				return 1;
-			}
+			err = add_segment(buffer_pos_to_addr(buffer, 0),
+				(size_t)(treh->event_size - size_part),
+				fd_out);
 		}
 		else {
 			/* The event does not cross the end of the buffer.*/
-			errno = 0;
-			fwrite(treh, (size_t)treh->event_size, 1, outf);
-			if (errno != 0) {
-				fprintf(stderr,
-		"Failed to write an event (pos=%u) to the file: %s\n",
-					(unsigned int)rp,
-					strerror(errno));
-				return 1;
-			}
+			err = add_segment(treh, (size_t)treh->event_size,
+					  fd_out);
 		}
+		if (err)
+			break;
+
 		rp = (rp + treh->event_size) & (buffer_size - 1);
 				
 		/* Finish if the last target module has been unloaded
 		 * (that is, the session has ended). */
 		if (treh->type == KEDR_TR_EVENT_SESSION_END) {
+			session_ended = 1;
 			done = 1;
 			break;
 		}
 	}
-	set_read_pos(buffer, rp);
-	return 0; /* OK */
+
+	/* The events found before the error are saved anyway. */
+	if (write_segments(fd_out) != 0)
+		return 1;
+
+	if (!err)
+		set_read_pos(buffer, rp);
+
+	if (show_stats) {
+		double t = get_time() - start;
+
+		++nr_drains;
+		drain_time += t;
+		if (t > drain_time_max)
+			drain_time_max = t;
+	}
+	return err;
+}
+
+static void
+print_stats(double total_time)
+{
+	const double mb = 1024.0 * 1024.0;
+
+	fprintf(stderr, "Saved %llu bytes in %llu write operation(s).\n",
+		bytes_written, nr_writes);
+	if (drain_time > 0.0) {
+		fprintf(stderr, "Time spent saving the data: %.3f s, "
+			"drain rate: %.1f MB/s.\n",
+			drain_time, bytes_written / mb / drain_time);
+	}
+	if (total_time > 0.0) {
+		fprintf(stderr, "Total time: %.3f s, "
+			"average input rate: %.1f MB/s.\n",
+			total_time, bytes_written / mb / total_time);
+	}
+	fprintf(stderr, "Wake-ups: %llu", nr_wakeups);
+	if (bytes_written != 0) {
+		fprintf(stderr, " (%.2f per MB)",
+			nr_wakeups * mb / bytes_written);
+	}
+	fprintf(stderr, ".\n");
+	if (nr_drains != 0) {
+		fprintf(stderr, "Portions of data saved: %llu, "
+			"time per portion: average %.1f us, max %.1f us.\n",
+			nr_drains, drain_time * 1e6 / nr_drains,
+			drain_time_max * 1e6);
+	}
+}
+
+/* Waits until new data may be available in the buffer. If 'spin_usec' is
+ * not 0, checks the write position for that long first and only then 
+ * sleeps in poll(). */
+static int
+wait_for_data(void *buffer, struct pollfd *pollfd)
+{
+	int ret;
+
+	if (spin_usec != 0) {
+		double end = get_time() + spin_usec / 1e6;
+
+		do {
+			if (done || get_write_pos(buffer) != 
+			    get_read_pos(buffer))
+				return 0;
+			tr_cpu_relax();
+		} while (get_time() < end);
+	}
+
+	errno = 0;
+	ret = poll(pollfd, 1, -1);
+	if (ret == -1 && errno != EAGAIN && errno != EINTR) {
+		fprintf(stderr, 
+			"Failed to poll() the input file: %s\n",
+			strerror(errno));
+		return 1;
+	}
+	if (ret > 0)
+		++nr_wakeups;
+	return 0;
+}
+
+/* Flight recorder mode: the file the current snapshot is saved to and 
+ * the sequence number of that snapshot. */
+static int fd_snapshot = -1;
+static __u32 snapshot_seq = 0;
+
+/* Flight recorder mode: saves the records in the header of the snapshot
+ * with the given sequence number to a new file. The data from the buffer
+ * are to be saved to that file too. */
+static int
+start_snapshot(void *buffer, __u32 seq)
+{
+	struct kedr_tr_start_page *sp = buffer;
+	char *name;
+	ssize_t ret;
+	size_t done_size = 0;
+	size_t header_size = sp->header_size;
+	int err = 0;
+
+	if (fd_snapshot != -1 && close(fd_snapshot) != 0) {
+		fprintf(stderr, "Failed to close the file for snapshot #%u: "
+			"%s\n", (unsigned int)snapshot_seq, strerror(errno));
+		fd_snapshot = -1;
+		return 1;
+	}
+	fd_snapshot = -1;
+	
+	if (header_size > KEDR_TR_SNAPSHOT_HEADER_SIZE) {
+		fprintf(stderr, "Invalid size of the snapshot header: %u\n",
+			(unsigned int)header_size);
+		return 1;
+	}
+
+	name = malloc(strlen(out_file) + 16);
+	if (name == NULL) {
+		fprintf(stderr, "Not enough memory.\n");
+		return 1;
+	}
+	sprintf(name, "%s.%u", out_file, (unsigned int)seq);
+
+	errno = 0;
+	fd_snapshot = open(name, O_WRONLY | O_CREAT | O_TRUNC, 
+		S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+	if (fd_snapshot == -1) {
+		fprintf(stderr, "Failed to open output file (%s): %s\n",
+			name, strerror(errno));
+		free(name);
+		return 1;
+	}
+	snapshot_seq = seq;
+
+	while (done_size < header_size) {
+		ret = write(fd_snapshot, &sp->header[done_size], 
+			    header_size - done_size);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "Failed to write to %s: %s\n",
+				name, strerror(errno));
+			err = 1;
+			break;
+		}
+		done_size += (size_t)ret;
+		bytes_written += (unsigned long long)ret;
+		++nr_writes;
+	}
+	free(name);
+	return err;
+}
+
+/* Flight recorder mode: saves the snapshot if one has been taken. The 
+ * rest of the current snapshot ("session end" event that arrived after 
+ * the snapshot had been taken) is saved to the same file. */
+static int
+save_snapshot(void *buffer)
+{
+	struct kedr_tr_start_page *sp = buffer;
+	__u32 seq;
+
+	if (!sp->frozen)
+		return 0;
+	
+	/* The kernel part sets 'frozen' after it has prepared the 
+	 * header. */
+	tr_smp_rmb();
+	seq = sp->snapshot_seq;
+	
+	if ((fd_snapshot == -1 || seq != snapshot_seq) && 
+	    start_snapshot(buffer, seq) != 0)
+		return 1;
+	
+	return process_data(buffer, fd_snapshot);
+}
+
+/* Flight recorder mode: asks the kernel part to take a snapshot. */
+static int
+request_snapshot(void)
+{
+	int fd;
+	int err = 0;
+
+	errno = 0;
+	fd = open(snapshot_file, O_WRONLY);
+	if (fd == -1) {
+		fprintf(stderr, "Failed to open %s: %s\n",
+			snapshot_file, strerror(errno));
+		return 1;
+	}
+	if (write(fd, "1", 1) != 1) {
+		fprintf(stderr, "Failed to request a snapshot: %s\n",
+			strerror(errno));
+		err = 1;
+	}
+	close(fd);
+	return err;
+}
+
+/* Flight recorder mode: waits for the snapshots and saves them until the 
+ * session ends or a signal arrives. */
+static int
+save_snapshots(void *buffer, struct pollfd *pollfd)
+{
+	int ret;
+	int err = 0;
+
+	for (;;) {
+		err = save_snapshot(buffer);
+		if (err || done)
+			break;
+
+		/* No need to spin here, the snapshots are rare. */
+		errno = 0;
+		ret = poll(pollfd, 1, -1);
+		if (ret == -1 && errno != EAGAIN && errno != EINTR) {
+			fprintf(stderr, 
+				"Failed to poll() the input file: %s\n",
+				strerror(errno));
+			err = 1;
+			break;
+		}
+		if (ret > 0)
+			++nr_wakeups;
+	}
+
+	/* Interrupted by a signal: save the latest events. */
+	if (!err && !session_ended) {
+		err = request_snapshot();
+		if (!err)
+			err = save_snapshot(buffer);
+	}
+
+	if (fd_snapshot != -1 && close(fd_snapshot) != 0) {
+		fprintf(stderr, "Failed to close the file for snapshot #%u: "
+			"%s\n", (unsigned int)snapshot_seq, strerror(errno));
+		err = 1;
+	}
+	return err;
 }
 
 static int 
-save_trace(int fd_in, FILE *outf)
+save_trace(int fd_in, int fd_out)
 {
 	void *buffer = NULL;
 	int ret = 0;
@@ -275,19 +633,18 @@ save_trace(int fd_in, FILE *outf)
 	pollfd.fd = fd_in;
 	pollfd.events = POLLIN;
 	
-	for (;;) {
-		err = process_data(buffer, outf);
-		if (err || done)
-			break;
-		
-		errno = 0;
-		ret = poll(&pollfd, 1, -1);
-		if (ret == -1 && errno != EAGAIN && errno != EINTR) {
-			fprintf(stderr, 
-				"Failed to poll() the input file: %s\n",
-				strerror(errno));
-			err = 1;
-			break;
+	if (flight_recorder) {
+		err = save_snapshots(buffer, &pollfd);
+	}
+	else {
+		for (;;) {
+			err = process_data(buffer, fd_out);
+			if (err || done)
+				break;
+			
+			err = wait_for_data(buffer, &pollfd);
+			if (err)
+				break;
 		}
 	}
 	
@@ -302,15 +659,19 @@ save_trace(int fd_in, FILE *outf)
 
 #define KEDR_NR_MAX_DIGITS 9
 
+/* Reads the value of the given parameter of the kernel module. */
 static int
-read_nr_data_pages(void)
+read_param(const char *name, unsigned int *value)
 {
 	char *endp = NULL;
 	char *p;
 	char value_buf[KEDR_NR_MAX_DIGITS + 1];
+	char param_file[256];
 	FILE *fd;
 	
 	memset(&value_buf[0], 0, sizeof(value_buf));
+	snprintf(&param_file[0], sizeof(param_file), "%s%s", param_dir, 
+		 name);
 	
 	errno = 0;
 	fd = fopen(param_file, "r");
@@ -331,12 +692,21 @@ read_nr_data_pages(void)
 	fclose(fd);
 	
 	errno = 0;
-	nr_data_pages = (unsigned int)strtoul(value_buf, &endp, 10);
+	*value = (unsigned int)strtoul(value_buf, &endp, 10);
 	if (errno != 0 || (*endp != 0 && *endp != '\n')) {
-		fprintf(stderr, "Invalid value of 'nr_data_pages': %s\n",
-			value_buf);
+		fprintf(stderr, "Invalid value of '%s': %s\n",
+			name, value_buf);
 		return 1;
 	}
+	return 0;
+}
+
+static int
+read_params(void)
+{
+	if (read_param("nr_data_pages", &nr_data_pages) != 0 ||
+	    read_param("flight_recorder", &flight_recorder) != 0)
+		return 1;
 	
 	if (!test_is_power_of_2(nr_data_pages)) {
 		fprintf(stderr, "'nr_data_pages' must be a power of 2.\n");
@@ -351,15 +721,41 @@ int
 main(int argc, char *argv[])
 {
 	int fd_in;
-	FILE *outf;
+	int fd_out;
 	int ret = 0;
+	double start;
+	
+	while (argc > 2 && strncmp(argv[1], "--", 2) == 0) {
+		if (strcmp(argv[1], "--stats") == 0) {
+			show_stats = 1;
+			--argc;
+			++argv;
+		}
+		else if (strcmp(argv[1], "--spin") == 0 && argc > 3) {
+			char *endp = NULL;
+			
+			errno = 0;
+			spin_usec = strtoul(argv[2], &endp, 10);
+			if (errno != 0 || *endp != 0 || argv[2][0] == 0) {
+				fprintf(stderr, 
+					"Invalid value of '--spin': %s\n",
+					argv[2]);
+				return EXIT_FAILURE;
+			}
+			argc -= 2;
+			argv += 2;
+		}
+		else {
+			break;
+		}
+	}
 	
 	if (argc != 2) {
 		print_usage();
 		return EXIT_FAILURE;
 	}
 	
-	ret = read_nr_data_pages();
+	ret = read_params();
 	if (ret != 0)
 		return EXIT_FAILURE;
 	
@@ -377,22 +773,37 @@ main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 	
+	/* In the flight recorder mode, the snapshots are saved to separate
+	 * files. */
 	errno = 0;
-	outf = fopen(out_file, "w");
-	if (outf == NULL) {
+	fd_out = -1;
+	if (!flight_recorder) {
+		fd_out = open(out_file, O_WRONLY | O_CREAT | O_TRUNC, 
+			S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | 
+			S_IWOTH);
+	}
+	if (fd_out == -1 && !flight_recorder) {
 		fprintf(stderr, "Failed to open output file (%s): %s\n",
 			out_file, strerror(errno));
 		close(fd_in);
 		return EXIT_FAILURE;
 	}
 	
-	if (save_trace(fd_in, outf) != 0) {
+	start = get_time();
+	if (save_trace(fd_in, fd_out) != 0) {
 		fprintf(stderr, "Failed to save the trace.\n");
 		ret = EXIT_FAILURE;
 	}
 	
+	if (show_stats)
+		print_stats(get_time() - start);
+	
 	close(fd_in);
-	fclose(outf);
+	if (fd_out != -1 && close(fd_out) != 0) {
+		fprintf(stderr, "Failed to close output file (%s): %s\n",
+			out_file, strerror(errno));
+		ret = EXIT_FAILURE;
+	}
 	return ret;
 }
 /* ====================================================================== */